@@ -0,0 +1,371 @@
+// Thousands of digits of e and pi computed by Lim programs with the big
+// integer natives, then the kernels underneath them: products of growing
+// sizes, whose time grows by less than the 4x of schoolbook multiplication
+// when the size doubles, and decimal conversion against dividing by 10^19
+// over and over.
+//
+// Usage: bignum [<digits>]
+#define _DEFAULT_SOURCE
+#include "lim.h"
+
+#include <time.h>
+
+// [digits] -> prints e * 10^digits. The sum of 10^(digits + 10) / k! for k
+// from 0 until the terms are 0, the 10 extra digits absorb the truncation of
+// the terms. Locals: digits <- 0, term <- 1, sum <- 2, k <- 3, zero <- 4,
+// big k <- 5.
+static const char *const e_source =
+    "  push 10\n"
+    "  native big_from_i64\n"
+    "  dup 0\n"
+    "  load_local 0\n"
+    "  push 10\n"
+    "  plus\n"
+    "  native big_pow\n"
+    "  swap 1\n"
+    "  native big_free\n"
+    "  push 0\n"
+    "  native big_from_i64\n"
+    "  push 1\n"
+    "  push 0\n"
+    "  native big_from_i64\n"
+    "  push 0\n"
+    "loop:\n"
+    "  load_local 2\n"
+    "  load_local 1\n"
+    "  native big_add\n"
+    "  load_local 2\n"
+    "  native big_free\n"
+    "  store_local 2\n"
+    "  load_local 3\n"
+    "  native big_from_i64\n"
+    "  store_local 5\n"
+    "  load_local 1\n"
+    "  load_local 5\n"
+    "  native big_divmod\n"
+    "  native big_free\n"
+    "  load_local 1\n"
+    "  native big_free\n"
+    "  store_local 1\n"
+    "  load_local 5\n"
+    "  native big_free\n"
+    "  load_local 3\n"
+    "  push 1\n"
+    "  plus\n"
+    "  store_local 3\n"
+    "  load_local 1\n"
+    "  load_local 4\n"
+    "  native big_cmp\n"
+    "  jnz loop\n"
+    "  load_local 2\n"
+    "  push 10\n"
+    "  native big_from_i64\n"
+    "  push 10\n"
+    "  native big_pow\n"
+    "  native big_divmod\n"
+    "  native big_free\n"
+    "  native big_print\n"
+    "  halt\n";
+
+// [digits] -> prints pi * 10^digits with Machin's formula
+// pi = 16 atan(1/5) - 4 atan(1/239), 10 extra digits like e.
+static const char *const pi_source =
+    "  jmp main\n"
+    // [scale x] -> [scale * atan(1/x)], the sum of (-1)^k scale / (2k + 1)
+    // x^(2k + 1). Locals: power <- 0, x^2 <- 1, zero <- 2, sum <- 3,
+    // 2k + 1 <- 4, subtract <- 5, term <- 6.
+    "atan:\n"
+    "  load_local -1\n"
+    "  native big_from_i64\n"
+    "  load_local -2\n"
+    "  dup 1\n"
+    "  native big_divmod\n"
+    "  native big_free\n"
+    "  swap 1\n"
+    "  dup 0\n"
+    "  dup 0\n"
+    "  native big_mul\n"
+    "  swap 1\n"
+    "  native big_free\n"
+    "  push 0\n"
+    "  native big_from_i64\n"
+    "  load_local 0\n"
+    "  load_local 2\n"
+    "  native big_add\n"
+    "  push 1\n"
+    "  push 1\n"
+    "  push 0\n"
+    "atan_loop:\n"
+    "  load_local 0\n"
+    "  load_local 1\n"
+    "  native big_divmod\n"
+    "  native big_free\n"
+    "  load_local 0\n"
+    "  native big_free\n"
+    "  store_local 0\n"
+    "  load_local 4\n"
+    "  push 2\n"
+    "  plus\n"
+    "  store_local 4\n"
+    "  load_local 4\n"
+    "  native big_from_i64\n"
+    "  store_local 6\n"
+    "  load_local 0\n"
+    "  load_local 6\n"
+    "  native big_divmod\n"
+    "  native big_free\n"
+    "  load_local 6\n"
+    "  native big_free\n"
+    "  store_local 6\n"
+    "  load_local 6\n"
+    "  load_local 2\n"
+    "  native big_cmp\n"
+    "  jz atan_done\n"
+    "  load_local 3\n"
+    "  load_local 6\n"
+    "  load_local 5\n"
+    "  jnz atan_sub\n"
+    "  native big_add\n"
+    "  jmp atan_next\n"
+    "atan_sub:\n"
+    "  native big_sub\n"
+    "atan_next:\n"
+    "  load_local 3\n"
+    "  native big_free\n"
+    "  store_local 3\n"
+    "  load_local 6\n"
+    "  native big_free\n"
+    "  push 1\n"
+    "  load_local 5\n"
+    "  minus\n"
+    "  store_local 5\n"
+    "  jmp atan_loop\n"
+    "atan_done:\n"
+    "  load_local 6\n"
+    "  native big_free\n"
+    "  load_local 0\n"
+    "  native big_free\n"
+    "  load_local 1\n"
+    "  native big_free\n"
+    "  load_local 2\n"
+    "  native big_free\n"
+    "  load_local 3\n"
+    "  drop 9\n"
+    "  ret\n"
+    // Locals: digits <- 0, scale <- 1
+    "main:\n"
+    "  push 10\n"
+    "  native big_from_i64\n"
+    "  dup 0\n"
+    "  load_local 0\n"
+    "  push 10\n"
+    "  plus\n"
+    "  native big_pow\n"
+    "  swap 1\n"
+    "  native big_free\n"
+    "  load_local 1\n"
+    "  push 5\n"
+    "  call atan\n"
+    "  push 16\n"
+    "  native big_from_i64\n"
+    "  native big_mul\n"
+    "  load_local 1\n"
+    "  push 239\n"
+    "  call atan\n"
+    "  push 4\n"
+    "  native big_from_i64\n"
+    "  native big_mul\n"
+    "  native big_sub\n"
+    "  push 10\n"
+    "  native big_from_i64\n"
+    "  push 10\n"
+    "  native big_pow\n"
+    "  native big_divmod\n"
+    "  native big_free\n"
+    "  native big_print\n"
+    "  halt\n";
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Runs the program on [digits] and checks the digits it prints
+static bool run(const char *name, const char *source, uint64_t digits,
+                const char *prefix)
+{
+    static Lasm lasm = {0};
+    Lim *lim = lim_create();
+    if (lim == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return false;
+    }
+    lim_attach_natives(lim);
+    if (lim_translate_source(cstr_as_sv(source), lim, &lasm) != LIM_OK ||
+        lim_bind_natives(lim) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim->error);
+        lim_destroy(lim);
+        return false;
+    }
+
+    char *output = NULL;
+    size_t output_size = 0;
+    lim->output = open_memstream(&output, &output_size);
+    lim_push_word(lim, (Word){.as_u64 = digits});
+    uint64_t start = now_ns();
+    Trap trap = lim_execute_program(lim);
+    uint64_t elapsed = now_ns() - start;
+    fclose(lim->output);
+    lim->output = NULL;
+    lim_destroy(lim);
+    if (trap != TRAP_OK) {
+        fprintf(stderr, "Error: %s\n", trap_as_cstr(trap));
+        free(output);
+        return false;
+    }
+
+    // the integer part and `digits` decimals
+    bool ok = output_size == digits + 2 &&
+              strncmp(output, prefix, strlen(prefix)) == 0;
+    if (!ok) {
+        fprintf(stderr, "ERROR: wrong digits of %s: %.*s...\n", name, 60,
+                output);
+    } else {
+        printf("%-2s to %lu digits: %.3f ms, %.20s...%.*s\n", name, digits,
+               elapsed * 1e-6, output, 10, output + output_size - 11);
+    }
+    free(output);
+    return ok;
+}
+
+// Decimal digits the schoolbook way, one division by 10^19 of the whole
+// number for every 19 digits
+static void naive_decimal(Lim *lim, const Lim_Big *big, FILE *out)
+{
+    Lim_Big *chunk = lim_big_from_i64(lim, 1000000000);
+    Lim_Big *ten19 = lim_big_mul(lim, chunk, chunk);
+    Lim_Big *ten = lim_big_from_i64(lim, 10);
+    Lim_Big *divisor = lim_big_mul(lim, ten19, ten);
+    Lim_Big *zero = lim_big_from_i64(lim, 0);
+    Lim_Big *a = lim_big_add(lim, big, zero);
+
+    static uint64_t chunks[64 * 1024];
+    size_t n = 0;
+    while (lim_big_cmp(a, zero) != 0 && n < ARRAY_SIZE(chunks)) {
+        Lim_Big *q = NULL;
+        Lim_Big *r = NULL;
+        lim_big_divmod(lim, a, divisor, &q, &r);
+        chunks[n++] = (uint64_t) lim_big_to_i64(r);
+        lim_big_destroy(lim, r);
+        lim_big_destroy(lim, a);
+        a = q;
+    }
+    fprintf(out, "%lu", n > 0 ? chunks[n - 1] : 0);
+    for (size_t i = n - 1; i-- > 0;) {
+        fprintf(out, "%019lu", chunks[i]);
+    }
+
+    Lim_Big *bigs[] = {chunk, ten19, ten, divisor, zero, a};
+    for (size_t i = 0; i < ARRAY_SIZE(bigs); i++) {
+        lim_big_destroy(lim, bigs[i]);
+    }
+}
+
+// 7^exponent, a dense number of about 2.8 * exponent bits
+static Lim_Big *power_of_seven(Lim *lim, uint64_t exponent)
+{
+    Lim_Big *seven = lim_big_from_i64(lim, 7);
+    Lim_Big *power = lim_big_pow(lim, seven, exponent);
+    lim_big_destroy(lim, seven);
+    return power;
+}
+
+static bool kernels(void)
+{
+    Lim *lim = lim_create();
+    if (lim == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return false;
+    }
+
+    double previous = 0;
+    for (uint64_t exponent = 1000; exponent <= 256000; exponent *= 2) {
+        Lim_Big *a = power_of_seven(lim, exponent);
+        Lim_Big *b = power_of_seven(lim, exponent + 1);
+        // repeat for 50 ms at least
+        uint64_t rounds = 0;
+        uint64_t start = now_ns();
+        uint64_t elapsed = 0;
+        while (elapsed < 50000000) {
+            lim_big_destroy(lim, lim_big_mul(lim, a, b));
+            rounds++;
+            elapsed = now_ns() - start;
+        }
+        double ns = (double) elapsed / rounds;
+        printf("mul of %6lu bit numbers: %10.1f us", exponent * 281 / 100,
+               ns * 1e-3);
+        if (previous > 0) {
+            printf(", %.2fx the half size", ns / previous);
+        }
+        printf("\n");
+        previous = ns;
+        lim_big_destroy(lim, a);
+        lim_big_destroy(lim, b);
+    }
+
+    for (uint64_t exponent = 10000; exponent <= 160000; exponent *= 4) {
+        Lim_Big *a = power_of_seven(lim, exponent);
+        char *fast = NULL;
+        char *naive = NULL;
+        size_t fast_size = 0;
+        size_t naive_size = 0;
+        FILE *out = open_memstream(&naive, &naive_size);
+
+        uint64_t start = now_ns();
+        fast = lim_big_to_decimal(a);
+        uint64_t fast_ns = now_ns() - start;
+        start = now_ns();
+        naive_decimal(lim, a, out);
+        fclose(out);
+        uint64_t naive_ns = now_ns() - start;
+
+        fast_size = fast != NULL ? strlen(fast) : 0;
+        bool same = fast_size == naive_size && !memcmp(fast, naive, fast_size);
+        free(fast);
+        free(naive);
+        lim_big_destroy(lim, a);
+        if (!same) {
+            fprintf(stderr, "ERROR: decimal conversions of 7^%lu differ\n",
+                    exponent);
+            lim_destroy(lim);
+            return false;
+        }
+        printf("%6zu digits: divide and conquer %.3f ms, by 10^19 %.3f ms, "
+               "%.1fx\n",
+               fast_size, fast_ns * 1e-6, naive_ns * 1e-6,
+               (double) naive_ns / fast_ns);
+    }
+    lim_destroy(lim);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t digits = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000;
+    if (digits < 50) {
+        fprintf(stderr, "ERROR: expect at least 50 digits\n");
+        return 1;
+    }
+
+    static const char *const e_digits =
+        "271828182845904523536028747135266249775724709369995";
+    static const char *const pi_digits =
+        "314159265358979323846264338327950288419716939937510";
+    if (!run("e", e_source, digits, e_digits) ||
+        !run("pi", pi_source, digits, pi_digits) || !kernels()) {
+        return 1;
+    }
+    return 0;
+}
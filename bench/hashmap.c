@@ -0,0 +1,175 @@
+// Lookups per second of the `map_has` native against a linear search of the
+// same keys written in bytecode, for growing amounts of keys.
+//
+// Usage: hashmap [<lookups>]
+#define _DEFAULT_SOURCE
+#include "lim.h"
+
+// Both programs take [n lookups], store the keys 3 * i + 1 for i in [0, n),
+// look up the key of ((7 * j) mod n) for j in [0, lookups) and leave
+// [... hits nanoseconds] for the lookups alone. Locals: n <- 0, lookups <- 1,
+// table <- 2, i and j <- 3, hits <- 4, start <- 5.
+#define KEYS_PROLOGUE         \
+    "  push 0\n"              \
+    "fill:\n"                 \
+    "  load_local 2\n"        \
+    "  load_local 3\n"        \
+    "  dup 0\n"               \
+    "  push 3\n"              \
+    "  mult\n"                \
+    "  push 1\n"              \
+    "  plus\n"                \
+    FILL_ONE                  \
+    "  load_local 3\n"        \
+    "  push 1\n"              \
+    "  plus\n"                \
+    "  store_local 3\n"       \
+    "  load_local 3\n"        \
+    "  load_local 0\n"        \
+    "  lt\n"                  \
+    "  jnz fill\n"            \
+    "  push 0\n"              \
+    "  store_local 3\n"       \
+    "  push 0\n"              \
+    "  native clock_ns\n"     \
+    "lookup:\n"               \
+    "  load_local 3\n"        \
+    "  push 7\n"              \
+    "  mult\n"                \
+    "  dup 0\n"               \
+    "  load_local 0\n"        \
+    "  div\n"                 \
+    "  load_local 0\n"        \
+    "  mult\n"                \
+    "  minus\n"               \
+    "  push 3\n"              \
+    "  mult\n"                \
+    "  push 1\n"              \
+    "  plus\n"
+
+#define KEYS_EPILOGUE         \
+    "  load_local 4\n"        \
+    "  plus\n"                \
+    "  store_local 4\n"       \
+    "  load_local 3\n"        \
+    "  push 1\n"              \
+    "  plus\n"                \
+    "  store_local 3\n"       \
+    "  load_local 3\n"        \
+    "  load_local 1\n"        \
+    "  lt\n"                  \
+    "  jnz lookup\n"          \
+    "  native clock_ns\n"     \
+    "  load_local 5\n"        \
+    "  minus\n"               \
+    "  halt\n"
+
+// [key] -> [found], scans the words of the table
+#define FILL_ONE "  native write_word\n"
+static const char *const linear =
+    "  load_local 0\n"
+    "  push 8\n"
+    "  mult\n"
+    "  native alloc\n"
+    KEYS_PROLOGUE
+    "  push 0\n"
+    "scan:\n"
+    "  load_local 2\n"
+    "  dup 1\n"
+    "  native read_word\n"
+    "  dup 2\n"
+    "  eq\n"
+    "  jnz found\n"
+    "  push 1\n"
+    "  plus\n"
+    "  dup 0\n"
+    "  load_local 0\n"
+    "  lt\n"
+    "  jnz scan\n"
+    "  drop 1\n"
+    "  push 0\n"
+    "  swap 1\n"
+    "  pop\n"
+    "  jmp next\n"
+    "found:\n"
+    "  drop 1\n"
+    "  pop\n"
+    "  push 1\n"
+    "next:\n"
+    KEYS_EPILOGUE;
+#undef FILL_ONE
+
+// [key] -> [found], one `map_has` on the map from the keys to i
+#define FILL_ONE "  swap 1\n  native map_insert\n  pop\n"
+static const char *const hashed =
+    "  load_local 0\n"
+    "  native map_new\n"
+    KEYS_PROLOGUE
+    "  load_local 2\n"
+    "  swap 1\n"
+    "  native map_has\n"
+    KEYS_EPILOGUE;
+#undef FILL_ONE
+
+static bool run(const char *source, uint64_t n, uint64_t lookups,
+                double *per_second)
+{
+    static Lasm lasm = {0};
+    static Ir ir = {0};
+    Lim *lim = lim_create();
+    if (lim == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return false;
+    }
+    lim_attach_natives(lim);
+    if (lim_translate_source(cstr_as_sv(source), lim, &lasm) != LIM_OK ||
+        lim_bind_natives(lim) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim->error);
+        lim_destroy(lim);
+        return false;
+    }
+    lim_push_word(lim, (Word){.as_u64 = n});
+    lim_push_word(lim, (Word){.as_u64 = lookups});
+    Trap trap = lim_ir_translate(&ir, lim) ? lim_ir_execute_program(&ir, lim)
+                                           : lim_execute_program(lim);
+    if (trap != TRAP_OK) {
+        fprintf(stderr, "Error: %s\n", trap_as_cstr(trap));
+        lim_destroy(lim);
+        return false;
+    }
+
+    uint64_t hits = lim->stack[4].as_u64;
+    uint64_t elapsed = lim->stack[lim->stack_size - 1].as_u64;
+    lim_destroy(lim);
+    if (hits != lookups) {
+        fprintf(stderr, "ERROR: %lu of %lu keys found\n", hits, lookups);
+        return false;
+    }
+    *per_second = lookups / (elapsed * 1e-9);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t lookups = argc > 1 ? strtoull(argv[1], NULL, 10) : 2000000;
+    if (lookups == 0) {
+        fprintf(stderr, "ERROR: expect at least one lookup\n");
+        return 1;
+    }
+
+    static const uint64_t sizes[] = {8, 64, 512, 4096, 32768};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint64_t n = sizes[i];
+        // a linear search costs n / 2 steps, keep its run time bounded
+        uint64_t scans = lookups * 8 / n;
+        scans = scans < 1000 ? 1000 : scans > lookups ? lookups : scans;
+        double map = 0, scan = 0;
+        if (!run(hashed, n, lookups, &map) || !run(linear, n, scans, &scan)) {
+            return 1;
+        }
+        printf("%6lu keys: map_has %.0f lookups/s, linear search %.0f "
+               "lookups/s, %.1fx\n",
+               n, map, scan, map / scan);
+    }
+    return 0;
+}
@@ -0,0 +1,206 @@
+// Loop kernels in the stack interpreter, the register IR, the tracing JIT and
+// plain C: a float series like tests/pi.lasm and an integer sum with a
+// division. Every engine has to leave the same bits as the C loop.
+//
+// Usage: jit [<iterations>]
+#define _DEFAULT_SOURCE
+#include "lim.h"
+
+#include <time.h>
+
+// [n] -> [4 * sum((-1)^k / (2k + 1)) for k in [0, n)], n as a double.
+// Stack: n, sum, sign, 2k + 1.
+static const char *const leibniz_source =
+    "  push 0.0\n"
+    "  push 1.0\n"
+    "  push 1.0\n"
+    "loop:\n"
+    "  dup 1\n"
+    "  dup 1\n"
+    "  fdiv\n"
+    "  load_local 1\n"
+    "  fplus\n"
+    "  store_local 1\n"
+    "  swap 1\n"
+    "  push -1.0\n"
+    "  fmult\n"
+    "  swap 1\n"
+    "  push 2.0\n"
+    "  fplus\n"
+    "  dup 0\n"
+    "  load_local 0\n"
+    "  dup 0\n"
+    "  fplus\n"
+    "  lt\n"
+    "  jnz loop\n"
+    "  pop\n"
+    "  pop\n"
+    "  push 4.0\n"
+    "  fmult\n"
+    "  drop 1\n"
+    "  halt\n";
+
+static double leibniz(double n)
+{
+    double sum = 0.0;
+    double sign = 1.0;
+    double k = 1.0;
+    do {
+        sum = sign / k + sum;
+        sign = sign * -1.0;
+        k = k + 2.0;
+    } while (k < n + n);
+    return sum * 4.0;
+}
+
+// [n] -> [sum(i * i / (i + 1) for i in [0, n))]. Stack: n, sum, i.
+static const char *const sum_source =
+    "  push 0\n"
+    "  push 0\n"
+    "loop:\n"
+    "  dup 0\n"
+    "  dup 0\n"
+    "  mult\n"
+    "  dup 1\n"
+    "  push 1\n"
+    "  plus\n"
+    "  div\n"
+    "  load_local 1\n"
+    "  plus\n"
+    "  store_local 1\n"
+    "  push 1\n"
+    "  plus\n"
+    "  dup 0\n"
+    "  load_local 0\n"
+    "  lt\n"
+    "  jnz loop\n"
+    "  pop\n"
+    "  drop 1\n"
+    "  halt\n";
+
+static int64_t sum(int64_t n)
+{
+    int64_t sum = 0;
+    int64_t i = 0;
+    do {
+        sum = i * i / (i + 1) + sum;
+        i = i + 1;
+    } while (i < n);
+    return sum;
+}
+
+typedef enum {
+    ENGINE_STACK = 0,
+    ENGINE_IR,
+    ENGINE_JIT,
+    ENGINE_NUM,
+} Engine;
+
+static const char *const engine_names[ENGINE_NUM] = {"stack", "ir", "jit"};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Runs the program on [input] and checks that it leaves [expected]
+static bool run(const char *name, const char *source, Engine engine,
+                Word input, Word expected, uint64_t iterations)
+{
+    static Lasm lasm = {0};
+    static Ir ir = {0};
+    Lim *lim = lim_create();
+    if (lim == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return false;
+    }
+    if (lim_translate_source(cstr_as_sv(source), lim, &lasm) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim->error);
+        lim_destroy(lim);
+        return false;
+    }
+    Lim_Jit *jit = NULL;
+    if (engine == ENGINE_JIT) {
+        jit = lim_jit_create();
+        if (jit == NULL) {
+            fprintf(stderr, "ERROR: out of memory\n");
+            lim_destroy(lim);
+            return false;
+        }
+    }
+
+    lim_push_word(lim, input);
+    uint64_t start = now_ns();
+    Trap trap = TRAP_OK;
+    if (engine == ENGINE_STACK) {
+        trap = lim_execute_program(lim);
+    } else if (engine == ENGINE_IR) {
+        trap = lim_ir_translate(&ir, lim) ? lim_ir_execute_program(&ir, lim)
+                                          : lim_execute_program(lim);
+    } else {
+        trap = lim_jit_execute_program(jit, lim);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    bool ok = trap == TRAP_OK && lim->stack_size == 1 &&
+              lim->stack[0].as_u64 == expected.as_u64;
+    if (trap != TRAP_OK) {
+        fprintf(stderr, "Error: %s\n", trap_as_cstr(trap));
+    } else if (!ok) {
+        fprintf(stderr, "ERROR: %s in %s left 0x%016lx, expected 0x%016lx\n",
+                name, engine_names[engine], lim->stack[0].as_u64,
+                expected.as_u64);
+    } else {
+        printf("%-8s %-5s: %8.3f ms, %6.2f ns per iteration", name,
+               engine_names[engine], elapsed * 1e-6,
+               (double) elapsed / iterations);
+        if (jit != NULL) {
+            Lim_Jit_Stats stats = lim_jit_stats(jit);
+            printf(", %lu traces, %lu iterations compiled", stats.traces,
+                   stats.iterations);
+        }
+        printf("\n");
+    }
+    lim_jit_destroy(jit);
+    lim_destroy(lim);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t iterations = argc > 1 ? strtoull(argv[1], NULL, 10) : 50000000;
+    if (iterations == 0) {
+        fprintf(stderr, "ERROR: expect at least one iteration\n");
+        return 1;
+    }
+
+    // the C loops, through volatile so they are not folded away
+    volatile double n = iterations;
+    uint64_t start = now_ns();
+    Word pi = {.as_f64 = leibniz(n)};
+    uint64_t elapsed = now_ns() - start;
+    printf("%-8s %-5s: %8.3f ms, %6.2f ns per iteration, %.10f\n", "leibniz",
+           "c", elapsed * 1e-6, (double) elapsed / iterations, pi.as_f64);
+    for (Engine engine = 0; engine < ENGINE_NUM; engine++) {
+        if (!run("leibniz", leibniz_source, engine, (Word){.as_f64 = n}, pi,
+                 iterations)) {
+            return 1;
+        }
+    }
+
+    volatile int64_t m = iterations;
+    start = now_ns();
+    Word total = {.as_i64 = sum(m)};
+    elapsed = now_ns() - start;
+    printf("%-8s %-5s: %8.3f ms, %6.2f ns per iteration, %ld\n", "sum", "c",
+           elapsed * 1e-6, (double) elapsed / iterations, total.as_i64);
+    for (Engine engine = 0; engine < ENGINE_NUM; engine++) {
+        if (!run("sum", sum_source, engine, (Word){.as_i64 = m}, total,
+                 iterations)) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,203 @@
+// Pipeline of three VMs on three threads connected by lock-free rings:
+// producer -> transform -> consumer. Every message is the time it was sent,
+// the consumer records how long it took to arrive.
+//
+// Usage: pipeline [<messages>] [<capacity>]
+#define _DEFAULT_SOURCE
+#include "lim.h"
+
+#include <pthread.h>
+#include <time.h>
+
+// [out n] -> [], sends n time stamps and closes `out`
+static const char *const producer =
+    "  push 0\n"
+    "send:\n"
+    "  dup 2\n"
+    "  native clock_ns\n"
+    "  native ring_send\n"
+    "  pop\n"
+    "  push 1\n"
+    "  plus\n"
+    "  dup 0\n"
+    "  dup 2\n"
+    "  lt\n"
+    "  jnz send\n"
+    "  pop\n"
+    "  pop\n"
+    "  native ring_close\n"
+    "  halt\n";
+
+// [in out] -> [], forwards every message until `in` is closed
+static const char *const transform =
+    "recv:\n"
+    "  dup 1\n"
+    "  native ring_recv\n"
+    "  jz done\n"
+    "  dup 1\n"
+    "  swap 1\n"
+    "  native ring_send\n"
+    "  pop\n"
+    "  jmp recv\n"
+    "done:\n"
+    "  pop\n"
+    "  native ring_close\n"
+    "  halt\n";
+
+// [in latencies] -> [in latencies count], latencies[i] is the time message
+// i was underway
+static const char *const consumer =
+    "  push 0\n"
+    "recv:\n"
+    "  dup 2\n"
+    "  native ring_recv\n"
+    "  jz done\n"
+    "  native clock_ns\n"
+    "  swap 1\n"
+    "  minus\n"
+    "  dup 2\n"
+    "  dup 2\n"
+    "  dup 2\n"
+    "  native write_word\n"
+    "  pop\n"
+    "  push 1\n"
+    "  plus\n"
+    "  jmp recv\n"
+    "done:\n"
+    "  pop\n"
+    "  halt\n";
+
+typedef struct {
+    Lim *lim;
+    Ir *ir;
+    Trap trap;
+} Stage;
+
+static void *stage_run(void *arg)
+{
+    Stage *stage = arg;
+    stage->trap = lim_ir_translate(stage->ir, stage->lim)
+                      ? lim_ir_execute_program(stage->ir, stage->lim)
+                      : lim_execute_program(stage->lim);
+    return NULL;
+}
+
+static bool stage_init(Stage *stage, const char *source, Lasm *lasm)
+{
+    stage->lim = lim_create();
+    stage->ir = malloc(sizeof(*stage->ir));
+    if (stage->lim == NULL || stage->ir == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return false;
+    }
+    lim_attach_natives(stage->lim);
+    if (lim_translate_source(cstr_as_sv(source), stage->lim, lasm) != LIM_OK ||
+        lim_bind_natives(stage->lim) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", stage->lim->error);
+        return false;
+    }
+    return true;
+}
+
+static void stage_free(Stage *stage)
+{
+    lim_destroy(stage->lim);
+    free(stage->ir);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool bench(const char *name, bool mpmc, uint64_t n, uint64_t capacity)
+{
+    static Lasm lasm = {0};
+    Stage stages[3] = {0};
+    const char *const sources[3] = {producer, transform, consumer};
+    Lim_Ring *first = lim_ring_create(capacity, mpmc);
+    Lim_Ring *second = lim_ring_create(capacity, mpmc);
+    uint64_t *latencies = malloc(sizeof(latencies[0]) * n);
+    if (first == NULL || second == NULL || latencies == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return false;
+    }
+    for (size_t i = 0; i < 3; i++) {
+        if (!stage_init(&stages[i], sources[i], &lasm)) {
+            return false;
+        }
+    }
+    lim_push_word(stages[0].lim, (Word){.as_ptr = first});
+    lim_push_word(stages[0].lim, (Word){.as_u64 = n});
+    lim_push_word(stages[1].lim, (Word){.as_ptr = first});
+    lim_push_word(stages[1].lim, (Word){.as_ptr = second});
+    lim_push_word(stages[2].lim, (Word){.as_ptr = second});
+    lim_push_word(stages[2].lim, (Word){.as_ptr = latencies});
+
+    double start = now();
+    pthread_t threads[3];
+    for (size_t i = 0; i < 3; i++) {
+        if (pthread_create(&threads[i], NULL, stage_run, &stages[i]) != 0) {
+            fprintf(stderr, "ERROR: Could not start thread\n");
+            return false;
+        }
+    }
+    for (size_t i = 0; i < 3; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = now() - start;
+
+    for (size_t i = 0; i < 3; i++) {
+        if (stages[i].trap != TRAP_OK) {
+            fprintf(stderr, "ERROR: %s\n", trap_as_cstr(stages[i].trap));
+            return false;
+        }
+    }
+    const Lim *last = stages[2].lim;
+    uint64_t received = last->stack[last->stack_size - 1].as_u64;
+    if (received != n) {
+        fprintf(stderr, "ERROR: %lu of %lu messages received\n", received,
+                n);
+        return false;
+    }
+
+    qsort(latencies, n, sizeof(latencies[0]), compare_u64);
+    printf("%s: %lu messages in %.3fs, %.0f msg/s, latency p50 %luns p90 "
+           "%luns p99 %luns p99.9 %luns max %luns\n",
+           name, n, elapsed, n / elapsed, latencies[n / 2],
+           latencies[n * 9 / 10], latencies[n * 99 / 100],
+           latencies[n * 999 / 1000], latencies[n - 1]);
+
+    for (size_t i = 0; i < 3; i++) {
+        stage_free(&stages[i]);
+    }
+    lim_ring_destroy(first);
+    lim_ring_destroy(second);
+    free(latencies);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    uint64_t capacity = argc > 2 ? strtoull(argv[2], NULL, 10) : 1024;
+    if (n == 0) {
+        fprintf(stderr, "ERROR: expect at least one message\n");
+        return 1;
+    }
+
+    if (!bench("spsc", false, n, capacity) ||
+        !bench("mpmc", true, n, capacity)) {
+        return 1;
+    }
+    return 0;
+}
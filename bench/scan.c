@@ -0,0 +1,254 @@
+// Values per second parsed by the `scan_i64` and `scan_f64` natives from
+// comma and newline separated columns, against copying every number into a
+// string for strtoll and strtod like the assembler does for literals.
+//
+// Usage: scan [<values>]
+#define _DEFAULT_SOURCE
+#include "lim.h"
+
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SCAN_BLOCK 4096
+#define SCAN_COLUMNS 4
+
+// [fd] -> [... values checksum nanoseconds status], scans the file in blocks
+// of 4096 words; the checksum adds up the bits of the last value of every
+// block and the status is 0 at the end of the input or -errno.
+// Locals: fd <- 0, scanner <- 1, buffer <- 2, values <- 3, checksum <- 4,
+// start <- 5.
+#define SCAN_SOURCE(native)   \
+    "  load_local 0\n"        \
+    "  native scan_new\n"     \
+    "  push 32768\n"          \
+    "  native alloc\n"        \
+    "  push 0\n"              \
+    "  push 0\n"              \
+    "  native clock_ns\n"     \
+    "loop:\n"                 \
+    "  load_local 1\n"        \
+    "  load_local 2\n"        \
+    "  push 4096\n"           \
+    "  native " native "\n"   \
+    "  dup 0\n"               \
+    "  push 0\n"              \
+    "  gt\n"                  \
+    "  jz done\n"             \
+    "  dup 0\n"               \
+    "  load_local 3\n"        \
+    "  plus\n"                \
+    "  store_local 3\n"       \
+    "  push 1\n"              \
+    "  minus\n"               \
+    "  load_local 2\n"        \
+    "  swap 1\n"              \
+    "  native read_word\n"    \
+    "  load_local 4\n"        \
+    "  plus\n"                \
+    "  store_local 4\n"       \
+    "  jmp loop\n"            \
+    "done:\n"                 \
+    "  native clock_ns\n"     \
+    "  load_local 5\n"        \
+    "  minus\n"               \
+    "  store_local 5\n"       \
+    "  load_local 1\n"        \
+    "  native scan_free\n"    \
+    "  halt\n"
+
+typedef struct {
+    const char *name;
+    bool floats;
+} Dataset;
+
+static const Dataset datasets[] = {
+    {"i64", false},
+    {"f64 %.2f", true},
+    {"f64 %.17g", true},
+};
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t random_u64(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Rows of 4 columns of the dataset in a temporary file, NULL on errors
+static FILE *generate(size_t d, uint64_t values)
+{
+    FILE *f = tmpfile();
+    if (f == NULL) {
+        return NULL;
+    }
+    for (uint64_t i = 0; i < values; i++) {
+        const char *end = (i + 1) % SCAN_COLUMNS == 0 ? "\n" : ",";
+        uint64_t r = random_u64();
+        if (d == 0) {
+            fprintf(f, "%ld%s", (int64_t) (r % 2000000001) - 1000000000, end);
+        } else if (d == 1) {
+            fprintf(f, "%.2f%s", (double) (r % 1000000) / 100, end);
+        } else {
+            fprintf(f, "%.17g%s", (double) (r >> 11) / (1ULL << 53), end);
+        }
+    }
+    fflush(f);
+    return f;
+}
+
+// The whole file parsed a copied token at a time into blocks like the
+// program does. Returns the number of values or -1.
+static int64_t baseline(int fd, bool floats, uint64_t *checksum)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return -1;
+    }
+    char *text = malloc(st.st_size);
+    if (text == NULL) {
+        return -1;
+    }
+    for (off_t n = 0; n < st.st_size;) {
+        ssize_t r = pread(fd, text + n, st.st_size - n, n);
+        if (r <= 0) {
+            free(text);
+            return -1;
+        }
+        n += r;
+    }
+
+    static Word block[SCAN_BLOCK];
+    int64_t values = 0;
+    *checksum = 0;
+    const char *p = text;
+    const char *end = text + st.st_size;
+    while (p < end) {
+        const char *q = p;
+        while (q < end && *q != ',' && *q != '\n') {
+            q++;
+        }
+        char str[64];
+        size_t n = q - p;
+        if (n > 0 && n < sizeof(str)) {
+            memcpy(str, p, n);
+            str[n] = '\0';
+            Word *w = &block[values % SCAN_BLOCK];
+            if (floats) {
+                w->as_f64 = strtod(str, NULL);
+            } else {
+                w->as_i64 = strtoll(str, NULL, 10);
+            }
+            values++;
+            if (values % SCAN_BLOCK == 0) {
+                *checksum += w->as_u64;
+            }
+        }
+        p = q + 1;
+    }
+    if (values % SCAN_BLOCK != 0) {
+        *checksum += block[(values - 1) % SCAN_BLOCK].as_u64;
+    }
+    free(text);
+    return values;
+}
+
+static void report(const char *name, const char *engine, uint64_t elapsed,
+                   uint64_t values, uint64_t bytes)
+{
+    printf("%-10s %-8s: %8.3f ms, %7.1f M values/s, %7.1f MB/s\n", name,
+           engine, elapsed * 1e-6, values * 1e3 / elapsed,
+           bytes * 1e3 / elapsed);
+}
+
+// Runs the program on the file and checks it against the baseline
+static bool run(size_t d, FILE *f)
+{
+    static Lasm lasm = {0};
+    const Dataset *dataset = &datasets[d];
+    int fd = fileno(f);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "ERROR: %s\n", strerror(errno));
+        return false;
+    }
+
+    uint64_t start = now_ns();
+    uint64_t expected_checksum = 0;
+    int64_t expected = baseline(fd, dataset->floats, &expected_checksum);
+    uint64_t elapsed = now_ns() - start;
+    if (expected < 0) {
+        fprintf(stderr, "ERROR: could not read the dataset\n");
+        return false;
+    }
+    report(dataset->name, "strtod", elapsed, expected, st.st_size);
+
+    Lim *lim = lim_create();
+    if (lim == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return false;
+    }
+    const char *source = dataset->floats ? SCAN_SOURCE("scan_f64")
+                                         : SCAN_SOURCE("scan_i64");
+    lim_attach_natives(lim);
+    if (lim_translate_source(cstr_as_sv(source), lim, &lasm) != LIM_OK ||
+        lim_bind_natives(lim) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim->error);
+        lim_destroy(lim);
+        return false;
+    }
+    lseek(fd, 0, SEEK_SET);
+    lim_push_word(lim, (Word){.as_i64 = fd});
+    Trap trap = lim_execute_program(lim);
+    bool ok = trap == TRAP_OK && lim->stack_size == 7 &&
+              lim->stack[6].as_i64 == 0 &&
+              lim->stack[3].as_i64 == expected &&
+              lim->stack[4].as_u64 == expected_checksum;
+    if (trap != TRAP_OK) {
+        fprintf(stderr, "Error: %s\n", trap_as_cstr(trap));
+    } else if (!ok) {
+        fprintf(stderr,
+                "ERROR: %s scanned %ld values with checksum 0x%016lx, "
+                "expected %ld with 0x%016lx\n",
+                dataset->name, lim->stack[3].as_i64, lim->stack[4].as_u64,
+                expected, expected_checksum);
+    } else {
+        report(dataset->name, "scan", lim->stack[5].as_u64, expected,
+               st.st_size);
+    }
+    lim_destroy(lim);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t values = argc > 1 ? strtoull(argv[1], NULL, 10) : 4000000;
+    if (values == 0) {
+        fprintf(stderr, "ERROR: expect at least one value\n");
+        return 1;
+    }
+    for (size_t d = 0; d < ARRAY_SIZE(datasets); d++) {
+        FILE *f = generate(d, values);
+        if (f == NULL) {
+            fprintf(stderr, "ERROR: could not write the dataset: %s\n",
+                    strerror(errno));
+            return 1;
+        }
+        bool ok = run(d, f);
+        fclose(f);
+        if (!ok) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -1,5 +1,7 @@
 #include "lim.h"
 
+static Lim lim = {0};
+
 int main(int argc, char *argv[])
 {
     const char *program = shift_args(&argc, &argv);
@@ -28,15 +30,33 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    lim_load_program_from_file(&lim, input_file_path);
+    if (lim_load_program_from_file(&lim, input_file_path) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim.error);
+        return 1;
+    }
     for (size_t i = 0; i < (size_t) lim.program_size; i++) {
         const Inst inst = lim.program[i];
         printf("%s", inst_type_as_cstr(inst.type));
-        if (inst_has_operand(inst.type)) {
+        if (inst.type == INST_NATIVE) {
+            printf(" %s", lim.imports[inst.operand.as_u64].name);
+        } else if (inst.type == INST_PUSH_SYM) {
+            printf(" %s", lim_interned_name(&lim, inst.operand.as_u64));
+        } else if (inst_has_operand(inst.type)) {
             printf(" %ld", inst.operand.as_i64);
         }
         printf("\n");
     }
 
+    // the data as `.byte` lines that lasm assembles back
+    if (lim.data_size > 0) {
+        printf(".data\n");
+    }
+    for (uint64_t i = 0; i < lim.data_size; i++) {
+        printf("%s%u", i % 16 == 0 ? ".byte " : " ", lim.data[i]);
+        if (i % 16 == 15 || i + 1 == lim.data_size) {
+            printf("\n");
+        }
+    }
+
     return 0;
 }
@@ -0,0 +1,1025 @@
+#include "lim.h"
+
+typedef struct {
+    uint64_t ir;      // index of the jump instruction in the IR
+    Inst_Addr ip;     // target in the stack program
+    uint64_t depth;   // stack depth when arriving at the target
+    uint64_t base;    // frame base when arriving at the target
+} Ir_Fixup;
+
+typedef struct {
+    Ir *ir;
+    Lim *lim;
+    bool overflow;
+
+    bool leaders[LIM_PROGRAM_CAPACITY];
+    int64_t ret_depth;
+    Inst_Addr worklist[LIM_PROGRAM_CAPACITY];
+    size_t worklist_size;
+
+    Ir_Fixup fixups[LIM_IR_CAPACITY];
+    size_t fixups_size;
+
+    // Virtual stack of the basic block being translated: the register which
+    // currently holds the value of each stack slot
+    Word *vs[LIM_STACK_CAPACITY];
+    uint64_t depth;
+    uint64_t base;
+    size_t temps_size;
+
+    // Instructions translated since the last exit that charges them, folded
+    // and eliminated ones included. The next such exit costs that much fuel.
+    uint64_t cost;
+
+    // written instead of the IR once it overflows
+    Ir_Inst dummy;
+} Ir_Translator;
+
+// Allocated per translation, so VMs can be translated from several threads
+static Ir_Translator *ir_translator_create(Ir *ir, Lim *lim)
+{
+    Ir_Translator *t = calloc(1, sizeof(*t));
+    if (t != NULL) {
+        t->ir = ir;
+        t->lim = lim;
+    }
+    return t;
+}
+
+static Word *ir_slot(Ir_Translator *t, uint64_t i)
+{
+    return &t->lim->stack[i];
+}
+
+static uint32_t ir_push_exit(Ir_Translator *t, Inst_Addr ip, uint64_t depth)
+{
+    Ir *ir = t->ir;
+    if (ir->exits_size >= LIM_IR_CAPACITY) {
+        t->overflow = true;
+        return 0;
+    }
+    ir->exits[ir->exits_size] = (Ir_Exit){
+        .ip = ip,
+        .stack_size = depth,
+        .cost = t->cost,
+    };
+    return ir->exits_size++;
+}
+
+static Ir_Inst *ir_emit(Ir_Translator *t, Ir_Op op)
+{
+    Ir *ir = t->ir;
+    if (ir->insts_size >= LIM_IR_CAPACITY) {
+        t->overflow = true;
+        return &t->dummy;
+    }
+    Ir_Inst *inst = &ir->insts[ir->insts_size++];
+    *inst = (Ir_Inst){.op = op};
+    return inst;
+}
+
+static void ir_emit_mov(Ir_Translator *t, Word *dst, Word *src)
+{
+    Ir_Inst *inst = ir_emit(t, IR_MOV);
+    inst->dst = dst;
+    inst->a = src;
+}
+
+static void ir_emit_jump(Ir_Translator *t,
+                         Ir_Op op,
+                         Word *cond,
+                         Inst_Addr ip,
+                         uint64_t depth,
+                         uint64_t base)
+{
+    // the exit of a jump is where execution resumes once out of fuel
+    uint32_t exit = op == IR_CALL ? 0 : ir_push_exit(t, ip, depth);
+    Ir_Inst *inst = ir_emit(t, op);
+    inst->a = cond;
+    inst->exit = exit;
+    if (t->fixups_size >= LIM_IR_CAPACITY) {
+        t->overflow = true;
+        return;
+    }
+    t->fixups[t->fixups_size++] = (Ir_Fixup){
+        .ir = t->ir->insts_size - 1,
+        .ip = ip,
+        .depth = depth,
+        .base = base,
+    };
+}
+
+static Word *ir_const(Ir_Translator *t, Word value)
+{
+    Ir *ir = t->ir;
+    for (size_t i = 0; i < ir->consts_size; i++) {
+        if (ir->consts[i].as_u64 == value.as_u64) {
+            return &ir->consts[i];
+        }
+    }
+    if (ir->consts_size >= LIM_IR_CONSTS_CAPACITY) {
+        t->overflow = true;
+        return &ir->consts[0];
+    }
+    ir->consts[ir->consts_size] = value;
+    return &ir->consts[ir->consts_size++];
+}
+
+static Word *ir_temp(Ir_Translator *t)
+{
+    assert(t->temps_size < LIM_IR_TEMPS_CAPACITY);
+    return &t->ir->temps[t->temps_size++];
+}
+
+// Materialize the virtual stack into the real stack slots, so that slot `i`
+// holds its own value for every `i` below the current depth. This is a
+// parallel move: cycles (e.g. left by `swap`) are broken with a scratch
+// register.
+static void ir_flush(Ir_Translator *t)
+{
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        bool pending = false;
+        for (uint64_t i = 0; i < t->depth; i++) {
+            Word *dst = ir_slot(t, i);
+            if (t->vs[i] == dst) {
+                continue;
+            }
+            pending = true;
+
+            bool blocked = false;
+            for (uint64_t j = 0; j < t->depth && !blocked; j++) {
+                blocked = j != i && t->vs[j] == dst;
+            }
+            if (!blocked) {
+                ir_emit_mov(t, dst, t->vs[i]);
+                t->vs[i] = dst;
+                progress = true;
+            }
+        }
+
+        if (pending && !progress) {
+            // every pending destination is still read by another move
+            for (uint64_t i = 0; i < t->depth; i++) {
+                Word *dst = ir_slot(t, i);
+                if (t->vs[i] != dst) {
+                    Word *temp = ir_temp(t);
+                    ir_emit_mov(t, temp, dst);
+                    for (uint64_t j = 0; j < t->depth; j++) {
+                        if (t->vs[j] == dst) {
+                            t->vs[j] = temp;
+                        }
+                    }
+                    break;
+                }
+            }
+            progress = true;
+        }
+    }
+
+    t->temps_size = 0;
+}
+
+// Preserve the values that still live in `reg` before it gets overwritten
+static void ir_clobber(Ir_Translator *t, Word *reg, uint64_t below)
+{
+    Word *temp = NULL;
+    for (uint64_t i = 0; i < below; i++) {
+        if (t->vs[i] == reg) {
+            if (temp == NULL) {
+                temp = ir_temp(t);
+                ir_emit_mov(t, temp, reg);
+            }
+            t->vs[i] = temp;
+        }
+    }
+}
+
+static void ir_emit_trap(Ir_Translator *t, Inst_Addr ip, Trap trap)
+{
+    ir_flush(t);
+    uint32_t exit = ir_push_exit(t, ip, t->depth);
+    Ir_Inst *inst = ir_emit(t, IR_TRAP);
+    inst->exit = exit;
+    inst->target = trap;
+}
+
+static void ir_fall_through(Ir_Translator *t, Inst_Addr ip)
+{
+    const Ir *ir = t->ir;
+    if (t->cost == 0 && ip < t->lim->program_size &&
+        ir->depths[ip] == (int64_t) t->depth &&
+        ir->bases[ip] == (int64_t) t->base) {
+        // the block of `ip` is translated right after the current one and
+        // there is nothing left to charge
+        return;
+    }
+    ir_emit_jump(t, IR_JMP, NULL, ip, t->depth, t->base);
+}
+
+static const Ir_Op ir_binary_ops[INST_NUM] = {
+    [INST_PLUS] = IR_PLUS,   [INST_MINUS] = IR_MINUS, [INST_MULT] = IR_MULT,
+    [INST_DIV] = IR_DIV,     [INST_FPLUS] = IR_FPLUS, [INST_FMINUS] = IR_FMINUS,
+    [INST_FMULT] = IR_FMULT, [INST_FDIV] = IR_FDIV,   [INST_GT] = IR_GT,
+    [INST_LT] = IR_LT,       [INST_GE] = IR_GE,       [INST_LE] = IR_LE,
+    [INST_EQ] = IR_EQ,
+};
+
+// The amount of words `inst` needs on the stack and the amount it leaves in
+// their place. Returns false when the effect is not known statically.
+static bool ir_stack_effect(const Lim *lim,
+                            Inst inst,
+                            uint64_t *in,
+                            uint64_t *out)
+{
+    switch (inst.type) {
+    case INST_NOP:
+    case INST_JMP:
+    case INST_CALL:
+    case INST_RET:
+    case INST_HALT:
+    case INST_SNAPSHOT:
+    case INST_YIELD:
+        *in = 0;
+        *out = 0;
+        return true;
+    case INST_PUSH:
+    case INST_PUSH_DATA:
+    case INST_PUSH_SYM:
+    case INST_LOAD_LOCAL:
+        *in = 0;
+        *out = 1;
+        return true;
+    case INST_SPAWN:
+    case INST_JOIN:
+    case INST_CHAN:
+    case INST_RECV:
+        *in = 1;
+        *out = 1;
+        return true;
+    case INST_SEND:
+        *in = 2;
+        *out = 0;
+        return true;
+    case INST_POP:
+    case INST_JNZ:
+    case INST_JZ:
+    case INST_PRINT_DEBUG:
+    case INST_STORE_LOCAL:
+        *in = 1;
+        *out = 0;
+        return true;
+    case INST_DROP:
+        *in = inst.operand.as_u64 + 1;
+        *out = 1;
+        return true;
+    case INST_DUP:
+        *in = inst.operand.as_u64 + 1;
+        *out = inst.operand.as_u64 + 2;
+        return true;
+    case INST_SWAP:
+        *in = inst.operand.as_u64 + 1;
+        *out = inst.operand.as_u64 + 1;
+        return true;
+    case INST_PLUS:
+    case INST_MINUS:
+    case INST_MULT:
+    case INST_DIV:
+    case INST_FPLUS:
+    case INST_FMINUS:
+    case INST_FMULT:
+    case INST_FDIV:
+    case INST_GT:
+    case INST_LT:
+    case INST_GE:
+    case INST_LE:
+    case INST_EQ:
+        *in = 2;
+        *out = 1;
+        return true;
+    case INST_NATIVE:
+        if (inst.operand.as_u64 >= lim->imports_size ||
+            lim->imports[inst.operand.as_u64].func == NULL) {
+            return false;
+        }
+        *in = lim->imports[inst.operand.as_u64].args;
+        *out = lim->imports[inst.operand.as_u64].rets;
+        return true;
+    case INST_NUM:
+    default:
+        return false;
+    }
+}
+
+static void ir_offer(Ir_Translator *t,
+                     Inst_Addr ip,
+                     uint64_t depth,
+                     uint64_t base,
+                     bool leader)
+{
+    if (ip >= t->lim->program_size) {
+        return;
+    }
+    t->leaders[ip] = t->leaders[ip] || leader;
+    if (t->ir->depths[ip] < 0) {
+        t->ir->depths[ip] = depth;
+        t->ir->bases[ip] = base;
+        t->worklist[t->worklist_size++] = ip;
+    } else if (t->ir->depths[ip] != (int64_t) depth ||
+               t->ir->bases[ip] != (int64_t) base) {
+        t->ir->exact = false;
+    }
+}
+
+// Find the stack depth and frame base at every reachable instruction. Where
+// two paths disagree the first one wins; the other path leaves the IR through
+// an exit and the interpreter carries on from there.
+static void ir_analyze(Ir_Translator *t)
+{
+    const Lim *lim = t->lim;
+
+    for (size_t i = 0; i < LIM_PROGRAM_CAPACITY; i++) {
+        t->ir->depths[i] = -1;
+        t->ir->bases[i] = -1;
+        t->leaders[i] = false;
+    }
+    t->ret_depth = -1;
+    t->ir->exact = true;
+    t->worklist_size = 0;
+    ir_offer(t, lim->ip, lim->stack_size, lim_frame_base(lim), true);
+
+    while (t->worklist_size > 0) {
+        Inst_Addr ip = t->worklist[--t->worklist_size];
+        uint64_t depth = t->ir->depths[ip];
+        uint64_t base = t->ir->bases[ip];
+        Inst inst = lim->program[ip];
+
+        uint64_t in, out;
+        if (!ir_stack_effect(lim, inst, &in, &out) || depth < in ||
+            depth - in + out > LIM_STACK_CAPACITY) {
+            continue;
+        }
+        uint64_t next = depth - in + out;
+
+        switch (inst.type) {
+        case INST_JMP:
+            ir_offer(t, inst.operand.as_u64, next, base, true);
+            break;
+        case INST_JNZ:
+        case INST_JZ:
+            ir_offer(t, inst.operand.as_u64, next, base, true);
+            ir_offer(t, ip + 1, next, base, true);
+            break;
+        case INST_CALL:
+            ir_offer(t, inst.operand.as_u64, next, next, true);
+            if (t->ret_depth >= 0) {
+                ir_offer(t, ip + 1, t->ret_depth, base, true);
+            }
+            break;
+        case INST_RET:
+            // The callee is not known statically, assume it returns to every
+            // analyzed call site with the depth of the first `ret` found.
+            // `IR_RET` checks depth and frame base at runtime.
+            if (t->ret_depth < 0) {
+                t->ret_depth = next;
+            } else if (t->ret_depth != (int64_t) next) {
+                t->ir->exact = false;
+            }
+            for (Inst_Addr i = 0; i < lim->program_size; i++) {
+                if (lim->program[i].type == INST_CALL &&
+                    t->ir->depths[i] >= 0) {
+                    ir_offer(t, i + 1, next, t->ir->bases[i], true);
+                }
+            }
+            break;
+        case INST_HALT:
+            break;
+        case INST_SPAWN:
+            // a new thread starts with its argument as the only word
+            ir_offer(t, inst.operand.as_u64, 1, 0, true);
+            ir_offer(t, ip + 1, next, base, false);
+            break;
+        case INST_NOP:
+        case INST_PUSH:
+        case INST_POP:
+        case INST_DUP:
+        case INST_PLUS:
+        case INST_MINUS:
+        case INST_MULT:
+        case INST_DIV:
+        case INST_FPLUS:
+        case INST_FMINUS:
+        case INST_FMULT:
+        case INST_FDIV:
+        case INST_GT:
+        case INST_LT:
+        case INST_GE:
+        case INST_LE:
+        case INST_EQ:
+        case INST_SWAP:
+        case INST_NATIVE:
+        case INST_PRINT_DEBUG:
+        case INST_LOAD_LOCAL:
+        case INST_STORE_LOCAL:
+        case INST_DROP:
+        case INST_SNAPSHOT:
+        case INST_YIELD:
+        case INST_JOIN:
+        case INST_CHAN:
+        case INST_SEND:
+        case INST_RECV:
+        case INST_PUSH_DATA:
+        case INST_PUSH_SYM:
+        case INST_NUM:
+        default:
+            ir_offer(t, ip + 1, next, base, false);
+            break;
+        }
+    }
+
+    // everything after a control transfer starts a new block
+    for (Inst_Addr ip = 0; ip < lim->program_size; ip++) {
+        Inst_Type type = lim->program[ip].type;
+        if ((type == INST_JMP || type == INST_JNZ || type == INST_JZ ||
+             type == INST_CALL || type == INST_RET || type == INST_HALT) &&
+            ip + 1 < lim->program_size) {
+            t->leaders[ip + 1] = true;
+        }
+    }
+}
+
+// Translate the basic block starting at `start`
+static void ir_translate_block(Ir_Translator *t, Inst_Addr start)
+{
+    Ir *ir = t->ir;
+    const Lim *lim = t->lim;
+
+    t->depth = ir->depths[start];
+    t->base = ir->bases[start];
+    for (uint64_t i = 0; i < t->depth; i++) {
+        t->vs[i] = ir_slot(t, i);
+    }
+    t->temps_size = 0;
+    t->cost = 0;
+    ir->entries[start] = ir->insts_size;
+
+    for (Inst_Addr ip = start;; ip++) {
+        if (ip != start && ip < lim->program_size && t->leaders[ip]) {
+            ir_flush(t);
+            ir_fall_through(t, ip);
+            return;
+        }
+        if (ip >= lim->program_size) {
+            ir_flush(t);
+            ir_emit_jump(t, IR_JMP, NULL, ip, t->depth, t->base);
+            return;
+        }
+        if (t->temps_size >= LIM_IR_TEMPS_CAPACITY / 2) {
+            ir_flush(t);
+        }
+        t->cost++;
+        if (t->depth > ir->stack_peak) {
+            ir->stack_peak = t->depth;
+        }
+
+        const Inst inst = lim->program[ip];
+        const uint64_t operand = inst.operand.as_u64;
+        switch (inst.type) {
+        case INST_NOP:
+            break;
+
+        case INST_PUSH:
+        case INST_PUSH_SYM:
+            if (t->depth >= LIM_STACK_CAPACITY) {
+                ir_emit_trap(t, ip, TRAP_STACK_OVERFLOW);
+                return;
+            }
+            t->vs[t->depth++] = ir_const(t, inst.operand);
+            break;
+
+        case INST_PUSH_DATA:
+            // the data stays at its address while the program is loaded
+            if (t->depth >= LIM_STACK_CAPACITY) {
+                ir_emit_trap(t, ip, TRAP_STACK_OVERFLOW);
+                return;
+            }
+            t->vs[t->depth++] =
+                ir_const(t, (Word){.as_ptr = (void *) (lim->data + operand)});
+            break;
+
+        case INST_POP:
+            if (t->depth < 1) {
+                ir_emit_trap(t, ip, TRAP_STACK_UNDERFLOW);
+                return;
+            }
+            t->depth--;
+            break;
+
+        case INST_DUP:
+            if (t->depth >= LIM_STACK_CAPACITY) {
+                ir_emit_trap(t, ip, TRAP_STACK_OVERFLOW);
+                return;
+            }
+            if (t->depth <= operand) {
+                ir_emit_trap(t, ip, TRAP_STACK_UNDERFLOW);
+                return;
+            }
+            t->vs[t->depth] = t->vs[t->depth - 1 - operand];
+            t->depth++;
+            break;
+
+        case INST_SWAP:
+            if (t->depth <= operand) {
+                ir_emit_trap(t, ip, TRAP_STACK_UNDERFLOW);
+                return;
+            }
+            if (operand > 0) {
+                Word *r = t->vs[t->depth - 1];
+                t->vs[t->depth - 1] = t->vs[t->depth - 1 - operand];
+                t->vs[t->depth - 1 - operand] = r;
+            }
+            break;
+
+        case INST_DIV:
+            // the only binary operation which traps at runtime, sync the
+            // stack first so the trap leaves the same state behind
+            if (t->depth >= 2) {
+                ir_flush(t);
+            }
+            // fallthrough
+        case INST_PLUS:
+        case INST_MINUS:
+        case INST_MULT:
+        case INST_FPLUS:
+        case INST_FMINUS:
+        case INST_FMULT:
+        case INST_FDIV:
+        case INST_GT:
+        case INST_LT:
+        case INST_GE:
+        case INST_LE:
+        case INST_EQ: {
+            if (t->depth < 2) {
+                ir_emit_trap(t, ip, TRAP_STACK_UNDERFLOW);
+                return;
+            }
+            Word *dst = ir_slot(t, t->depth - 2);
+            Word *a = t->vs[t->depth - 2];
+            Word *b = t->vs[t->depth - 1];
+            ir_clobber(t, dst, t->depth - 2);
+
+            uint32_t exit = 0;
+            if (inst.type == INST_DIV) {
+                exit = ir_push_exit(t, ip, t->depth);
+            }
+            Ir_Inst *op = ir_emit(t, ir_binary_ops[inst.type]);
+            op->exit = exit;
+            op->dst = dst;
+            op->a = a;
+            op->b = b;
+
+            t->vs[t->depth - 2] = dst;
+            t->depth--;
+        } break;
+
+        case INST_JMP:
+            ir_flush(t);
+            ir_emit_jump(t, IR_JMP, NULL, operand, t->depth, t->base);
+            return;
+
+        case INST_JNZ:
+        case INST_JZ: {
+            if (t->depth < 1) {
+                ir_emit_trap(t, ip, TRAP_STACK_UNDERFLOW);
+                return;
+            }
+            Word *cond = t->vs[--t->depth];
+            for (uint64_t i = 0; i < t->depth; i++) {
+                if (cond == ir_slot(t, i) && t->vs[i] != cond) {
+                    // the flush below overwrites the condition
+                    Word *temp = ir_temp(t);
+                    ir_emit_mov(t, temp, cond);
+                    cond = temp;
+                    break;
+                }
+            }
+            ir_flush(t);
+            ir_emit_jump(t, inst.type == INST_JNZ ? IR_JNZ : IR_JZ, cond,
+                         operand, t->depth, t->base);
+            // both ways pay for the block at the jump
+            t->cost = 0;
+            ir_fall_through(t, ip + 1);
+        }
+            return;
+
+        case INST_CALL: {
+            ir_flush(t);
+            uint32_t exit = ir_push_exit(t, ip, t->depth);
+            ir_emit_jump(t, IR_CALL, NULL, operand, t->depth, t->depth);
+            t->ir->insts[t->ir->insts_size - 1].exit = exit;
+        }
+            return;
+
+        case INST_RET: {
+            ir_flush(t);
+            uint32_t exit = ir_push_exit(t, ip, t->depth);
+            ir_emit(t, IR_RET)->exit = exit;
+        }
+            return;
+
+        case INST_LOAD_LOCAL: {
+            if (t->depth >= LIM_STACK_CAPACITY) {
+                ir_emit_trap(t, ip, TRAP_STACK_OVERFLOW);
+                return;
+            }
+            uint64_t slot = t->base + operand;
+            if (slot >= t->depth) {
+                ir_emit_trap(t, ip, TRAP_ILLEGAL_OPERAND);
+                return;
+            }
+            t->vs[t->depth] = t->vs[slot];
+            t->depth++;
+        } break;
+
+        case INST_STORE_LOCAL: {
+            if (t->depth < 1) {
+                ir_emit_trap(t, ip, TRAP_STACK_UNDERFLOW);
+                return;
+            }
+            uint64_t slot = t->base + operand;
+            if (slot >= t->depth - 1) {
+                ir_emit_trap(t, ip, TRAP_ILLEGAL_OPERAND);
+                return;
+            }
+            t->vs[slot] = t->vs[--t->depth];
+        } break;
+
+        case INST_DROP:
+            if (t->depth <= operand) {
+                ir_emit_trap(t, ip, TRAP_STACK_UNDERFLOW);
+                return;
+            }
+            t->vs[t->depth - 1 - operand] = t->vs[t->depth - 1];
+            t->depth -= operand;
+            break;
+
+        case INST_NATIVE:
+        case INST_PRINT_DEBUG:
+        case INST_SNAPSHOT:
+        case INST_SPAWN:
+        case INST_YIELD:
+        case INST_JOIN:
+        case INST_CHAN:
+        case INST_SEND:
+        case INST_RECV: {
+            uint64_t in, out;
+            ir_flush(t);
+            uint32_t exit = ir_push_exit(t, ip, t->depth);
+            Ir_Inst *op = ir_emit(t, IR_STEP);
+            op->exit = exit;
+            op->target = UINT64_MAX;
+            if (!ir_stack_effect(lim, inst, &in, &out) || t->depth < in) {
+                // the instruction traps, nothing after it is reachable
+                return;
+            }
+            t->depth = t->depth - in + out;
+            op->target = t->depth;
+            for (uint64_t i = 0; i < t->depth; i++) {
+                t->vs[i] = ir_slot(t, i);
+            }
+        } break;
+
+        case INST_HALT: {
+            ir_flush(t);
+            uint32_t exit = ir_push_exit(t, ip, t->depth);
+            ir_emit(t, IR_HALT)->exit = exit;
+        }
+            return;
+
+        case INST_NUM:
+        default:
+            ir_emit_trap(t, ip, TRAP_ILLEGAL_INST);
+            return;
+        }
+    }
+}
+
+// Only run the stack depth analysis from the current state of `lim`. When
+// out of memory nothing is known: every instruction is unreachable.
+void lim_ir_analyze(Ir *ir, Lim *lim)
+{
+    Ir_Translator *t = ir_translator_create(ir, lim);
+    if (t == NULL) {
+        for (size_t i = 0; i < LIM_PROGRAM_CAPACITY; i++) {
+            ir->depths[i] = -1;
+            ir->bases[i] = -1;
+        }
+        ir->exact = false;
+        return;
+    }
+    ir_analyze(t);
+    free(t);
+}
+
+bool lim_ir_translate(Ir *ir, Lim *lim)
+{
+    ir->insts_size = 0;
+    ir->exits_size = 0;
+    ir->consts_size = 0;
+    ir->stack_peak = 0;
+    for (size_t i = 0; i < LIM_PROGRAM_CAPACITY; i++) {
+        ir->entries[i] = -1;
+    }
+
+    Ir_Translator *t = ir_translator_create(ir, lim);
+    if (t == NULL) {
+        return false;
+    }
+
+    ir_analyze(t);
+    for (Inst_Addr ip = 0; ip < lim->program_size; ip++) {
+        if (t->leaders[ip] && ir->depths[ip] >= 0) {
+            ir_translate_block(t, ip);
+        }
+    }
+
+    // Resolve jumps. Targets without a translated block at the expected depth
+    // get an exit to the interpreter instead.
+    for (size_t i = 0; i < t->fixups_size; i++) {
+        const Ir_Fixup *fixup = &t->fixups[i];
+        if (fixup->ip < lim->program_size && ir->entries[fixup->ip] >= 0 &&
+            ir->depths[fixup->ip] == (int64_t) fixup->depth &&
+            ir->bases[fixup->ip] == (int64_t) fixup->base) {
+            ir->insts[fixup->ir].target = ir->entries[fixup->ip];
+        } else {
+            uint32_t exit = ir_push_exit(t, fixup->ip, fixup->depth);
+            ir->insts[fixup->ir].target = ir->insts_size;
+            ir_emit(t, IR_EXIT)->exit = exit;
+        }
+    }
+
+    const bool overflow = t->overflow;
+    free(t);
+    if (overflow) {
+        ir->insts_size = 0;
+        for (size_t i = 0; i < LIM_PROGRAM_CAPACITY; i++) {
+            ir->entries[i] = -1;
+        }
+        return false;
+    }
+    return true;
+}
+
+static bool ir_entry(const Ir *ir, const Lim *lim, uint64_t *index)
+{
+    if (lim->ip >= lim->program_size || ir->entries[lim->ip] < 0 ||
+        ir->depths[lim->ip] != (int64_t) lim->stack_size ||
+        ir->bases[lim->ip] != (int64_t) lim_frame_base(lim)) {
+        return false;
+    }
+    *index = ir->entries[lim->ip];
+    return true;
+}
+
+#define IR_BINARY_OP(field, op)                                \
+    inst->dst->field = inst->a->field op inst->b->field;      \
+    inst++;                                                    \
+    break
+
+#define IR_COMPARE_OP(op)                                      \
+    inst->dst->as_i64 = inst->a->as_i64 op inst->b->as_i64;    \
+    inst++;                                                    \
+    break
+
+// Run the IR from the current state of `lim`. Returns TRAP_OK without
+// halting when the rest has to be executed by the stack interpreter.
+// Fuel is charged with the amount of stack instructions a jump, `call` or
+// `ret` leaves behind, so it adds up to what the interpreter executes. Once
+// out of fuel the state is left at the jump target, so the next run carries
+// on from there.
+#define IR_SPEND(exit)                                               \
+    do {                                                             \
+        *fuel -= (exit)->cost < *fuel ? (exit)->cost : *fuel;        \
+        lim->stats.instructions += (exit)->cost;                     \
+    } while (0)
+
+#define IR_CHARGE()                                                  \
+    do {                                                             \
+        const Ir_Exit *exit = &ir->exits[inst->exit];                \
+        IR_SPEND(exit);                                              \
+        if (*fuel == 0) {                                            \
+            lim->ip = exit->ip;                                      \
+            lim->stack_size = exit->stack_size;                      \
+            return TRAP_OUT_OF_FUEL;                                 \
+        }                                                            \
+    } while (0)
+
+// A conditional jump which is not taken is charged as well, it runs out of
+// fuel at the next jump
+#define IR_FALL_THROUGH()                                            \
+    do {                                                             \
+        const Ir_Exit *exit = &ir->exits[inst->exit];                \
+        IR_SPEND(exit);                                              \
+        inst++;                                                      \
+    } while (0)
+
+Trap lim_ir_execute(const Ir *ir, Lim *lim, uint64_t *fuel)
+{
+    uint64_t index;
+    if (!ir_entry(ir, lim, &index)) {
+        return TRAP_OK;
+    }
+    // the stack is not tracked per instruction in the IR
+    if (ir->stack_peak > lim->stats.stack_peak) {
+        lim->stats.stack_peak = ir->stack_peak;
+    }
+
+    const Ir_Inst *inst = &ir->insts[index];
+    for (;;) {
+        switch (inst->op) {
+        case IR_MOV:
+            *inst->dst = *inst->a;
+            inst++;
+            break;
+
+        case IR_PLUS:
+            IR_BINARY_OP(as_i64, +);
+        case IR_MINUS:
+            IR_BINARY_OP(as_i64, -);
+        case IR_MULT:
+            IR_BINARY_OP(as_i64, *);
+        case IR_DIV:
+            if (inst->b->as_i64 == 0) {
+                const Ir_Exit *exit = &ir->exits[inst->exit];
+                IR_SPEND(exit);
+                lim->ip = exit->ip;
+                lim->stack_size = exit->stack_size;
+                return TRAP_DIV_BY_ZERO;
+            }
+            IR_BINARY_OP(as_i64, /);
+        case IR_FPLUS:
+            IR_BINARY_OP(as_f64, +);
+        case IR_FMINUS:
+            IR_BINARY_OP(as_f64, -);
+        case IR_FMULT:
+            IR_BINARY_OP(as_f64, *);
+        case IR_FDIV:
+            IR_BINARY_OP(as_f64, /);
+        case IR_GT:
+            IR_COMPARE_OP(>);
+        case IR_LT:
+            IR_COMPARE_OP(<);
+        case IR_GE:
+            IR_COMPARE_OP(>=);
+        case IR_LE:
+            IR_COMPARE_OP(<=);
+        case IR_EQ:
+            IR_COMPARE_OP(==);
+
+        case IR_JMP:
+            IR_CHARGE();
+            inst = &ir->insts[inst->target];
+            break;
+
+        case IR_JNZ:
+            if (!inst->a->as_u64) {
+                IR_FALL_THROUGH();
+                break;
+            }
+            IR_CHARGE();
+            inst = &ir->insts[inst->target];
+            break;
+
+        case IR_JZ:
+            if (inst->a->as_u64) {
+                IR_FALL_THROUGH();
+                break;
+            }
+            IR_CHARGE();
+            inst = &ir->insts[inst->target];
+            break;
+
+        case IR_CALL: {
+            const Ir_Exit *exit = &ir->exits[inst->exit];
+            if (lim->frames_size >= LIM_FRAMES_CAPACITY) {
+                lim->ip = exit->ip;
+                lim->stack_size = exit->stack_size;
+                return TRAP_CALL_STACK_OVERFLOW;
+            }
+            lim->frames[lim->frames_size++] = (Lim_Frame){
+                .ret = exit->ip + 1,
+                .base = exit->stack_size,
+            };
+            lim->stats.calls++;
+            // runs out of fuel at the next jump
+            IR_SPEND(exit);
+            inst = &ir->insts[inst->target];
+        } break;
+
+        case IR_RET: {
+            const Ir_Exit *exit = &ir->exits[inst->exit];
+            lim->stack_size = exit->stack_size;
+            if (lim->frames_size < 1) {
+                // the interpreter finishes a green thread or traps
+                IR_SPEND(exit);
+                lim->ip = exit->ip;
+                return lim_execute_inst(lim);
+            }
+            lim->ip = lim->frames[--lim->frames_size].ret;
+            lim->stats.returns++;
+            IR_SPEND(exit);
+            if (*fuel == 0) {
+                return TRAP_OUT_OF_FUEL;
+            }
+            if (!ir_entry(ir, lim, &index)) {
+                return TRAP_OK;
+            }
+            inst = &ir->insts[index];
+        } break;
+
+        case IR_STEP: {
+            const Ir_Exit *exit = &ir->exits[inst->exit];
+            const uint64_t thread = lim->thread;
+            lim->ip = exit->ip;
+            lim->stack_size = exit->stack_size;
+            Trap trap = lim_execute_inst(lim);
+            if (trap != TRAP_OK) {
+                IR_SPEND(exit);
+                return trap;
+            }
+            // a native which does not keep to its declared stack effect or a
+            // switch to another green thread sends us back to the interpreter
+            if (lim->halt || lim->thread != thread ||
+                lim->ip != exit->ip + 1 || lim->stack_size != inst->target) {
+                IR_SPEND(exit);
+                return TRAP_OK;
+            }
+            inst++;
+        } break;
+
+        case IR_EXIT: {
+            const Ir_Exit *exit = &ir->exits[inst->exit];
+            lim->ip = exit->ip;
+            lim->stack_size = exit->stack_size;
+        }
+            return TRAP_OK;
+
+        case IR_HALT: {
+            const Ir_Exit *exit = &ir->exits[inst->exit];
+            IR_SPEND(exit);
+            lim->ip = exit->ip;
+            lim->stack_size = exit->stack_size;
+            lim->halt = true;
+        }
+            return TRAP_OK;
+
+        case IR_TRAP: {
+            const Ir_Exit *exit = &ir->exits[inst->exit];
+            IR_SPEND(exit);
+            lim->ip = exit->ip;
+            lim->stack_size = exit->stack_size;
+        }
+            return (Trap) inst->target;
+
+        default:
+            assert(false && "lim_ir_execute: unreachable");
+            return TRAP_ILLEGAL_INST;
+        }
+    }
+}
+
+// Mixed mode execution: run translated blocks in the IR and everything else
+// in the stack interpreter until the program halts or traps
+Trap lim_ir_execute_budget(const Ir *ir, Lim *lim, uint64_t fuel)
+{
+    Trap trap = TRAP_OK;
+    while (!lim->halt && trap == TRAP_OK) {
+        if (fuel == 0) {
+            trap = TRAP_OUT_OF_FUEL;
+            break;
+        }
+        trap = lim_ir_execute(ir, lim, &fuel);
+
+        // the interpreter is charged per instruction until back in the IR
+        uint64_t index;
+        while (trap == TRAP_OK && !lim->halt && !ir_entry(ir, lim, &index)) {
+            if (fuel == 0) {
+                trap = TRAP_OUT_OF_FUEL;
+                break;
+            }
+            fuel--;
+            trap = lim_execute_inst(lim);
+            lim->stats.instructions++;
+            if (lim->stack_size > lim->stats.stack_peak) {
+                lim->stats.stack_peak = lim->stack_size;
+            }
+        }
+    }
+    return trap;
+}
+
+Trap lim_ir_execute_program(const Ir *ir, Lim *lim)
+{
+    return lim_ir_execute_budget(ir, lim, UINT64_MAX);
+}
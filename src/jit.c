@@ -0,0 +1,1254 @@
+#define _DEFAULT_SOURCE
+#include "lim.h"
+
+#include <sys/mman.h>
+
+// A tracing JIT on top of the stack interpreter. The interpreter counts the
+// taken backward jumps per target. Once a loop head is hot the instructions
+// of the next iteration are recorded as they execute: stack shuffles, pushes
+// and locals only move value numbers around a symbolic stack, arithmetic
+// becomes a value, and every conditional jump becomes a guard on the
+// direction it took. When the recording is back at the loop head with the
+// same stack depth, the trace is compiled to x86-64 with every value in a
+// register, so the loop runs without touching the VM stack. A guard which
+// fails writes the live values back into their stack slots and leaves to the
+// interpreter at the other side of the jump.
+//
+// Words carry no type, so the type of a value is the one of the instructions
+// which produce and consume it: the operands and results of the float
+// instructions live in XMM registers, the others in general purpose ones, and
+// a value used both ways is moved across with `movq`.
+
+#define JIT_HOT 64                 // taken backward jumps before recording
+#define JIT_ABORTS_CAPACITY 4      // recordings given up before a loop head
+                                   // is left to the interpreter for good
+#define JIT_TRACE_CAPACITY 512     // instructions of a recording
+#define JIT_VALUES_CAPACITY (LIM_STACK_CAPACITY + JIT_TRACE_CAPACITY)
+#define JIT_EXITS_CAPACITY 64      // per trace, one is the loop head
+#define JIT_SNAPSHOTS_CAPACITY (64 * 1024)
+#define JIT_TRACES_CAPACITY 256
+#define JIT_CODE_CAPACITY (1024 * 1024)
+
+#if defined(__x86_64__)
+#define JIT_ENABLED true
+#else
+#define JIT_ENABLED false
+#endif
+
+typedef enum {
+    JIT_ENTRY = 0,  // value i is what slot i holds when the iteration starts
+    JIT_CONST,
+    JIT_OP,
+} Jit_Value_Kind;
+
+typedef struct {
+    Jit_Value_Kind kind;
+    Inst_Type op;
+    uint32_t a;
+    uint32_t b;
+    Word constant;
+
+    // Register allocation. `floats` and `ints` count the uses by float and by
+    // integer instructions, the majority picks the register file of entries
+    // and constants. Pinned values keep their register for the whole trace,
+    // entries and constants without one are loaded where they are used.
+    uint32_t floats;
+    uint32_t ints;
+    bool xmm;
+    bool pinned;
+    bool used;
+    uint32_t last;  // step of the last use
+    int reg;
+} Jit_Value;
+
+typedef struct {
+    uint32_t value;  // computed by the step, or tested by a guard
+    uint32_t exit;   // UINT32_MAX when the step cannot leave the trace
+    bool guard;
+    bool nonzero;    // the guard holds while the value is nonzero
+} Jit_Step;
+
+// Where a trace leaves to the interpreter: the state of the stack interpreter
+// at `ip`, with `depth` slots of which `snapshot` names the values, and the
+// instructions of the iteration executed up to there
+typedef struct {
+    Inst_Addr ip;
+    uint64_t depth;
+    uint64_t cost;
+    uint32_t snapshot;
+} Jit_Exit;
+
+typedef struct {
+    bool active;
+    Inst_Addr anchor;
+    uint64_t entry_depth;
+    uint64_t base;
+    uint64_t length;
+    uint64_t peak;
+
+    uint32_t vs[LIM_STACK_CAPACITY];
+    uint64_t depth;
+
+    Jit_Value values[JIT_VALUES_CAPACITY];
+    size_t values_size;
+    Jit_Step steps[JIT_TRACE_CAPACITY];
+    size_t steps_size;
+    Jit_Exit exits[JIT_EXITS_CAPACITY];
+    size_t exits_size;
+    uint32_t snapshots[JIT_SNAPSHOTS_CAPACITY];
+    size_t snapshots_size;
+} Jit_Recorder;
+
+// [stack, iterations] -> exit. Runs up to `*iterations` iterations and
+// leaves the ones left there.
+typedef uint32_t (*Jit_Func)(Word *stack, uint64_t *iterations);
+
+typedef struct {
+    Inst_Addr anchor;
+    uint64_t depth;
+    uint64_t base;
+    uint64_t length;
+    uint64_t peak;
+    Jit_Func func;
+    Jit_Exit exits[JIT_EXITS_CAPACITY];
+    size_t exits_size;
+} Jit_Trace;
+
+typedef struct {
+    size_t at;  // of the rel32 to patch
+    uint32_t exit;
+} Jit_Fixup;
+
+struct Lim_Jit {
+    uint32_t counters[LIM_PROGRAM_CAPACITY];
+    uint8_t aborts[LIM_PROGRAM_CAPACITY];
+    uint32_t traces_at[LIM_PROGRAM_CAPACITY];  // index + 1, 0 when none
+
+    Jit_Trace traces[JIT_TRACES_CAPACITY];
+    size_t traces_size;
+
+    uint8_t *code;
+    size_t code_size;
+    size_t code_begin;  // of the trace being emitted
+    bool code_overflow;
+    Jit_Fixup fixups[JIT_TRACE_CAPACITY + 1];
+    size_t fixups_size;
+
+    Jit_Recorder recorder;
+    Lim_Jit_Stats stats;
+};
+
+Lim_Jit *lim_jit_create(void)
+{
+    Lim_Jit *jit = calloc(1, sizeof(*jit));
+    if (jit == NULL) {
+        return NULL;
+    }
+    if (JIT_ENABLED) {
+        jit->code = mmap(NULL, JIT_CODE_CAPACITY, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (jit->code == MAP_FAILED) {
+            free(jit);
+            return NULL;
+        }
+    }
+    return jit;
+}
+
+void lim_jit_destroy(Lim_Jit *jit)
+{
+    if (jit == NULL) {
+        return;
+    }
+    if (jit->code != NULL) {
+        munmap(jit->code, JIT_CODE_CAPACITY);
+    }
+    free(jit);
+}
+
+Lim_Jit_Stats lim_jit_stats(const Lim_Jit *jit)
+{
+    return jit->stats;
+}
+
+/* x86-64 code */
+
+enum {
+    RAX = 0,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+};
+
+// XMM registers follow the general purpose ones in register numbers
+#define XMM(n) (16 + (n))
+#define JIT_IS_XMM(reg) ((reg) >= 16)
+
+// rdi is the stack, rsi the iteration budget in memory and r15 in a register.
+// rax, rdx, r10 and r11 are scratch: rdx for `idiv`, r10 and r11 for
+// operands moved over from XMM registers. xmm13 to xmm15 likewise.
+static const int jit_gprs[] = {RBX, RBP, RCX, R8, R9, R12, R13, R14};
+#define JIT_XMMS 13
+
+enum {
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_L = 0xc,
+    CC_GE = 0xd,
+    CC_LE = 0xe,
+    CC_G = 0xf,
+};
+
+static void jit_u8(Lim_Jit *jit, uint8_t byte)
+{
+    if (jit->code_size >= JIT_CODE_CAPACITY) {
+        jit->code_overflow = true;
+        return;
+    }
+    jit->code[jit->code_size++] = byte;
+}
+
+static void jit_u32(Lim_Jit *jit, uint32_t x)
+{
+    for (int i = 0; i < 4; i++) {
+        jit_u8(jit, x >> (8 * i));
+    }
+}
+
+static void jit_u64(Lim_Jit *jit, uint64_t x)
+{
+    for (int i = 0; i < 8; i++) {
+        jit_u8(jit, x >> (8 * i));
+    }
+}
+
+// REX prefix with the high bits of the register numbers, left out when
+// empty
+static void jit_rex(Lim_Jit *jit, bool w, int reg, int rm)
+{
+    uint8_t rex = 0x40 | w << 3 | (reg & 8) >> 1 | (rm & 8) >> 3;
+    if (rex != 0x40) {
+        jit_u8(jit, rex);
+    }
+}
+
+static void jit_modrm(Lim_Jit *jit, int reg, int rm)
+{
+    jit_u8(jit, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// [rdi + 8 * slot]
+static void jit_modrm_slot(Lim_Jit *jit, int reg, uint64_t slot)
+{
+    jit_u8(jit, 0x80 | (reg & 7) << 3 | RDI);
+    jit_u32(jit, slot * sizeof(Word));
+}
+
+// `op dst, src` for the ALU instructions which take `r/m64, r64`
+static void jit_alu(Lim_Jit *jit, uint8_t opcode, int dst, int src)
+{
+    jit_rex(jit, true, src, dst);
+    jit_u8(jit, opcode);
+    jit_modrm(jit, src, dst);
+}
+
+#define JIT_ADD 0x01
+#define JIT_SUB 0x29
+#define JIT_CMP 0x39
+#define JIT_TEST 0x85
+#define JIT_MOV 0x89
+
+static void jit_imul(Lim_Jit *jit, int dst, int src)
+{
+    jit_rex(jit, true, dst, src);
+    jit_u8(jit, 0x0f);
+    jit_u8(jit, 0xaf);
+    jit_modrm(jit, dst, src);
+}
+
+// Scalar double instructions `op xmm, xmm` behind a mandatory prefix
+static void jit_sse(Lim_Jit *jit, uint8_t prefix, uint8_t opcode, int dst,
+                    int src)
+{
+    jit_u8(jit, prefix);
+    jit_rex(jit, false, dst - 16, src - 16);
+    jit_u8(jit, 0x0f);
+    jit_u8(jit, opcode);
+    jit_modrm(jit, dst - 16, src - 16);
+}
+
+#define JIT_MOVAPD 0x66, 0x28
+#define JIT_ADDSD 0xf2, 0x58
+#define JIT_MULSD 0xf2, 0x59
+#define JIT_SUBSD 0xf2, 0x5c
+#define JIT_DIVSD 0xf2, 0x5e
+
+// Moves the bits between any two registers
+static void jit_move(Lim_Jit *jit, int dst, int src)
+{
+    if (dst == src) {
+        return;
+    }
+    if (!JIT_IS_XMM(dst) && !JIT_IS_XMM(src)) {
+        jit_alu(jit, JIT_MOV, dst, src);
+    } else if (JIT_IS_XMM(dst) && JIT_IS_XMM(src)) {
+        jit_sse(jit, JIT_MOVAPD, dst, src);
+    } else {
+        // movq xmm, r64 is 66 REX.W 0F 6E and movq r64, xmm 66 REX.W 0F 7E
+        int xmm = JIT_IS_XMM(dst) ? dst - 16 : src - 16;
+        int gpr = JIT_IS_XMM(dst) ? src : dst;
+        jit_u8(jit, 0x66);
+        jit_rex(jit, true, xmm, gpr);
+        jit_u8(jit, 0x0f);
+        jit_u8(jit, JIT_IS_XMM(dst) ? 0x6e : 0x7e);
+        jit_modrm(jit, xmm, gpr);
+    }
+}
+
+static void jit_move_imm(Lim_Jit *jit, int dst, uint64_t imm)
+{
+    int gpr = JIT_IS_XMM(dst) ? RAX : dst;
+    jit_rex(jit, true, 0, gpr);
+    jit_u8(jit, 0xb8 + (gpr & 7));
+    jit_u64(jit, imm);
+    jit_move(jit, dst, gpr);
+}
+
+static void jit_load(Lim_Jit *jit, int dst, uint64_t slot)
+{
+    if (JIT_IS_XMM(dst)) {
+        // movsd xmm, m64
+        jit_u8(jit, 0xf2);
+        jit_rex(jit, false, dst - 16, RDI);
+        jit_u8(jit, 0x0f);
+        jit_u8(jit, 0x10);
+        jit_modrm_slot(jit, dst - 16, slot);
+    } else {
+        jit_rex(jit, true, dst, RDI);
+        jit_u8(jit, 0x8b);
+        jit_modrm_slot(jit, dst, slot);
+    }
+}
+
+static void jit_store(Lim_Jit *jit, uint64_t slot, int src)
+{
+    if (JIT_IS_XMM(src)) {
+        jit_u8(jit, 0xf2);
+        jit_rex(jit, false, src - 16, RDI);
+        jit_u8(jit, 0x0f);
+        jit_u8(jit, 0x11);
+        jit_modrm_slot(jit, src - 16, slot);
+    } else {
+        jit_rex(jit, true, src, RDI);
+        jit_u8(jit, 0x89);
+        jit_modrm_slot(jit, src, slot);
+    }
+}
+
+// A jump to exit `exit`, patched once the exits are emitted
+static void jit_jcc_exit(Lim_Jit *jit, uint8_t cc, uint32_t exit)
+{
+    jit_u8(jit, 0x0f);
+    jit_u8(jit, 0x80 | cc);
+    jit->fixups[jit->fixups_size++] = (Jit_Fixup){
+        .at = jit->code_size,
+        .exit = exit,
+    };
+    jit_u32(jit, 0);
+}
+
+static void jit_patch(Lim_Jit *jit, size_t at, size_t target)
+{
+    if (at + 4 <= JIT_CODE_CAPACITY) {
+        uint32_t rel = (uint32_t) (target - (at + 4));
+        memcpy(&jit->code[at], &rel, sizeof(rel));
+    }
+}
+
+/* Recording */
+
+static void jit_abort(Lim_Jit *jit)
+{
+    Jit_Recorder *r = &jit->recorder;
+    r->active = false;
+    if (jit->aborts[r->anchor] < UINT8_MAX) {
+        jit->aborts[r->anchor]++;
+    }
+    jit->stats.aborts++;
+}
+
+static uint32_t jit_value(Jit_Recorder *r, Jit_Value value)
+{
+    if (r->values_size >= JIT_VALUES_CAPACITY) {
+        return UINT32_MAX;
+    }
+    value.reg = -1;
+    r->values[r->values_size] = value;
+    return r->values_size++;
+}
+
+static uint32_t jit_const(Jit_Recorder *r, Word constant)
+{
+    for (size_t i = r->entry_depth; i < r->values_size; i++) {
+        if (r->values[i].kind == JIT_CONST &&
+            r->values[i].constant.as_u64 == constant.as_u64) {
+            return i;
+        }
+    }
+    return jit_value(r, (Jit_Value){.kind = JIT_CONST, .constant = constant});
+}
+
+// Remember the symbolic stack as the state of an exit to `ip`
+static uint32_t jit_exit(Jit_Recorder *r, Inst_Addr ip, uint64_t cost)
+{
+    if (r->exits_size >= JIT_EXITS_CAPACITY - 1 ||
+        r->snapshots_size + r->depth > JIT_SNAPSHOTS_CAPACITY) {
+        return UINT32_MAX;
+    }
+    r->exits[r->exits_size] = (Jit_Exit){
+        .ip = ip,
+        .depth = r->depth,
+        .cost = cost,
+        .snapshot = r->snapshots_size,
+    };
+    memcpy(&r->snapshots[r->snapshots_size], r->vs,
+           r->depth * sizeof(r->vs[0]));
+    r->snapshots_size += r->depth;
+    return r->exits_size++;
+}
+
+static bool jit_step(Jit_Recorder *r, Jit_Step step)
+{
+    if (r->steps_size >= JIT_TRACE_CAPACITY) {
+        return false;
+    }
+    r->steps[r->steps_size++] = step;
+    return true;
+}
+
+static void jit_record_start(Lim_Jit *jit, const Lim *lim)
+{
+    Jit_Recorder *r = &jit->recorder;
+    r->active = true;
+    r->anchor = lim->ip;
+    r->entry_depth = lim->stack_size;
+    r->base = lim_frame_base(lim);
+    r->length = 0;
+    r->peak = lim->stack_size;
+    r->depth = lim->stack_size;
+    r->values_size = 0;
+    r->steps_size = 0;
+    r->exits_size = 0;
+    r->snapshots_size = 0;
+    for (uint64_t i = 0; i < r->depth; i++) {
+        r->vs[i] = jit_value(r, (Jit_Value){.kind = JIT_ENTRY});
+    }
+}
+
+// Follow `inst` at `ip`, which the interpreter just executed without a trap.
+// Returns false when the instruction cannot be part of a trace.
+static bool jit_record_inst(Jit_Recorder *r, const Lim *lim, Inst_Addr ip,
+                            Inst inst)
+{
+    const uint64_t operand = inst.operand.as_u64;
+    switch (inst.type) {
+    case INST_NOP:
+    case INST_JMP:
+        break;
+
+    case INST_PUSH:
+    case INST_PUSH_SYM:
+    case INST_PUSH_DATA: {
+        Word constant = inst.operand;
+        if (inst.type == INST_PUSH_DATA) {
+            constant.as_ptr = (void *) (lim->data + operand);
+        }
+        uint32_t value = jit_const(r, constant);
+        if (value == UINT32_MAX) {
+            return false;
+        }
+        r->vs[r->depth++] = value;
+    } break;
+
+    case INST_POP:
+        r->depth--;
+        break;
+
+    case INST_DUP:
+        r->vs[r->depth] = r->vs[r->depth - 1 - operand];
+        r->depth++;
+        break;
+
+    case INST_SWAP: {
+        uint32_t top = r->vs[r->depth - 1];
+        r->vs[r->depth - 1] = r->vs[r->depth - 1 - operand];
+        r->vs[r->depth - 1 - operand] = top;
+    } break;
+
+    case INST_DROP:
+        r->vs[r->depth - 1 - operand] = r->vs[r->depth - 1];
+        r->depth -= operand;
+        break;
+
+    case INST_LOAD_LOCAL:
+        r->vs[r->depth] = r->vs[r->base + operand];
+        r->depth++;
+        break;
+
+    case INST_STORE_LOCAL:
+        r->vs[r->base + operand] = r->vs[r->depth - 1];
+        r->depth--;
+        break;
+
+    case INST_PLUS:
+    case INST_MINUS:
+    case INST_MULT:
+    case INST_DIV:
+    case INST_FPLUS:
+    case INST_FMINUS:
+    case INST_FMULT:
+    case INST_FDIV:
+    case INST_GT:
+    case INST_LT:
+    case INST_GE:
+    case INST_LE:
+    case INST_EQ: {
+        // `div` leaves before it would trap, the interpreter traps then
+        uint32_t exit = UINT32_MAX;
+        if (inst.type == INST_DIV) {
+            exit = jit_exit(r, ip, r->length);
+            if (exit == UINT32_MAX) {
+                return false;
+            }
+        }
+        uint32_t value = jit_value(r, (Jit_Value){
+                                          .kind = JIT_OP,
+                                          .op = inst.type,
+                                          .a = r->vs[r->depth - 2],
+                                          .b = r->vs[r->depth - 1],
+                                      });
+        if (value == UINT32_MAX ||
+            !jit_step(r, (Jit_Step){.value = value, .exit = exit})) {
+            return false;
+        }
+        r->vs[r->depth - 2] = value;
+        r->depth--;
+    } break;
+
+    case INST_JNZ:
+    case INST_JZ: {
+        uint32_t cond = r->vs[--r->depth];
+        if (operand == ip + 1) {
+            break;
+        }
+        bool taken = lim->ip == operand;
+        uint32_t exit = jit_exit(r, taken ? ip + 1 : operand, r->length + 1);
+        if (exit == UINT32_MAX ||
+            !jit_step(r, (Jit_Step){
+                             .value = cond,
+                             .exit = exit,
+                             .guard = true,
+                             .nonzero = taken == (inst.type == INST_JNZ),
+                         })) {
+            return false;
+        }
+    } break;
+
+    case INST_CALL:
+    case INST_RET:
+    case INST_NATIVE:
+    case INST_HALT:
+    case INST_PRINT_DEBUG:
+    case INST_SNAPSHOT:
+    case INST_SPAWN:
+    case INST_YIELD:
+    case INST_JOIN:
+    case INST_CHAN:
+    case INST_SEND:
+    case INST_RECV:
+    case INST_NUM:
+    default:
+        return false;
+    }
+
+    r->length++;
+    if (r->depth > r->peak) {
+        r->peak = r->depth;
+    }
+    return r->length < JIT_TRACE_CAPACITY;
+}
+
+/* Compilation */
+
+static bool jit_is_float_op(Inst_Type op)
+{
+    return op == INST_FPLUS || op == INST_FMINUS || op == INST_FMULT ||
+           op == INST_FDIV;
+}
+
+static void jit_use(Jit_Recorder *r, uint32_t value, uint32_t step,
+                    bool as_float)
+{
+    Jit_Value *v = &r->values[value];
+    v->used = true;
+    v->last = step > v->last ? step : v->last;
+    if (as_float) {
+        v->floats++;
+    } else {
+        v->ints++;
+    }
+}
+
+// Whether slot `slot` of an exit has to be written back. The stack is never
+// written inside the trace, so a slot which holds what it held at the start
+// of the iteration only needs a store when the loop changes it.
+static bool jit_exit_stores(const Jit_Recorder *r, uint64_t slot,
+                            uint32_t value)
+{
+    return slot >= r->entry_depth || value != slot || r->vs[slot] != slot;
+}
+
+
+static void jit_take(Jit_Value *v, uint32_t *taken)
+{
+    if (v->xmm) {
+        for (int n = 0; n < JIT_XMMS; n++) {
+            if (!(*taken & 1u << XMM(n))) {
+                *taken |= 1u << XMM(n);
+                v->reg = XMM(n);
+                return;
+            }
+        }
+    } else {
+        for (size_t g = 0; g < ARRAY_SIZE(jit_gprs); g++) {
+            if (!(*taken & 1u << jit_gprs[g])) {
+                *taken |= 1u << jit_gprs[g];
+                v->reg = jit_gprs[g];
+                return;
+            }
+        }
+    }
+}
+
+// Picks the register file and the register of every value the trace needs.
+// Entries keep theirs through the whole loop, the values of the steps get one
+// from their step to their last use, which the exits and the jump back to the
+// loop head count as well. Fails when the registers run out.
+static bool jit_allocate(Jit_Recorder *r)
+{
+    const uint32_t end = r->steps_size;
+
+    for (uint32_t k = 0; k < r->steps_size; k++) {
+        const Jit_Step *step = &r->steps[k];
+        if (step->guard) {
+            jit_use(r, step->value, k, false);
+        } else {
+            const Jit_Value *v = &r->values[step->value];
+            bool as_float = jit_is_float_op(v->op);
+            jit_use(r, v->a, k, as_float);
+            jit_use(r, v->b, k, as_float);
+        }
+        if (step->exit == UINT32_MAX) {
+            continue;
+        }
+        const Jit_Exit *exit = &r->exits[step->exit];
+        for (uint64_t i = 0; i < exit->depth; i++) {
+            Jit_Value *v = &r->values[r->snapshots[exit->snapshot + i]];
+            if (jit_exit_stores(r, i, r->snapshots[exit->snapshot + i])) {
+                v->used = true;
+                v->last = k > v->last ? k : v->last;
+            }
+        }
+    }
+    // `r->vs` holds the values of the next iteration, which go to the
+    // registers of the entries they replace
+    for (uint64_t i = 0; i < r->entry_depth; i++) {
+        if (r->vs[i] == i) {
+            continue;
+        }
+        Jit_Value *v = &r->values[r->vs[i]];
+        v->used = true;
+        v->last = end;
+        r->values[i].used = true;
+        if (v->kind == JIT_OP) {
+            jit_use(r, i, end, jit_is_float_op(v->op));
+        }
+    }
+
+    // entries the loop changes need their register, entries it leaves
+    // alone and constants can be loaded again from the stack or from an
+    // immediate and only get one if some are left
+    uint32_t taken = 0;
+    for (size_t i = 0; i < r->values_size; i++) {
+        Jit_Value *v = &r->values[i];
+        v->xmm = v->kind == JIT_OP ? jit_is_float_op(v->op)
+                                   : v->floats > v->ints;
+        v->pinned = v->used && v->kind == JIT_ENTRY && r->vs[i] != i;
+        if (v->pinned) {
+            jit_take(v, &taken);
+            if (v->reg < 0) {
+                return false;
+            }
+        }
+    }
+
+    uint32_t ever = taken;
+    uint32_t live[JIT_TRACE_CAPACITY];
+    size_t live_size = 0;
+    for (uint32_t k = 0; k < r->steps_size; k++) {
+        size_t kept = 0;
+        for (size_t i = 0; i < live_size; i++) {
+            const Jit_Value *v = &r->values[live[i]];
+            if (v->last <= k) {
+                taken &= ~(1u << v->reg);
+            } else {
+                live[kept++] = live[i];
+            }
+        }
+        live_size = kept;
+
+        Jit_Value *v = &r->values[r->steps[k].value];
+        if (r->steps[k].guard || !v->used) {
+            continue;
+        }
+        jit_take(v, &taken);
+        if (v->reg < 0) {
+            return false;
+        }
+        ever |= taken;
+        live[live_size++] = r->steps[k].value;
+    }
+
+    // the most used first
+    uint32_t rest[JIT_VALUES_CAPACITY];
+    size_t rest_size = 0;
+    for (size_t i = 0; i < r->values_size; i++) {
+        const Jit_Value *v = &r->values[i];
+        if (!v->used || v->kind == JIT_OP || v->pinned) {
+            continue;
+        }
+        size_t j = rest_size++;
+        for (; j > 0; j--) {
+            const Jit_Value *u = &r->values[rest[j - 1]];
+            if (u->floats + u->ints >= v->floats + v->ints) {
+                break;
+            }
+            rest[j] = rest[j - 1];
+        }
+        rest[j] = i;
+    }
+    for (size_t i = 0; i < rest_size; i++) {
+        Jit_Value *v = &r->values[rest[i]];
+        jit_take(v, &ever);
+        v->pinned = v->reg >= 0;
+    }
+    return true;
+}
+
+// Loads an entry or a constant which has no register into `dst`
+static void jit_materialize(Lim_Jit *jit, const Jit_Recorder *r,
+                            uint32_t value, int dst)
+{
+    const Jit_Value *v = &r->values[value];
+    if (v->kind == JIT_ENTRY) {
+        jit_load(jit, dst, value);
+    } else {
+        jit_move_imm(jit, dst, v->constant.as_u64);
+    }
+}
+
+// The register of `value` in the register file wanted by its user, loaded
+// into `scratch` when it has none or lives in the other file
+static int jit_operand(Lim_Jit *jit, const Jit_Recorder *r, uint32_t value,
+                       bool xmm, int scratch)
+{
+    const Jit_Value *v = &r->values[value];
+    if (v->reg < 0) {
+        jit_materialize(jit, r, value, scratch);
+        return scratch;
+    }
+    if (v->xmm == xmm) {
+        return v->reg;
+    }
+    jit_move(jit, scratch, v->reg);
+    return scratch;
+}
+
+// `dst = dst op src`
+static void jit_arith_rr(Lim_Jit *jit, Inst_Type op, int dst, int src)
+{
+    if (op == INST_PLUS) {
+        jit_alu(jit, JIT_ADD, dst, src);
+    } else if (op == INST_MINUS) {
+        jit_alu(jit, JIT_SUB, dst, src);
+    } else if (op == INST_MULT) {
+        jit_imul(jit, dst, src);
+    } else if (op == INST_FPLUS) {
+        jit_sse(jit, JIT_ADDSD, dst, src);
+    } else if (op == INST_FMINUS) {
+        jit_sse(jit, JIT_SUBSD, dst, src);
+    } else if (op == INST_FMULT) {
+        jit_sse(jit, JIT_MULSD, dst, src);
+    } else {
+        jit_sse(jit, JIT_DIVSD, dst, src);
+    }
+}
+
+// `rd = ra op rb` out of two-address instructions. Only the integer ones
+// swap their operands: the float ones keep them in order, which picks the
+// NaN the interpreter gets.
+static void jit_arith(Lim_Jit *jit, Inst_Type op, int rd, int ra, int rb)
+{
+    if (rd == ra) {
+        jit_arith_rr(jit, op, rd, rb);
+    } else if (rd != rb) {
+        jit_move(jit, rd, ra);
+        jit_arith_rr(jit, op, rd, rb);
+    } else if (op == INST_PLUS || op == INST_MULT) {
+        jit_arith_rr(jit, op, rd, ra);
+    } else {
+        int tmp = JIT_IS_XMM(rd) ? XMM(13) : RAX;
+        jit_move(jit, tmp, ra);
+        jit_arith_rr(jit, op, tmp, rb);
+        jit_move(jit, rd, tmp);
+    }
+}
+
+static void jit_emit_step(Lim_Jit *jit, const Jit_Recorder *r,
+                          const Jit_Step *step)
+{
+    const Jit_Value *v = &r->values[step->value];
+    if (step->guard) {
+        int cond = jit_operand(jit, r, step->value, false, RAX);
+        jit_alu(jit, JIT_TEST, cond, cond);
+        jit_jcc_exit(jit, step->nonzero ? CC_E : CC_NE, step->exit);
+        return;
+    }
+
+    bool xmm = jit_is_float_op(v->op);
+    int ra = jit_operand(jit, r, v->a, xmm, xmm ? XMM(14) : R11);
+    int rb = jit_operand(jit, r, v->b, xmm, xmm ? XMM(15) : R10);
+    if (v->op == INST_DIV) {
+        // leave on 0 and -1, the interpreter traps or overflows on those:
+        // rb + 1 <= 1 as unsigned
+        jit_move(jit, RAX, rb);
+        jit_u8(jit, 0x48);  // add rax, 1
+        jit_u8(jit, 0x83);
+        jit_u8(jit, 0xc0);
+        jit_u8(jit, 0x01);
+        jit_u8(jit, 0x48);  // cmp rax, 1
+        jit_u8(jit, 0x83);
+        jit_u8(jit, 0xf8);
+        jit_u8(jit, 0x01);
+        jit_jcc_exit(jit, CC_BE, step->exit);
+        if (v->used) {
+            jit_move(jit, RAX, ra);
+            jit_u8(jit, 0x48);  // cqo
+            jit_u8(jit, 0x99);
+            jit_rex(jit, true, 0, rb);  // idiv rb
+            jit_u8(jit, 0xf7);
+            jit_modrm(jit, 7, rb);
+            jit_move(jit, v->reg, RAX);
+        }
+        return;
+    }
+    if (!v->used) {
+        return;
+    }
+
+    uint8_t cc = 0;
+    switch (v->op) {
+    case INST_GT:
+        cc = CC_G;
+        break;
+    case INST_LT:
+        cc = CC_L;
+        break;
+    case INST_GE:
+        cc = CC_GE;
+        break;
+    case INST_LE:
+        cc = CC_LE;
+        break;
+    case INST_EQ:
+        cc = CC_E;
+        break;
+
+    case INST_PLUS:
+    case INST_MINUS:
+    case INST_MULT:
+    case INST_FPLUS:
+    case INST_FMINUS:
+    case INST_FMULT:
+    case INST_FDIV:
+        jit_arith(jit, v->op, v->reg, ra, rb);
+        return;
+
+    case INST_NOP:
+    case INST_PUSH:
+    case INST_POP:
+    case INST_DUP:
+    case INST_DIV:
+    case INST_JMP:
+    case INST_JNZ:
+    case INST_JZ:
+    case INST_SWAP:
+    case INST_CALL:
+    case INST_RET:
+    case INST_NATIVE:
+    case INST_HALT:
+    case INST_PRINT_DEBUG:
+    case INST_LOAD_LOCAL:
+    case INST_STORE_LOCAL:
+    case INST_DROP:
+    case INST_SNAPSHOT:
+    case INST_SPAWN:
+    case INST_YIELD:
+    case INST_JOIN:
+    case INST_CHAN:
+    case INST_SEND:
+    case INST_RECV:
+    case INST_PUSH_DATA:
+    case INST_PUSH_SYM:
+    case INST_NUM:
+    default:
+        assert(0 && "jit_emit_step: not a step");
+        return;
+    }
+    // cmp ra, rb; setcc al; movzx rd, al
+    jit_alu(jit, JIT_CMP, ra, rb);
+    jit_u8(jit, 0x0f);
+    jit_u8(jit, 0x90 | cc);
+    jit_u8(jit, 0xc0);
+    jit_rex(jit, true, v->reg, RAX);
+    jit_u8(jit, 0x0f);
+    jit_u8(jit, 0xb6);
+    jit_modrm(jit, v->reg, RAX);
+}
+
+// Moves the values of the next iteration into the registers of the entries
+// as one parallel move, breaking cycles through a scratch register. Values
+// without a register are loaded last.
+static void jit_emit_back_edge(Lim_Jit *jit, const Jit_Recorder *r)
+{
+    int dsts[JIT_XMMS + ARRAY_SIZE(jit_gprs)];
+    int srcs[JIT_XMMS + ARRAY_SIZE(jit_gprs)];
+    size_t moves = 0;
+    for (uint64_t i = 0; i < r->entry_depth; i++) {
+        if (r->vs[i] != i && r->values[r->vs[i]].reg >= 0) {
+            dsts[moves] = r->values[i].reg;
+            srcs[moves] = r->values[r->vs[i]].reg;
+            moves++;
+        }
+    }
+
+    while (moves > 0) {
+        size_t ready = moves;
+        for (size_t m = 0; m < moves && ready == moves; m++) {
+            ready = m;
+            for (size_t k = 0; k < moves; k++) {
+                if (k != m && srcs[k] == dsts[m]) {
+                    ready = moves;
+                    break;
+                }
+            }
+        }
+        if (ready < moves) {
+            jit_move(jit, dsts[ready], srcs[ready]);
+            moves--;
+            dsts[ready] = dsts[moves];
+            srcs[ready] = srcs[moves];
+            continue;
+        }
+        int cycle = srcs[0];
+        int scratch = JIT_IS_XMM(cycle) ? XMM(15) : RAX;
+        jit_move(jit, scratch, cycle);
+        for (size_t k = 0; k < moves; k++) {
+            if (srcs[k] == cycle) {
+                srcs[k] = scratch;
+            }
+        }
+    }
+
+    // the rest read the stack or an immediate, which the moves leave alone
+    for (uint64_t i = 0; i < r->entry_depth; i++) {
+        if (r->vs[i] != i && r->values[r->vs[i]].reg < 0) {
+            jit_materialize(jit, r, r->vs[i], r->values[i].reg);
+        }
+    }
+}
+
+// Writes back the slots of the exit, leaves the iterations left and returns
+// the exit
+static void jit_emit_exit(Lim_Jit *jit, const Jit_Recorder *r, uint32_t exit)
+{
+    const Jit_Exit *e = &r->exits[exit];
+    for (uint64_t i = 0; i < e->depth; i++) {
+        uint32_t value = r->snapshots[e->snapshot + i];
+        if (!jit_exit_stores(r, i, value)) {
+            continue;
+        }
+        int reg = r->values[value].reg;
+        if (reg < 0) {
+            jit_materialize(jit, r, value, RAX);
+            reg = RAX;
+        }
+        jit_store(jit, i, reg);
+    }
+    jit_u8(jit, 0x4c);  // mov [rsi], r15
+    jit_u8(jit, 0x89);
+    jit_u8(jit, 0x3e);
+    jit_u8(jit, 0xb8);  // mov eax, exit
+    jit_u32(jit, exit);
+}
+
+static const int jit_saved[] = {RBX, RBP, R12, R13, R14, R15};
+
+static void jit_emit_trace(Lim_Jit *jit, const Jit_Recorder *r,
+                           uint32_t loop_exit)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(jit_saved); i++) {
+        jit_rex(jit, false, 0, jit_saved[i]);
+        jit_u8(jit, 0x50 + (jit_saved[i] & 7));
+    }
+    jit_u8(jit, 0x4c);  // mov r15, [rsi]
+    jit_u8(jit, 0x8b);
+    jit_u8(jit, 0x3e);
+    for (size_t i = 0; i < r->values_size; i++) {
+        const Jit_Value *v = &r->values[i];
+        if (v->pinned) {
+            jit_materialize(jit, r, i, v->reg);
+        }
+    }
+
+    size_t head = jit->code_size;
+    for (size_t k = 0; k < r->steps_size; k++) {
+        jit_emit_step(jit, r, &r->steps[k]);
+    }
+    jit_emit_back_edge(jit, r);
+    jit_u8(jit, 0x49);  // dec r15
+    jit_u8(jit, 0xff);
+    jit_u8(jit, 0xcf);
+    jit_u8(jit, 0x0f);  // jnz head
+    jit_u8(jit, 0x85);
+    jit_u32(jit, 0);
+    jit_patch(jit, jit->code_size - 4, head);
+
+    // out of iterations at the loop head, falls through to the epilogue
+    jit_emit_exit(jit, r, loop_exit);
+    size_t epilogue = jit->code_size;
+    for (size_t i = ARRAY_SIZE(jit_saved); i > 0; i--) {
+        jit_rex(jit, false, 0, jit_saved[i - 1]);
+        jit_u8(jit, 0x58 + (jit_saved[i - 1] & 7));
+    }
+    jit_u8(jit, 0xc3);
+
+    for (uint32_t exit = 0; exit < r->exits_size; exit++) {
+        if (exit == loop_exit) {
+            continue;
+        }
+        size_t stub = jit->code_size;
+        for (size_t i = 0; i < jit->fixups_size; i++) {
+            if (jit->fixups[i].exit == exit) {
+                jit_patch(jit, jit->fixups[i].at, stub);
+            }
+        }
+        jit_emit_exit(jit, r, exit);
+        jit_u8(jit, 0xe9);  // jmp epilogue
+        jit_u32(jit, 0);
+        jit_patch(jit, jit->code_size - 4, epilogue);
+    }
+}
+
+// Compiles the recording, which is back at its loop head
+static bool jit_compile(Lim_Jit *jit)
+{
+    Jit_Recorder *r = &jit->recorder;
+    if (!JIT_ENABLED || jit->traces_size >= JIT_TRACES_CAPACITY) {
+        return false;
+    }
+
+    // the loop head itself, as an exit with every slot as it is there
+    if (r->exits_size >= JIT_EXITS_CAPACITY ||
+        r->snapshots_size + r->entry_depth > JIT_SNAPSHOTS_CAPACITY) {
+        return false;
+    }
+    uint32_t loop_exit = r->exits_size++;
+    r->exits[loop_exit] = (Jit_Exit){
+        .ip = r->anchor,
+        .depth = r->entry_depth,
+        .snapshot = r->snapshots_size,
+    };
+    for (uint64_t i = 0; i < r->entry_depth; i++) {
+        r->snapshots[r->snapshots_size++] = i;
+    }
+
+    if (!jit_allocate(r)) {
+        return false;
+    }
+
+    if (mprotect(jit->code, JIT_CODE_CAPACITY, PROT_READ | PROT_WRITE) < 0) {
+        return false;
+    }
+    jit->code_begin = jit->code_size;
+    jit->code_overflow = false;
+    jit->fixups_size = 0;
+    jit_emit_trace(jit, r, loop_exit);
+    bool ok = !jit->code_overflow;
+    if (!ok) {
+        jit->code_size = jit->code_begin;
+    }
+    if (mprotect(jit->code, JIT_CODE_CAPACITY, PROT_READ | PROT_EXEC) < 0) {
+        return false;
+    }
+    if (!ok) {
+        return false;
+    }
+
+    Jit_Trace *trace = &jit->traces[jit->traces_size++];
+    trace->anchor = r->anchor;
+    trace->depth = r->entry_depth;
+    trace->base = r->base;
+    trace->length = r->length;
+    trace->peak = r->peak;
+    // ISO C has no conversion from object to function pointers
+    void *entry = jit->code + jit->code_begin;
+    memcpy(&trace->func, &entry, sizeof(trace->func));
+    memcpy(trace->exits, r->exits, r->exits_size * sizeof(r->exits[0]));
+    trace->exits_size = r->exits_size;
+    jit->traces_at[r->anchor] = jit->traces_size;
+    jit->stats.traces++;
+    return true;
+}
+
+/* Execution */
+
+static void jit_record(Lim_Jit *jit, const Lim *lim, Inst_Addr ip, Inst inst)
+{
+    Jit_Recorder *r = &jit->recorder;
+    if (!jit_record_inst(r, lim, ip, inst)) {
+        jit_abort(jit);
+    } else if (lim->ip == r->anchor) {
+        if (r->depth == r->entry_depth && jit_compile(jit)) {
+            r->active = false;
+        } else {
+            jit_abort(jit);
+        }
+    } else if (lim->ip < lim->program_size && jit->traces_at[lim->ip] > 0) {
+        // an inner loop has its own trace already
+        jit_abort(jit);
+    }
+}
+
+// Counts the backward jump which took the VM to `lim->ip`, recording the
+// loop it closes when hot
+static void jit_count(Lim_Jit *jit, const Lim *lim)
+{
+    Inst_Addr target = lim->ip;
+    if (!JIT_ENABLED || target >= lim->program_size ||
+        jit->traces_at[target] > 0 ||
+        jit->aborts[target] >= JIT_ABORTS_CAPACITY) {
+        return;
+    }
+    if (++jit->counters[target] >= JIT_HOT) {
+        jit->counters[target] = 0;
+        jit_record_start(jit, lim);
+    }
+}
+
+// Runs the trace at `lim->ip` if the VM is in the state it was recorded in
+// and `*fuel` pays for an iteration
+static void jit_enter(Lim_Jit *jit, Lim *lim, uint64_t *fuel)
+{
+    const Jit_Trace *trace = &jit->traces[jit->traces_at[lim->ip] - 1];
+    if (lim->stack_size != trace->depth ||
+        lim_frame_base(lim) != trace->base || *fuel < trace->length) {
+        return;
+    }
+
+    uint64_t budget = *fuel / trace->length;
+    uint64_t left = budget;
+    uint32_t exit = trace->func(lim->stack, &left);
+    const Jit_Exit *e = &trace->exits[exit];
+    uint64_t cost = (budget - left) * trace->length + e->cost;
+    lim->ip = e->ip;
+    lim->stack_size = e->depth;
+    *fuel -= cost;
+
+    Lim_Stats *stats = &lim->stats;
+    stats->instructions += cost;
+    if (trace->peak > stats->stack_peak) {
+        stats->stack_peak = trace->peak;
+    }
+    jit->stats.entries++;
+    jit->stats.iterations += budget - left;
+    if (e->ip != trace->anchor) {
+        jit->stats.exits++;
+    }
+}
+
+Trap lim_jit_execute_budget(Lim_Jit *jit, Lim *lim, uint64_t fuel)
+{
+    Lim_Stats *stats = &lim->stats;
+    Jit_Recorder *r = &jit->recorder;
+    while (!lim->halt) {
+        if (fuel == 0) {
+            return TRAP_OUT_OF_FUEL;
+        }
+        if (!r->active && lim->ip < lim->program_size &&
+            jit->traces_at[lim->ip] > 0) {
+            // at least one instruction is interpreted after a trace, which
+            // leaves it on its own exits
+            jit_enter(jit, lim, &fuel);
+            if (fuel == 0) {
+                continue;
+            }
+        }
+
+        Inst_Addr ip = lim->ip;
+        Inst inst = ip < lim->program_size ? lim->program[ip] : (Inst){0};
+        Trap trap = lim_execute_inst(lim);
+        fuel--;
+        stats->instructions++;
+        if (lim->stack_size > stats->stack_peak) {
+            stats->stack_peak = lim->stack_size;
+        }
+        if (trap != TRAP_OK) {
+            if (r->active) {
+                jit_abort(jit);
+            }
+            return trap;
+        }
+
+        if (r->active) {
+            jit_record(jit, lim, ip, inst);
+        } else if ((inst.type == INST_JMP || inst.type == INST_JNZ ||
+                    inst.type == INST_JZ) &&
+                   lim->ip <= ip) {
+            jit_count(jit, lim);
+        }
+    }
+    if (r->active) {
+        jit_abort(jit);
+    }
+
+    return TRAP_OK;
+}
+
+Trap lim_jit_execute_program(Lim_Jit *jit, Lim *lim)
+{
+    return lim_jit_execute_budget(jit, lim, UINT64_MAX);
+}
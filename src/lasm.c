@@ -1,10 +1,32 @@
 #include "lim.h"
 
+static Lim lim = {0};
+static Lasm lasm = {0};
+static Lim_Symbol symbols[LABEL_CAPACITY];
+static uint64_t symbols_size = 0;
+
+// An object assembled from the same source is left untouched, so that the
+// modules which did not change are neither reassembled nor relinked
+static bool object_up_to_date(const char *file_path, uint64_t source_hash)
+{
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    Lim_Object_Meta meta = {0};
+    size_t n = fread(&meta, sizeof(meta), 1, f);
+    fclose(f);
+    return n == 1 && meta.magic == LIM_OBJECT_MAGIC &&
+           meta.version == LIM_OBJECT_VERSION &&
+           meta.source_hash == source_hash;
+}
+
 int main(int argc, char *argv[])
 {
     const char *program = shift_args(&argc, &argv);
     const char *input_file_path = NULL;
     const char *output_file_path = NULL;
+    bool object = false;
 
     while (argc > 0) {
         const char *flag = shift_args(&argc, &argv);
@@ -21,8 +43,12 @@ int main(int argc, char *argv[])
                 return 1;
             }
             output_file_path = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-c")) {
+            object = true;
         } else if (!strcmp(flag, "-h")) {
-            fprintf(stdout, "Usage: %s -i <input.lasm> -o <output.lim> [-h]\n",
+            fprintf(stdout,
+                    "Usage: %s -i <input.lasm> -o <output.lim> [-c] [-h]\n"
+                    "  -c  emit a relocatable object for limld\n",
                     program);
             return 0;
         } else {
@@ -40,9 +66,48 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    String_View source = slurp_file(input_file_path);
-    lim_translate_source(source, &lim, &lasm);
-    lim_save_program_to_file(&lim, output_file_path);
+    String_View source = {0};
+    // built-in natives resolve the legacy `native <number>` syntax
+    lim_attach_natives(&lim);
+    if (slurp_file(&lim, input_file_path, &source) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim.error);
+        return 1;
+    }
+
+    if (object) {
+        uint64_t source_hash = lim_hash_bytes(source.data, source.count);
+        if (object_up_to_date(output_file_path, source_hash)) {
+            return 0;
+        }
+        lasm.relocatable = true;
+        if (lim_translate_source(source, &lim, &lasm) != LIM_OK ||
+            lim_save_object_to_file(&lim, &lasm, source_hash,
+                                    output_file_path) != LIM_OK) {
+            fprintf(stderr, "ERROR: %s\n", lim.error);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (lim_translate_source(source, &lim, &lasm) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim.error);
+        return 1;
+    }
+
+    // labels are kept as symbols for debuggers
+    for (size_t i = 0; i < lasm.labels_size; i++) {
+        const Label *label = &lasm.labels[i];
+        if (label->name.count < LIM_SYMBOL_NAME_CAPACITY) {
+            Lim_Symbol *symbol = &symbols[symbols_size++];
+            memcpy(symbol->name, label->name.data, label->name.count);
+            symbol->addr = label->addr;
+        }
+    }
+    if (lim_save_program_with_symbols(&lim, symbols, symbols_size,
+                                      output_file_path) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim.error);
+        return 1;
+    }
 
     return 0;
 }
@@ -1,5 +1,32 @@
+#define _DEFAULT_SOURCE
 #include "lim.h"
 
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#if defined(IORING_FEAT_FAST_POLL) && defined(SYS_io_uring_setup)
+#define LIM_HAS_IO_URING
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 const char *trap_as_cstr(Trap trap)
 {
     switch (trap) {
@@ -17,11 +44,64 @@ const char *trap_as_cstr(Trap trap)
         return "TRAP_ILLEGAL_INST_ACCESS";
     case TRAP_ILLEGAL_OPERAND:
         return "TRAP_ILLEGAL_OPERAND";
+    case TRAP_CALL_STACK_OVERFLOW:
+        return "TRAP_CALL_STACK_OVERFLOW";
+    case TRAP_CALL_STACK_UNDERFLOW:
+        return "TRAP_CALL_STACK_UNDERFLOW";
+    case TRAP_THREADS_OVERFLOW:
+        return "TRAP_THREADS_OVERFLOW";
+    case TRAP_DEADLOCK:
+        return "TRAP_DEADLOCK";
+    case TRAP_OUT_OF_FUEL:
+        return "TRAP_OUT_OF_FUEL";
+    case TRAP_SNAPSHOT_FAILED:
+        return "TRAP_SNAPSHOT_FAILED";
     default:
         assert(0 && "trap_as_cstr: unreachable");
     }
 }
 
+const char *lim_error_as_cstr(Lim_Error error)
+{
+    switch (error) {
+    case LIM_OK:
+        return "LIM_OK";
+    case LIM_ERROR_IO:
+        return "LIM_ERROR_IO";
+    case LIM_ERROR_FORMAT:
+        return "LIM_ERROR_FORMAT";
+    case LIM_ERROR_CAPACITY:
+        return "LIM_ERROR_CAPACITY";
+    case LIM_ERROR_SYNTAX:
+        return "LIM_ERROR_SYNTAX";
+    case LIM_ERROR_NATIVE:
+        return "LIM_ERROR_NATIVE";
+    case LIM_ERROR_MEMORY:
+        return "LIM_ERROR_MEMORY";
+    default:
+        assert(0 && "lim_error_as_cstr: unreachable");
+    }
+}
+
+static Lim_Error lim_vfail(Lim *lim,
+                           Lim_Error error,
+                           const char *fmt,
+                           va_list args)
+{
+    vsnprintf(lim->error, sizeof(lim->error), fmt, args);
+    return error;
+}
+
+// Leave the message of `error` in `lim->error` for the host and return it
+static Lim_Error lim_fail(Lim *lim, Lim_Error error, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    lim_vfail(lim, error, fmt, args);
+    va_end(args);
+    return error;
+}
+
 const char *inst_type_as_cstr(Inst_Type type)
 {
     switch (type) {
@@ -77,6 +157,30 @@ const char *inst_type_as_cstr(Inst_Type type)
         return "halt";
     case INST_PRINT_DEBUG:
         return "print_debug";
+    case INST_LOAD_LOCAL:
+        return "load_local";
+    case INST_STORE_LOCAL:
+        return "store_local";
+    case INST_DROP:
+        return "drop";
+    case INST_SNAPSHOT:
+        return "snapshot";
+    case INST_SPAWN:
+        return "spawn";
+    case INST_YIELD:
+        return "yield";
+    case INST_JOIN:
+        return "join";
+    case INST_CHAN:
+        return "chan";
+    case INST_SEND:
+        return "send";
+    case INST_RECV:
+        return "recv";
+    case INST_PUSH_DATA:
+        return "push_data";
+    case INST_PUSH_SYM:
+        return "push_sym";
     case INST_NUM:
     default:
         assert(false && "unreachable");
@@ -94,6 +198,12 @@ bool inst_has_operand(Inst_Type type)
     case INST_SWAP:
     case INST_CALL:
     case INST_NATIVE:
+    case INST_LOAD_LOCAL:
+    case INST_STORE_LOCAL:
+    case INST_DROP:
+    case INST_SPAWN:
+    case INST_PUSH_DATA:
+    case INST_PUSH_SYM:
         return true;
 
     case INST_NOP:
@@ -114,6 +224,12 @@ bool inst_has_operand(Inst_Type type)
     case INST_RET:
     case INST_HALT:
     case INST_PRINT_DEBUG:
+    case INST_SNAPSHOT:
+    case INST_YIELD:
+    case INST_JOIN:
+    case INST_CHAN:
+    case INST_SEND:
+    case INST_RECV:
         return false;
 
     case INST_NUM:
@@ -220,24 +336,500 @@ int label_table_find(const Lasm *lasm, String_View label)
     return -1;
 }
 
-void label_table_push(Lasm *lasm, String_View label, Inst_Addr addr)
+bool label_table_push(Lasm *lasm, String_View label, Inst_Addr addr)
 {
-    assert(lasm->labels_size < LABEL_CAPACITY);
+    if (lasm->labels_size >= LABEL_CAPACITY) {
+        return false;
+    }
     lasm->labels[lasm->labels_size++] = (Label){
         .name = label,
         .addr = addr,
     };
+    return true;
 }
 
-void label_table_push_unresolved_jmp(Lasm *lasm,
+bool label_table_push_unresolved_jmp(Lasm *lasm,
                                      Inst_Addr addr,
                                      String_View label)
 {
-    assert(lasm->unresolved_jmps_size < LABEL_CAPACITY);
+    if (lasm->unresolved_jmps_size >= UNRESOLVED_JMPS_CAPACITY) {
+        return false;
+    }
     lasm->unresolved_jmps[lasm->unresolved_jmps_size++] = (Unresolved_Jmp){
         .addr = addr,
         .label = label,
     };
+    return true;
+}
+
+uint64_t lim_frame_base(const Lim *lim)
+{
+    return lim->frames_size > 0 ? lim->frames[lim->frames_size - 1].base : 0;
+}
+
+// Green threads are scheduled cooperatively: a thread runs until it yields,
+// blocks on `join`/`send`/`recv` or is done, then the first ready thread is
+// switched in. Switching copies the live part of the stacks, which is small
+// for the typical task, and involves no system call.
+static bool lim_threads_init(Lim *lim)
+{
+    if (lim->threads == NULL) {
+        lim->threads = calloc(LIM_THREADS_CAPACITY, sizeof(lim->threads[0]));
+        lim->channels =
+            calloc(LIM_CHANNELS_CAPACITY, sizeof(lim->channels[0]));
+        if (lim->threads == NULL || lim->channels == NULL) {
+            free(lim->threads);
+            free(lim->channels);
+            lim->threads = NULL;
+            lim->channels = NULL;
+            return false;
+        }
+        lim->threads_size = 1;
+        lim->thread = 0;
+    }
+    return true;
+}
+
+static void lim_queue_push(Lim *lim, Lim_Queue *queue, uint64_t id)
+{
+    lim->threads[id].next = 0;
+    if (queue->tail == 0) {
+        queue->head = id + 1;
+    } else {
+        lim->threads[queue->tail - 1].next = id + 1;
+    }
+    queue->tail = id + 1;
+}
+
+static bool lim_queue_pop(Lim *lim, Lim_Queue *queue, uint64_t *id)
+{
+    if (queue->head == 0) {
+        return false;
+    }
+    *id = queue->head - 1;
+    queue->head = lim->threads[*id].next;
+    if (queue->head == 0) {
+        queue->tail = 0;
+    }
+    return true;
+}
+
+static bool lim_thread_reserve(Lim_Thread *thread, uint64_t size)
+{
+    if (size <= thread->capacity) {
+        return true;
+    }
+    uint64_t capacity = thread->capacity > 0 ? thread->capacity : 4;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+    Word *stack = realloc(thread->stack, sizeof(stack[0]) * capacity);
+    if (stack == NULL) {
+        return false;
+    }
+    thread->stack = stack;
+    Lim_Frame *frames = realloc(thread->frames, sizeof(frames[0]) * capacity);
+    if (frames == NULL) {
+        return false;
+    }
+    thread->frames = frames;
+    thread->capacity = capacity;
+    return true;
+}
+
+static bool lim_thread_save(Lim *lim)
+{
+    Lim_Thread *thread = &lim->threads[lim->thread];
+    if (!lim_thread_reserve(thread, lim->stack_size > lim->frames_size
+                                        ? lim->stack_size
+                                        : lim->frames_size)) {
+        return false;
+    }
+    memcpy(thread->stack, lim->stack, sizeof(lim->stack[0]) * lim->stack_size);
+    thread->stack_size = lim->stack_size;
+    memcpy(thread->frames, lim->frames,
+           sizeof(lim->frames[0]) * lim->frames_size);
+    thread->frames_size = lim->frames_size;
+    thread->ip = lim->ip;
+    return true;
+}
+
+// The current thread has to be saved or done
+static Trap lim_thread_switch(Lim *lim)
+{
+    uint64_t id;
+    if (!lim_queue_pop(lim, &lim->ready, &id)) {
+        return TRAP_DEADLOCK;
+    }
+    const Lim_Thread *thread = &lim->threads[id];
+    memcpy(lim->stack, thread->stack,
+           sizeof(lim->stack[0]) * thread->stack_size);
+    lim->stack_size = thread->stack_size;
+    memcpy(lim->frames, thread->frames,
+           sizeof(lim->frames[0]) * thread->frames_size);
+    lim->frames_size = thread->frames_size;
+    lim->ip = thread->ip;
+    lim->thread = id;
+    return TRAP_OK;
+}
+
+static void lim_thread_wake(Lim *lim, Lim_Queue *queue)
+{
+    uint64_t id;
+    if (lim_queue_pop(lim, queue, &id)) {
+        lim->threads[id].state = THREAD_READY;
+        lim_queue_push(lim, &lim->ready, id);
+    }
+}
+
+// Park the current thread on `queue`, it runs the blocking instruction again
+// once woken up
+static Trap lim_thread_block(Lim *lim, Lim_Queue *queue)
+{
+    if (lim->threads == NULL) {
+        return TRAP_DEADLOCK;
+    }
+    if (!lim_thread_save(lim)) {
+        return TRAP_THREADS_OVERFLOW;
+    }
+    lim->threads[lim->thread].state = THREAD_BLOCKED;
+    lim_queue_push(lim, queue, lim->thread);
+    return lim_thread_switch(lim);
+}
+
+static void lim_thread_release(Lim *lim, uint64_t id)
+{
+    lim->threads[id].state = THREAD_FREE;
+    lim->threads[id].next = lim->threads_free;
+    lim->threads_free = id + 1;
+}
+
+// The result of a thread is the top of its stack when it is done. The
+// threads blocked in `join` get it right away and the id is free again,
+// otherwise the first `join` frees it.
+static Trap lim_thread_exit(Lim *lim)
+{
+    Lim_Thread *thread = &lim->threads[lim->thread];
+    thread->result = lim->stack_size > 0 ? lim->stack[lim->stack_size - 1]
+                                         : (Word){.as_u64 = 0};
+    thread->state = THREAD_DONE;
+    free(thread->stack);
+    free(thread->frames);
+    thread->stack = NULL;
+    thread->frames = NULL;
+    thread->capacity = 0;
+    if (thread->joiners.head != 0) {
+        uint64_t id;
+        while (lim_queue_pop(lim, &thread->joiners, &id)) {
+            Lim_Thread *joiner = &lim->threads[id];
+            joiner->stack[joiner->stack_size - 1] = thread->result;
+            joiner->ip++;
+            joiner->state = THREAD_READY;
+            lim_queue_push(lim, &lim->ready, id);
+        }
+        lim_thread_release(lim, lim->thread);
+    }
+    return lim_thread_switch(lim);
+}
+
+static void lim_threads_free(Lim *lim)
+{
+    for (uint64_t i = 0; i < lim->threads_size; i++) {
+        free(lim->threads[i].stack);
+        free(lim->threads[i].frames);
+    }
+    for (uint64_t i = 0; i < lim->channels_size; i++) {
+        free(lim->channels[i].items);
+    }
+    free(lim->threads);
+    free(lim->channels);
+    lim->threads = NULL;
+    lim->threads_size = 0;
+    lim->threads_free = 0;
+    lim->thread = 0;
+    lim->ready = (Lim_Queue){0};
+    lim->channels = NULL;
+    lim->channels_size = 0;
+    lim->channels_free = 0;
+}
+
+// [channel] -> [], its id goes to the next `chan`. Threads must not be
+// blocked on it.
+static Trap lim_chan_free(Lim *lim)
+{
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    uint64_t id = lim->stack[lim->stack_size - 1].as_u64;
+    if (lim->channels == NULL || id >= lim->channels_size) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    Lim_Channel *channel = &lim->channels[id];
+    if (channel->capacity == 0 || channel->senders.head != 0 ||
+        channel->receivers.head != 0) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    free(channel->items);
+    *channel = (Lim_Channel){.head = lim->channels_free};
+    lim->channels_free = id + 1;
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static bool lim_resource_add(Lim *lim,
+                             Lim_Resource_Type type,
+                             Word handle,
+                             uint64_t size)
+{
+    if (lim->resources_size >= lim->resources_capacity) {
+        uint64_t capacity =
+            lim->resources_capacity > 0 ? lim->resources_capacity * 2 : 16;
+        Lim_Resource *resources =
+            realloc(lim->resources, sizeof(resources[0]) * capacity);
+        if (resources == NULL) {
+            return false;
+        }
+        lim->resources = resources;
+        lim->resources_capacity = capacity;
+    }
+    lim->resources[lim->resources_size++] = (Lim_Resource){
+        .type = type,
+        .handle = handle,
+        .size = size,
+    };
+    return true;
+}
+
+// The program releases it itself. Handles the program got elsewhere, e.g.
+// fds passed in by the host, are not tracked.
+static void lim_resource_remove(Lim *lim, Lim_Resource_Type type, Word handle)
+{
+    for (uint64_t i = lim->resources_size; i > 0; i--) {
+        Lim_Resource *resource = &lim->resources[i - 1];
+        if (resource->type == type &&
+            resource->handle.as_u64 == handle.as_u64) {
+            *resource = lim->resources[--lim->resources_size];
+            return;
+        }
+    }
+}
+
+// The I/O queues go first, requests in flight may still use the files and
+// the heap
+static void lim_resources_free(Lim *lim)
+{
+    for (uint64_t i = 0; i < lim->resources_size; i++) {
+        if (lim->resources[i].type == LIM_RESOURCE_IO) {
+            lim_io_destroy(lim->resources[i].handle.as_ptr);
+        }
+    }
+    for (uint64_t i = 0; i < lim->resources_size; i++) {
+        const Lim_Resource *resource = &lim->resources[i];
+        switch (resource->type) {
+        case LIM_RESOURCE_FILE:
+            close(resource->handle.as_i64);
+            break;
+        case LIM_RESOURCE_MAP:
+            munmap(resource->handle.as_ptr, resource->size);
+            break;
+        case LIM_RESOURCE_SCAN:
+            free(resource->handle.as_ptr);
+            break;
+        case LIM_RESOURCE_IO:
+            break;
+        }
+    }
+    free(lim->resources);
+    lim->resources = NULL;
+    lim->resources_size = 0;
+    lim->resources_capacity = 0;
+}
+
+static void lim_unmap_data(Lim *lim)
+{
+    if (lim->data_map != NULL) {
+        munmap(lim->data_map, lim->data_map_size);
+    }
+    lim->data_map = NULL;
+    lim->data_map_size = 0;
+    lim->data = NULL;
+    lim->data_size = 0;
+}
+
+// Copy the data of a program the VM builds itself into a read-only mapping
+// of its own
+static Lim_Error lim_map_data(Lim *lim, const void *data, uint64_t size)
+{
+    lim_unmap_data(lim);
+    if (size == 0) {
+        return LIM_OK;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return lim_fail(lim, LIM_ERROR_MEMORY,
+                        "Could not map %lu bytes of data: %s", size,
+                        strerror(errno));
+    }
+    memcpy(map, data, size);
+    mprotect(map, size, PROT_READ);
+    lim->data = map;
+    lim->data_size = size;
+    lim->data_map = map;
+    lim->data_map_size = size;
+    return LIM_OK;
+}
+
+static void lim_clear_interned(Lim *lim)
+{
+    lim->interned_size = 0;
+    lim->interned_program = 0;
+    memset(lim->interned_index, 0, sizeof(lim->interned_index));
+}
+
+// Symbols are found by the hash of their name with linear probing, the
+// index has twice the slots of the table so probes stay short
+static Lim_Error lim_intern_symbol(Lim *lim, String_View name, uint64_t *symbol)
+{
+    const uint64_t mask = LIM_INTERNED_CAPACITY * 2 - 1;
+    uint64_t i = lim_hash_bytes(name.data, name.count) & mask;
+    for (; lim->interned_index[i] != 0; i = (i + 1) & mask) {
+        const char *interned = lim->interned[lim->interned_index[i] - 1];
+        if (strlen(interned) == name.count &&
+            memcmp(interned, name.data, name.count) == 0) {
+            *symbol = lim->interned_index[i] - 1;
+            return LIM_OK;
+        }
+    }
+
+    if (name.count == 0 || name.count >= LIM_INTERNED_NAME_CAPACITY ||
+        memchr(name.data, '\0', name.count) != NULL) {
+        return lim_fail(lim, LIM_ERROR_SYNTAX, "invalid symbol `%.*s`",
+                        (int) name.count, name.data);
+    }
+    if (lim->interned_size >= LIM_INTERNED_CAPACITY) {
+        return lim_fail(lim, LIM_ERROR_CAPACITY, "too many symbols");
+    }
+    memcpy(lim->interned[lim->interned_size], name.data, name.count);
+    lim->interned[lim->interned_size][name.count] = '\0';
+    lim->interned_index[i] = lim->interned_size + 1;
+    *symbol = lim->interned_size++;
+    return LIM_OK;
+}
+
+Lim_Error lim_intern(Lim *lim, String_View name, uint64_t *symbol)
+{
+    Lim_Error error = lim_intern_symbol(lim, name, symbol);
+    lim->interned_program = lim->interned_size;
+    return error;
+}
+
+// Drop the symbols interned while the program ran, the newest first: no
+// probe of an older symbol goes through the slot of a newer one
+static void lim_truncate_interned(Lim *lim)
+{
+    const uint64_t mask = LIM_INTERNED_CAPACITY * 2 - 1;
+    while (lim->interned_size > lim->interned_program) {
+        const uint64_t symbol = --lim->interned_size;
+        const char *name = lim->interned[symbol];
+        uint64_t i = lim_hash_bytes(name, strlen(name)) & mask;
+        while (lim->interned_index[i] != symbol + 1) {
+            i = (i + 1) & mask;
+        }
+        lim->interned_index[i] = 0;
+    }
+}
+
+const char *lim_interned_name(const Lim *lim, uint64_t symbol)
+{
+    return symbol < lim->interned_size ? lim->interned[symbol] : NULL;
+}
+
+// Intern the names of a symbol table in order, so symbol N of the table is
+// symbol N of the VM
+static Lim_Error lim_intern_table(Lim *lim,
+                                  const uint8_t *names,
+                                  uint64_t names_size)
+{
+    lim_clear_interned(lim);
+    for (uint64_t i = 0; i < names_size; i++) {
+        const char *name =
+            (const char *) names + i * LIM_INTERNED_NAME_CAPACITY;
+        uint64_t symbol = 0;
+        Lim_Error error = lim_intern(
+            lim,
+            (String_View){
+                .count = strnlen(name, LIM_INTERNED_NAME_CAPACITY),
+                .data = name,
+            },
+            &symbol);
+        if (error != LIM_OK) {
+            return error;
+        }
+        if (symbol != i) {
+            return lim_fail(lim, LIM_ERROR_FORMAT, "symbol `%s` is repeated",
+                            lim->interned[symbol]);
+        }
+    }
+    return LIM_OK;
+}
+
+Lim *lim_create(void)
+{
+    return calloc(1, sizeof(Lim));
+}
+
+void lim_destroy(Lim *lim)
+{
+    if (lim == NULL) {
+        return;
+    }
+    lim_resources_free(lim);
+    lim_threads_free(lim);
+    if (lim->heap.base != NULL) {
+        munmap(lim->heap.base, LIM_HEAP_CAPACITY);
+    }
+    lim_unmap_data(lim);
+    free(lim);
+}
+
+// The heap stays mapped for the next run, only its blocks are given up
+void lim_reset(Lim *lim)
+{
+    lim_resources_free(lim);
+    lim_threads_free(lim);
+    lim_truncate_interned(lim);
+    lim->heap.size = 0;
+    lim->heap.free = NULL;
+    lim->stack_size = 0;
+    lim->frames_size = 0;
+    lim->ip = 0;
+    lim->halt = false;
+    lim->error[0] = '\0';
+    memset(&lim->stats, 0, sizeof(lim->stats));
+}
+
+Trap lim_push_word(Lim *lim, Word word)
+{
+    if (lim->stack_size >= LIM_STACK_CAPACITY) {
+        return TRAP_STACK_OVERFLOW;
+    }
+    lim->stack[lim->stack_size++] = word;
+    return TRAP_OK;
+}
+
+Trap lim_pop_word(Lim *lim, Word *word)
+{
+    if (lim->stack_size == 0) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    *word = lim->stack[--lim->stack_size];
+    return TRAP_OK;
+}
+
+static FILE *lim_output(const Lim *lim)
+{
+    return lim->output != NULL ? lim->output : stdout;
 }
 
 Trap lim_execute_inst(Lim *lim)
@@ -473,32 +1065,41 @@ Trap lim_execute_inst(Lim *lim)
         break;
 
     case INST_CALL:
-        if (lim->stack_size >= LIM_STACK_CAPACITY) {
-            return TRAP_STACK_OVERFLOW;
+        if (lim->frames_size >= LIM_FRAMES_CAPACITY) {
+            return TRAP_CALL_STACK_OVERFLOW;
         }
-        lim->stack[lim->stack_size++].as_u64 = lim->ip + 1;
+        lim->frames[lim->frames_size++] = (Lim_Frame){
+            .ret = lim->ip + 1,
+            .base = lim->stack_size,
+        };
         lim->ip = inst.operand.as_u64;
+        lim->stats.calls++;
         break;
 
     case INST_RET:
         // Calling Convention: after return from function call, the return value
         // (if exists) should store in the top of stack.
-        if (lim->stack_size < 1) {
-            return TRAP_STACK_UNDERFLOW;
+        if (lim->frames_size < 1) {
+            // a spawned thread returning from its entry point is done
+            if (lim->thread != 0) {
+                return lim_thread_exit(lim);
+            }
+            return TRAP_CALL_STACK_UNDERFLOW;
         }
-        lim->ip = lim->stack[--lim->stack_size].as_u64;
+        lim->ip = lim->frames[--lim->frames_size].ret;
+        lim->stats.returns++;
         break;
 
-    case INST_NATIVE:
-        if (inst.operand.as_u64 >= lim->natives_size) {
-            return TRAP_ILLEGAL_OPERAND;
-        }
-        Trap trap = lim->natives[inst.operand.as_u64](lim);
+    case INST_NATIVE: {
+        // The operand was checked against the import table when the program
+        // was loaded, imports which were never bound trap by themselves.
+        lim->stats.native_calls[inst.operand.as_u64]++;
+        Trap trap = lim->imports[inst.operand.as_u64].func(lim);
         if (trap != TRAP_OK) {
             return trap;
         }
         lim->ip++;
-        break;
+    } break;
 
     case INST_HALT:
         lim->halt = true;
@@ -509,395 +1110,5262 @@ Trap lim_execute_inst(Lim *lim)
             return TRAP_STACK_UNDERFLOW;
         }
         Word word = lim->stack[--lim->stack_size];
-        printf("%lu %ld %lf %p\n", word.as_u64, word.as_i64, word.as_f64,
-               word.as_ptr);
+        fprintf(lim_output(lim), "%lu %ld %lf %p\n", word.as_u64, word.as_i64,
+                word.as_f64, word.as_ptr);
         lim->ip++;
         break;
 
-    case INST_NUM:
-    default:
-        return TRAP_ILLEGAL_INST;
-    }
-    return TRAP_OK;
-}
-
-Trap lim_execute_program(Lim *lim)
-{
-    while (!lim->halt) {
-        Trap trap = lim_execute_inst(lim);
-        if (trap != TRAP_OK) {
-            return trap;
+    case INST_LOAD_LOCAL: {
+        // The operand is a signed offset about the frame base, which is 0
+        // outside of any function call.
+        if (lim->stack_size >= LIM_STACK_CAPACITY) {
+            return TRAP_STACK_OVERFLOW;
         }
-    }
+        uint64_t slot = lim_frame_base(lim) + inst.operand.as_u64;
+        if (slot >= lim->stack_size) {
+            return TRAP_ILLEGAL_OPERAND;
+        }
+        lim->stack[lim->stack_size++] = lim->stack[slot];
+        lim->ip++;
+    } break;
 
-    return TRAP_OK;
-}
+    case INST_STORE_LOCAL: {
+        if (lim->stack_size < 1) {
+            return TRAP_STACK_UNDERFLOW;
+        }
+        uint64_t slot = lim_frame_base(lim) + inst.operand.as_u64;
+        if (slot >= lim->stack_size - 1) {
+            return TRAP_ILLEGAL_OPERAND;
+        }
+        lim->stack[slot] = lim->stack[--lim->stack_size];
+        lim->ip++;
+    } break;
 
-void lim_load_program_from_memory(Lim *lim,
-                                  Inst *program,
-                                  uint64_t program_size)
-{
-    assert(program_size <= LIM_PROGRAM_CAPACITY);
+    case INST_DROP:
+        // Discard `operand` words below the top of stack, e.g. the arguments
+        // under the return value of a function.
+        if (lim->stack_size <= inst.operand.as_u64) {
+            return TRAP_STACK_UNDERFLOW;
+        }
+        lim->stack[lim->stack_size - 1 - inst.operand.as_u64] =
+            lim->stack[lim->stack_size - 1];
+        lim->stack_size -= inst.operand.as_u64;
+        lim->ip++;
+        break;
 
-    memcpy(lim->program, program, sizeof(program[0]) * program_size);
-    lim->program_size = program_size;
-}
+    case INST_SNAPSHOT:
+        // resumes after the instruction, so a restored VM does not snapshot
+        // itself again
+        lim->ip++;
+        if (lim->snapshot_file_path != NULL &&
+            lim_save_snapshot(lim, lim->snapshot_file_path) != LIM_OK) {
+            return TRAP_SNAPSHOT_FAILED;
+        }
+        break;
 
-void lim_load_program_from_file(Lim *lim, const char *file_path)
-{
-    FILE *f = fopen(file_path, "rb");
-    if (f == NULL) {
-        fprintf(stderr, "ERROR: Counld not open file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
-    }
+    case INST_SPAWN: {
+        // [arg] -> [thread], the new thread starts with [arg] on its stack
+        if (lim->stack_size < 1) {
+            return TRAP_STACK_UNDERFLOW;
+        }
+        if (!lim_threads_init(lim) ||
+            (lim->threads_free == 0 &&
+             lim->threads_size >= LIM_THREADS_CAPACITY)) {
+            return TRAP_THREADS_OVERFLOW;
+        }
+        uint64_t id = lim->threads_free > 0 ? lim->threads_free - 1
+                                            : lim->threads_size;
+        Lim_Thread *thread = &lim->threads[id];
+        if (!lim_thread_reserve(thread, 1)) {
+            return TRAP_THREADS_OVERFLOW;
+        }
+        if (id == lim->threads_size) {
+            lim->threads_size++;
+        } else {
+            lim->threads_free = thread->next;
+        }
+        thread->state = THREAD_READY;
+        thread->ip = inst.operand.as_u64;
+        thread->stack[0] = lim->stack[lim->stack_size - 1];
+        thread->stack_size = 1;
+        thread->frames_size = 0;
+        lim_queue_push(lim, &lim->ready, id);
 
-    if (fseek(f, 0, SEEK_END) < 0) {
-        fprintf(stderr, "ERROR: Counld not read file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
-    }
+        lim->stack[lim->stack_size - 1].as_u64 = id;
+        lim->ip++;
+    } break;
 
-    long m = ftell(f);
-    if (m < 0) {
-        fprintf(stderr, "ERROR: Counld not read file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
-    }
+    case INST_YIELD:
+        lim->ip++;
+        if (lim->ready.head != 0) {
+            if (!lim_thread_save(lim)) {
+                return TRAP_THREADS_OVERFLOW;
+            }
+            lim_queue_push(lim, &lim->ready, lim->thread);
+            return lim_thread_switch(lim);
+        }
+        break;
 
-    assert(m % sizeof(lim->program[0]) == 0);
-    assert((size_t) m <= LIM_PROGRAM_CAPACITY * sizeof(lim->program[0]));
+    case INST_JOIN: {
+        // [thread] -> [result], blocks until the thread is done
+        if (lim->stack_size < 1) {
+            return TRAP_STACK_UNDERFLOW;
+        }
+        uint64_t id = lim->stack[lim->stack_size - 1].as_u64;
+        if (lim->threads == NULL || id >= lim->threads_size ||
+            lim->threads[id].state == THREAD_FREE) {
+            return TRAP_ILLEGAL_OPERAND;
+        }
+        if (lim->threads[id].state != THREAD_DONE) {
+            return lim_thread_block(lim, &lim->threads[id].joiners);
+        }
+        lim->stack[lim->stack_size - 1] = lim->threads[id].result;
+        lim_thread_release(lim, id);
+        lim->ip++;
+    } break;
 
-    if (fseek(f, 0, SEEK_SET) < 0) {
-        fprintf(stderr, "ERROR: Counld not read file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
-    }
+    case INST_CHAN: {
+        // [capacity] -> [channel], a channel buffers at least one word
+        if (lim->stack_size < 1) {
+            return TRAP_STACK_UNDERFLOW;
+        }
+        if (!lim_threads_init(lim) ||
+            (lim->channels_free == 0 &&
+             lim->channels_size >= LIM_CHANNELS_CAPACITY)) {
+            return TRAP_THREADS_OVERFLOW;
+        }
+        uint64_t capacity = lim->stack[lim->stack_size - 1].as_u64;
+        if (capacity == 0) {
+            capacity = 1;
+        }
+        if (capacity > SIZE_MAX / sizeof(Word)) {
+            return TRAP_THREADS_OVERFLOW;
+        }
+        Word *items = malloc(sizeof(items[0]) * capacity);
+        if (items == NULL) {
+            return TRAP_THREADS_OVERFLOW;
+        }
+        uint64_t id = lim->channels_free > 0 ? lim->channels_free - 1
+                                             : lim->channels_size++;
+        Lim_Channel *channel = &lim->channels[id];
+        if (id + 1 == lim->channels_free) {
+            lim->channels_free = channel->head;
+        }
+        *channel = (Lim_Channel){.items = items, .capacity = capacity};
+        lim->stack[lim->stack_size - 1].as_u64 = id;
+        lim->ip++;
+    } break;
 
-    lim->program_size = fread(lim->program, sizeof(lim->program[0]),
-                              m / sizeof(lim->program[0]), f);
+    case INST_SEND: {
+        // [channel value] -> [], blocks while the channel is full
+        if (lim->stack_size < 2) {
+            return TRAP_STACK_UNDERFLOW;
+        }
+        uint64_t id = lim->stack[lim->stack_size - 2].as_u64;
+        if (lim->channels == NULL || id >= lim->channels_size ||
+            lim->channels[id].capacity == 0) {
+            return TRAP_ILLEGAL_OPERAND;
+        }
+        Lim_Channel *channel = &lim->channels[id];
+        if (channel->size == channel->capacity) {
+            return lim_thread_block(lim, &channel->senders);
+        }
+        channel->items[(channel->head + channel->size++) % channel->capacity] =
+            lim->stack[lim->stack_size - 1];
+        lim->stack_size -= 2;
+        lim->ip++;
+        lim_thread_wake(lim, &channel->receivers);
+    } break;
 
+    case INST_RECV: {
+        // [channel] -> [value], blocks while the channel is empty
+        if (lim->stack_size < 1) {
+            return TRAP_STACK_UNDERFLOW;
+        }
+        uint64_t id = lim->stack[lim->stack_size - 1].as_u64;
+        if (lim->channels == NULL || id >= lim->channels_size ||
+            lim->channels[id].capacity == 0) {
+            return TRAP_ILLEGAL_OPERAND;
+        }
+        Lim_Channel *channel = &lim->channels[id];
+        if (channel->size == 0) {
+            return lim_thread_block(lim, &channel->receivers);
+        }
+        lim->stack[lim->stack_size - 1] = channel->items[channel->head];
+        channel->head = (channel->head + 1) % channel->capacity;
+        channel->size--;
+        lim->ip++;
+        lim_thread_wake(lim, &channel->senders);
+    } break;
+
+    case INST_PUSH_DATA:
+        // the operand was checked against the data when the program was
+        // loaded
+        if (lim->stack_size >= LIM_STACK_CAPACITY) {
+            return TRAP_STACK_OVERFLOW;
+        }
+        lim->stack[lim->stack_size++].as_ptr =
+            (void *) (lim->data + inst.operand.as_u64);
+        lim->ip++;
+        break;
+
+    case INST_PUSH_SYM:
+        // a symbol is its number, so symbols compare with `eq`
+        if (lim->stack_size >= LIM_STACK_CAPACITY) {
+            return TRAP_STACK_OVERFLOW;
+        }
+        lim->stack[lim->stack_size++] = inst.operand;
+        lim->ip++;
+        break;
+
+    case INST_NUM:
+    default:
+        return TRAP_ILLEGAL_INST;
+    }
+    return TRAP_OK;
+}
+
+Trap lim_execute_program(Lim *lim)
+{
+    Lim_Stats *stats = &lim->stats;
+    while (!lim->halt) {
+        Trap trap = lim_execute_inst(lim);
+        stats->instructions++;
+        if (lim->stack_size > stats->stack_peak) {
+            stats->stack_peak = lim->stack_size;
+        }
+        if (trap != TRAP_OK) {
+            return trap;
+        }
+    }
+
+    return TRAP_OK;
+}
+
+// Fuel is charged per basic block: a block which starts with fuel left runs
+// until it transfers control, then its length is taken off. The VM stays
+// resumable after `TRAP_OUT_OF_FUEL`.
+Trap lim_execute_budget(Lim *lim, uint64_t fuel)
+{
+    Lim_Stats *stats = &lim->stats;
+    while (!lim->halt) {
+        if (fuel == 0) {
+            return TRAP_OUT_OF_FUEL;
+        }
+
+        uint64_t cost = 0;
+        Inst_Addr ip;
+        do {
+            ip = lim->ip;
+            Trap trap = lim_execute_inst(lim);
+            cost++;
+            if (lim->stack_size > stats->stack_peak) {
+                stats->stack_peak = lim->stack_size;
+            }
+            if (trap != TRAP_OK) {
+                stats->instructions += cost;
+                return trap;
+            }
+        } while (!lim->halt && lim->ip == ip + 1);
+        fuel -= cost < fuel ? cost : fuel;
+        stats->instructions += cost;
+    }
+
+    return TRAP_OK;
+}
+
+// Imports point here until `lim_bind_natives` resolves them, which fails the
+// load on a name that no native is registered under. A host that runs a
+// program without binding it gets a trap instead of a wild call.
+static Trap lim_native_unbound(Lim *lim)
+{
+    (void) lim;
+    return TRAP_ILLEGAL_OPERAND;
+}
+
+// Every `native` operand has to index the import table, every `push_data`
+// operand has to point into the data and every `push_sym` operand has to be
+// a symbol, so the interpreter can use them without a bounds check.
+static Lim_Error lim_verify_program(Lim *lim)
+{
+    for (uint64_t i = 0; i < lim->program_size; i++) {
+        if (lim->program[i].type == INST_NATIVE &&
+            lim->program[i].operand.as_u64 >= lim->imports_size) {
+            return lim_fail(lim, LIM_ERROR_NATIVE,
+                            "native %lu at address %lu is not in the import "
+                            "table",
+                            lim->program[i].operand.as_u64, i);
+        }
+        if (lim->program[i].type == INST_PUSH_DATA &&
+            lim->program[i].operand.as_u64 > lim->data_size) {
+            return lim_fail(lim, LIM_ERROR_FORMAT,
+                            "data offset %lu at address %lu is out of the "
+                            "%lu bytes of data",
+                            lim->program[i].operand.as_u64, i,
+                            lim->data_size);
+        }
+        if (lim->program[i].type == INST_PUSH_SYM &&
+            lim->program[i].operand.as_u64 >= lim->interned_size) {
+            return lim_fail(lim, LIM_ERROR_FORMAT,
+                            "symbol %lu at address %lu is not in the symbol "
+                            "table",
+                            lim->program[i].operand.as_u64, i);
+        }
+    }
+    return LIM_OK;
+}
+
+// The import table, the symbols and the data are kept, fill them in first
+Lim_Error lim_load_program_from_memory(Lim *lim,
+                                       const Inst *program,
+                                       uint64_t program_size)
+{
+    if (program_size > LIM_PROGRAM_CAPACITY) {
+        return lim_fail(lim, LIM_ERROR_CAPACITY,
+                        "program of %lu instructions is too big to load",
+                        program_size);
+    }
+
+    memcpy(lim->program, program, sizeof(program[0]) * program_size);
+    lim->program_size = program_size;
+    return lim_verify_program(lim);
+}
+
+// Everything but the data, which is left to the caller. `data` of the image
+// is `data_size` bytes at `data_offset`.
+static Lim_Error lim_load_image(Lim *lim,
+                                const uint8_t *bytes,
+                                size_t size,
+                                Lim_File_Meta *meta)
+{
+    if (size < sizeof(*meta)) {
+        return lim_fail(lim, LIM_ERROR_FORMAT, "unexpected end of program");
+    }
+    memcpy(meta, bytes, sizeof(*meta));
+
+    if (meta->magic != LIM_FILE_MAGIC) {
+        return lim_fail(lim, LIM_ERROR_FORMAT, "not a LIM program");
+    }
+    if (meta->version != LIM_FILE_VERSION) {
+        return lim_fail(lim, LIM_ERROR_FORMAT,
+                        "unsupported version %u, expected %u", meta->version,
+                        LIM_FILE_VERSION);
+    }
+    if (meta->program_size > LIM_PROGRAM_CAPACITY ||
+        meta->imports_size > LIM_IMPORTS_CAPACITY ||
+        meta->interned_size > LIM_INTERNED_CAPACITY) {
+        return lim_fail(lim, LIM_ERROR_CAPACITY, "too big to load");
+    }
+    if (size - sizeof(*meta) <
+        sizeof(lim->imports[0].name) * meta->imports_size +
+            sizeof(lim->interned[0]) * meta->interned_size +
+            sizeof(lim->program[0]) * meta->program_size) {
+        return lim_fail(lim, LIM_ERROR_FORMAT, "unexpected end of program");
+    }
+    if (meta->data_size > 0 && (meta->data_offset > size ||
+                                meta->data_size > size - meta->data_offset)) {
+        return lim_fail(lim, LIM_ERROR_FORMAT, "unexpected end of data");
+    }
+    bytes += sizeof(*meta);
+
+    lim->imports_size = meta->imports_size;
+    for (uint64_t i = 0; i < lim->imports_size; i++) {
+        Lim_Native *import = &lim->imports[i];
+        memcpy(import->name, bytes, sizeof(import->name));
+        bytes += sizeof(import->name);
+        import->name[sizeof(import->name) - 1] = '\0';
+        import->func = lim_native_unbound;
+        import->args = 0;
+        import->rets = 0;
+    }
+
+    Lim_Error error = lim_intern_table(lim, bytes, meta->interned_size);
+    if (error != LIM_OK) {
+        return error;
+    }
+    bytes += sizeof(lim->interned[0]) * meta->interned_size;
+
+    memcpy(lim->program, bytes, sizeof(lim->program[0]) * meta->program_size);
+    lim->program_size = meta->program_size;
+    return LIM_OK;
+}
+
+Lim_Error lim_load_program_from_bytes(Lim *lim, const void *data, size_t size)
+{
+    Lim_File_Meta meta = {0};
+    Lim_Error error = lim_load_image(lim, data, size, &meta);
+    if (error == LIM_OK) {
+        error = lim_map_data(lim, (const uint8_t *) data + meta.data_offset,
+                             meta.data_size);
+    }
+    if (error != LIM_OK) {
+        return error;
+    }
+    return lim_verify_program(lim);
+}
+
+Lim_Error lim_load_symbols_from_file(Lim *lim,
+                                     const char *file_path,
+                                     Lim_Symbol *symbols,
+                                     uint64_t *symbols_size)
+{
+    String_View content = {0};
+    Lim_Error error = slurp_file(lim, file_path, &content);
+    if (error != LIM_OK) {
+        return error;
+    }
+
+    Lim_File_Meta meta = {0};
+    size_t offset = sizeof(meta);
+    if (content.count >= sizeof(meta)) {
+        memcpy(&meta, content.data, sizeof(meta));
+        offset += LIM_NATIVE_NAME_CAPACITY * meta.imports_size +
+                  LIM_INTERNED_NAME_CAPACITY * meta.interned_size +
+                  sizeof(Inst) * meta.program_size;
+    }
+    if (meta.magic != LIM_FILE_MAGIC || meta.version != LIM_FILE_VERSION ||
+        meta.symbols_size > LABEL_CAPACITY ||
+        content.count < offset + sizeof(Lim_Symbol) * meta.symbols_size) {
+        error = lim_fail(lim, LIM_ERROR_FORMAT, "`%s`: no symbols", file_path);
+    } else {
+        memcpy(symbols, content.data + offset,
+               sizeof(Lim_Symbol) * meta.symbols_size);
+        for (uint64_t i = 0; i < meta.symbols_size; i++) {
+            symbols[i].name[sizeof(symbols[i].name) - 1] = '\0';
+        }
+        *symbols_size = meta.symbols_size;
+    }
+
+    free((void *) content.data);
+    return error;
+}
+
+// The file is mapped read-only: the program is copied out of it and the
+// mapping stays for the data, whose pages are only read in when touched
+Lim_Error lim_load_program_from_file(Lim *lim, const char *file_path)
+{
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        return lim_fail(lim, LIM_ERROR_IO, "Could not open file `%s`: %s",
+                        file_path, strerror(errno));
+    }
+    long size = 0;
+    if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0) {
+        fclose(f);
+        return lim_fail(lim, LIM_ERROR_IO, "Could not read file `%s`: %s",
+                        file_path, strerror(errno));
+    }
+    if ((size_t) size < sizeof(Lim_File_Meta)) {
+        fclose(f);
+        return lim_fail(lim, LIM_ERROR_FORMAT,
+                        "`%s`: unexpected end of program", file_path);
+    }
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    fclose(f);
+    if (map == MAP_FAILED) {
+        return lim_fail(lim, LIM_ERROR_IO, "Could not map file `%s`: %s",
+                        file_path, strerror(errno));
+    }
+
+    Lim_File_Meta meta = {0};
+    Lim_Error error = lim_load_image(lim, map, size, &meta);
+    if (error == LIM_OK) {
+        lim_unmap_data(lim);
+        if (meta.data_size > 0) {
+            lim->data = (const uint8_t *) map + meta.data_offset;
+            lim->data_size = meta.data_size;
+            lim->data_map = map;
+            lim->data_map_size = size;
+        } else {
+            munmap(map, size);
+        }
+        error = lim_verify_program(lim);
+    } else {
+        munmap(map, size);
+    }
+    if (error != LIM_OK) {
+        char message[sizeof(lim->error)];
+        memcpy(message, lim->error, sizeof(message));
+        lim_fail(lim, error, "`%s`: %s", file_path, message);
+    }
+    return error;
+}
+
+Lim_Error lim_save_program_to_file(Lim *lim, const char *file_path)
+{
+    return lim_save_program_with_symbols(lim, NULL, 0, file_path);
+}
+
+Lim_Error lim_save_program_with_symbols(Lim *lim,
+                                        const Lim_Symbol *symbols,
+                                        uint64_t symbols_size,
+                                        const char *file_path)
+{
+    FILE *f = fopen(file_path, "wb");
+    if (f == NULL) {
+        return lim_fail(lim, LIM_ERROR_IO, "Could not open file `%s`: %s",
+                        file_path, strerror(errno));
+    }
+
+    const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    Lim_File_Meta meta = {
+        .magic = LIM_FILE_MAGIC,
+        .version = LIM_FILE_VERSION,
+        .program_size = lim->program_size,
+        .imports_size = lim->imports_size,
+        .symbols_size = symbols_size,
+        .data_size = lim->data_size,
+        .interned_size = lim->interned_size,
+    };
+    meta.data_offset = sizeof(meta) +
+                       sizeof(lim->imports[0].name) * lim->imports_size +
+                       sizeof(lim->interned[0]) * lim->interned_size +
+                       sizeof(lim->program[0]) * lim->program_size +
+                       sizeof(symbols[0]) * symbols_size;
+    meta.data_offset = (meta.data_offset + page_size - 1) & ~(page_size - 1);
+
+    fwrite(&meta, sizeof(meta), 1, f);
+    for (uint64_t i = 0; i < lim->imports_size; i++) {
+        fwrite(lim->imports[i].name, sizeof(lim->imports[i].name), 1, f);
+    }
+    fwrite(lim->interned, sizeof(lim->interned[0]), lim->interned_size, f);
+    fwrite(lim->program, sizeof(lim->program[0]), lim->program_size, f);
+    fwrite(symbols, sizeof(symbols[0]), symbols_size, f);
+    if (lim->data_size > 0) {
+        fseek(f, meta.data_offset, SEEK_SET);
+        fwrite(lim->data, 1, lim->data_size, f);
+    }
+
+    Lim_Error error = LIM_OK;
     if (ferror(f)) {
-        fprintf(stderr, "ERROR: Counld not write file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
+        error = lim_fail(lim, LIM_ERROR_IO, "Could not write file `%s`: %s",
+                         file_path, strerror(errno));
+    }
+
+    fclose(f);
+    return error;
+}
+
+uint64_t lim_hash_bytes(const void *data, size_t size)
+{
+    // FNV-1a
+    const uint8_t *bytes = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static bool lim_symbol_name(char name[LIM_SYMBOL_NAME_CAPACITY],
+                            String_View label)
+{
+    if (label.count >= LIM_SYMBOL_NAME_CAPACITY) {
+        return false;
+    }
+    memset(name, 0, LIM_SYMBOL_NAME_CAPACITY);
+    memcpy(name, label.data, label.count);
+    return true;
+}
+
+// The program of `lim` must be translated by `lasm` with `relocatable` set:
+// jumps to local labels keep their module relative address and jumps to
+// unknown labels are left to the linker.
+Lim_Error lim_save_object_to_file(Lim *lim,
+                                  const Lasm *lasm,
+                                  uint64_t source_hash,
+                                  const char *file_path)
+{
+    for (size_t i = 0; i < lasm->exports_size; i++) {
+        String_View label = lasm->exports[i];
+        if (label_table_find(lasm, label) < 0) {
+            return lim_fail(lim, LIM_ERROR_SYNTAX,
+                            "exported label `%.*s` is not defined",
+                            (int) label.count, label.data);
+        }
+        if (label.count >= LIM_SYMBOL_NAME_CAPACITY) {
+            return lim_fail(lim, LIM_ERROR_SYNTAX,
+                            "exported label `%.*s` is too long",
+                            (int) label.count, label.data);
+        }
+    }
+
+    FILE *f = fopen(file_path, "wb");
+    if (f == NULL) {
+        return lim_fail(lim, LIM_ERROR_IO, "Could not open file `%s`: %s",
+                        file_path, strerror(errno));
+    }
+
+    Lim_Object_Meta meta = {
+        .magic = LIM_OBJECT_MAGIC,
+        .version = LIM_OBJECT_VERSION,
+        .program_size = lim->program_size,
+        .imports_size = lim->imports_size,
+        .symbols_size = lasm->exports_size,
+        .relocs_size = lasm->unresolved_jmps_size,
+        .source_hash = source_hash,
+        .data_size = lasm->data_size,
+        .interned_size = lim->interned_size,
+    };
+    fwrite(&meta, sizeof(meta), 1, f);
+    for (uint64_t i = 0; i < lim->imports_size; i++) {
+        fwrite(lim->imports[i].name, sizeof(lim->imports[i].name), 1, f);
+    }
+    fwrite(lim->interned, sizeof(lim->interned[0]), lim->interned_size, f);
+    fwrite(lim->program, sizeof(lim->program[0]), lim->program_size, f);
+
+    for (size_t i = 0; i < lasm->exports_size; i++) {
+        Lim_Symbol symbol = {0};
+        lim_symbol_name(symbol.name, lasm->exports[i]);
+        symbol.addr =
+            lasm->labels[label_table_find(lasm, lasm->exports[i])].addr;
+        fwrite(&symbol, sizeof(symbol), 1, f);
+    }
+
+    Lim_Error error = LIM_OK;
+    for (size_t i = 0; i < lasm->unresolved_jmps_size; i++) {
+        const Unresolved_Jmp *jmp = &lasm->unresolved_jmps[i];
+        Lim_Reloc reloc = {.addr = jmp->addr};
+        if (label_table_find(lasm, jmp->label) < 0 &&
+            !lim_symbol_name(reloc.symbol, jmp->label)) {
+            error = lim_fail(lim, LIM_ERROR_SYNTAX, "label `%.*s` is too long",
+                             (int) jmp->label.count, jmp->label.data);
+            break;
+        }
+        fwrite(&reloc, sizeof(reloc), 1, f);
+    }
+    fwrite(lasm->data, 1, lasm->data_size, f);
+
+    if (error == LIM_OK && ferror(f)) {
+        error = lim_fail(lim, LIM_ERROR_IO, "Could not write file `%s`: %s",
+                         file_path, strerror(errno));
+    }
+
+    fclose(f);
+    return error;
+}
+
+typedef struct {
+    const char *file_path;
+    String_View content;
+    Lim_Object_Meta meta;
+    const uint8_t *imports;
+    const uint8_t *interned;
+    const uint8_t *program;
+    const uint8_t *symbols;
+    const uint8_t *relocs;
+    const uint8_t *data;
+    uint64_t base;       // address of the module in the linked program
+    uint64_t data_base;  // offset of its data in the linked data
+} Lim_Object;
+
+static Lim_Error lim_read_object(Lim *lim, Lim_Object *object)
+{
+    Lim_Error error = slurp_file(lim, object->file_path, &object->content);
+    if (error != LIM_OK) {
+        return error;
+    }
+
+    const uint8_t *bytes = (const uint8_t *) object->content.data;
+    size_t size = object->content.count;
+    Lim_Object_Meta *meta = &object->meta;
+    if (size < sizeof(*meta)) {
+        return lim_fail(lim, LIM_ERROR_FORMAT,
+                        "`%s`: unexpected end of object", object->file_path);
+    }
+    memcpy(meta, bytes, sizeof(*meta));
+    bytes += sizeof(*meta);
+    size -= sizeof(*meta);
+
+    if (meta->magic != LIM_OBJECT_MAGIC) {
+        return lim_fail(lim, LIM_ERROR_FORMAT, "`%s`: not a LIM object",
+                        object->file_path);
+    }
+    if (meta->version != LIM_OBJECT_VERSION) {
+        return lim_fail(lim, LIM_ERROR_FORMAT,
+                        "`%s`: unsupported version %u, expected %u",
+                        object->file_path, meta->version, LIM_OBJECT_VERSION);
+    }
+    if (meta->program_size > LIM_PROGRAM_CAPACITY ||
+        meta->imports_size > LIM_IMPORTS_CAPACITY ||
+        meta->symbols_size > LABEL_CAPACITY ||
+        meta->relocs_size > UNRESOLVED_JMPS_CAPACITY ||
+        meta->data_size > LIM_DATA_CAPACITY ||
+        meta->interned_size > LIM_INTERNED_CAPACITY) {
+        return lim_fail(lim, LIM_ERROR_CAPACITY, "`%s`: too big to link",
+                        object->file_path);
+    }
+    if (size < LIM_NATIVE_NAME_CAPACITY * meta->imports_size +
+                   LIM_INTERNED_NAME_CAPACITY * meta->interned_size +
+                   sizeof(Inst) * meta->program_size +
+                   sizeof(Lim_Symbol) * meta->symbols_size +
+                   sizeof(Lim_Reloc) * meta->relocs_size + meta->data_size) {
+        return lim_fail(lim, LIM_ERROR_FORMAT,
+                        "`%s`: unexpected end of object", object->file_path);
+    }
+
+    object->imports = bytes;
+    object->interned =
+        object->imports + LIM_NATIVE_NAME_CAPACITY * meta->imports_size;
+    object->program =
+        object->interned + LIM_INTERNED_NAME_CAPACITY * meta->interned_size;
+    object->symbols = object->program + sizeof(Inst) * meta->program_size;
+    object->relocs = object->symbols + sizeof(Lim_Symbol) * meta->symbols_size;
+    object->data = object->relocs + sizeof(Lim_Reloc) * meta->relocs_size;
+    return LIM_OK;
+}
+
+typedef struct {
+    Lim_Symbol symbol;
+    const Lim_Object *object;
+} Lim_Link_Symbol;
+
+static const Lim_Link_Symbol *lim_link_symbol_find(
+    const Lim_Link_Symbol *symbols, size_t symbols_size, const char *name)
+{
+    for (size_t i = 0; i < symbols_size; i++) {
+        if (strcmp(symbols[i].symbol.name, name) == 0) {
+            return &symbols[i];
+        }
+    }
+    return NULL;
+}
+
+static Lim_Error lim_link(Lim *lim,
+                          Lim_Object *objects,
+                          size_t objects_size,
+                          Lim_Link_Symbol *symbols)
+{
+    // Lay the modules out one after another and collect their exports
+    uint64_t program_size = 0;
+    uint64_t data_size = 0;
+    size_t symbols_size = 0;
+    for (size_t i = 0; i < objects_size; i++) {
+        Lim_Object *object = &objects[i];
+        object->base = program_size;
+        program_size += object->meta.program_size;
+        // keep the words of every module aligned
+        object->data_base = (data_size + sizeof(Word) - 1) & -sizeof(Word);
+        data_size = object->data_base + object->meta.data_size;
+        if (program_size > LIM_PROGRAM_CAPACITY) {
+            return lim_fail(lim, LIM_ERROR_CAPACITY,
+                            "linked program is longer than %d instructions",
+                            LIM_PROGRAM_CAPACITY);
+        }
+
+        for (uint64_t j = 0; j < object->meta.symbols_size; j++) {
+            Lim_Symbol symbol = {0};
+            memcpy(&symbol, object->symbols + j * sizeof(symbol),
+                   sizeof(symbol));
+            symbol.name[sizeof(symbol.name) - 1] = '\0';
+            if (symbol.addr > object->meta.program_size) {
+                return lim_fail(lim, LIM_ERROR_FORMAT,
+                                "`%s`: symbol `%s` is out of the module",
+                                object->file_path, symbol.name);
+            }
+
+            const Lim_Link_Symbol *defined =
+                lim_link_symbol_find(symbols, symbols_size, symbol.name);
+            if (defined != NULL) {
+                return lim_fail(lim, LIM_ERROR_SYNTAX,
+                                "symbol `%s` is defined in both `%s` and `%s`",
+                                symbol.name, defined->object->file_path,
+                                object->file_path);
+            }
+            symbol.addr += object->base;
+            symbols[symbols_size++] = (Lim_Link_Symbol){
+                .symbol = symbol,
+                .object = object,
+            };
+        }
+    }
+
+    lim->program_size = 0;
+    lim->imports_size = 0;
+    lim_clear_interned(lim);
+    for (size_t i = 0; i < objects_size; i++) {
+        const Lim_Object *object = &objects[i];
+        Inst *program = &lim->program[object->base];
+        memcpy(program, object->program,
+               sizeof(Inst) * object->meta.program_size);
+        lim->program_size += object->meta.program_size;
+
+        // Natives are imported by the module, rebuild the import table
+        for (uint64_t j = 0; j < object->meta.program_size; j++) {
+            if (program[j].type != INST_NATIVE) {
+                continue;
+            }
+            uint64_t import = program[j].operand.as_u64;
+            if (import >= object->meta.imports_size) {
+                return lim_fail(lim, LIM_ERROR_FORMAT,
+                                "`%s`: unknown import %lu at %lu",
+                                object->file_path, import, j);
+            }
+            char name[LIM_NATIVE_NAME_CAPACITY];
+            memcpy(name, object->imports + import * sizeof(name),
+                   sizeof(name));
+            name[sizeof(name) - 1] = '\0';
+            Lim_Error error = lim_import_native(
+                lim, cstr_as_sv(name), &program[j].operand.as_u64);
+            if (error != LIM_OK) {
+                return error;
+            }
+        }
+
+        for (uint64_t j = 0; j < object->meta.relocs_size; j++) {
+            Lim_Reloc reloc = {0};
+            memcpy(&reloc, object->relocs + j * sizeof(reloc), sizeof(reloc));
+            reloc.symbol[sizeof(reloc.symbol) - 1] = '\0';
+            if (reloc.addr >= object->meta.program_size) {
+                return lim_fail(lim, LIM_ERROR_FORMAT,
+                                "`%s`: relocation at %lu is out of the module",
+                                object->file_path, reloc.addr);
+            }
+
+            Word *operand = &program[reloc.addr].operand;
+            if (*reloc.symbol == '\0') {
+                operand->as_u64 += object->base;
+                continue;
+            }
+            const Lim_Link_Symbol *symbol =
+                lim_link_symbol_find(symbols, symbols_size, reloc.symbol);
+            if (symbol == NULL) {
+                return lim_fail(lim, LIM_ERROR_SYNTAX,
+                                "undefined symbol `%s` referenced in `%s`",
+                                reloc.symbol, object->file_path);
+            }
+            operand->as_u64 = symbol->symbol.addr;
+        }
+
+        // symbols are numbered per module as well, intern them by name
+        for (uint64_t j = 0; j < object->meta.program_size; j++) {
+            if (program[j].type != INST_PUSH_SYM) {
+                continue;
+            }
+            uint64_t symbol = program[j].operand.as_u64;
+            if (symbol >= object->meta.interned_size) {
+                return lim_fail(lim, LIM_ERROR_FORMAT,
+                                "`%s`: unknown symbol %lu at %lu",
+                                object->file_path, symbol, j);
+            }
+            const char *name = (const char *) object->interned +
+                               symbol * LIM_INTERNED_NAME_CAPACITY;
+            Lim_Error error = lim_intern(
+                lim,
+                (String_View){
+                    .count = strnlen(name, LIM_INTERNED_NAME_CAPACITY),
+                    .data = name,
+                },
+                &program[j].operand.as_u64);
+            if (error != LIM_OK) {
+                return error;
+            }
+        }
+
+        for (uint64_t j = 0; j < object->meta.program_size; j++) {
+            if (program[j].type != INST_PUSH_DATA) {
+                continue;
+            }
+            if (program[j].operand.as_u64 > object->meta.data_size) {
+                return lim_fail(lim, LIM_ERROR_FORMAT,
+                                "`%s`: data offset %lu at %lu is out of the "
+                                "module",
+                                object->file_path, program[j].operand.as_u64,
+                                j);
+            }
+            program[j].operand.as_u64 += object->data_base;
+        }
+    }
+
+    uint8_t *data = calloc(data_size + 1, 1);
+    if (data == NULL) {
+        return lim_fail(lim, LIM_ERROR_MEMORY,
+                        "Could not allocate memory for linking: %s",
+                        strerror(errno));
+    }
+    for (size_t i = 0; i < objects_size; i++) {
+        memcpy(data + objects[i].data_base, objects[i].data,
+               objects[i].meta.data_size);
+    }
+    Lim_Error error = lim_map_data(lim, data, data_size);
+    free(data);
+    if (error != LIM_OK) {
+        return error;
+    }
+    return lim_verify_program(lim);
+}
+
+Lim_Error lim_link_objects(Lim *lim,
+                           const char *const *file_paths,
+                           size_t file_paths_size,
+                           Lim_Symbol *symbols,
+                           uint64_t *symbols_size)
+{
+    Lim_Object *objects = calloc(file_paths_size, sizeof(*objects));
+    if (objects == NULL) {
+        return lim_fail(lim, LIM_ERROR_MEMORY,
+                        "Could not allocate memory for linking: %s",
+                        strerror(errno));
+    }
+
+    Lim_Error error = LIM_OK;
+    size_t link_symbols_size = 0;
+    for (size_t i = 0; i < file_paths_size && error == LIM_OK; i++) {
+        objects[i].file_path = file_paths[i];
+        error = lim_read_object(lim, &objects[i]);
+        link_symbols_size += objects[i].meta.symbols_size;
+    }
+
+    Lim_Link_Symbol *link_symbols = NULL;
+    if (error == LIM_OK) {
+        link_symbols = calloc(link_symbols_size + 1, sizeof(*link_symbols));
+        if (link_symbols == NULL) {
+            error = lim_fail(lim, LIM_ERROR_MEMORY,
+                             "Could not allocate memory for linking: %s",
+                             strerror(errno));
+        }
+    }
+    if (error == LIM_OK) {
+        error = lim_link(lim, objects, file_paths_size, link_symbols);
+    }
+    if (error == LIM_OK && symbols != NULL) {
+        *symbols_size = 0;
+        for (size_t i = 0;
+             i < link_symbols_size && *symbols_size < LABEL_CAPACITY; i++) {
+            symbols[(*symbols_size)++] = link_symbols[i].symbol;
+        }
+    }
+
+    for (size_t i = 0; i < file_paths_size; i++) {
+        free((void *) objects[i].content.data);
+    }
+    free(objects);
+    free(link_symbols);
+    return error;
+}
+
+// Every block starts with a header. Freed blocks are kept in address order,
+// so a freed block merges with the free blocks next to it and a free block
+// at the end of the used part goes back to the arena. Allocation is first
+// fit and splits off what is left of a block when another block fits in it.
+typedef struct Lim_Heap_Block {
+    uint64_t size;
+    struct Lim_Heap_Block *next;
+} Lim_Heap_Block;
+
+static uint8_t *lim_heap_block_end(Lim_Heap_Block *block)
+{
+    return (uint8_t *) (block + 1) + block->size;
+}
+
+static bool lim_heap_reserve(Lim_Heap *heap, void *address, int flags)
+{
+    void *base = mmap(address, LIM_HEAP_CAPACITY, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | flags, -1,
+                      0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    heap->base = base;
+    return true;
+}
+
+void *lim_heap_alloc(Lim *lim, uint64_t size)
+{
+    Lim_Heap *heap = &lim->heap;
+    if (size > LIM_HEAP_CAPACITY) {
+        return NULL;
+    }
+    if (heap->base == NULL && !lim_heap_reserve(heap, LIM_HEAP_ADDRESS, 0)) {
+        return NULL;
+    }
+
+    size = (size + sizeof(Lim_Heap_Block) - 1) & ~(sizeof(Lim_Heap_Block) - 1);
+    for (Lim_Heap_Block **it = (Lim_Heap_Block **) &heap->free; *it != NULL;
+         it = &(*it)->next) {
+        Lim_Heap_Block *block = *it;
+        if (block->size < size) {
+            continue;
+        }
+        if (block->size - size >= 2 * sizeof(Lim_Heap_Block)) {
+            Lim_Heap_Block *rest =
+                (Lim_Heap_Block *) ((uint8_t *) (block + 1) + size);
+            rest->size = block->size - size - sizeof(Lim_Heap_Block);
+            rest->next = block->next;
+            block->size = size;
+            *it = rest;
+        } else {
+            *it = block->next;
+        }
+        lim->stats.allocated += block->size;
+        return block + 1;
+    }
+
+    if (size > LIM_HEAP_CAPACITY - sizeof(Lim_Heap_Block) - heap->size) {
+        return NULL;
+    }
+    Lim_Heap_Block *block = (Lim_Heap_Block *) (heap->base + heap->size);
+    block->size = size;
+    heap->size += sizeof(Lim_Heap_Block) + size;
+    lim->stats.allocated += size;
+    return block + 1;
+}
+
+void lim_heap_free(Lim *lim, void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    Lim_Heap *heap = &lim->heap;
+    Lim_Heap_Block *block = (Lim_Heap_Block *) ptr - 1;
+    lim->stats.freed += block->size;
+
+    // `link` points at `block` once it is in the list, `prev_link` at the
+    // free block before it
+    Lim_Heap_Block **link = (Lim_Heap_Block **) &heap->free;
+    Lim_Heap_Block **prev_link = NULL;
+    while (*link != NULL && *link < block) {
+        prev_link = link;
+        link = &(*link)->next;
+    }
+    Lim_Heap_Block *next = *link;
+    if (next != NULL && lim_heap_block_end(block) == (uint8_t *) next) {
+        block->size += sizeof(Lim_Heap_Block) + next->size;
+        next = next->next;
+    }
+    block->next = next;
+    *link = block;
+    if (prev_link != NULL &&
+        lim_heap_block_end(*prev_link) == (uint8_t *) block) {
+        Lim_Heap_Block *prev = *prev_link;
+        prev->size += sizeof(Lim_Heap_Block) + block->size;
+        prev->next = next;
+        block = prev;
+        link = prev_link;
+    }
+    if (lim_heap_block_end(block) == heap->base + heap->size) {
+        heap->size = (uint8_t *) block - heap->base;
+        *link = NULL;
+    }
+}
+
+Lim_Error lim_save_snapshot(Lim *lim, const char *file_path)
+{
+    if (lim->threads_size > 1) {
+        return lim_fail(lim, LIM_ERROR_FORMAT,
+                        "Could not snapshot `%s`: green threads are not "
+                        "supported",
+                        file_path);
+    }
+
+    FILE *f = fopen(file_path, "wb");
+    if (f == NULL) {
+        return lim_fail(lim, LIM_ERROR_IO, "Could not open file `%s`: %s",
+                        file_path, strerror(errno));
+    }
+
+    const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    Lim_Snapshot_Meta meta = {
+        .magic = LIM_SNAPSHOT_MAGIC,
+        .version = LIM_SNAPSHOT_VERSION,
+        .program_size = lim->program_size,
+        .imports_size = lim->imports_size,
+        .stack_size = lim->stack_size,
+        .frames_size = lim->frames_size,
+        .ip = lim->ip,
+        .heap_address = (uint64_t) (uintptr_t) lim->heap.base,
+        .heap_size = lim->heap.size,
+        .heap_free = (uint64_t) (uintptr_t) lim->heap.free,
+        .data_address = (uint64_t) (uintptr_t) lim->data,
+        .data_size = lim->data_size,
+        .interned_size = lim->interned_size,
+    };
+    meta.heap_offset = sizeof(meta) +
+                       sizeof(lim->imports[0].name) * lim->imports_size +
+                       sizeof(lim->interned[0]) * lim->interned_size +
+                       sizeof(lim->program[0]) * lim->program_size +
+                       sizeof(lim->stack[0]) * lim->stack_size +
+                       sizeof(lim->frames[0]) * lim->frames_size;
+    meta.heap_offset = (meta.heap_offset + page_size - 1) & ~(page_size - 1);
+    meta.data_offset = meta.heap_offset + lim->heap.size;
+    meta.data_offset = (meta.data_offset + page_size - 1) & ~(page_size - 1);
+
+    fwrite(&meta, sizeof(meta), 1, f);
+    for (uint64_t i = 0; i < lim->imports_size; i++) {
+        fwrite(lim->imports[i].name, sizeof(lim->imports[i].name), 1, f);
+    }
+    fwrite(lim->interned, sizeof(lim->interned[0]), lim->interned_size, f);
+    fwrite(lim->program, sizeof(lim->program[0]), lim->program_size, f);
+    fwrite(lim->stack, sizeof(lim->stack[0]), lim->stack_size, f);
+    fwrite(lim->frames, sizeof(lim->frames[0]), lim->frames_size, f);
+    if (lim->heap.size > 0) {
+        fseek(f, meta.heap_offset, SEEK_SET);
+        fwrite(lim->heap.base, 1, lim->heap.size, f);
+    }
+    if (lim->data_size > 0) {
+        fseek(f, meta.data_offset, SEEK_SET);
+        fwrite(lim->data, 1, lim->data_size, f);
+    }
+
+    Lim_Error error = LIM_OK;
+    if (ferror(f)) {
+        error = lim_fail(lim, LIM_ERROR_IO, "Could not write file `%s`: %s",
+                         file_path, strerror(errno));
+    }
+
+    fclose(f);
+    return error;
+}
+
+static Lim_Error lim_read_snapshot(Lim *lim, const char *file_path, FILE *f)
+{
+    Lim_Snapshot_Meta meta = {0};
+    if (fread(&meta, sizeof(meta), 1, f) < 1) {
+        return lim_fail(lim, LIM_ERROR_IO, "Could not read file `%s`: %s",
+                        file_path,
+                        ferror(f) ? strerror(errno) : "unexpected end of file");
+    }
+    if (meta.magic != LIM_SNAPSHOT_MAGIC) {
+        return lim_fail(lim, LIM_ERROR_FORMAT, "`%s` is not a LIM snapshot",
+                        file_path);
+    }
+    if (meta.version != LIM_SNAPSHOT_VERSION) {
+        return lim_fail(lim, LIM_ERROR_FORMAT,
+                        "`%s` has unsupported version %u, expected %u",
+                        file_path, meta.version, LIM_SNAPSHOT_VERSION);
+    }
+    if (meta.program_size > LIM_PROGRAM_CAPACITY ||
+        meta.imports_size > LIM_IMPORTS_CAPACITY ||
+        meta.stack_size > LIM_STACK_CAPACITY ||
+        meta.frames_size > LIM_FRAMES_CAPACITY ||
+        meta.heap_size > LIM_HEAP_CAPACITY ||
+        meta.interned_size > LIM_INTERNED_CAPACITY) {
+        return lim_fail(lim, LIM_ERROR_CAPACITY, "`%s` is too big to load",
+                        file_path);
+    }
+
+    lim->imports_size = meta.imports_size;
+    for (uint64_t i = 0; i < lim->imports_size; i++) {
+        Lim_Native *import = &lim->imports[i];
+        if (fread(import->name, sizeof(import->name), 1, f) < 1) {
+            break;
+        }
+        import->name[sizeof(import->name) - 1] = '\0';
+        import->func = lim_native_unbound;
+        import->args = 0;
+        import->rets = 0;
+    }
+    // symbols interned while the program ran are saved too, so symbols on
+    // the stack and in the heap keep their names
+    uint8_t(*interned)[LIM_INTERNED_NAME_CAPACITY] =
+        calloc(meta.interned_size + 1, sizeof(*interned));
+    if (interned == NULL) {
+        return lim_fail(lim, LIM_ERROR_MEMORY,
+                        "Could not allocate memory for `%s`: %s", file_path,
+                        strerror(errno));
+    }
+    uint64_t interned_size =
+        fread(interned, sizeof(*interned), meta.interned_size, f);
+    Lim_Error error = lim_intern_table(lim, *interned, interned_size);
+    free(interned);
+    if (error != LIM_OK) {
+        return error;
+    }
+    lim->program_size =
+        fread(lim->program, sizeof(lim->program[0]), meta.program_size, f);
+    lim->stack_size =
+        fread(lim->stack, sizeof(lim->stack[0]), meta.stack_size, f);
+    lim->frames_size =
+        fread(lim->frames, sizeof(lim->frames[0]), meta.frames_size, f);
+    if (ferror(f)) {
+        return lim_fail(lim, LIM_ERROR_IO, "Could not read file `%s`: %s",
+                        file_path, strerror(errno));
+    }
+    if (lim->program_size != meta.program_size ||
+        lim->interned_size != meta.interned_size ||
+        lim->stack_size != meta.stack_size ||
+        lim->frames_size != meta.frames_size) {
+        return lim_fail(lim, LIM_ERROR_IO, "Could not read file `%s`: %s",
+                        file_path, "unexpected end of file");
+    }
+    lim->ip = meta.ip;
+    lim->halt = false;
+
+    if (meta.heap_address != 0) {
+        void *address = (void *) (uintptr_t) meta.heap_address;
+        if (lim->heap.base != NULL && lim->heap.base != address) {
+            munmap(lim->heap.base, LIM_HEAP_CAPACITY);
+            lim->heap.base = NULL;
+        }
+        if (lim->heap.base == NULL &&
+            (!lim_heap_reserve(&lim->heap, address, MAP_FIXED_NOREPLACE) ||
+             lim->heap.base != address)) {
+            return lim_fail(lim, LIM_ERROR_MEMORY,
+                            "Could not map the heap of `%s` at %p", file_path,
+                            address);
+        }
+        if (meta.heap_size > 0 &&
+            mmap(address, meta.heap_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, fileno(f),
+                 meta.heap_offset) == MAP_FAILED) {
+            return lim_fail(lim, LIM_ERROR_MEMORY,
+                            "Could not map the heap of `%s`: %s", file_path,
+                            strerror(errno));
+        }
+        lim->heap.size = meta.heap_size;
+        lim->heap.free = (void *) (uintptr_t) meta.heap_free;
+    }
+
+    // the data goes back to its address too, pointers to it may be saved
+    lim_unmap_data(lim);
+    if (meta.data_size > 0) {
+        void *address = (void *) (uintptr_t) meta.data_address;
+        void *map = mmap(address, meta.data_size, PROT_READ,
+                         MAP_PRIVATE | MAP_FIXED_NOREPLACE, fileno(f),
+                         meta.data_offset);
+        if (map == MAP_FAILED || map != address) {
+            if (map != MAP_FAILED) {
+                munmap(map, meta.data_size);
+            }
+            return lim_fail(lim, LIM_ERROR_MEMORY,
+                            "Could not map the data of `%s` at %p", file_path,
+                            address);
+        }
+        lim->data = map;
+        lim->data_size = meta.data_size;
+        lim->data_map = map;
+        lim->data_map_size = meta.data_size;
+    }
+
+    return lim_verify_program(lim);
+}
+
+// Only the heap and the data are mapped, everything else is small enough to be read.
+// Natives are restored by name: bind them with `lim_bind_natives` after
+// registering them.
+Lim_Error lim_load_snapshot(Lim *lim, const char *file_path)
+{
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        return lim_fail(lim, LIM_ERROR_IO, "Could not open file `%s`: %s",
+                        file_path, strerror(errno));
+    }
+
+    Lim_Error error = lim_read_snapshot(lim, file_path, f);
+    fclose(f);
+    return error;
+}
+
+Lim_Error slurp_file(Lim *lim, const char *file_path, String_View *content)
+{
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        return lim_fail(lim, LIM_ERROR_IO, "Could not open file `%s`: %s",
+                        file_path, strerror(errno));
+    }
+
+    char *buffer = NULL;
+    long m = 0;
+    if (fseek(f, 0, SEEK_END) < 0 || (m = ftell(f)) < 0 ||
+        fseek(f, 0, SEEK_SET) < 0) {
+        fclose(f);
+        return lim_fail(lim, LIM_ERROR_IO, "Could not read file `%s`: %s",
+                        file_path, strerror(errno));
+    }
+
+    buffer = malloc(m + 1);
+    if (buffer == NULL) {
+        fclose(f);
+        return lim_fail(lim, LIM_ERROR_MEMORY,
+                        "Could not allocate memory for file: %s",
+                        strerror(errno));
+    }
+
+    size_t n = fread(buffer, 1, m, f);
+
+    if (ferror(f)) {
+        free(buffer);
+        fclose(f);
+        return lim_fail(lim, LIM_ERROR_IO, "Could not read file `%s`: %s",
+                        file_path, strerror(errno));
+    }
+
+    fclose(f);
+
+    *content = (String_View){
+        .count = n,
+        .data = buffer,
+    };
+    return LIM_OK;
+}
+
+bool number_literal_as_word(String_View sv, Word *word)
+{
+    if (sv.count >= 1024) {
+        return false;
+    }
+    char str[sv.count + 1];
+
+    memcpy(str, sv.data, sv.count);
+    str[sv.count] = '\0';
+
+    char *endptr = NULL;
+    word->as_i64 = strtoll(str, &endptr, 10);
+    if ((size_t) (endptr - str) != sv.count) {
+        word->as_f64 = strtod(str, &endptr);
+        if ((size_t) (endptr - str) != sv.count) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Only the first error of a translation is kept
+static void lasm_fail(Lim *lim, Lasm *lasm, Lim_Error error, const char *fmt,
+                      ...)
+{
+    if (lasm->error != LIM_OK) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    lasm->error = lim_vfail(lim, error, fmt, args);
+    va_end(args);
+}
+
+static Word lasm_number(Lim *lim, Lasm *lasm, String_View operand)
+{
+    Word word = {0};
+    if (!number_literal_as_word(operand, &word)) {
+        lasm_fail(lim, lasm, LIM_ERROR_SYNTAX,
+                  "`%.*s` is not a valid number literal", (int) operand.count,
+                  operand.data);
+    }
+    return word;
+}
+
+static void lasm_unresolved_jmp(Lim *lim,
+                                Lasm *lasm,
+                                Inst_Addr addr,
+                                String_View label)
+{
+    if (!label_table_push_unresolved_jmp(lasm, addr, label)) {
+        lasm_fail(lim, lasm, LIM_ERROR_CAPACITY, "too many jumps to labels");
+    }
+}
+
+static Inst lim_translate_line(Lim *lim,
+                               Lasm *lasm,
+                               Inst_Addr addr,
+                               String_View line)
+{
+    line = sv_trim_left(line);
+    String_View inst_name = sv_chop_delim(&line, ' ');
+    String_View operand = sv_trim(sv_chop_delim(&line, '#'));
+
+    if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_NOP)))) {
+        return MAKE_INST_NOP();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_PUSH)))) {
+        // a label pushes its address, e.g. the function for `par_map`
+        Word word = {0};
+        if (operand.count > 0 &&
+            (isalpha(*operand.data) || *operand.data == '_') &&
+            !number_literal_as_word(operand, &word)) {
+            lasm_unresolved_jmp(lim, lasm, addr, operand);
+            return MAKE_INST_PUSH(word);
+        }
+        return MAKE_INST_PUSH(lasm_number(lim, lasm, operand));
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_POP)))) {
+        return MAKE_INST_POP();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_DUP)))) {
+        return MAKE_INST_DUP(lasm_number(lim, lasm, operand));
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_PLUS)))) {
+        return MAKE_INST_PLUS();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_MINUS)))) {
+        return MAKE_INST_MINUS();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_MULT)))) {
+        return MAKE_INST_MULT();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_DIV)))) {
+        return MAKE_INST_DIV();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_FPLUS)))) {
+        return MAKE_INST_FPLUS();
+    } else if (sv_equal(inst_name,
+                        cstr_as_sv(inst_type_as_cstr(INST_FMINUS)))) {
+        return MAKE_INST_FMINUS();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_FMULT)))) {
+        return MAKE_INST_FMULT();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_FDIV)))) {
+        return MAKE_INST_FDIV();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_GT)))) {
+        return MAKE_INST_GT();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_LT)))) {
+        return MAKE_INST_LT();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_GE)))) {
+        return MAKE_INST_GE();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_LE)))) {
+        return MAKE_INST_LE();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_EQ)))) {
+        return MAKE_INST_EQ();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_JMP)))) {
+        if (operand.count > 0 && isdigit(*operand.data)) {
+            return MAKE_INST_JMP(lasm_number(lim, lasm, operand));
+        } else {
+            lasm_unresolved_jmp(lim, lasm, addr, operand);
+            return MAKE_INST_JMP_WITHOUT_OPERAND();
+        }
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_JNZ)))) {
+        if (operand.count > 0 && isdigit(*operand.data)) {
+            return MAKE_INST_JNZ(lasm_number(lim, lasm, operand));
+        } else {
+            lasm_unresolved_jmp(lim, lasm, addr, operand);
+            return MAKE_INST_JNZ_WITHOUT_OPERAND();
+        }
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_JZ)))) {
+        if (operand.count > 0 && isdigit(*operand.data)) {
+            return MAKE_INST_JZ(lasm_number(lim, lasm, operand));
+        } else {
+            lasm_unresolved_jmp(lim, lasm, addr, operand);
+            return MAKE_INST_JZ_WITHOUT_OPERAND();
+        }
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_SWAP)))) {
+        return MAKE_INST_SWAP(lasm_number(lim, lasm, operand));
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_CALL)))) {
+        // call instruction only support label
+        lasm_unresolved_jmp(lim, lasm, addr, operand);
+        return MAKE_INST_CALL_WITHOUT_OPERAND();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_RET)))) {
+        return MAKE_INST_RET();
+    } else if (sv_equal(inst_name,
+                        cstr_as_sv(inst_type_as_cstr(INST_NATIVE)))) {
+        // natives are called by name, a number refers to the built-in native
+        // registered with that number by `lim_attach_natives`
+        if (operand.count > 0 && isdigit(*operand.data)) {
+            uint64_t number = lasm_number(lim, lasm, operand).as_u64;
+            if (number >= lim->natives_size) {
+                lasm_fail(lim, lasm, LIM_ERROR_NATIVE, "unknown native %lu",
+                          number);
+                return MAKE_INST_NOP();
+            }
+            operand = cstr_as_sv(lim->natives[number].name);
+        }
+        Word import = {0};
+        Lim_Error error = lim_import_native(lim, operand, &import.as_u64);
+        if (error != LIM_OK && lasm->error == LIM_OK) {
+            lasm->error = error;
+        }
+        return MAKE_INST_NATIVE(import);
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_HALT)))) {
+        return MAKE_INST_HALT();
+    } else if (sv_equal(inst_name,
+                        cstr_as_sv(inst_type_as_cstr(INST_PRINT_DEBUG)))) {
+        return MAKE_INST_PRINT_DEBUG();
+    } else if (sv_equal(inst_name,
+                        cstr_as_sv(inst_type_as_cstr(INST_LOAD_LOCAL)))) {
+        return MAKE_INST_LOAD_LOCAL(lasm_number(lim, lasm, operand));
+    } else if (sv_equal(inst_name,
+                        cstr_as_sv(inst_type_as_cstr(INST_STORE_LOCAL)))) {
+        return MAKE_INST_STORE_LOCAL(lasm_number(lim, lasm, operand));
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_DROP)))) {
+        return MAKE_INST_DROP(lasm_number(lim, lasm, operand));
+    } else if (sv_equal(inst_name,
+                        cstr_as_sv(inst_type_as_cstr(INST_SNAPSHOT)))) {
+        return MAKE_INST_SNAPSHOT();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_SPAWN)))) {
+        // spawn instruction only support label
+        lasm_unresolved_jmp(lim, lasm, addr, operand);
+        return MAKE_INST_SPAWN_WITHOUT_OPERAND();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_YIELD)))) {
+        return MAKE_INST_YIELD();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_JOIN)))) {
+        return MAKE_INST_JOIN();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_CHAN)))) {
+        return MAKE_INST_CHAN();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_SEND)))) {
+        return MAKE_INST_SEND();
+    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_RECV)))) {
+        return MAKE_INST_RECV();
+    } else if (sv_equal(inst_name,
+                        cstr_as_sv(inst_type_as_cstr(INST_PUSH_DATA)))) {
+        // a label of the `.data` section or a byte offset into it
+        if (operand.count > 0 && isdigit(*operand.data)) {
+            return MAKE_INST_PUSH_DATA(lasm_number(lim, lasm, operand));
+        }
+        if (lasm->unresolved_data_size >= UNRESOLVED_JMPS_CAPACITY) {
+            lasm_fail(lim, lasm, LIM_ERROR_CAPACITY,
+                      "too many references to data");
+        } else {
+            lasm->unresolved_data[lasm->unresolved_data_size++] =
+                (Unresolved_Jmp){.addr = addr, .label = operand};
+        }
+        return MAKE_INST_PUSH_DATA((Word){0});
+    } else if (sv_equal(inst_name,
+                        cstr_as_sv(inst_type_as_cstr(INST_PUSH_SYM)))) {
+        // symbols are interned by name, the program keeps their names
+        Word symbol = {0};
+        Lim_Error error = lim_intern(lim, operand, &symbol.as_u64);
+        if (error != LIM_OK && lasm->error == LIM_OK) {
+            lasm->error = error;
+        }
+        return MAKE_INST_PUSH_SYM(symbol);
+    } else {
+        lasm_fail(lim, lasm, LIM_ERROR_SYNTAX, "unknown instruction `%.*s`",
+                  (int) inst_name.count, inst_name.data);
+    }
+
+    return MAKE_INST_NOP();
+}
+
+static int lasm_data_label_find(const Lasm *lasm, String_View label)
+{
+    for (size_t i = 0; i < lasm->data_labels_size; i++) {
+        if (sv_equal(lasm->data_labels[i].name, label)) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+static void lasm_data_push(Lim *lim, Lasm *lasm, const void *bytes, size_t n)
+{
+    if (n > LIM_DATA_CAPACITY - lasm->data_size) {
+        lasm_fail(lim, lasm, LIM_ERROR_CAPACITY,
+                  "data is larger than %d bytes", LIM_DATA_CAPACITY);
+        return;
+    }
+    memcpy(lasm->data + lasm->data_size, bytes, n);
+    lasm->data_size += n;
+}
+
+// `.string "..."` with the escapes \n \t \\ \" \0, terminated by a zero byte
+static void lasm_data_string(Lim *lim, Lasm *lasm, String_View operand)
+{
+    if (operand.count == 0 || *operand.data != '"') {
+        lasm_fail(lim, lasm, LIM_ERROR_SYNTAX, "`.string` expects a string");
+        return;
+    }
+    size_t i = 1;
+    for (; i < operand.count && operand.data[i] != '"'; i++) {
+        char c = operand.data[i];
+        if (c == '\\' && i + 1 < operand.count) {
+            switch (operand.data[++i]) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case '0': c = '\0'; break;
+            case '\\': c = '\\'; break;
+            case '"': c = '"'; break;
+            default:
+                lasm_fail(lim, lasm, LIM_ERROR_SYNTAX,
+                          "unknown escape `\\%c`", operand.data[i]);
+                return;
+            }
+        }
+        lasm_data_push(lim, lasm, &c, 1);
+    }
+    String_View rest = sv_trim((String_View){
+        .count = i < operand.count ? operand.count - i - 1 : 0,
+        .data = operand.data + i + 1,
+    });
+    if (i >= operand.count || (rest.count > 0 && *rest.data != '#')) {
+        lasm_fail(lim, lasm, LIM_ERROR_SYNTAX, "unterminated string");
+        return;
+    }
+    lasm_data_push(lim, lasm, "", 1);
+}
+
+// A line of the `.data` section: `.string`, `.byte <n>...`, `.word <n>...`
+static void lasm_data_line(Lim *lim, Lasm *lasm, String_View line)
+{
+    String_View directive = sv_chop_delim(&line, ' ');
+    line = sv_trim(line);
+    if (sv_equal(directive, cstr_as_sv(".string"))) {
+        lasm_data_string(lim, lasm, line);
+        return;
+    }
+
+    bool word = sv_equal(directive, cstr_as_sv(".word"));
+    if (!word && !sv_equal(directive, cstr_as_sv(".byte"))) {
+        lasm_fail(lim, lasm, LIM_ERROR_SYNTAX, "unknown data directive `%.*s`",
+                  (int) directive.count, directive.data);
+        return;
+    }
+    if (word) {
+        // words are aligned, so they can be read through a pointer
+        static const uint8_t padding[sizeof(Word)] = {0};
+        uint64_t unaligned = lasm->data_size;
+        lasm_data_push(lim, lasm, padding,
+                       -lasm->data_size & (sizeof(Word) - 1));
+        // labels right in front of the words move past the padding
+        for (size_t i = 0; i < lasm->data_labels_size; i++) {
+            if (lasm->data_labels[i].addr == unaligned) {
+                lasm->data_labels[i].addr = lasm->data_size;
+            }
+        }
+    }
+    line = sv_trim(sv_chop_delim(&line, '#'));
+    while (line.count > 0 && lasm->error == LIM_OK) {
+        Word value = lasm_number(lim, lasm, sv_chop_delim(&line, ' '));
+        if (word) {
+            lasm_data_push(lim, lasm, &value, sizeof(value));
+        } else {
+            uint8_t byte = (uint8_t) value.as_u64;
+            lasm_data_push(lim, lasm, &byte, 1);
+        }
+        line = sv_trim_left(line);
+    }
+}
+
+Lim_Error lim_translate_source(String_View source, Lim *lim, Lasm *lasm)
+{
+    lim->program_size = 0;
+    lim->imports_size = 0;
+    lim_clear_interned(lim);
+    lasm->labels_size = 0;
+    lasm->unresolved_jmps_size = 0;
+    lasm->exports_size = 0;
+    lasm->data_size = 0;
+    lasm->data_labels_size = 0;
+    lasm->unresolved_data_size = 0;
+    lasm->error = LIM_OK;
+    bool in_data = false;
+
+    // First pass
+    while (source.count > 0 && lasm->error == LIM_OK) {
+        String_View line = sv_chop_delim(&source, '\n');
+        line = sv_trim_left(line);
+
+        String_View word = sv_delim(line, ' ');
+
+        // example:
+        // ```
+        // label: # comment
+        // ```
+        // Note: this implementation requires label and instruction can not
+        // locate in the same line
+
+        // labels
+        if (word.count > 0 && word.data[word.count - 1] == ':') {
+            String_View name = {.count = word.count - 1, .data = word.data};
+            if (in_data) {
+                if (lasm->data_labels_size >= LABEL_CAPACITY) {
+                    return lim_fail(lim, LIM_ERROR_CAPACITY,
+                                    "too many labels");
+                }
+                lasm->data_labels[lasm->data_labels_size++] = (Label){
+                    .name = name,
+                    .addr = lasm->data_size,
+                };
+            } else if (!label_table_push(lasm, name, lim->program_size)) {
+                return lim_fail(lim, LIM_ERROR_CAPACITY, "too many labels");
+            }
+            sv_chop_delim(&line, ' ');
+            line = sv_trim_left(line);
+            word = sv_delim(line, ' ');
+        }
+
+        // skip blank lines and comments
+        if (word.count == 0 || *word.data == '#')
+            continue;
+
+        // `.data` and `.text` switch between data and instructions
+        if (sv_equal(word, cstr_as_sv(".data")) ||
+            sv_equal(word, cstr_as_sv(".text"))) {
+            in_data = sv_equal(word, cstr_as_sv(".data"));
+            continue;
+        }
+        if (in_data) {
+            lasm_data_line(lim, lasm, line);
+            continue;
+        }
+
+        // `.export <label>` makes the label visible to other modules
+        if (sv_equal(word, cstr_as_sv(".export"))) {
+            sv_chop_delim(&line, ' ');
+            String_View label = sv_trim(sv_chop_delim(&line, '#'));
+            if (label.count == 0) {
+                return lim_fail(lim, LIM_ERROR_SYNTAX,
+                                "`.export` expects a label");
+            }
+            if (lasm->exports_size >= LABEL_CAPACITY) {
+                return lim_fail(lim, LIM_ERROR_CAPACITY, "too many exports");
+            }
+            lasm->exports[lasm->exports_size++] = label;
+            continue;
+        }
+
+        if (lim->program_size >= LIM_PROGRAM_CAPACITY) {
+            return lim_fail(lim, LIM_ERROR_CAPACITY,
+                            "program is longer than %d instructions",
+                            LIM_PROGRAM_CAPACITY);
+        }
+        Inst inst = lim_translate_line(lim, lasm, lim->program_size, line);
+        lim->program[lim->program_size++] = inst;
+    }
+    if (lasm->error != LIM_OK) {
+        return lasm->error;
+    }
+
+    // Second pass
+    for (size_t i = 0; i < lasm->unresolved_jmps_size; i++) {
+        const Unresolved_Jmp *jmp = &lasm->unresolved_jmps[i];
+        int j = label_table_find(lasm, jmp->label);
+        if (j < 0 && lasm->relocatable) {
+            continue;
+        } else if (j < 0) {
+            return lim_fail(lim, LIM_ERROR_SYNTAX, "unknown label `%.*s`",
+                            (int) jmp->label.count, jmp->label.data);
+        }
+        lim->program[jmp->addr].operand.as_i64 = lasm->labels[j].addr;
+    }
+    // data labels are local to the module, the linker only moves them
+    for (size_t i = 0; i < lasm->unresolved_data_size; i++) {
+        const Unresolved_Jmp *ref = &lasm->unresolved_data[i];
+        int j = lasm_data_label_find(lasm, ref->label);
+        if (j < 0) {
+            return lim_fail(lim, LIM_ERROR_SYNTAX, "unknown data label `%.*s`",
+                            (int) ref->label.count, ref->label.data);
+        }
+        lim->program[ref->addr].operand.as_u64 = lasm->data_labels[j].addr;
+    }
+    Lim_Error error = lim_map_data(lim, lasm->data, lasm->data_size);
+    if (error != LIM_OK) {
+        return error;
+    }
+    return lim_verify_program(lim);
+}
+
+void lim_dump_stack(FILE *stream, const Lim *lim)
+{
+    fprintf(stream, "Stack:\n");
+    fprintf(stream, "  u64\ti64\tf64\tptr\n");
+    if (lim->stack_size > 0) {
+        for (uint64_t i = 0; i < lim->stack_size; i++) {
+            fprintf(stream, "  %lu\t%ld\t%lf\t%p\n", lim->stack[i].as_u64,
+                    lim->stack[i].as_i64, lim->stack[i].as_f64,
+                    lim->stack[i].as_ptr);
+        }
+    } else {
+        fprintf(stream, "  [empty]\n");
+    }
+}
+
+static Trap lim_alloc(Lim *lim)
+{
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    lim->stack[lim->stack_size - 1].as_ptr =
+        lim_heap_alloc(lim, lim->stack[lim->stack_size - 1].as_u64);
+    return TRAP_OK;
+}
+
+static Trap lim_free(Lim *lim)
+{
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    lim_heap_free(lim, lim->stack[--lim->stack_size].as_ptr);
+    return TRAP_OK;
+}
+
+static Trap lim_print_u64(Lim *lim)
+{
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    fprintf(lim_output(lim), "%lu\n", lim->stack[--lim->stack_size].as_u64);
+    return TRAP_OK;
+}
+
+static Trap lim_print_i64(Lim *lim)
+{
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    fprintf(lim_output(lim), "%ld\n", lim->stack[--lim->stack_size].as_i64);
+    return TRAP_OK;
+}
+
+static Trap lim_print_f64(Lim *lim)
+{
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    fprintf(lim_output(lim), "%lf\n", lim->stack[--lim->stack_size].as_f64);
+    return TRAP_OK;
+}
+
+static Trap lim_print_ptr(Lim *lim)
+{
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    fprintf(lim_output(lim), "%p\n", lim->stack[--lim->stack_size].as_ptr);
+    return TRAP_OK;
+}
+
+// Bulk numeric kernels over buffers obtained from `lim_alloc`. Buffers are
+// passed as (pointer, length) pairs where the length is the number of f64
+// elements. Kernels are written against 4-lane vectors so every target gets
+// SIMD code, and are cloned per ISA so the loader picks the widest one the
+// host supports at runtime.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define LIM_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define LIM_KERNEL
+#endif
+
+#define LIM_KERNEL_LANES 4
+
+typedef double f64x4 __attribute__((vector_size(sizeof(double) * 4)));
+typedef int64_t i64x4 __attribute__((vector_size(sizeof(int64_t) * 4)));
+typedef double f64x4_unaligned
+    __attribute__((vector_size(sizeof(double) * 4), aligned(8), may_alias));
+
+#define F64X4_LOAD(p) (*(const f64x4_unaligned *) (p))
+#define F64X4_STORE(p, v) (*(f64x4_unaligned *) (p) = (v))
+#define F64X4_SPLAT(x) ((f64x4){(x), (x), (x), (x)})
+#define F64X4_SELECT(mask, a, b) \
+    ((f64x4) (((i64x4) (a) & (mask)) | ((i64x4) (b) & ~(mask))))
+
+LIM_KERNEL
+static double kernel_sum_f64(const double *x, uint64_t n)
+{
+    f64x4 acc = {0};
+    uint64_t i = 0;
+    for (; i + LIM_KERNEL_LANES <= n; i += LIM_KERNEL_LANES) {
+        acc += F64X4_LOAD(x + i);
+    }
+    double result = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    for (; i < n; i++) {
+        result += x[i];
+    }
+    return result;
+}
+
+LIM_KERNEL
+static double kernel_dot_f64(const double *x, const double *y, uint64_t n)
+{
+    f64x4 acc = {0};
+    uint64_t i = 0;
+    for (; i + LIM_KERNEL_LANES <= n; i += LIM_KERNEL_LANES) {
+        acc += F64X4_LOAD(x + i) * F64X4_LOAD(y + i);
+    }
+    double result = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    for (; i < n; i++) {
+        result += x[i] * y[i];
+    }
+    return result;
+}
+
+LIM_KERNEL
+static void kernel_axpy_f64(double a, const double *x, double *y, uint64_t n)
+{
+    const f64x4 va = F64X4_SPLAT(a);
+    uint64_t i = 0;
+    for (; i + LIM_KERNEL_LANES <= n; i += LIM_KERNEL_LANES) {
+        F64X4_STORE(y + i, va * F64X4_LOAD(x + i) + F64X4_LOAD(y + i));
+    }
+    for (; i < n; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+LIM_KERNEL
+static void kernel_scale_f64(double a, double *x, uint64_t n)
+{
+    const f64x4 va = F64X4_SPLAT(a);
+    uint64_t i = 0;
+    for (; i + LIM_KERNEL_LANES <= n; i += LIM_KERNEL_LANES) {
+        F64X4_STORE(x + i, va * F64X4_LOAD(x + i));
+    }
+    for (; i < n; i++) {
+        x[i] *= a;
+    }
+}
+
+LIM_KERNEL
+static void kernel_prefix_sum_f64(double *x, uint64_t n)
+{
+    // In-register scan of each 4-lane block, then add the running carry.
+    double carry = 0.0;
+    uint64_t i = 0;
+    for (; i + LIM_KERNEL_LANES <= n; i += LIM_KERNEL_LANES) {
+        f64x4 v = F64X4_LOAD(x + i);
+        v += (f64x4){0.0, v[0], v[1], v[2]};
+        v += (f64x4){0.0, 0.0, v[0], v[1]};
+        v += F64X4_SPLAT(carry);
+        F64X4_STORE(x + i, v);
+        carry = v[3];
+    }
+    for (; i < n; i++) {
+        carry += x[i];
+        x[i] = carry;
+    }
+}
+
+LIM_KERNEL
+static double kernel_min_f64(const double *x, uint64_t n)
+{
+    f64x4 acc = F64X4_SPLAT(HUGE_VAL);
+    uint64_t i = 0;
+    for (; i + LIM_KERNEL_LANES <= n; i += LIM_KERNEL_LANES) {
+        f64x4 v = F64X4_LOAD(x + i);
+        acc = F64X4_SELECT(v < acc, v, acc);
+    }
+    double result = acc[0];
+    for (size_t j = 1; j < LIM_KERNEL_LANES; j++) {
+        result = acc[j] < result ? acc[j] : result;
+    }
+    for (; i < n; i++) {
+        result = x[i] < result ? x[i] : result;
+    }
+    return result;
+}
+
+LIM_KERNEL
+static double kernel_max_f64(const double *x, uint64_t n)
+{
+    f64x4 acc = F64X4_SPLAT(-HUGE_VAL);
+    uint64_t i = 0;
+    for (; i + LIM_KERNEL_LANES <= n; i += LIM_KERNEL_LANES) {
+        f64x4 v = F64X4_LOAD(x + i);
+        acc = F64X4_SELECT(v > acc, v, acc);
+    }
+    double result = acc[0];
+    for (size_t j = 1; j < LIM_KERNEL_LANES; j++) {
+        result = acc[j] > result ? acc[j] : result;
+    }
+    for (; i < n; i++) {
+        result = x[i] > result ? x[i] : result;
+    }
+    return result;
+}
+
+LIM_KERNEL
+// Clamp a bucket position computed in doubles into [0, bins_size) before it
+// is converted, the conversion of an out of range double is undefined.
+static inline uint64_t histogram_bin(double f, uint64_t bins_size)
+{
+    if (!(f > 0)) {
+        return 0;
+    }
+    uint64_t b = f < (double) bins_size ? (uint64_t) f : bins_size - 1;
+    return b < bins_size ? b : bins_size - 1;
+}
+
+static void kernel_histogram_f64(const double *x,
+                                 uint64_t n,
+                                 uint64_t *bins,
+                                 uint64_t bins_size,
+                                 double lo,
+                                 double hi)
+{
+    // Bucket indices are computed a vector at a time, the scatter into
+    // `bins` stays scalar. Values outside of [lo, hi) are not counted.
+    // Both bounds are finite, but hi - lo may still overflow, in which case
+    // everything is computed on halved values.
+    const double s = isinf(hi - lo) ? 0.5 : 1.0;
+    const double slo = lo * s;
+    const double w = hi * s - slo;
+    const double m = (double) bins_size;
+    const f64x4 vs = F64X4_SPLAT(s);
+    const f64x4 vslo = F64X4_SPLAT(slo);
+    const f64x4 vw = F64X4_SPLAT(w);
+    const f64x4 vm = F64X4_SPLAT(m);
+    uint64_t i = 0;
+    for (; i + LIM_KERNEL_LANES <= n; i += LIM_KERNEL_LANES) {
+        f64x4 v = F64X4_LOAD(x + i);
+        f64x4 idx = (v * vs - vslo) / vw * vm;
+        for (size_t j = 0; j < LIM_KERNEL_LANES; j++) {
+            if (v[j] >= lo && v[j] < hi) {
+                bins[histogram_bin(idx[j], bins_size)]++;
+            }
+        }
+    }
+    for (; i < n; i++) {
+        if (x[i] >= lo && x[i] < hi) {
+            bins[histogram_bin((x[i] * s - slo) / w * m, bins_size)]++;
+        }
+    }
+}
+
+// Map a double onto an unsigned key with the same total order, so that the
+// radix sort below can work on plain integers.
+static inline uint64_t f64_sort_key(double x)
+{
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return (u & (1ULL << 63)) ? ~u : u | (1ULL << 63);
+}
+
+static inline double f64_from_sort_key(uint64_t u)
+{
+    u = (u & (1ULL << 63)) ? u & ~(1ULL << 63) : ~u;
+    double x;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+#define SORT_RADIX_BITS 11
+#define SORT_RADIX_SIZE (1 << SORT_RADIX_BITS)
+#define SORT_RADIX_PASSES ((64 + SORT_RADIX_BITS - 1) / SORT_RADIX_BITS)
+
+// LSD radix sort: O(n) with branch-free inner loops. Returns false when the
+// scratch buffer is too big or can not be allocated.
+static bool kernel_sort_f64(double *x, uint64_t n)
+{
+    if (n < 2) {
+        return true;
+    }
+    if (n > (SIZE_MAX / sizeof(uint64_t) -
+             SORT_RADIX_PASSES * SORT_RADIX_SIZE) / 2) {
+        return false;
+    }
+
+    uint64_t(*counts)[SORT_RADIX_SIZE] =
+        calloc(1, sizeof(uint64_t) * (SORT_RADIX_PASSES * SORT_RADIX_SIZE +
+                                      n * 2));
+    if (counts == NULL) {
+        return false;
+    }
+    uint64_t *keys = (uint64_t *) (counts + SORT_RADIX_PASSES);
+    uint64_t *tmp = keys + n;
+
+    for (uint64_t i = 0; i < n; i++) {
+        keys[i] = f64_sort_key(x[i]);
+        for (size_t p = 0; p < SORT_RADIX_PASSES; p++) {
+            counts[p][(keys[i] >> (p * SORT_RADIX_BITS)) &
+                      (SORT_RADIX_SIZE - 1)]++;
+        }
+    }
+
+    for (size_t p = 0; p < SORT_RADIX_PASSES; p++) {
+        const size_t shift = p * SORT_RADIX_BITS;
+        // skip passes where every key shares the same digit
+        if (counts[p][(keys[0] >> shift) & (SORT_RADIX_SIZE - 1)] == n) {
+            continue;
+        }
+
+        uint64_t offset = 0;
+        for (size_t d = 0; d < SORT_RADIX_SIZE; d++) {
+            uint64_t c = counts[p][d];
+            counts[p][d] = offset;
+            offset += c;
+        }
+        for (uint64_t i = 0; i < n; i++) {
+            tmp[counts[p][(keys[i] >> shift) & (SORT_RADIX_SIZE - 1)]++] =
+                keys[i];
+        }
+
+        uint64_t *t = keys;
+        keys = tmp;
+        tmp = t;
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        x[i] = f64_from_sort_key(keys[i]);
+    }
+    free(counts);
+    return true;
+}
+
+static Trap lim_sum_f64(Lim *lim)
+{
+    // [ptr len] -> [sum]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const double *x = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t n = lim->stack[lim->stack_size - 1].as_u64;
+    lim->stack[lim->stack_size - 2].as_f64 = kernel_sum_f64(x, n);
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_dot_f64(Lim *lim)
+{
+    // [x y len] -> [dot]
+    if (lim->stack_size < 3) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const double *x = lim->stack[lim->stack_size - 3].as_ptr;
+    const double *y = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t n = lim->stack[lim->stack_size - 1].as_u64;
+    lim->stack[lim->stack_size - 3].as_f64 = kernel_dot_f64(x, y, n);
+    lim->stack_size -= 2;
+    return TRAP_OK;
+}
+
+static Trap lim_axpy_f64(Lim *lim)
+{
+    // [a x y len] -> [], y = a * x + y
+    if (lim->stack_size < 4) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    double a = lim->stack[lim->stack_size - 4].as_f64;
+    const double *x = lim->stack[lim->stack_size - 3].as_ptr;
+    double *y = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t n = lim->stack[lim->stack_size - 1].as_u64;
+    kernel_axpy_f64(a, x, y, n);
+    lim->stack_size -= 4;
+    return TRAP_OK;
+}
+
+static Trap lim_scale_f64(Lim *lim)
+{
+    // [a x len] -> [], x = a * x
+    if (lim->stack_size < 3) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    double a = lim->stack[lim->stack_size - 3].as_f64;
+    double *x = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t n = lim->stack[lim->stack_size - 1].as_u64;
+    kernel_scale_f64(a, x, n);
+    lim->stack_size -= 3;
+    return TRAP_OK;
+}
+
+static Trap lim_prefix_sum_f64(Lim *lim)
+{
+    // [ptr len] -> [], inclusive scan in place
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    double *x = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t n = lim->stack[lim->stack_size - 1].as_u64;
+    kernel_prefix_sum_f64(x, n);
+    lim->stack_size -= 2;
+    return TRAP_OK;
+}
+
+static Trap lim_min_f64(Lim *lim)
+{
+    // [ptr len] -> [min], +inf for an empty buffer
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const double *x = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t n = lim->stack[lim->stack_size - 1].as_u64;
+    lim->stack[lim->stack_size - 2].as_f64 = kernel_min_f64(x, n);
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_max_f64(Lim *lim)
+{
+    // [ptr len] -> [max], -inf for an empty buffer
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const double *x = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t n = lim->stack[lim->stack_size - 1].as_u64;
+    lim->stack[lim->stack_size - 2].as_f64 = kernel_max_f64(x, n);
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_sort_f64(Lim *lim)
+{
+    // [ptr len] -> [ok], ascending in place. Like the other natives that
+    // allocate, ok is 0 and the buffer is left untouched when the scratch
+    // buffer is too big or out of memory.
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    double *x = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t n = lim->stack[lim->stack_size - 1].as_u64;
+    lim->stack[lim->stack_size - 2].as_u64 = kernel_sort_f64(x, n);
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_histogram_f64(Lim *lim)
+{
+    // [ptr len bins bins_len lo hi] -> [], bins are u64 counters that get
+    // incremented (not cleared) by this call
+    if (lim->stack_size < 6) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const double *x = lim->stack[lim->stack_size - 6].as_ptr;
+    uint64_t n = lim->stack[lim->stack_size - 5].as_u64;
+    uint64_t *bins = lim->stack[lim->stack_size - 4].as_ptr;
+    uint64_t bins_size = lim->stack[lim->stack_size - 3].as_u64;
+    double lo = lim->stack[lim->stack_size - 2].as_f64;
+    double hi = lim->stack[lim->stack_size - 1].as_f64;
+    if (bins_size == 0 || !(lo < hi) || !isfinite(lo) || !isfinite(hi)) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    kernel_histogram_f64(x, n, bins, bins_size, lo, hi);
+    lim->stack_size -= 6;
+    return TRAP_OK;
+}
+
+// Open addressing in the style of SwissTable: a control byte per slot holds
+// 7 bits of the hash of its key, or marks the slot empty or deleted. A probe
+// compares a whole group of control bytes with one SIMD compare and only
+// looks at the keys whose bits match. Groups are probed in triangular steps,
+// which visits every group of a power of two table, and a probe ends at the
+// first group with an empty slot.
+#define LIM_MAP_GROUP 16
+#define LIM_MAP_EMPTY 0x80
+#define LIM_MAP_DELETED 0xfe
+
+typedef struct {
+    Word key;
+    Word value;
+} Lim_Map_Slot;
+
+struct Lim_Map {
+    uint64_t capacity;  // a power of two, at least one group
+    uint64_t size;
+    uint64_t deleted;
+    uint8_t *ctrl;
+    Lim_Map_Slot *slots;
+};
+
+static inline uint64_t lim_map_hash(Word key)
+{
+    uint64_t h = key.as_u64;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+// Bit i is set when control byte i of the group is `byte`
+static inline uint32_t lim_map_match(const uint8_t *group, uint8_t byte)
+{
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+#else
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < LIM_MAP_GROUP; i++) {
+        mask |= (uint32_t) (group[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+// Bit i is set when slot i of the group is empty or deleted
+static inline uint32_t lim_map_match_free(const uint8_t *group)
+{
+#if defined(__SSE2__)
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+#else
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < LIM_MAP_GROUP; i++) {
+        mask |= (uint32_t) (group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+static Lim_Map_Slot *lim_map_find(const Lim_Map *map, Word key, uint64_t hash)
+{
+    const uint64_t groups_mask = map->capacity / LIM_MAP_GROUP - 1;
+    uint64_t g = (hash >> 7) & groups_mask;
+    for (uint64_t step = 1; step <= groups_mask + 1; step++) {
+        const uint8_t *group = map->ctrl + g * LIM_MAP_GROUP;
+        for (uint32_t m = lim_map_match(group, hash & 0x7f); m != 0;
+             m &= m - 1) {
+            Lim_Map_Slot *slot =
+                &map->slots[g * LIM_MAP_GROUP + __builtin_ctz(m)];
+            if (slot->key.as_u64 == key.as_u64) {
+                return slot;
+            }
+        }
+        if (lim_map_match(group, LIM_MAP_EMPTY) != 0) {
+            break;
+        }
+        g = (g + step) & groups_mask;
+    }
+    return NULL;
+}
+
+// The key must not be in the map and there must be a free slot
+static void lim_map_place(Lim_Map *map, Word key, Word value, uint64_t hash)
+{
+    const uint64_t groups_mask = map->capacity / LIM_MAP_GROUP - 1;
+    uint64_t g = (hash >> 7) & groups_mask;
+    uint32_t m = 0;
+    for (uint64_t step = 1;
+         (m = lim_map_match_free(map->ctrl + g * LIM_MAP_GROUP)) == 0;
+         step++) {
+        g = (g + step) & groups_mask;
+    }
+    uint64_t i = g * LIM_MAP_GROUP + __builtin_ctz(m);
+    if (map->ctrl[i] == LIM_MAP_DELETED) {
+        map->deleted--;
+    }
+    map->ctrl[i] = hash & 0x7f;
+    map->slots[i] = (Lim_Map_Slot){.key = key, .value = value};
+    map->size++;
+}
+
+static bool lim_map_rehash(Lim *lim, Lim_Map *map, uint64_t capacity)
+{
+    Lim_Map_Slot *slots =
+        lim_heap_alloc(lim, (sizeof(*slots) + 1) * capacity);
+    if (slots == NULL) {
+        return false;
+    }
+    const Lim_Map old = *map;
+    map->capacity = capacity;
+    map->size = 0;
+    map->deleted = 0;
+    map->slots = slots;
+    map->ctrl = (uint8_t *) (slots + capacity);
+    memset(map->ctrl, LIM_MAP_EMPTY, capacity);
+    for (uint64_t i = 0; i < old.capacity; i++) {
+        if (old.ctrl[i] < LIM_MAP_EMPTY) {
+            lim_map_place(map, old.slots[i].key, old.slots[i].value,
+                          lim_map_hash(old.slots[i].key));
+        }
+    }
+    lim_heap_free(lim, old.slots);
+    return true;
+}
+
+Lim_Map *lim_map_create(Lim *lim, uint64_t capacity)
+{
+    // more slots than that do not fit into the heap
+    if (capacity > LIM_HEAP_CAPACITY / (sizeof(Lim_Map_Slot) + 1)) {
+        return NULL;
+    }
+    // at most 7/8 of the slots are used
+    uint64_t slots = LIM_MAP_GROUP;
+    while (slots / 8 * 7 < capacity) {
+        slots *= 2;
+    }
+    Lim_Map *map = lim_heap_alloc(lim, sizeof(*map));
+    if (map == NULL) {
+        return NULL;
+    }
+    *map = (Lim_Map){0};
+    if (!lim_map_rehash(lim, map, slots)) {
+        lim_heap_free(lim, map);
+        return NULL;
+    }
+    return map;
+}
+
+void lim_map_destroy(Lim *lim, Lim_Map *map)
+{
+    if (map != NULL) {
+        lim_heap_free(lim, map->slots);
+        lim_heap_free(lim, map);
+    }
+}
+
+bool lim_map_insert(Lim *lim, Lim_Map *map, Word key, Word value)
+{
+    const uint64_t hash = lim_map_hash(key);
+    Lim_Map_Slot *slot = lim_map_find(map, key, hash);
+    if (slot != NULL) {
+        slot->value = value;
+        return true;
+    }
+    if ((map->size + map->deleted + 1) * 8 > map->capacity * 7) {
+        // grow when the keys fill half of the map, otherwise just drop the
+        // deleted slots
+        uint64_t capacity = map->capacity;
+        if ((map->size + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+        if (!lim_map_rehash(lim, map, capacity)) {
+            return false;
+        }
+    }
+    lim_map_place(map, key, value, hash);
+    return true;
+}
+
+bool lim_map_get(const Lim_Map *map, Word key, Word *value)
+{
+    const Lim_Map_Slot *slot = lim_map_find(map, key, lim_map_hash(key));
+    if (slot == NULL) {
+        return false;
+    }
+    *value = slot->value;
+    return true;
+}
+
+bool lim_map_delete(Lim_Map *map, Word key)
+{
+    Lim_Map_Slot *slot = lim_map_find(map, key, lim_map_hash(key));
+    if (slot == NULL) {
+        return false;
+    }
+    uint64_t i = slot - map->slots;
+    // no probe went past a group with an empty slot, so the slot can be
+    // empty again instead of deleted
+    if (lim_map_match(map->ctrl + i / LIM_MAP_GROUP * LIM_MAP_GROUP,
+                      LIM_MAP_EMPTY) != 0) {
+        map->ctrl[i] = LIM_MAP_EMPTY;
+    } else {
+        map->ctrl[i] = LIM_MAP_DELETED;
+        map->deleted++;
+    }
+    map->size--;
+    return true;
+}
+
+uint64_t lim_map_size(const Lim_Map *map)
+{
+    return map->size;
+}
+
+uint64_t lim_map_next(const Lim_Map *map, uint64_t cursor)
+{
+    for (uint64_t i = cursor; i < map->capacity; i++) {
+        if (map->ctrl[i] < LIM_MAP_EMPTY) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static const Lim_Map_Slot *lim_map_at(const Lim_Map *map, uint64_t cursor)
+{
+    if (cursor == 0 || cursor > map->capacity ||
+        map->ctrl[cursor - 1] >= LIM_MAP_EMPTY) {
+        return NULL;
+    }
+    return &map->slots[cursor - 1];
+}
+
+static Trap lim_map_new(Lim *lim)
+{
+    // [capacity] -> [map or 0 when out of memory]
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *top = &lim->stack[lim->stack_size - 1];
+    top->as_ptr = lim_map_create(lim, top->as_u64);
+    return TRAP_OK;
+}
+
+static Trap lim_map_insert_native(Lim *lim)
+{
+    // [map key value] -> [0 when out of memory]
+    if (lim->stack_size < 3) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Lim_Map *map = lim->stack[lim->stack_size - 3].as_ptr;
+    if (map == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    bool ok = lim_map_insert(lim, map, lim->stack[lim->stack_size - 2],
+                             lim->stack[lim->stack_size - 1]);
+    lim->stack[lim->stack_size - 3].as_u64 = ok;
+    lim->stack_size -= 2;
+    return TRAP_OK;
+}
+
+static Trap lim_map_get_native(Lim *lim)
+{
+    // [map key default] -> [value, or default when the key is missing]
+    if (lim->stack_size < 3) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const Lim_Map *map = lim->stack[lim->stack_size - 3].as_ptr;
+    if (map == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    Word value = lim->stack[lim->stack_size - 1];
+    lim_map_get(map, lim->stack[lim->stack_size - 2], &value);
+    lim->stack[lim->stack_size - 3] = value;
+    lim->stack_size -= 2;
+    return TRAP_OK;
+}
+
+static Trap lim_map_has(Lim *lim)
+{
+    // [map key] -> [1 when the key is in the map]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const Lim_Map *map = lim->stack[lim->stack_size - 2].as_ptr;
+    if (map == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    Word value;
+    lim->stack[lim->stack_size - 2].as_u64 =
+        lim_map_get(map, lim->stack[lim->stack_size - 1], &value);
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_map_delete_native(Lim *lim)
+{
+    // [map key] -> [1 when the key was in the map]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Lim_Map *map = lim->stack[lim->stack_size - 2].as_ptr;
+    if (map == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    lim->stack[lim->stack_size - 2].as_u64 =
+        lim_map_delete(map, lim->stack[lim->stack_size - 1]);
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_map_size_native(Lim *lim)
+{
+    // [map] -> [size]
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *top = &lim->stack[lim->stack_size - 1];
+    if (top->as_ptr == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    top->as_u64 = lim_map_size(top->as_ptr);
+    return TRAP_OK;
+}
+
+static Trap lim_map_next_native(Lim *lim)
+{
+    // [map cursor] -> [cursor of the next entry, 0 after the last one]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const Lim_Map *map = lim->stack[lim->stack_size - 2].as_ptr;
+    if (map == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    lim->stack[lim->stack_size - 2].as_u64 =
+        lim_map_next(map, lim->stack[lim->stack_size - 1].as_u64);
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_map_entry(Lim *lim, bool key)
+{
+    // [map cursor] -> [key or value of the entry]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const Lim_Map *map = lim->stack[lim->stack_size - 2].as_ptr;
+    if (map == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    const Lim_Map_Slot *slot =
+        lim_map_at(map, lim->stack[lim->stack_size - 1].as_u64);
+    if (slot == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    lim->stack[lim->stack_size - 2] = key ? slot->key : slot->value;
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_map_key(Lim *lim)
+{
+    return lim_map_entry(lim, true);
+}
+
+static Trap lim_map_value(Lim *lim)
+{
+    return lim_map_entry(lim, false);
+}
+
+static Trap lim_map_free(Lim *lim)
+{
+    // [map] -> []
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    lim_map_destroy(lim, lim->stack[--lim->stack_size].as_ptr);
+    return TRAP_OK;
+}
+
+// A big integer is a sign and a magnitude of 64 bit limbs, the least
+// significant first and without leading zero limbs, so zero has no limbs.
+// The kernels work on plain limb arrays. Products are schoolbook below
+// LIM_BIG_KARATSUBA limbs and Karatsuba above, which trades one of the four
+// half sized products for a few additions. Quotients use Knuth's algorithm D.
+// Decimal conversion splits the number by 10^(19 * 2^k) recursively, so the
+// work goes into a few large divisions instead of one pass over the whole
+// number for every 19 digits.
+#define LIM_BIG_KARATSUBA 32
+#define LIM_BIG_DIGITS_BASE 32
+#define LIM_BIG_CHUNK_DIGITS 19
+#define LIM_BIG_CHUNK 10000000000000000000ULL
+
+__extension__ typedef unsigned __int128 Lim_U128;
+
+struct Lim_Big {
+    uint64_t size;
+    bool negative;
+    uint64_t limbs[];
+};
+
+static uint64_t lim_limbs_normalize(const uint64_t *a, uint64_t n)
+{
+    while (n > 0 && a[n - 1] == 0) {
+        n--;
+    }
+    return n;
+}
+
+// Compares normalized limbs
+static int lim_limbs_cmp(const uint64_t *a, uint64_t an, const uint64_t *b,
+                         uint64_t bn)
+{
+    if (an != bn) {
+        return an < bn ? -1 : 1;
+    }
+    for (uint64_t i = an; i-- > 0;) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// r[0, an] = a + b for an >= bn
+static void lim_limbs_add(uint64_t *r, const uint64_t *a, uint64_t an,
+                          const uint64_t *b, uint64_t bn)
+{
+    uint64_t carry = 0;
+    for (uint64_t i = 0; i < bn; i++) {
+        Lim_U128 t = (Lim_U128) a[i] + b[i] + carry;
+        r[i] = (uint64_t) t;
+        carry = (uint64_t) (t >> 64);
+    }
+    for (uint64_t i = bn; i < an; i++) {
+        r[i] = a[i] + carry;
+        carry = r[i] < carry;
+    }
+    r[an] = carry;
+}
+
+// r[0, rn) += a[0, an) for an <= rn when the sum fits
+static void lim_limbs_add_to(uint64_t *r, uint64_t rn, const uint64_t *a,
+                             uint64_t an)
+{
+    uint64_t carry = 0;
+    for (uint64_t i = 0; i < an; i++) {
+        Lim_U128 t = (Lim_U128) r[i] + a[i] + carry;
+        r[i] = (uint64_t) t;
+        carry = (uint64_t) (t >> 64);
+    }
+    for (uint64_t i = an; carry != 0 && i < rn; i++) {
+        r[i] += carry;
+        carry = r[i] == 0;
+    }
+}
+
+// r[0, rn) -= a[0, an) for an <= rn when r >= a
+static void lim_limbs_sub_from(uint64_t *r, uint64_t rn, const uint64_t *a,
+                               uint64_t an)
+{
+    uint64_t borrow = 0;
+    for (uint64_t i = 0; i < an; i++) {
+        uint64_t x = r[i];
+        r[i] = x - a[i] - borrow;
+        borrow = x < a[i] || x - a[i] < borrow;
+    }
+    for (uint64_t i = an; borrow != 0 && i < rn; i++) {
+        borrow = r[i] == 0;
+        r[i]--;
+    }
+}
+
+// r[0, an + bn) = a * b, r overlaps neither a nor b
+static void lim_limbs_mul_school(uint64_t *r, const uint64_t *a, uint64_t an,
+                                 const uint64_t *b, uint64_t bn)
+{
+    memset(r, 0, an * sizeof(*r));
+    for (uint64_t j = 0; j < bn; j++) {
+        uint64_t carry = 0;
+        for (uint64_t i = 0; i < an; i++) {
+            Lim_U128 t = (Lim_U128) a[i] * b[j] + r[i + j] + carry;
+            r[i + j] = (uint64_t) t;
+            carry = (uint64_t) (t >> 64);
+        }
+        r[j + an] = carry;
+    }
+}
+
+// Scratch limbs of lim_limbs_mul_karatsuba, every level of the recursion
+// takes less than 2 * (an + bn) + 8 and halves the sizes
+static uint64_t lim_limbs_mul_scratch(uint64_t an, uint64_t bn)
+{
+    return 4 * (an + bn) + 64 * 8;
+}
+
+// r[0, an + bn) = a * b, r overlaps neither a nor b nor the scratch
+static void lim_limbs_mul_karatsuba(uint64_t *r, const uint64_t *a,
+                                    uint64_t an, const uint64_t *b,
+                                    uint64_t bn, uint64_t *scratch)
+{
+    if (an < bn) {
+        const uint64_t *t = a;
+        a = b;
+        b = t;
+        uint64_t tn = an;
+        an = bn;
+        bn = tn;
+    }
+    if (bn < LIM_BIG_KARATSUBA) {
+        lim_limbs_mul_school(r, a, an, b, bn);
+        return;
+    }
+
+    if (an >= 2 * bn) {
+        // a slice of a at a time, each product is balanced
+        uint64_t *t = scratch;
+        memset(r, 0, (an + bn) * sizeof(*r));
+        for (uint64_t i = 0; i < an; i += bn) {
+            uint64_t n = an - i < bn ? an - i : bn;
+            lim_limbs_mul_karatsuba(t, a + i, n, b, bn, scratch + 2 * bn);
+            lim_limbs_add_to(r + i, an + bn - i, t, n + bn);
+        }
+        return;
+    }
+
+    // a = a1 B^m + a0 and b = b1 B^m + b0 with a1 and b1 not empty, then
+    // a b = z2 B^2m + z1 B^m + z0 where z1 = (a0 + a1)(b0 + b1) - z2 - z0
+    uint64_t m = an / 2;
+    uint64_t a1n = an - m;
+    uint64_t b1n = bn - m;
+    lim_limbs_mul_karatsuba(r, a, m, b, m, scratch);
+    lim_limbs_mul_karatsuba(r + 2 * m, a + m, a1n, b + m, b1n, scratch);
+
+    uint64_t sa_n = a1n + 1;
+    uint64_t sb_n = (m > b1n ? m : b1n) + 1;
+    uint64_t z1_n = sa_n + sb_n;
+    uint64_t *sa = scratch;
+    uint64_t *sb = sa + sa_n;
+    uint64_t *z1 = sb + sb_n;
+    lim_limbs_add(sa, a + m, a1n, a, m);
+    if (m > b1n) {
+        lim_limbs_add(sb, b, m, b + m, b1n);
+    } else {
+        lim_limbs_add(sb, b + m, b1n, b, m);
+    }
+    lim_limbs_mul_karatsuba(z1, sa, sa_n, sb, sb_n, z1 + z1_n);
+    lim_limbs_sub_from(z1, z1_n, r, 2 * m);
+    lim_limbs_sub_from(z1, z1_n, r + 2 * m, a1n + b1n);
+
+    // z1 fits in the product, so the limbs past it are zero
+    uint64_t rn = an + bn - m;
+    lim_limbs_add_to(r + m, rn, z1, z1_n < rn ? z1_n : rn);
+}
+
+// r[0, an + bn) = a * b, false when out of memory
+static bool lim_limbs_mul(uint64_t *r, const uint64_t *a, uint64_t an,
+                          const uint64_t *b, uint64_t bn)
+{
+    if (an < LIM_BIG_KARATSUBA || bn < LIM_BIG_KARATSUBA) {
+        lim_limbs_mul_school(r, a, an, b, bn);
+        return true;
+    }
+    uint64_t *scratch =
+        malloc(lim_limbs_mul_scratch(an, bn) * sizeof(*scratch));
+    if (scratch == NULL) {
+        return false;
+    }
+    lim_limbs_mul_karatsuba(r, a, an, b, bn, scratch);
+    free(scratch);
+    return true;
+}
+
+// q[0, an) = a / d and returns a % d, q may be a
+static uint64_t lim_limbs_divmod_1(uint64_t *q, const uint64_t *a,
+                                   uint64_t an, uint64_t d)
+{
+    uint64_t r = 0;
+    for (uint64_t i = an; i-- > 0;) {
+        Lim_U128 t = (Lim_U128) r << 64 | a[i];
+        q[i] = (uint64_t) (t / d);
+        r = (uint64_t) (t % d);
+    }
+    return r;
+}
+
+// r[0, n) = a << s for s < 64, returns the limb shifted out
+static uint64_t lim_limbs_shl(uint64_t *r, const uint64_t *a, uint64_t n,
+                              int s)
+{
+    if (s == 0) {
+        memmove(r, a, n * sizeof(*r));
+        return 0;
+    }
+    uint64_t out = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t x = a[i];
+        r[i] = x << s | out;
+        out = x >> (64 - s);
+    }
+    return out;
+}
+
+// r[0, n) = a >> s for s < 64
+static void lim_limbs_shr(uint64_t *r, const uint64_t *a, uint64_t n, int s)
+{
+    if (s == 0) {
+        memmove(r, a, n * sizeof(*r));
+        return;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        r[i] = a[i] >> s | (i + 1 < n ? a[i + 1] << (64 - s) : 0);
+    }
+}
+
+// q[0, an - bn + 1) = a / b and r[0, bn) = a % b for an >= bn >= 2 and a
+// normalized b, false when out of memory
+static bool lim_limbs_divmod(uint64_t *q, uint64_t *r, const uint64_t *a,
+                             uint64_t an, const uint64_t *b, uint64_t bn)
+{
+    uint64_t *u = malloc((an + 1 + bn) * sizeof(*u));
+    if (u == NULL) {
+        return false;
+    }
+    // with the top bit of the divisor set each estimated quotient limb is
+    // at most two too large
+    uint64_t *v = u + an + 1;
+    int s = __builtin_clzll(b[bn - 1]);
+    lim_limbs_shl(v, b, bn, s);
+    u[an] = lim_limbs_shl(u, a, an, s);
+
+    for (uint64_t j = an - bn + 1; j-- > 0;) {
+        Lim_U128 top = (Lim_U128) u[j + bn] << 64 | u[j + bn - 1];
+        Lim_U128 qhat = top / v[bn - 1];
+        Lim_U128 rhat = top % v[bn - 1];
+        while (qhat >> 64 != 0 ||
+               qhat * v[bn - 2] > (rhat << 64 | u[j + bn - 2])) {
+            qhat--;
+            rhat += v[bn - 1];
+            if (rhat >> 64 != 0) {
+                break;
+            }
+        }
+
+        // u[j, j + bn] -= qhat * v
+        uint64_t carry = 0;
+        uint64_t borrow = 0;
+        for (uint64_t i = 0; i < bn; i++) {
+            Lim_U128 p = (Lim_U128) (uint64_t) qhat * v[i] + carry;
+            uint64_t lo = (uint64_t) p;
+            uint64_t x = u[i + j];
+            carry = (uint64_t) (p >> 64);
+            u[i + j] = x - lo - borrow;
+            borrow = x < lo || x - lo < borrow;
+        }
+        uint64_t x = u[j + bn];
+        u[j + bn] = x - carry - borrow;
+        if (x < carry || x - carry < borrow) {
+            // qhat was one too large, add v back
+            qhat--;
+            carry = 0;
+            for (uint64_t i = 0; i < bn; i++) {
+                Lim_U128 t = (Lim_U128) u[i + j] + v[i] + carry;
+                u[i + j] = (uint64_t) t;
+                carry = (uint64_t) (t >> 64);
+            }
+            u[j + bn] += carry;
+        }
+        q[j] = (uint64_t) qhat;
+    }
+
+    lim_limbs_shr(r, u, bn, s);
+    free(u);
+    return true;
+}
+
+static Lim_Big *lim_big_alloc(Lim *lim, uint64_t size)
+{
+    Lim_Big *big =
+        lim_heap_alloc(lim, sizeof(*big) + size * sizeof(big->limbs[0]));
+    if (big != NULL) {
+        big->size = size;
+        big->negative = false;
+    }
+    return big;
+}
+
+// Drops the leading zero limbs, zero is never negative
+static Lim_Big *lim_big_normalize(Lim_Big *big)
+{
+    big->size = lim_limbs_normalize(big->limbs, big->size);
+    if (big->size == 0) {
+        big->negative = false;
+    }
+    return big;
+}
+
+Lim_Big *lim_big_from_i64(Lim *lim, int64_t x)
+{
+    Lim_Big *big = lim_big_alloc(lim, 1);
+    if (big == NULL) {
+        return NULL;
+    }
+    big->limbs[0] = x < 0 ? -(uint64_t) x : (uint64_t) x;
+    big->negative = x < 0;
+    return lim_big_normalize(big);
+}
+
+void lim_big_destroy(Lim *lim, Lim_Big *big)
+{
+    lim_heap_free(lim, big);
+}
+
+int64_t lim_big_to_i64(const Lim_Big *big)
+{
+    uint64_t low = big->size > 0 ? big->limbs[0] : 0;
+    return (int64_t) (big->negative ? -low : low);
+}
+
+int lim_big_cmp(const Lim_Big *a, const Lim_Big *b)
+{
+    if (a->negative != b->negative) {
+        return a->negative ? -1 : 1;
+    }
+    int c = lim_limbs_cmp(a->limbs, a->size, b->limbs, b->size);
+    return a->negative ? -c : c;
+}
+
+// a + b, or a - b when `negate`
+static Lim_Big *lim_big_add_signed(Lim *lim, const Lim_Big *a,
+                                   const Lim_Big *b, bool negate)
+{
+    bool a_negative = a->negative;
+    bool b_negative = b->negative != negate;
+    Lim_Big *r = NULL;
+    if (a_negative == b_negative) {
+        if (a->size < b->size) {
+            const Lim_Big *t = a;
+            a = b;
+            b = t;
+        }
+        r = lim_big_alloc(lim, a->size + 1);
+        if (r == NULL) {
+            return NULL;
+        }
+        lim_limbs_add(r->limbs, a->limbs, a->size, b->limbs, b->size);
+        r->negative = a_negative;
+        return lim_big_normalize(r);
+    }
+
+    // the difference of the magnitudes takes the sign of the larger one
+    if (lim_limbs_cmp(a->limbs, a->size, b->limbs, b->size) < 0) {
+        const Lim_Big *t = a;
+        a = b;
+        b = t;
+        a_negative = b_negative;
+    }
+    r = lim_big_alloc(lim, a->size);
+    if (r == NULL) {
+        return NULL;
+    }
+    memcpy(r->limbs, a->limbs, a->size * sizeof(r->limbs[0]));
+    lim_limbs_sub_from(r->limbs, r->size, b->limbs, b->size);
+    r->negative = a_negative;
+    return lim_big_normalize(r);
+}
+
+Lim_Big *lim_big_add(Lim *lim, const Lim_Big *a, const Lim_Big *b)
+{
+    return lim_big_add_signed(lim, a, b, false);
+}
+
+Lim_Big *lim_big_sub(Lim *lim, const Lim_Big *a, const Lim_Big *b)
+{
+    return lim_big_add_signed(lim, a, b, true);
+}
+
+Lim_Big *lim_big_mul(Lim *lim, const Lim_Big *a, const Lim_Big *b)
+{
+    Lim_Big *r = lim_big_alloc(lim, a->size + b->size);
+    if (r == NULL) {
+        return NULL;
+    }
+    if (!lim_limbs_mul(r->limbs, a->limbs, a->size, b->limbs, b->size)) {
+        lim_heap_free(lim, r);
+        return NULL;
+    }
+    r->negative = a->negative != b->negative;
+    return lim_big_normalize(r);
+}
+
+bool lim_big_divmod(Lim *lim, const Lim_Big *a, const Lim_Big *b,
+                    Lim_Big **quotient, Lim_Big **remainder)
+{
+    uint64_t qn = a->size >= b->size ? a->size - b->size + 1 : 0;
+    Lim_Big *q = lim_big_alloc(lim, qn);
+    Lim_Big *r = lim_big_alloc(lim, b->size);
+    if (q == NULL || r == NULL) {
+        goto fail;
+    }
+
+    if (a->size < b->size) {
+        memcpy(r->limbs, a->limbs, a->size * sizeof(r->limbs[0]));
+        r->size = a->size;
+    } else if (b->size == 1) {
+        r->limbs[0] =
+            lim_limbs_divmod_1(q->limbs, a->limbs, a->size, b->limbs[0]);
+    } else if (!lim_limbs_divmod(q->limbs, r->limbs, a->limbs, a->size,
+                                 b->limbs, b->size)) {
+        goto fail;
+    }
+    q->negative = a->negative != b->negative;
+    r->negative = a->negative;
+    *quotient = lim_big_normalize(q);
+    *remainder = lim_big_normalize(r);
+    return true;
+
+fail:
+    lim_heap_free(lim, q);
+    lim_heap_free(lim, r);
+    return false;
+}
+
+Lim_Big *lim_big_pow(Lim *lim, const Lim_Big *a, uint64_t exponent)
+{
+    // square and multiply from the top bit of the exponent down
+    Lim_Big *r = lim_big_from_i64(lim, 1);
+    for (int bit = 63; bit >= 0 && r != NULL; bit--) {
+        if (exponent >> bit == 0) {
+            continue;
+        }
+        Lim_Big *square = lim_big_mul(lim, r, r);
+        lim_heap_free(lim, r);
+        r = square;
+        if (r != NULL && (exponent >> bit & 1)) {
+            Lim_Big *product = lim_big_mul(lim, r, a);
+            lim_heap_free(lim, r);
+            r = product;
+        }
+    }
+    return r;
+}
+
+typedef struct {
+    uint64_t *limbs;
+    uint64_t size;
+} Lim_Limbs;
+
+// Writes a[0, n) < 10^(19 * 2^level) as exactly 19 * 2^level digits with
+// leading zeros, a is clobbered. powers[k] is 10^(19 * 2^k).
+static bool lim_big_digits(char *out, uint64_t *a, uint64_t n,
+                           const Lim_Limbs *powers, uint64_t level)
+{
+    n = lim_limbs_normalize(a, n);
+    uint64_t width = (uint64_t) LIM_BIG_CHUNK_DIGITS << level;
+    if (n <= LIM_BIG_DIGITS_BASE) {
+        // 19 digits at a time from the right
+        for (uint64_t i = width; i > 0; i -= LIM_BIG_CHUNK_DIGITS) {
+            uint64_t chunk = lim_limbs_divmod_1(a, a, n, LIM_BIG_CHUNK);
+            n = lim_limbs_normalize(a, n);
+            for (uint64_t k = 1; k <= LIM_BIG_CHUNK_DIGITS; k++) {
+                out[i - k] = '0' + chunk % 10;
+                chunk /= 10;
+            }
+        }
+        return true;
+    }
+
+    // a needs more than one limb here, so the power it is split by does too
+    uint64_t half = width / 2;
+    const Lim_Limbs *p = &powers[level - 1];
+    if (lim_limbs_cmp(a, n, p->limbs, p->size) < 0) {
+        memset(out, '0', half);
+        return lim_big_digits(out + half, a, n, powers, level - 1);
+    }
+    uint64_t qn = n - p->size + 1;
+    uint64_t *q = malloc((qn + p->size) * sizeof(*q));
+    if (q == NULL) {
+        return false;
+    }
+    uint64_t *r = q + qn;
+    bool ok = lim_limbs_divmod(q, r, a, n, p->limbs, p->size) &&
+              lim_big_digits(out, q, qn, powers, level - 1) &&
+              lim_big_digits(out + half, r, p->size, powers, level - 1);
+    free(q);
+    return ok;
+}
+
+char *lim_big_to_decimal(const Lim_Big *big)
+{
+    // a limb holds less than 19.27 digits, so 2^level limbs of 19 digits
+    // with an extra one every 64 are enough
+    uint64_t level = 0;
+    while ((1ULL << level) < big->size + big->size / 64 + 1) {
+        level++;
+    }
+    uint64_t width = (uint64_t) LIM_BIG_CHUNK_DIGITS << level;
+
+    Lim_Limbs powers[64] = {0};
+    char *digits = malloc(width + 2);
+    uint64_t *a = malloc((big->size + 1) * sizeof(*a));
+    bool ok = digits != NULL && a != NULL;
+    for (uint64_t k = 0; ok && k < level; k++) {
+        if (k == 0) {
+            powers[k].limbs = malloc(sizeof(uint64_t));
+            ok = powers[k].limbs != NULL;
+            if (ok) {
+                powers[k].limbs[0] = LIM_BIG_CHUNK;
+                powers[k].size = 1;
+            }
+            continue;
+        }
+        const Lim_Limbs *p = &powers[k - 1];
+        powers[k].limbs = malloc(2 * p->size * sizeof(uint64_t));
+        ok = powers[k].limbs != NULL &&
+             lim_limbs_mul(powers[k].limbs, p->limbs, p->size, p->limbs,
+                           p->size);
+        if (ok) {
+            powers[k].size = lim_limbs_normalize(powers[k].limbs, 2 * p->size);
+        }
+    }
+    if (ok) {
+        memcpy(a, big->limbs, big->size * sizeof(*a));
+        ok = lim_big_digits(digits + 1, a, big->size, powers, level);
+    }
+    for (uint64_t k = 0; k < level; k++) {
+        free(powers[k].limbs);
+    }
+    free(a);
+    if (!ok) {
+        free(digits);
+        return NULL;
+    }
+
+    // strip the leading zeros and keep at least one digit
+    uint64_t start = 1;
+    while (start < width && digits[start] == '0') {
+        start++;
+    }
+    if (big->negative) {
+        digits[--start] = '-';
+    }
+    memmove(digits, digits + start, width + 1 - start);
+    digits[width + 1 - start] = '\0';
+    return digits;
+}
+
+// The big natives return 0 when out of memory, which they trap on as an
+// operand
+static Trap lim_big_from_i64_native(Lim *lim)
+{
+    // [i64] -> [big]
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *top = &lim->stack[lim->stack_size - 1];
+    top->as_ptr = lim_big_from_i64(lim, top->as_i64);
+    return TRAP_OK;
+}
+
+static Trap lim_big_to_i64_native(Lim *lim)
+{
+    // [big] -> [low 64 bits of big]
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *top = &lim->stack[lim->stack_size - 1];
+    if (top->as_ptr == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    top->as_i64 = lim_big_to_i64(top->as_ptr);
+    return TRAP_OK;
+}
+
+static Trap lim_big_binary(Lim *lim, Lim_Big *(*op)(Lim *, const Lim_Big *,
+                                                    const Lim_Big *))
+{
+    // [a b] -> [a op b]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const Lim_Big *a = lim->stack[lim->stack_size - 2].as_ptr;
+    const Lim_Big *b = lim->stack[lim->stack_size - 1].as_ptr;
+    if (a == NULL || b == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    lim->stack[lim->stack_size - 2].as_ptr = op(lim, a, b);
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_big_add_native(Lim *lim)
+{
+    return lim_big_binary(lim, lim_big_add);
+}
+
+static Trap lim_big_sub_native(Lim *lim)
+{
+    return lim_big_binary(lim, lim_big_sub);
+}
+
+static Trap lim_big_mul_native(Lim *lim)
+{
+    return lim_big_binary(lim, lim_big_mul);
+}
+
+static Trap lim_big_divmod_native(Lim *lim)
+{
+    // [a b] -> [a / b rounded toward zero, a % b with the sign of a]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *a = &lim->stack[lim->stack_size - 2];
+    Word *b = &lim->stack[lim->stack_size - 1];
+    if (a->as_ptr == NULL || b->as_ptr == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    if (((const Lim_Big *) b->as_ptr)->size == 0) {
+        return TRAP_DIV_BY_ZERO;
+    }
+    Lim_Big *q = NULL;
+    Lim_Big *r = NULL;
+    lim_big_divmod(lim, a->as_ptr, b->as_ptr, &q, &r);
+    a->as_ptr = q;
+    b->as_ptr = r;
+    return TRAP_OK;
+}
+
+static Trap lim_big_pow_native(Lim *lim)
+{
+    // [a exponent] -> [a^exponent]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const Lim_Big *a = lim->stack[lim->stack_size - 2].as_ptr;
+    if (a == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    lim->stack[lim->stack_size - 2].as_ptr =
+        lim_big_pow(lim, a, lim->stack[lim->stack_size - 1].as_u64);
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_big_cmp_native(Lim *lim)
+{
+    // [a b] -> [-1, 0 or 1]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const Lim_Big *a = lim->stack[lim->stack_size - 2].as_ptr;
+    const Lim_Big *b = lim->stack[lim->stack_size - 1].as_ptr;
+    if (a == NULL || b == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    lim->stack[lim->stack_size - 2].as_i64 = lim_big_cmp(a, b);
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_big_print(Lim *lim)
+{
+    // [big] -> [], prints nothing when out of memory
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const Lim_Big *big = lim->stack[--lim->stack_size].as_ptr;
+    if (big == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    char *digits = lim_big_to_decimal(big);
+    if (digits != NULL) {
+        fprintf(lim_output(lim), "%s\n", digits);
+    }
+    free(digits);
+    return TRAP_OK;
+}
+
+static Trap lim_big_free(Lim *lim)
+{
+    // [big] -> []
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    lim_big_destroy(lim, lim->stack[--lim->stack_size].as_ptr);
+    return TRAP_OK;
+}
+
+// A ring is a bounded queue of cells which carry a sequence number, so a
+// sender and a receiver only touch the cell and their own counter. With one
+// sender and one receiver the counters are owned and advanced with a plain
+// store, with several they are advanced with a compare and swap.
+typedef struct {
+    atomic_uint_fast64_t seq;
+    Word value;
+} Lim_Ring_Cell;
+
+struct Lim_Ring {
+    bool mpmc;
+    uint64_t mask;
+    _Alignas(64) atomic_uint_fast64_t head;  // next cell to receive
+    _Alignas(64) atomic_uint_fast64_t tail;  // next cell to send
+    // Futex words bumped when a value or a free cell shows up while a thread
+    // waits for one
+    _Alignas(64) atomic_uint readable;
+    atomic_uint recv_waiters;
+    _Alignas(64) atomic_uint writable;
+    atomic_uint send_waiters;
+    atomic_bool closed;
+    _Alignas(64) Lim_Ring_Cell cells[];
+};
+
+// Attempts before a blocked sender or receiver parks in the kernel
+#define LIM_RING_SPIN 256
+
+Lim_Ring *lim_ring_create(uint64_t capacity, bool mpmc)
+{
+    if (capacity > LIM_RING_CAPACITY) {
+        return NULL;
+    }
+    uint64_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+    size_t bytes = sizeof(Lim_Ring) + sizeof(Lim_Ring_Cell) * size;
+    Lim_Ring *ring = aligned_alloc(64, (bytes + 63) & ~(size_t) 63);
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->mpmc = mpmc;
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->readable, 0);
+    atomic_init(&ring->recv_waiters, 0);
+    atomic_init(&ring->writable, 0);
+    atomic_init(&ring->send_waiters, 0);
+    atomic_init(&ring->closed, false);
+    for (uint64_t i = 0; i < size; i++) {
+        atomic_init(&ring->cells[i].seq, i);
+    }
+    return ring;
+}
+
+void lim_ring_destroy(Lim_Ring *ring)
+{
+    free(ring);
+}
+
+static void lim_ring_wake(atomic_uint *event, atomic_uint *waiters, int count)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiters, memory_order_relaxed) > 0) {
+        atomic_fetch_add(event, 1);
+        syscall(SYS_futex, event, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+    }
+}
+
+// Park until `event` moves on from `seen`, or spuriously
+static void lim_ring_park(atomic_uint *event, unsigned seen)
+{
+    syscall(SYS_futex, event, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+bool lim_ring_try_send(Lim_Ring *ring, Word value)
+{
+    if (atomic_load_explicit(&ring->closed, memory_order_relaxed)) {
+        return false;
+    }
+    uint64_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    Lim_Ring_Cell *cell = NULL;
+    for (;;) {
+        cell = &ring->cells[pos & ring->mask];
+        uint64_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        int64_t diff = (int64_t) (seq - pos);
+        if (diff < 0) {
+            return false;
+        } else if (diff > 0) {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        } else if (!ring->mpmc) {
+            atomic_store_explicit(&ring->tail, pos + 1, memory_order_relaxed);
+            break;
+        } else if (atomic_compare_exchange_weak_explicit(
+                       &ring->tail, &pos, pos + 1, memory_order_relaxed,
+                       memory_order_relaxed)) {
+            break;
+        }
+    }
+    cell->value = value;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    lim_ring_wake(&ring->readable, &ring->recv_waiters, 1);
+    return true;
+}
+
+bool lim_ring_try_recv(Lim_Ring *ring, Word *value)
+{
+    uint64_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    Lim_Ring_Cell *cell = NULL;
+    for (;;) {
+        cell = &ring->cells[pos & ring->mask];
+        uint64_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        int64_t diff = (int64_t) (seq - (pos + 1));
+        if (diff < 0) {
+            return false;
+        } else if (diff > 0) {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        } else if (!ring->mpmc) {
+            atomic_store_explicit(&ring->head, pos + 1, memory_order_relaxed);
+            break;
+        } else if (atomic_compare_exchange_weak_explicit(
+                       &ring->head, &pos, pos + 1, memory_order_relaxed,
+                       memory_order_relaxed)) {
+            break;
+        }
+    }
+    *value = cell->value;
+    atomic_store_explicit(&cell->seq, pos + ring->mask + 1,
+                          memory_order_release);
+    lim_ring_wake(&ring->writable, &ring->send_waiters, 1);
+    return true;
+}
+
+bool lim_ring_send(Lim_Ring *ring, Word value)
+{
+    for (int i = 0; i < LIM_RING_SPIN; i++) {
+        if (lim_ring_try_send(ring, value)) {
+            return true;
+        }
+    }
+    for (;;) {
+        unsigned seen = atomic_load(&ring->writable);
+        atomic_fetch_add(&ring->send_waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool sent = lim_ring_try_send(ring, value);
+        bool closed = atomic_load(&ring->closed);
+        if (!sent && !closed) {
+            lim_ring_park(&ring->writable, seen);
+        }
+        atomic_fetch_sub(&ring->send_waiters, 1);
+        if (sent || closed) {
+            return sent;
+        }
+    }
+}
+
+bool lim_ring_recv(Lim_Ring *ring, Word *value)
+{
+    for (int i = 0; i < LIM_RING_SPIN; i++) {
+        if (lim_ring_try_recv(ring, value)) {
+            return true;
+        }
+    }
+    for (;;) {
+        unsigned seen = atomic_load(&ring->readable);
+        atomic_fetch_add(&ring->recv_waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool received = lim_ring_try_recv(ring, value);
+        bool closed = atomic_load(&ring->closed);
+        if (!received && !closed) {
+            lim_ring_park(&ring->readable, seen);
+        }
+        atomic_fetch_sub(&ring->recv_waiters, 1);
+        if (received) {
+            return true;
+        }
+        if (closed) {
+            // values sent before the close are still delivered
+            return lim_ring_try_recv(ring, value);
+        }
+    }
+}
+
+void lim_ring_close(Lim_Ring *ring)
+{
+    atomic_store(&ring->closed, true);
+    lim_ring_wake(&ring->readable, &ring->recv_waiters, INT32_MAX);
+    lim_ring_wake(&ring->writable, &ring->send_waiters, INT32_MAX);
+}
+
+// A worker VM applies the function to the elements [begin, end) in order and
+// stops at the first one which traps
+typedef struct {
+    const Lim *lim;
+    Inst_Addr func;
+    const Word *in;
+    Word *out;
+    uint64_t begin;
+    uint64_t end;
+    Trap trap;
+} Lim_Map_Task;
+
+// Below this amount of elements per worker a thread is not worth starting
+#define LIM_MAP_CHUNK_MIN 256
+
+static void *lim_map_worker(void *arg)
+{
+    Lim_Map_Task *task = arg;
+    const Lim *lim = task->lim;
+    Lim *worker = lim_create();
+    if (worker == NULL) {
+        task->trap = TRAP_THREADS_OVERFLOW;
+        return NULL;
+    }
+    memcpy(worker->program, lim->program,
+           sizeof(lim->program[0]) * lim->program_size);
+    worker->program_size = lim->program_size;
+    memcpy(worker->imports, lim->imports,
+           sizeof(lim->imports[0]) * lim->imports_size);
+    worker->imports_size = lim->imports_size;
+    // the data is read-only, the worker borrows it without owning the map
+    worker->data = lim->data;
+    worker->data_size = lim->data_size;
+    // symbols the function interns stay local to the element, every one
+    // starts from the symbols of the VM
+    memcpy(worker->interned, lim->interned,
+           sizeof(lim->interned[0]) * lim->interned_size);
+    memcpy(worker->interned_index, lim->interned_index,
+           sizeof(lim->interned_index));
+    worker->interned_size = lim->interned_size;
+    worker->interned_program = lim->interned_size;
+    worker->output = lim->output;
+
+    // the function returns to the end of the program, where the worker stops
+    const Inst_Addr ret = lim->program_size;
+    task->trap = TRAP_OK;
+    for (uint64_t i = task->begin; i < task->end; i++) {
+        lim_reset(worker);
+        worker->stack[worker->stack_size++] = task->in[i];
+        worker->frames[worker->frames_size++] = (Lim_Frame){
+            .ret = ret,
+            .base = worker->stack_size,
+        };
+        worker->ip = task->func;
+
+        Trap trap = TRAP_OK;
+        while (trap == TRAP_OK && worker->ip != ret && !worker->halt) {
+            trap = lim_execute_inst(worker);
+        }
+        if (trap == TRAP_OK && worker->stack_size == 0) {
+            trap = TRAP_STACK_UNDERFLOW;
+        }
+        if (trap != TRAP_OK) {
+            task->end = i;
+            task->trap = trap;
+            break;
+        }
+        task->out[i] = worker->stack[worker->stack_size - 1];
+    }
+
+    lim_destroy(worker);
+    return NULL;
+}
+
+static Trap lim_par_map(Lim *lim)
+{
+    // [f in out n] -> [], out[i] = f(in[i]) for i in [0, n), where `f` is
+    // the address of a function from the word on top of the stack to the
+    // word it leaves there. Every element is computed on its own, so the
+    // result does not depend on how the elements are split among workers,
+    // and a trap is the one of the lowest element which traps. Heap memory
+    // allocated by `f` is released after each element.
+    if (lim->stack_size < 4) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const Inst_Addr func = lim->stack[lim->stack_size - 4].as_u64;
+    const Word *in = lim->stack[lim->stack_size - 3].as_ptr;
+    Word *out = lim->stack[lim->stack_size - 2].as_ptr;
+    const uint64_t n = lim->stack[lim->stack_size - 1].as_u64;
+    if (func >= lim->program_size) {
+        return TRAP_ILLEGAL_INST_ACCESS;
+    }
+
+    uint64_t workers = lim->map_workers;
+    if (workers == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? cores : 1;
+        if (workers > n / LIM_MAP_CHUNK_MIN) {
+            workers = n / LIM_MAP_CHUNK_MIN;
+        }
+    }
+    if (workers > LIM_MAP_WORKERS_CAPACITY) {
+        workers = LIM_MAP_WORKERS_CAPACITY;
+    }
+    if (workers == 0) {
+        workers = 1;
+    }
+
+    Lim_Map_Task tasks[LIM_MAP_WORKERS_CAPACITY];
+    pthread_t threads[LIM_MAP_WORKERS_CAPACITY];
+    bool started[LIM_MAP_WORKERS_CAPACITY] = {0};
+    for (uint64_t w = 0; w < workers; w++) {
+        tasks[w] = (Lim_Map_Task){
+            .lim = lim,
+            .func = func,
+            .in = in,
+            .out = out,
+            .begin = n * w / workers,
+            .end = n * (w + 1) / workers,
+        };
+    }
+    // the calling thread takes the first chunk, chunks whose thread can not
+    // be started are run here as well
+    for (uint64_t w = 1; w < workers; w++) {
+        started[w] =
+            pthread_create(&threads[w], NULL, lim_map_worker, &tasks[w]) == 0;
+    }
+    lim_map_worker(&tasks[0]);
+    for (uint64_t w = 1; w < workers; w++) {
+        if (started[w]) {
+            pthread_join(threads[w], NULL);
+        } else {
+            lim_map_worker(&tasks[w]);
+        }
+    }
+
+    for (uint64_t w = 0; w < workers; w++) {
+        if (tasks[w].trap != TRAP_OK) {
+            return tasks[w].trap;
+        }
+    }
+    lim->stack_size -= 4;
+    return TRAP_OK;
+}
+
+static Trap lim_ring_new(Lim *lim, bool mpmc)
+{
+    // [capacity] -> [ring], 0 when the capacity is too big or out of memory
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *capacity = &lim->stack[lim->stack_size - 1];
+    capacity->as_ptr = lim_ring_create(capacity->as_u64, mpmc);
+    return TRAP_OK;
+}
+
+static Trap lim_spsc_new(Lim *lim)
+{
+    return lim_ring_new(lim, false);
+}
+
+static Trap lim_mpmc_new(Lim *lim)
+{
+    return lim_ring_new(lim, true);
+}
+
+static Trap lim_ring_send_native(Lim *lim)
+{
+    // [ring value] -> [ok], blocks while the ring is full, ok is 0 once the
+    // ring is closed
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Lim_Ring *ring = lim->stack[lim->stack_size - 2].as_ptr;
+    if (ring == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    bool sent = lim_ring_send(ring, lim->stack[lim->stack_size - 1]);
+    lim->stack[lim->stack_size - 2].as_u64 = sent;
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_ring_recv_native(Lim *lim, bool block)
+{
+    // [ring] -> [value ok], ok is 0 when the ring is empty and, for a
+    // blocking receive, closed
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    if (lim->stack_size >= LIM_STACK_CAPACITY) {
+        return TRAP_STACK_OVERFLOW;
+    }
+    Lim_Ring *ring = lim->stack[lim->stack_size - 1].as_ptr;
+    if (ring == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    Word value = {0};
+    bool received = block ? lim_ring_recv(ring, &value)
+                          : lim_ring_try_recv(ring, &value);
+    lim->stack[lim->stack_size - 1] = value;
+    lim->stack[lim->stack_size++].as_u64 = received;
+    return TRAP_OK;
+}
+
+static Trap lim_ring_recv_blocking(Lim *lim)
+{
+    return lim_ring_recv_native(lim, true);
+}
+
+static Trap lim_ring_try_recv_native(Lim *lim)
+{
+    return lim_ring_recv_native(lim, false);
+}
+
+static Trap lim_ring_close_native(Lim *lim)
+{
+    // [ring] -> []
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Lim_Ring *ring = lim->stack[--lim->stack_size].as_ptr;
+    if (ring == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    lim_ring_close(ring);
+    return TRAP_OK;
+}
+
+static Trap lim_ring_free(Lim *lim)
+{
+    // [ring] -> []
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    lim_ring_destroy(lim->stack[--lim->stack_size].as_ptr);
+    return TRAP_OK;
+}
+
+// Reads and writes of files which complete in the background, so a program
+// can compute while the kernel moves the data straight into its buffers.
+// The requests go to an io_uring when the kernel lets the process set one
+// up, to a few threads running pread/pwrite otherwise. Readiness through
+// epoll would be no help for regular files, which always poll as ready.
+#define LIM_IO_WORKERS 4
+
+typedef struct {
+    bool write;
+    int fd;
+    void *buffer;
+    uint64_t size;
+    int64_t offset;
+    uint64_t tag;
+} Lim_Io_Request;
+
+typedef struct {
+    uint64_t tag;
+    int64_t result;
+} Lim_Io_Completion;
+
+struct Lim_Io {
+    Lim_Io_Backend backend;
+    uint64_t entries;
+    uint64_t in_flight;  // submitted and not polled yet
+
+#ifdef LIM_HAS_IO_URING
+    // The rings shared with the kernel. Only this side writes the tail of
+    // the submissions and the head of the completions.
+    int ring_fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    atomic_uint *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    atomic_uint *cq_head;
+    atomic_uint *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned unsubmitted;  // queued, not taken by `io_uring_enter` yet
+#endif
+
+    // The threads take requests from one queue and put completions into
+    // another, both of `entries` cells
+    pthread_mutex_t lock;
+    pthread_cond_t requested;
+    pthread_cond_t completed;
+    pthread_t threads[LIM_IO_WORKERS];
+    size_t threads_size;
+    bool stopping;
+    Lim_Io_Request *requests;
+    uint64_t requests_head;
+    uint64_t requests_size;
+    Lim_Io_Completion *completions;
+    uint64_t completions_head;
+    uint64_t completions_size;
+};
+
+#ifdef LIM_HAS_IO_URING
+static void lim_io_uring_unmap(Lim_Io *io)
+{
+    if (io->sq_ring != NULL && io->sq_ring != MAP_FAILED) {
+        munmap(io->sq_ring, io->sq_ring_size);
+    }
+    if (io->cq_ring != NULL && io->cq_ring != MAP_FAILED) {
+        munmap(io->cq_ring, io->cq_ring_size);
+    }
+    if (io->sqes != NULL && (void *) io->sqes != MAP_FAILED) {
+        munmap(io->sqes, io->sqes_size);
+    }
+    close(io->ring_fd);
+}
+
+static bool lim_io_uring_setup(Lim_Io *io)
+{
+    struct io_uring_params params = {0};
+    io->ring_fd = syscall(SYS_io_uring_setup, io->entries, &params);
+    if (io->ring_fd < 0) {
+        return false;
+    }
+    // `IORING_OP_READ` and `IORING_OP_WRITE` are older than this feature
+    if (!(params.features & IORING_FEAT_FAST_POLL)) {
+        close(io->ring_fd);
+        return false;
+    }
+
+    io->sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    io->cq_ring_size = params.cq_off.cqes +
+                       params.cq_entries * sizeof(struct io_uring_cqe);
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    io->sq_ring = mmap(NULL, io->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, io->ring_fd,
+                       IORING_OFF_SQ_RING);
+    io->cq_ring = mmap(NULL, io->cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, io->ring_fd,
+                       IORING_OFF_CQ_RING);
+    io->sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQES);
+    if (io->sq_ring == MAP_FAILED || io->cq_ring == MAP_FAILED ||
+        (void *) io->sqes == MAP_FAILED) {
+        lim_io_uring_unmap(io);
+        return false;
+    }
+
+    uint8_t *sq = io->sq_ring;
+    uint8_t *cq = io->cq_ring;
+    io->sq_tail = (atomic_uint *) (sq + params.sq_off.tail);
+    io->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    io->sq_array = (unsigned *) (sq + params.sq_off.array);
+    io->cq_head = (atomic_uint *) (cq + params.cq_off.head);
+    io->cq_tail = (atomic_uint *) (cq + params.cq_off.tail);
+    io->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    io->unsubmitted = 0;
+    return true;
+}
+
+// Hands the queued requests to the kernel and, if `wait`, blocks until one
+// of them completes
+static void lim_io_uring_enter(Lim_Io *io, bool wait)
+{
+    int submitted =
+        syscall(SYS_io_uring_enter, io->ring_fd, io->unsubmitted,
+                wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (submitted > 0) {
+        io->unsubmitted -= submitted;
+    }
+}
+
+static void lim_io_uring_submit(Lim_Io *io, const Lim_Io_Request *request)
+{
+    unsigned tail = atomic_load_explicit(io->sq_tail, memory_order_relaxed);
+    unsigned index = tail & *io->sq_mask;
+    struct io_uring_sqe *sqe = &io->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = request->fd;
+    sqe->addr = (uintptr_t) request->buffer;
+    // a short transfer, like from read(2), for more than 2 GiB
+    sqe->len = request->size < INT32_MAX ? request->size : INT32_MAX;
+    // -1 is the file position
+    sqe->off = request->offset < 0 ? (uint64_t) -1 : (uint64_t) request->offset;
+    sqe->user_data = request->tag;
+    io->sq_array[index] = index;
+    atomic_store_explicit(io->sq_tail, tail + 1, memory_order_release);
+    io->unsubmitted++;
+    lim_io_uring_enter(io, false);
+}
+
+static bool lim_io_uring_reap(Lim_Io *io, Lim_Io_Completion *completion,
+                              bool wait)
+{
+    if (io->unsubmitted > 0) {
+        lim_io_uring_enter(io, false);
+    }
+    for (;;) {
+        unsigned head =
+            atomic_load_explicit(io->cq_head, memory_order_relaxed);
+        unsigned tail =
+            atomic_load_explicit(io->cq_tail, memory_order_acquire);
+        if (head != tail) {
+            const struct io_uring_cqe *cqe = &io->cqes[head & *io->cq_mask];
+            completion->tag = cqe->user_data;
+            completion->result = cqe->res;
+            atomic_store_explicit(io->cq_head, head + 1,
+                                  memory_order_release);
+            return true;
+        }
+        if (!wait) {
+            return false;
+        }
+        lim_io_uring_enter(io, true);
+    }
+}
+#endif
+
+// read(2) or write(2) at the file position when `offset` is negative,
+// pread(2) or pwrite(2) at `offset` otherwise. Returns the bytes moved or
+// -errno.
+static int64_t lim_io_transfer(bool writing, int fd, void *buffer,
+                               uint64_t size, int64_t offset)
+{
+    ssize_t n = 0;
+    if (writing) {
+        n = offset < 0 ? write(fd, buffer, size)
+                       : pwrite(fd, buffer, size, offset);
+    } else {
+        n = offset < 0 ? read(fd, buffer, size)
+                       : pread(fd, buffer, size, offset);
+    }
+    return n < 0 ? -errno : n;
+}
+
+static void *lim_io_worker(void *arg)
+{
+    Lim_Io *io = arg;
+    pthread_mutex_lock(&io->lock);
+    for (;;) {
+        while (io->requests_size == 0 && !io->stopping) {
+            pthread_cond_wait(&io->requested, &io->lock);
+        }
+        if (io->requests_size == 0) {
+            break;
+        }
+        Lim_Io_Request request = io->requests[io->requests_head];
+        io->requests_head = (io->requests_head + 1) % io->entries;
+        io->requests_size--;
+        pthread_mutex_unlock(&io->lock);
+
+        int64_t result =
+            lim_io_transfer(request.write, request.fd, request.buffer,
+                            request.size, request.offset);
+
+        pthread_mutex_lock(&io->lock);
+        uint64_t cell =
+            (io->completions_head + io->completions_size) % io->entries;
+        io->completions[cell] = (Lim_Io_Completion){request.tag, result};
+        io->completions_size++;
+        pthread_cond_signal(&io->completed);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+}
+
+static void lim_io_threads_stop(Lim_Io *io)
+{
+    pthread_mutex_lock(&io->lock);
+    io->stopping = true;
+    pthread_cond_broadcast(&io->requested);
+    pthread_mutex_unlock(&io->lock);
+    for (size_t i = 0; i < io->threads_size; i++) {
+        pthread_join(io->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&io->lock);
+    pthread_cond_destroy(&io->requested);
+    pthread_cond_destroy(&io->completed);
+    free(io->requests);
+    free(io->completions);
+}
+
+static bool lim_io_threads_setup(Lim_Io *io)
+{
+    io->requests = malloc(sizeof(io->requests[0]) * io->entries);
+    io->completions = malloc(sizeof(io->completions[0]) * io->entries);
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->requested, NULL);
+    pthread_cond_init(&io->completed, NULL);
+    if (io->requests != NULL && io->completions != NULL) {
+        uint64_t threads =
+            io->entries < LIM_IO_WORKERS ? io->entries : LIM_IO_WORKERS;
+        while (io->threads_size < threads &&
+               pthread_create(&io->threads[io->threads_size], NULL,
+                              lim_io_worker, io) == 0) {
+            io->threads_size++;
+        }
+    }
+    if (io->threads_size == 0) {
+        lim_io_threads_stop(io);
+        return false;
+    }
+    return true;
+}
+
+Lim_Io *lim_io_create(uint64_t entries, Lim_Io_Backend backend)
+{
+    if (entries == 0 || entries > LIM_IO_ENTRIES_CAPACITY) {
+        return NULL;
+    }
+    Lim_Io *io = calloc(1, sizeof(*io));
+    if (io == NULL) {
+        return NULL;
+    }
+    io->entries = entries;
+
+#ifdef LIM_HAS_IO_URING
+    if (backend != LIM_IO_THREADS && lim_io_uring_setup(io)) {
+        io->backend = LIM_IO_URING;
+        return io;
+    }
+#endif
+    if (backend != LIM_IO_URING && lim_io_threads_setup(io)) {
+        io->backend = LIM_IO_THREADS;
+        return io;
+    }
+    free(io);
+    return NULL;
+}
+
+void lim_io_destroy(Lim_Io *io)
+{
+    if (io == NULL) {
+        return;
+    }
+    // the buffers of the requests in flight may be freed right after
+    uint64_t tag = 0;
+    int64_t result = 0;
+    while (lim_io_poll(io, true, &tag, &result)) {
+    }
+#ifdef LIM_HAS_IO_URING
+    if (io->backend == LIM_IO_URING) {
+        lim_io_uring_unmap(io);
+        free(io);
+        return;
+    }
+#endif
+    lim_io_threads_stop(io);
+    free(io);
+}
+
+Lim_Io_Backend lim_io_backend(const Lim_Io *io)
+{
+    return io->backend;
+}
+
+static bool lim_io_submit(Lim_Io *io, Lim_Io_Request request)
+{
+    if (io->in_flight >= io->entries) {
+        return false;
+    }
+    io->in_flight++;
+#ifdef LIM_HAS_IO_URING
+    if (io->backend == LIM_IO_URING) {
+        lim_io_uring_submit(io, &request);
+        return true;
+    }
+#endif
+    pthread_mutex_lock(&io->lock);
+    io->requests[(io->requests_head + io->requests_size) % io->entries] =
+        request;
+    io->requests_size++;
+    pthread_cond_signal(&io->requested);
+    pthread_mutex_unlock(&io->lock);
+    return true;
+}
+
+bool lim_io_read(Lim_Io *io, int fd, void *buffer, uint64_t size,
+                 int64_t offset, uint64_t tag)
+{
+    return lim_io_submit(io, (Lim_Io_Request){
+                                 .fd = fd,
+                                 .buffer = buffer,
+                                 .size = size,
+                                 .offset = offset,
+                                 .tag = tag,
+                             });
+}
+
+bool lim_io_write(Lim_Io *io, int fd, const void *buffer, uint64_t size,
+                  int64_t offset, uint64_t tag)
+{
+    return lim_io_submit(io, (Lim_Io_Request){
+                                 .write = true,
+                                 .fd = fd,
+                                 .buffer = (void *) buffer,
+                                 .size = size,
+                                 .offset = offset,
+                                 .tag = tag,
+                             });
+}
+
+bool lim_io_poll(Lim_Io *io, bool wait, uint64_t *tag, int64_t *result)
+{
+    if (io->in_flight == 0) {
+        return false;
+    }
+    Lim_Io_Completion completion = {0};
+#ifdef LIM_HAS_IO_URING
+    if (io->backend == LIM_IO_URING) {
+        if (!lim_io_uring_reap(io, &completion, wait)) {
+            return false;
+        }
+        io->in_flight--;
+        *tag = completion.tag;
+        *result = completion.result;
+        return true;
+    }
+#endif
+    pthread_mutex_lock(&io->lock);
+    while (wait && io->completions_size == 0) {
+        pthread_cond_wait(&io->completed, &io->lock);
+    }
+    bool completed = io->completions_size > 0;
+    if (completed) {
+        completion = io->completions[io->completions_head];
+        io->completions_head = (io->completions_head + 1) % io->entries;
+        io->completions_size--;
+        io->in_flight--;
+    }
+    pthread_mutex_unlock(&io->lock);
+    *tag = completion.tag;
+    *result = completion.result;
+    return completed;
+}
+
+static Trap lim_file_open(Lim *lim)
+{
+    // [path mode] -> [fd], mode 0 reads, 1 writes a new file, 2 appends and
+    // 3 reads and writes; -errno when the file can not be opened
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    static const int flags[] = {
+        O_RDONLY,
+        O_WRONLY | O_CREAT | O_TRUNC,
+        O_WRONLY | O_CREAT | O_APPEND,
+        O_RDWR | O_CREAT,
+    };
+    const char *path = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t mode = lim->stack[lim->stack_size - 1].as_u64;
+    if (path == NULL || mode >= ARRAY_SIZE(flags)) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    int64_t fd = open(path, flags[mode] | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fd = -errno;
+    } else if (!lim_resource_add(lim, LIM_RESOURCE_FILE,
+                                 (Word){.as_i64 = fd}, 0)) {
+        close(fd);
+        fd = -ENOMEM;
+    }
+    lim->stack[lim->stack_size - 2].as_i64 = fd;
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static Trap lim_file_close(Lim *lim)
+{
+    // [fd] -> [0 or -errno]
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *fd = &lim->stack[lim->stack_size - 1];
+    lim_resource_remove(lim, LIM_RESOURCE_FILE, *fd);
+    fd->as_i64 = close(fd->as_i64) < 0 ? -errno : 0;
+    return TRAP_OK;
+}
+
+static Trap lim_file_size(Lim *lim)
+{
+    // [fd] -> [bytes or -errno]
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *fd = &lim->stack[lim->stack_size - 1];
+    struct stat st;
+    fd->as_i64 = fstat(fd->as_i64, &st) < 0 ? -errno : st.st_size;
+    return TRAP_OK;
+}
+
+static Trap lim_file_transfer(Lim *lim, bool writing)
+{
+    // [fd buffer size offset] -> [bytes or -errno], at the file position
+    // when the offset is negative
+    if (lim->stack_size < 4) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *args = &lim->stack[lim->stack_size - 4];
+    args[0].as_i64 = lim_io_transfer(writing, args[0].as_i64, args[1].as_ptr,
+                                     args[2].as_u64, args[3].as_i64);
+    lim->stack_size -= 3;
+    return TRAP_OK;
+}
+
+static Trap lim_file_read(Lim *lim)
+{
+    return lim_file_transfer(lim, false);
+}
+
+static Trap lim_file_write(Lim *lim)
+{
+    return lim_file_transfer(lim, true);
+}
+
+static Trap lim_file_map(Lim *lim)
+{
+    // [fd] -> [ptr size], a read-only mapping of the whole file. ptr is 0
+    // and size -errno when the file can not be mapped, both are 0 when the
+    // file is empty.
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    if (lim->stack_size >= LIM_STACK_CAPACITY) {
+        return TRAP_STACK_OVERFLOW;
+    }
+    Word *fd = &lim->stack[lim->stack_size - 1];
+    void *ptr = NULL;
+    int64_t size = 0;
+    struct stat st;
+    if (fstat(fd->as_i64, &st) < 0) {
+        size = -errno;
+    } else if (st.st_size > 0) {
+        ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd->as_i64, 0);
+        size = ptr == MAP_FAILED ? -errno : st.st_size;
+        ptr = ptr == MAP_FAILED ? NULL : ptr;
+    }
+    if (ptr != NULL && !lim_resource_add(lim, LIM_RESOURCE_MAP,
+                                         (Word){.as_ptr = ptr}, size)) {
+        munmap(ptr, size);
+        ptr = NULL;
+        size = -ENOMEM;
+    }
+    fd->as_ptr = ptr;
+    lim->stack[lim->stack_size++].as_i64 = size;
+    return TRAP_OK;
+}
+
+static Trap lim_file_advise(Lim *lim)
+{
+    // [ptr size advice] -> [0 or -errno], advice 0 is normal, 1 sequential,
+    // 2 random, 3 will need and 4 done with the pages of a mapping; any
+    // range inside the mapping is widened to whole pages
+    if (lim->stack_size < 3) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    static const int advices[] = {
+        MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED,
+        MADV_DONTNEED,
+    };
+    Word *args = &lim->stack[lim->stack_size - 3];
+    if (args[2].as_u64 >= ARRAY_SIZE(advices)) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) args[0].as_ptr;
+    uintptr_t offset = start % page;
+    int result = madvise((void *) (start - offset), args[1].as_u64 + offset,
+                         advices[args[2].as_u64]);
+    args[0].as_i64 = result < 0 ? -errno : 0;
+    lim->stack_size -= 2;
+    return TRAP_OK;
+}
+
+static Trap lim_file_unmap(Lim *lim)
+{
+    // [ptr size] -> [0 or -errno], a mapping of file_map
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *args = &lim->stack[lim->stack_size - 2];
+    int result = 0;
+    if (args[0].as_ptr != NULL) {
+        lim_resource_remove(lim, LIM_RESOURCE_MAP, args[0]);
+        result = munmap(args[0].as_ptr, args[1].as_u64);
+    }
+    args[0].as_i64 = result < 0 ? -errno : 0;
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+// Numbers separated by ',' or '\n' read from a file descriptor a block at a
+// time. A token may straddle two blocks, it is moved to the front of the
+// block before the next read.
+#define LIM_SCAN_BLOCK_SIZE (64 * 1024)
+
+typedef struct {
+    int fd;
+    bool eof;
+    // inside a token too long to be a number
+    bool skip;
+    // an error which comes after the values that were parsed before it
+    int64_t error;
+    size_t pos;
+    size_t size;
+    // bit i is set when block[i] is a separator
+    uint64_t separators[LIM_SCAN_BLOCK_SIZE / 64];
+    char block[LIM_SCAN_BLOCK_SIZE];
+} Lim_Scan;
+
+static uint64_t lim_scan_separators(const char *p, size_t n)
+{
+    uint64_t bits = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (p + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(bytes, comma),
+                                    _mm_cmpeq_epi8(bytes, newline));
+        bits |= (uint64_t) (uint16_t) _mm_movemask_epi8(hits) << i;
+    }
+#endif
+    for (; i < n; i++) {
+        bits |= (uint64_t) (p[i] == ',' || p[i] == '\n') << i;
+    }
+    return bits;
+}
+
+// Tops up the block after the unread bytes, false at the end of the file
+// or on an error, which is left in errno
+static bool lim_scan_fill(Lim_Scan *scan)
+{
+    if (scan->eof) {
+        return false;
+    }
+    memmove(scan->block, scan->block + scan->pos, scan->size - scan->pos);
+    scan->size -= scan->pos;
+    scan->pos = 0;
+    ssize_t n;
+    do {
+        n = read(scan->fd, scan->block + scan->size,
+                 LIM_SCAN_BLOCK_SIZE - scan->size);
+    } while (n < 0 && errno == EINTR);
+    scan->eof = n == 0;
+    scan->size += n > 0 ? n : 0;
+    for (size_t i = 0; i < scan->size; i += 64) {
+        size_t m = scan->size - i < 64 ? scan->size - i : 64;
+        scan->separators[i / 64] = lim_scan_separators(scan->block + i, m);
+    }
+    return n > 0;
+}
+
+// Index of the first separator at or after `pos`, `size` when there is none
+static size_t lim_scan_next(const Lim_Scan *scan, size_t pos)
+{
+    size_t words = (scan->size + 63) / 64;
+    size_t w = pos / 64;
+    if (w >= words) {
+        return scan->size;
+    }
+    uint64_t bits = scan->separators[w] & (~0ULL << (pos % 64));
+    while (bits == 0) {
+        if (++w >= words) {
+            return scan->size;
+        }
+        bits = scan->separators[w];
+    }
+    return w * 64 + __builtin_ctzll(bits);
+}
+
+static bool lim_scan_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// The next non-empty token without surrounding blanks: 1 when there is one,
+// 0 at the end of the input and -errno on errors. `start` is where the
+// token begins, for putting it back.
+static int64_t lim_scan_token(Lim_Scan *scan, size_t *start, const char **token,
+                              size_t *n)
+{
+    if (scan->error != 0) {
+        int64_t error = scan->error;
+        scan->error = 0;
+        return error;
+    }
+    for (;;) {
+        size_t end = lim_scan_next(scan, scan->pos);
+        if (end == scan->size && !scan->eof) {
+            if (scan->skip) {
+                scan->pos = scan->size;
+            } else if (scan->pos == 0 && scan->size == LIM_SCAN_BLOCK_SIZE) {
+                // a token as big as the block is never a number
+                scan->pos = scan->size;
+                scan->skip = true;
+                return -EINVAL;
+            }
+            if (!lim_scan_fill(scan) && !scan->eof) {
+                return -errno;
+            }
+            continue;
+        }
+        if (scan->pos >= scan->size) {
+            return 0;
+        }
+        *start = scan->pos;
+        const char *first = scan->block + scan->pos;
+        const char *last = scan->block + end;
+        scan->pos = end < scan->size ? end + 1 : end;
+        if (scan->skip) {
+            scan->skip = false;
+            continue;
+        }
+        while (first < last && lim_scan_blank(*first)) {
+            first++;
+        }
+        while (last > first && lim_scan_blank(last[-1])) {
+            last--;
+        }
+        if (first < last) {
+            *token = first;
+            *n = last - first;
+            return 1;
+        }
+    }
+}
+
+static bool lim_parse_i64(const char *p, size_t n, int64_t *value)
+{
+    const char *end = p + n;
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    if (p == end) {
+        return false;
+    }
+    uint64_t u = 0;
+    for (; p < end; p++) {
+        uint64_t digit = (uint64_t) (*p - '0');
+        if (digit > 9 || u > (UINT64_MAX - digit) / 10) {
+            return false;
+        }
+        u = u * 10 + digit;
+    }
+    if (u > (uint64_t) INT64_MAX + negative) {
+        return false;
+    }
+    *value = negative ? (int64_t) (0 - u) : (int64_t) u;
+    return true;
+}
+
+// 128 bit approximations of 5^q for the float parser, normalized so that
+// the top bit is set: 5^q truncated for q >= 0 and 2^b / 5^-q + 1 for q < 0,
+// as in the tables of Lemire's fast_float. They are computed once, exactly.
+#define LIM_POW5_MIN (-342)
+#define LIM_POW5_MAX 308
+#define LIM_POW5_LIMBS 32
+
+static uint64_t lim_pow5[2 * (LIM_POW5_MAX - LIM_POW5_MIN + 1)];
+static bool lim_pow5_ready = false;
+static pthread_once_t lim_pow5_once = PTHREAD_ONCE_INIT;
+
+// The top 128 bits of normalized limbs shifted up to bit 127
+static void lim_limbs_top128(const uint64_t *a, uint64_t n, uint64_t *out)
+{
+    uint64_t hi = a[n - 1];
+    uint64_t mid = n >= 2 ? a[n - 2] : 0;
+    uint64_t lo = n >= 3 ? a[n - 3] : 0;
+    int s = __builtin_clzll(hi);
+    out[0] = s != 0 ? hi << s | mid >> (64 - s) : hi;
+    out[1] = s != 0 ? mid << s | lo >> (64 - s) : mid;
+}
+
+static void lim_pow5_init(void)
+{
+    uint64_t p[LIM_POW5_LIMBS] = {1};
+    uint64_t pn = 1;
+    uint64_t a[LIM_POW5_LIMBS];
+    uint64_t q[LIM_POW5_LIMBS];
+    uint64_t r[LIM_POW5_LIMBS];
+    for (int64_t k = 0; k <= -LIM_POW5_MIN; k++) {
+        if (k > 0) {
+            uint64_t carry = 0;
+            for (uint64_t i = 0; i < pn; i++) {
+                Lim_U128 t = (Lim_U128) p[i] * 5 + carry;
+                p[i] = (uint64_t) t;
+                carry = (uint64_t) (t >> 64);
+            }
+            if (carry != 0) {
+                p[pn++] = carry;
+            }
+        }
+        if (k <= LIM_POW5_MAX) {
+            lim_limbs_top128(p, pn, &lim_pow5[2 * (k - LIM_POW5_MIN)]);
+        }
+        if (k == 0) {
+            continue;
+        }
+
+        // 5^k is not a power of two, so 2^z > 5^k for z bits of it
+        uint64_t z = 64 * pn - __builtin_clzll(p[pn - 1]);
+        uint64_t b = k <= 27 ? z + 127 : 2 * z + 128;
+        uint64_t an = b / 64 + 1;
+        memset(a, 0, an * sizeof(*a));
+        a[an - 1] = 1ULL << (b % 64);
+        uint64_t qn = an;
+        if (pn == 1) {
+            lim_limbs_divmod_1(q, a, an, p[0]);
+        } else if (lim_limbs_divmod(q, r, a, an, p, pn)) {
+            qn = an - pn + 1;
+        } else {
+            return;
+        }
+        qn = lim_limbs_normalize(q, qn);
+        for (uint64_t i = 0; i < qn && ++q[i] == 0; i++) {
+        }
+        lim_limbs_top128(q, qn, &lim_pow5[2 * (-k - LIM_POW5_MIN)]);
+    }
+    lim_pow5_ready = true;
+}
+
+// Eisel and Lemire's algorithm: w * 10^q rounded to the nearest double from
+// the top bits of w * 5^q. False for the few products too close to call
+// from 128 bits, and for subnormals and overflows, which go to strtod.
+static bool lim_eisel_lemire(uint64_t w, int64_t q, double *value)
+{
+    if (w == 0 || q < LIM_POW5_MIN || q > LIM_POW5_MAX) {
+        return false;
+    }
+    pthread_once(&lim_pow5_once, lim_pow5_init);
+    if (!lim_pow5_ready) {
+        return false;
+    }
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+    const uint64_t *pow5 = &lim_pow5[2 * (q - LIM_POW5_MIN)];
+    Lim_U128 first = (Lim_U128) w * pow5[0];
+    uint64_t hi = (uint64_t) (first >> 64);
+    uint64_t lo = (uint64_t) first;
+    if ((hi & 0x1FF) == 0x1FF) {
+        uint64_t second = (uint64_t) (((Lim_U128) w * pow5[1]) >> 64);
+        lo += second;
+        hi += second > lo;
+    }
+    if (lo == UINT64_MAX && (q < -27 || q > 55)) {
+        return false;
+    }
+
+    // 54 bits of mantissa, one more than a double keeps for rounding
+    int upper = hi >> 63;
+    uint64_t mantissa = hi >> (upper + 9);
+    int64_t power2 = ((217706 * q) >> 16) + 63 + upper - lz + 1023;
+    if (power2 <= 0 || power2 >= 0x7FF) {
+        return false;
+    }
+    if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+        mantissa << (upper + 9) == hi) {
+        // exactly halfway, round to even
+        mantissa &= ~1ULL;
+    }
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= 2ULL << 52) {
+        mantissa = 1ULL << 52;
+        power2++;
+    }
+    if (power2 >= 0x7FF) {
+        return false;
+    }
+    uint64_t bits = (mantissa & ~(1ULL << 52)) | (uint64_t) power2 << 52;
+    memcpy(value, &bits, sizeof(*value));
+    return true;
+}
+
+// Decimal mantissas of up to 2^53 scaled by at most 10^22 are exact as
+// doubles, so one multiplication or division rounds them correctly. Other
+// mantissas of up to 19 digits take the algorithm of Eisel and Lemire, the
+// rest, and inf and nan, go to strtod.
+static bool lim_parse_f64(const char *p, size_t n, double *value)
+{
+    static const double powers[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    const char *s = p;
+    const char *end = p + n;
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int64_t exponent = 0;
+    int digits = 0;
+    bool any = false;
+    for (; p < end && (unsigned) (*p - '0') <= 9; p++, any = true) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        } else {
+            exponent++;
+            digits++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && (unsigned) (*p - '0') <= 9; p++, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            } else {
+                digits++;
+            }
+        }
+    }
+    if (any && p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool minus = q < end && *q == '-';
+        if (q < end && (*q == '-' || *q == '+')) {
+            q++;
+        }
+        int64_t e = 0;
+        for (p = q; p < end && (unsigned) (*p - '0') <= 9; p++) {
+            e = e < 100000 ? e * 10 + (*p - '0') : e;
+        }
+        exponent += minus ? -e : e;
+        any = p > q;
+    }
+    if (any && p == end && digits <= 19 && mantissa <= (1ULL << 53) &&
+        exponent >= -22 && exponent <= 22) {
+        double d = mantissa;
+        d = exponent < 0 ? d / powers[-exponent] : d * powers[exponent];
+        *value = negative ? -d : d;
+        return true;
+    }
+    if (any && p == end && digits <= 19 &&
+        lim_eisel_lemire(mantissa, exponent, value)) {
+        *value = negative ? -*value : *value;
+        return true;
+    }
+
+    char str[1024];
+    if (n == 0 || n >= sizeof(str)) {
+        return false;
+    }
+    memcpy(str, s, n);
+    str[n] = '\0';
+    char *endptr = NULL;
+    *value = strtod(str, &endptr);
+    return endptr == str + n;
+}
+
+static Trap lim_scan_new(Lim *lim)
+{
+    // [fd] -> [scanner], 0 when out of memory. The scanner reads the file
+    // from its current position and does not close it.
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *fd = &lim->stack[lim->stack_size - 1];
+    Lim_Scan *scan = malloc(sizeof(*scan));
+    if (scan != NULL) {
+        scan->fd = fd->as_i64;
+        scan->eof = false;
+        scan->skip = false;
+        scan->error = 0;
+        scan->pos = 0;
+        scan->size = 0;
+        if (!lim_resource_add(lim, LIM_RESOURCE_SCAN, (Word){.as_ptr = scan},
+                              0)) {
+            free(scan);
+            scan = NULL;
+        }
+    }
+    fd->as_ptr = scan;
+    return TRAP_OK;
+}
+
+static Trap lim_scan_values(Lim *lim, bool floats)
+{
+    // [scanner buffer capacity] -> [count], up to `capacity` words parsed
+    // into the buffer; 0 at the end of the input and -errno on errors,
+    // -EINVAL for a token which is not a number. Values before an error are
+    // returned first and the error comes with the next call.
+    if (lim->stack_size < 3) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *args = &lim->stack[lim->stack_size - 3];
+    Lim_Scan *scan = args[0].as_ptr;
+    Word *buffer = args[1].as_ptr;
+    uint64_t capacity = args[2].as_u64;
+    if (scan == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    int64_t count = 0;
+    while ((uint64_t) count < capacity) {
+        size_t start = 0;
+        const char *token = NULL;
+        size_t n = 0;
+        int64_t status = lim_scan_token(scan, &start, &token, &n);
+        if (status <= 0) {
+            if (count == 0) {
+                count = status;
+            } else if (status < 0) {
+                scan->error = status;
+            }
+            break;
+        }
+        bool ok = floats ? lim_parse_f64(token, n, &buffer[count].as_f64)
+                         : lim_parse_i64(token, n, &buffer[count].as_i64);
+        if (!ok) {
+            if (count > 0) {
+                scan->pos = start;
+            } else {
+                count = -EINVAL;
+            }
+            break;
+        }
+        count++;
+    }
+    args[0].as_i64 = count;
+    lim->stack_size -= 2;
+    return TRAP_OK;
+}
+
+static Trap lim_scan_i64(Lim *lim)
+{
+    return lim_scan_values(lim, false);
+}
+
+static Trap lim_scan_f64(Lim *lim)
+{
+    return lim_scan_values(lim, true);
+}
+
+static Trap lim_scan_free(Lim *lim)
+{
+    // [scanner] -> []
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word scan = lim->stack[--lim->stack_size];
+    lim_resource_remove(lim, LIM_RESOURCE_SCAN, scan);
+    free(scan.as_ptr);
+    return TRAP_OK;
+}
+
+static Trap lim_io_new(Lim *lim)
+{
+    // [entries] -> [queue], 0 when it can not be set up
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *entries = &lim->stack[lim->stack_size - 1];
+    Lim_Io *io = lim_io_create(entries->as_u64, LIM_IO_AUTO);
+    if (io != NULL &&
+        !lim_resource_add(lim, LIM_RESOURCE_IO, (Word){.as_ptr = io}, 0)) {
+        lim_io_destroy(io);
+        io = NULL;
     }
-
-    fclose(f);
+    entries->as_ptr = io;
+    return TRAP_OK;
 }
 
-void lim_save_program_to_file(Lim *lim, const char *file_path)
+static Trap lim_io_request(Lim *lim, bool writing)
 {
-    FILE *f = fopen(file_path, "wb");
-    if (f == NULL) {
-        fprintf(stderr, "ERROR: Counld not open file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
+    // [queue fd buffer size offset tag] -> [ok], ok is 0 when `entries`
+    // requests are in flight already. The buffer must stay until the
+    // completion of the request is polled.
+    if (lim->stack_size < 6) {
+        return TRAP_STACK_UNDERFLOW;
     }
-
-    fwrite(lim->program, sizeof(lim->program[0]), lim->program_size, f);
-
-    if (ferror(f)) {
-        fprintf(stderr, "ERROR: Counld not write file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
+    Word *args = &lim->stack[lim->stack_size - 6];
+    Lim_Io *io = args[0].as_ptr;
+    if (io == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
     }
+    bool ok = writing ? lim_io_write(io, args[1].as_i64, args[2].as_ptr,
+                                     args[3].as_u64, args[4].as_i64,
+                                     args[5].as_u64)
+                      : lim_io_read(io, args[1].as_i64, args[2].as_ptr,
+                                    args[3].as_u64, args[4].as_i64,
+                                    args[5].as_u64);
+    args[0].as_u64 = ok;
+    lim->stack_size -= 5;
+    return TRAP_OK;
+}
 
-    fclose(f);
+static Trap lim_io_read_native(Lim *lim)
+{
+    return lim_io_request(lim, false);
 }
 
-String_View slurp_file(const char *file_path)
+static Trap lim_io_write_native(Lim *lim)
 {
-    FILE *f = fopen(file_path, "rb");
-    if (f == NULL) {
-        fprintf(stderr, "ERROR: Counld not open file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
-    }
+    return lim_io_request(lim, true);
+}
 
-    if (fseek(f, 0, SEEK_END) < 0) {
-        fprintf(stderr, "ERROR: Counld not read file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
+static Trap lim_io_completion(Lim *lim, bool wait)
+{
+    // [queue] -> [tag result ok], the result is what `file_read` or
+    // `file_write` would return. ok is 0 when no request completed or, when
+    // waiting, none is in flight.
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
     }
-
-    long m = ftell(f);
-    if (m < 0) {
-        fprintf(stderr, "ERROR: Counld not read file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
+    if (lim->stack_size + 2 > LIM_STACK_CAPACITY) {
+        return TRAP_STACK_OVERFLOW;
     }
-
-    char *buffer = malloc(m);
-    if (buffer == NULL) {
-        fprintf(stderr, "ERROR: Counld not allocate memory for file: %s\n",
-                strerror(errno));
-        exit(1);
+    Lim_Io *io = lim->stack[lim->stack_size - 1].as_ptr;
+    if (io == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
     }
+    uint64_t tag = 0;
+    int64_t result = 0;
+    bool ok = lim_io_poll(io, wait, &tag, &result);
+    lim->stack[lim->stack_size - 1].as_u64 = tag;
+    lim->stack[lim->stack_size++].as_i64 = result;
+    lim->stack[lim->stack_size++].as_u64 = ok;
+    return TRAP_OK;
+}
 
-    if (fseek(f, 0, SEEK_SET) < 0) {
-        fprintf(stderr, "ERROR: Counld not read file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
-    }
+static Trap lim_io_poll_native(Lim *lim)
+{
+    return lim_io_completion(lim, false);
+}
 
-    size_t n = fread(buffer, 1, m, f);
+static Trap lim_io_wait(Lim *lim)
+{
+    return lim_io_completion(lim, true);
+}
 
-    if (ferror(f)) {
-        fprintf(stderr, "ERROR: Counld not write file `%s`: %s\n", file_path,
-                strerror(errno));
-        exit(1);
+static Trap lim_io_free(Lim *lim)
+{
+    // [queue] -> [], waits for the requests in flight
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
     }
-
-    fclose(f);
-
-    return (String_View){
-        .count = n,
-        .data = buffer,
-    };
+    Word io = lim->stack[--lim->stack_size];
+    lim_resource_remove(lim, LIM_RESOURCE_IO, io);
+    lim_io_destroy(io.as_ptr);
+    return TRAP_OK;
 }
 
-Word number_literal_as_word(String_View sv)
+static Trap lim_clock_ns(Lim *lim)
 {
-    assert(sv.count < 1024);
-    char str[sv.count + 1];
-
-    memcpy(str, sv.data, sv.count);
-    str[sv.count] = '\0';
-
-    Word result = {0};
-
-    char *endptr = NULL;
-    result.as_i64 = strtoll(str, &endptr, 10);
-    if ((size_t) (endptr - str) != sv.count) {
-        result.as_f64 = strtod(str, &endptr);
-        if ((size_t) (endptr - str) != sv.count) {
-            fprintf(stderr, "ERROR: %s is not a valid number literal\n", str);
-            assert(false);
-            exit(1);
-        }
+    // [] -> [nanoseconds of a monotonic clock]
+    if (lim->stack_size >= LIM_STACK_CAPACITY) {
+        return TRAP_STACK_OVERFLOW;
     }
-
-    return result;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    lim->stack[lim->stack_size++].as_u64 =
+        (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return TRAP_OK;
 }
 
-static Inst lim_translate_line(Lasm *lasm, Inst_Addr addr, String_View line)
+static Trap lim_read_word(Lim *lim)
 {
-    line = sv_trim_left(line);
-    String_View inst_name = sv_chop_delim(&line, ' ');
-    String_View operand = sv_trim(sv_chop_delim(&line, '#'));
-
-    if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_NOP)))) {
-        return MAKE_INST_NOP();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_PUSH)))) {
-        return MAKE_INST_PUSH(number_literal_as_word(operand));
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_POP)))) {
-        return MAKE_INST_POP();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_DUP)))) {
-        return MAKE_INST_DUP(number_literal_as_word(operand));
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_PLUS)))) {
-        return MAKE_INST_PLUS();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_MINUS)))) {
-        return MAKE_INST_MINUS();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_MULT)))) {
-        return MAKE_INST_MULT();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_DIV)))) {
-        return MAKE_INST_DIV();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_FPLUS)))) {
-        return MAKE_INST_FPLUS();
-    } else if (sv_equal(inst_name,
-                        cstr_as_sv(inst_type_as_cstr(INST_FMINUS)))) {
-        return MAKE_INST_FMINUS();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_FMULT)))) {
-        return MAKE_INST_FMULT();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_FDIV)))) {
-        return MAKE_INST_FDIV();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_GT)))) {
-        return MAKE_INST_GT();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_LT)))) {
-        return MAKE_INST_LT();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_GE)))) {
-        return MAKE_INST_GE();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_LE)))) {
-        return MAKE_INST_LE();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_EQ)))) {
-        return MAKE_INST_EQ();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_JMP)))) {
-        if (operand.count > 0 && isdigit(*operand.data)) {
-            return MAKE_INST_JMP(number_literal_as_word(operand));
-        } else {
-            label_table_push_unresolved_jmp(lasm, addr, operand);
-            return MAKE_INST_JMP_WITHOUT_OPERAND();
-        }
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_JNZ)))) {
-        if (operand.count > 0 && isdigit(*operand.data)) {
-            return MAKE_INST_JNZ(number_literal_as_word(operand));
-        } else {
-            label_table_push_unresolved_jmp(lasm, addr, operand);
-            return MAKE_INST_JNZ_WITHOUT_OPERAND();
-        }
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_JZ)))) {
-        if (operand.count > 0 && isdigit(*operand.data)) {
-            return MAKE_INST_JZ(number_literal_as_word(operand));
-        } else {
-            label_table_push_unresolved_jmp(lasm, addr, operand);
-            return MAKE_INST_JZ_WITHOUT_OPERAND();
-        }
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_SWAP)))) {
-        return MAKE_INST_SWAP(number_literal_as_word(operand));
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_CALL)))) {
-        // call instruction only support label
-        label_table_push_unresolved_jmp(lasm, addr, operand);
-        return MAKE_INST_CALL_WITHOUT_OPERAND();
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_RET)))) {
-        return MAKE_INST_RET();
-    } else if (sv_equal(inst_name,
-                        cstr_as_sv(inst_type_as_cstr(INST_NATIVE)))) {
-        return MAKE_INST_NATIVE(number_literal_as_word(operand));
-    } else if (sv_equal(inst_name, cstr_as_sv(inst_type_as_cstr(INST_HALT)))) {
-        return MAKE_INST_HALT();
-    } else if (sv_equal(inst_name,
-                        cstr_as_sv(inst_type_as_cstr(INST_PRINT_DEBUG)))) {
-        return MAKE_INST_PRINT_DEBUG();
-    } else {
-        fprintf(stderr, "ERROR: unknown instruction `%.*s`\n",
-                (int) inst_name.count, inst_name.data);
-        assert(false);
-        exit(-1);
+    // [ptr index] -> [ptr[index]]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
     }
-
-    return MAKE_INST_NOP();
+    const Word *p = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t i = lim->stack[lim->stack_size - 1].as_u64;
+    lim->stack[lim->stack_size - 2] = p[i];
+    lim->stack_size--;
+    return TRAP_OK;
 }
 
-void lim_translate_source(String_View source, Lim *lim, Lasm *lasm)
+static Trap lim_write_word(Lim *lim)
 {
-    lim->program_size = 0;
-
-    // First pass
-    while (source.count > 0) {
-        assert(lim->program_size < LIM_PROGRAM_CAPACITY);
-        String_View line = sv_chop_delim(&source, '\n');
-        line = sv_trim_left(line);
-
-        String_View word = sv_delim(line, ' ');
+    // [ptr index value] -> [], ptr[index] = value
+    if (lim->stack_size < 3) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *p = lim->stack[lim->stack_size - 3].as_ptr;
+    uint64_t i = lim->stack[lim->stack_size - 2].as_u64;
+    p[i] = lim->stack[lim->stack_size - 1];
+    lim->stack_size -= 3;
+    return TRAP_OK;
+}
 
-        // example:
-        // ```
-        // label: # comment
-        // ```
-        // Note: this implementation requires label and instruction can not
-        // locate in the same line
+// The string natives work on NUL-terminated bytes in place, e.g. the strings
+// of the `.data` section, and never copy them.
+static Trap lim_str_len(Lim *lim)
+{
+    // [ptr] -> [length]
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    Word *top = &lim->stack[lim->stack_size - 1];
+    top->as_u64 = strlen(top->as_ptr);
+    return TRAP_OK;
+}
 
-        // labels
-        if (word.count > 0 && word.data[word.count - 1] == ':') {
-            label_table_push(
-                lasm, (String_View){.count = word.count - 1, .data = word.data},
-                lim->program_size);
-            sv_chop_delim(&line, ' ');
-            line = sv_trim_left(line);
-            word = sv_delim(line, ' ');
-        }
+static int64_t lim_sign(int x)
+{
+    return (x > 0) - (x < 0);
+}
 
-        // skip blank lines and comments
-        if (word.count == 0 || *word.data == '#')
-            continue;
+static Trap lim_str_cmp(Lim *lim)
+{
+    // [a b] -> [-1, 0 or 1]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    const char *a = lim->stack[lim->stack_size - 2].as_ptr;
+    const char *b = lim->stack[lim->stack_size - 1].as_ptr;
+    lim->stack[lim->stack_size - 2].as_i64 = lim_sign(strcmp(a, b));
+    lim->stack_size--;
+    return TRAP_OK;
+}
 
-        Inst inst = lim_translate_line(lasm, lim->program_size, line);
-        lim->program[lim->program_size++] = inst;
+static Trap lim_str_find(Lim *lim)
+{
+    // [haystack needle] -> [index of needle or -1]
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
     }
+    const char *haystack = lim->stack[lim->stack_size - 2].as_ptr;
+    const char *found =
+        strstr(haystack, lim->stack[lim->stack_size - 1].as_ptr);
+    lim->stack[lim->stack_size - 2].as_i64 =
+        found != NULL ? found - haystack : -1;
+    lim->stack_size--;
+    return TRAP_OK;
+}
 
-    // Second pass
-    for (size_t i = 0; i < lasm->unresolved_jmps_size; i++) {
-        int j = label_table_find(lasm, lasm->unresolved_jmps[i].label);
-        lim->program[lasm->unresolved_jmps[i].addr].operand.as_i64 =
-            lasm->labels[j].addr;
+static Trap lim_str_print(Lim *lim)
+{
+    // [ptr] -> []
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
     }
+    fputs(lim->stack[--lim->stack_size].as_ptr, lim_output(lim));
+    return TRAP_OK;
 }
 
-void lim_dump_stack(FILE *stream, const Lim *lim)
+static Trap lim_mem_cmp(Lim *lim)
 {
-    fprintf(stream, "Stack:\n");
-    fprintf(stream, "  u64\ti64\tf64\tptr\n");
-    if (lim->stack_size > 0) {
-        for (uint64_t i = 0; i < lim->stack_size; i++) {
-            fprintf(stream, "  %lu\t%ld\t%lf\t%p\n", lim->stack[i].as_u64,
-                    lim->stack[i].as_i64, lim->stack[i].as_f64,
-                    lim->stack[i].as_ptr);
-        }
-    } else {
-        fprintf(stream, "  [empty]\n");
+    // [a b n] -> [-1, 0 or 1]
+    if (lim->stack_size < 3) {
+        return TRAP_STACK_UNDERFLOW;
     }
+    const void *a = lim->stack[lim->stack_size - 3].as_ptr;
+    const void *b = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t n = lim->stack[lim->stack_size - 1].as_u64;
+    lim->stack[lim->stack_size - 3].as_i64 = lim_sign(memcmp(a, b, n));
+    lim->stack_size -= 2;
+    return TRAP_OK;
 }
 
-static Trap lim_alloc(Lim *lim)
+static Trap lim_mem_find(Lim *lim)
 {
-    if (lim->stack_size < 1) {
+    // [ptr n byte] -> [index of the first byte or -1]
+    if (lim->stack_size < 3) {
         return TRAP_STACK_UNDERFLOW;
     }
-    lim->stack[lim->stack_size - 1].as_ptr =
-        malloc(lim->stack[lim->stack_size - 1].as_u64);
+    const uint8_t *p = lim->stack[lim->stack_size - 3].as_ptr;
+    uint64_t n = lim->stack[lim->stack_size - 2].as_u64;
+    const uint8_t *found =
+        memchr(p, (uint8_t) lim->stack[lim->stack_size - 1].as_u64, n);
+    lim->stack[lim->stack_size - 3].as_i64 = found != NULL ? found - p : -1;
+    lim->stack_size -= 2;
     return TRAP_OK;
 }
 
-static Trap lim_free(Lim *lim)
+static Trap lim_write_bytes(Lim *lim)
 {
-    if (lim->stack_size < 1) {
+    // [ptr n] -> []
+    if (lim->stack_size < 2) {
         return TRAP_STACK_UNDERFLOW;
     }
-    free(lim->stack[--lim->stack_size].as_ptr);
+    fwrite(lim->stack[lim->stack_size - 2].as_ptr, 1,
+           lim->stack[lim->stack_size - 1].as_u64, lim_output(lim));
+    lim->stack_size -= 2;
     return TRAP_OK;
 }
 
-static Trap lim_print_u64(Lim *lim)
+static Trap lim_read_byte(Lim *lim)
 {
-    if (lim->stack_size < 1) {
+    // [ptr index] -> [ptr[index]]
+    if (lim->stack_size < 2) {
         return TRAP_STACK_UNDERFLOW;
     }
-    printf("%lu\n", lim->stack[--lim->stack_size].as_u64);
+    const uint8_t *p = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t i = lim->stack[lim->stack_size - 1].as_u64;
+    lim->stack[lim->stack_size - 2].as_u64 = p[i];
+    lim->stack_size--;
     return TRAP_OK;
 }
 
-static Trap lim_print_i64(Lim *lim)
+// [ptr offset] -> [value], `size` little-endian bytes at any byte offset,
+// e.g. a field of a record in a mapped file, zero extended
+static Trap lim_read_bytes(Lim *lim, size_t size)
 {
-    if (lim->stack_size < 1) {
+    if (lim->stack_size < 2) {
         return TRAP_STACK_UNDERFLOW;
     }
-    printf("%ld\n", lim->stack[--lim->stack_size].as_i64);
+    const uint8_t *p = lim->stack[lim->stack_size - 2].as_ptr;
+    uint64_t offset = lim->stack[lim->stack_size - 1].as_u64;
+    uint64_t value = 0;
+    memcpy(&value, p + offset, size);
+    lim->stack[lim->stack_size - 2].as_u64 = value;
+    lim->stack_size--;
     return TRAP_OK;
 }
 
-static Trap lim_print_f64(Lim *lim)
+static Trap lim_read_u16(Lim *lim)
+{
+    return lim_read_bytes(lim, sizeof(uint16_t));
+}
+
+static Trap lim_read_u32(Lim *lim)
+{
+    return lim_read_bytes(lim, sizeof(uint32_t));
+}
+
+static Trap lim_read_i32(Lim *lim)
+{
+    Trap trap = lim_read_bytes(lim, sizeof(int32_t));
+    if (trap == TRAP_OK) {
+        Word *top = &lim->stack[lim->stack_size - 1];
+        top->as_i64 = (int32_t) top->as_u64;
+    }
+    return trap;
+}
+
+static Trap lim_read_u64(Lim *lim)
+{
+    return lim_read_bytes(lim, sizeof(uint64_t));
+}
+
+static Trap lim_read_f32(Lim *lim)
+{
+    Trap trap = lim_read_bytes(lim, sizeof(float));
+    if (trap == TRAP_OK) {
+        Word *top = &lim->stack[lim->stack_size - 1];
+        uint32_t bits = top->as_u64;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        top->as_f64 = f;
+    }
+    return trap;
+}
+
+static Trap lim_sym_intern(Lim *lim)
 {
+    // [NUL-terminated name] -> [symbol]
     if (lim->stack_size < 1) {
         return TRAP_STACK_UNDERFLOW;
     }
-    printf("%lf\n", lim->stack[--lim->stack_size].as_f64);
+    Word *top = &lim->stack[lim->stack_size - 1];
+    if (lim_intern_symbol(lim, cstr_as_sv(top->as_ptr), &top->as_u64) !=
+        LIM_OK) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
     return TRAP_OK;
 }
 
-static Trap lim_print_ptr(Lim *lim)
+static Trap lim_sym_name(Lim *lim)
 {
+    // [symbol] -> [NUL-terminated name]
     if (lim->stack_size < 1) {
         return TRAP_STACK_UNDERFLOW;
     }
-    printf("%p\n", lim->stack[--lim->stack_size].as_ptr);
+    Word *top = &lim->stack[lim->stack_size - 1];
+    const char *name = lim_interned_name(lim, top->as_u64);
+    if (name == NULL) {
+        return TRAP_ILLEGAL_OPERAND;
+    }
+    top->as_ptr = (void *) name;
     return TRAP_OK;
 }
 
 void lim_attach_natives(Lim *lim)
 {
-    lim_push_native_func(lim, lim_alloc);      // native number 0
-    lim_push_native_func(lim, lim_free);       // native number 1
-    lim_push_native_func(lim, lim_print_u64);  // native number 2
-    lim_push_native_func(lim, lim_print_i64);  // native number 3
-    lim_push_native_func(lim, lim_print_f64);  // native number 4
-    lim_push_native_func(lim, lim_print_ptr);  // native number 5
+    lim_push_native_func(lim, "alloc", lim_alloc, 1, 1);
+    lim_push_native_func(lim, "free", lim_free, 1, 0);
+    lim_push_native_func(lim, "print_u64", lim_print_u64, 1, 0);
+    lim_push_native_func(lim, "print_i64", lim_print_i64, 1, 0);
+    lim_push_native_func(lim, "print_f64", lim_print_f64, 1, 0);
+    lim_push_native_func(lim, "print_ptr", lim_print_ptr, 1, 0);
+    lim_push_native_func(lim, "sum_f64", lim_sum_f64, 2, 1);
+    lim_push_native_func(lim, "dot_f64", lim_dot_f64, 3, 1);
+    lim_push_native_func(lim, "axpy_f64", lim_axpy_f64, 4, 0);
+    lim_push_native_func(lim, "scale_f64", lim_scale_f64, 3, 0);
+    lim_push_native_func(lim, "prefix_sum_f64", lim_prefix_sum_f64, 2, 0);
+    lim_push_native_func(lim, "min_f64", lim_min_f64, 2, 1);
+    lim_push_native_func(lim, "max_f64", lim_max_f64, 2, 1);
+    lim_push_native_func(lim, "sort_f64", lim_sort_f64, 2, 1);
+    lim_push_native_func(lim, "histogram_f64", lim_histogram_f64, 6, 0);
+    lim_push_native_func(lim, "read_word", lim_read_word, 2, 1);
+    lim_push_native_func(lim, "write_word", lim_write_word, 3, 0);
+    lim_push_native_func(lim, "chan_free", lim_chan_free, 1, 0);
+    lim_push_native_func(lim, "par_map", lim_par_map, 4, 0);
+    lim_push_native_func(lim, "spsc_new", lim_spsc_new, 1, 1);
+    lim_push_native_func(lim, "mpmc_new", lim_mpmc_new, 1, 1);
+    lim_push_native_func(lim, "ring_send", lim_ring_send_native, 2, 1);
+    lim_push_native_func(lim, "ring_recv", lim_ring_recv_blocking, 1, 2);
+    lim_push_native_func(lim, "ring_try_recv", lim_ring_try_recv_native, 1,
+                         2);
+    lim_push_native_func(lim, "ring_close", lim_ring_close_native, 1, 0);
+    lim_push_native_func(lim, "ring_free", lim_ring_free, 1, 0);
+    lim_push_native_func(lim, "clock_ns", lim_clock_ns, 0, 1);
+    lim_push_native_func(lim, "str_len", lim_str_len, 1, 1);
+    lim_push_native_func(lim, "str_cmp", lim_str_cmp, 2, 1);
+    lim_push_native_func(lim, "str_find", lim_str_find, 2, 1);
+    lim_push_native_func(lim, "str_print", lim_str_print, 1, 0);
+    lim_push_native_func(lim, "mem_cmp", lim_mem_cmp, 3, 1);
+    lim_push_native_func(lim, "mem_find", lim_mem_find, 3, 1);
+    lim_push_native_func(lim, "write_bytes", lim_write_bytes, 2, 0);
+    lim_push_native_func(lim, "read_byte", lim_read_byte, 2, 1);
+    lim_push_native_func(lim, "map_new", lim_map_new, 1, 1);
+    lim_push_native_func(lim, "map_insert", lim_map_insert_native, 3, 1);
+    lim_push_native_func(lim, "map_get", lim_map_get_native, 3, 1);
+    lim_push_native_func(lim, "map_has", lim_map_has, 2, 1);
+    lim_push_native_func(lim, "map_delete", lim_map_delete_native, 2, 1);
+    lim_push_native_func(lim, "map_size", lim_map_size_native, 1, 1);
+    lim_push_native_func(lim, "map_next", lim_map_next_native, 2, 1);
+    lim_push_native_func(lim, "map_key", lim_map_key, 2, 1);
+    lim_push_native_func(lim, "map_value", lim_map_value, 2, 1);
+    lim_push_native_func(lim, "map_free", lim_map_free, 1, 0);
+    lim_push_native_func(lim, "sym_intern", lim_sym_intern, 1, 1);
+    lim_push_native_func(lim, "sym_name", lim_sym_name, 1, 1);
+    lim_push_native_func(lim, "big_from_i64", lim_big_from_i64_native, 1, 1);
+    lim_push_native_func(lim, "big_to_i64", lim_big_to_i64_native, 1, 1);
+    lim_push_native_func(lim, "big_add", lim_big_add_native, 2, 1);
+    lim_push_native_func(lim, "big_sub", lim_big_sub_native, 2, 1);
+    lim_push_native_func(lim, "big_mul", lim_big_mul_native, 2, 1);
+    lim_push_native_func(lim, "big_divmod", lim_big_divmod_native, 2, 2);
+    lim_push_native_func(lim, "big_pow", lim_big_pow_native, 2, 1);
+    lim_push_native_func(lim, "big_cmp", lim_big_cmp_native, 2, 1);
+    lim_push_native_func(lim, "big_print", lim_big_print, 1, 0);
+    lim_push_native_func(lim, "big_free", lim_big_free, 1, 0);
+    lim_push_native_func(lim, "file_open", lim_file_open, 2, 1);
+    lim_push_native_func(lim, "file_close", lim_file_close, 1, 1);
+    lim_push_native_func(lim, "file_size", lim_file_size, 1, 1);
+    lim_push_native_func(lim, "file_read", lim_file_read, 4, 1);
+    lim_push_native_func(lim, "file_write", lim_file_write, 4, 1);
+    lim_push_native_func(lim, "io_new", lim_io_new, 1, 1);
+    lim_push_native_func(lim, "io_read", lim_io_read_native, 6, 1);
+    lim_push_native_func(lim, "io_write", lim_io_write_native, 6, 1);
+    lim_push_native_func(lim, "io_poll", lim_io_poll_native, 1, 3);
+    lim_push_native_func(lim, "io_wait", lim_io_wait, 1, 3);
+    lim_push_native_func(lim, "io_free", lim_io_free, 1, 0);
+    lim_push_native_func(lim, "file_map", lim_file_map, 1, 2);
+    lim_push_native_func(lim, "file_advise", lim_file_advise, 3, 1);
+    lim_push_native_func(lim, "file_unmap", lim_file_unmap, 2, 1);
+    lim_push_native_func(lim, "read_u16", lim_read_u16, 2, 1);
+    lim_push_native_func(lim, "read_u32", lim_read_u32, 2, 1);
+    lim_push_native_func(lim, "read_i32", lim_read_i32, 2, 1);
+    lim_push_native_func(lim, "read_u64", lim_read_u64, 2, 1);
+    lim_push_native_func(lim, "read_f32", lim_read_f32, 2, 1);
+    lim_push_native_func(lim, "scan_new", lim_scan_new, 1, 1);
+    lim_push_native_func(lim, "scan_i64", lim_scan_i64, 3, 1);
+    lim_push_native_func(lim, "scan_f64", lim_scan_f64, 3, 1);
+    lim_push_native_func(lim, "scan_free", lim_scan_free, 1, 0);
+}
+
+// `args` and `rets` describe the stack effect of the native, which lets the
+// register IR translator keep track of the stack depth across native calls.
+// Registering a name twice replaces the earlier native.
+Lim_Error lim_push_native_func(Lim *lim,
+                               const char *name,
+                               Lim_Native_Func func,
+                               uint64_t args,
+                               uint64_t rets)
+{
+    if (*name == '\0' || strlen(name) >= LIM_NATIVE_NAME_CAPACITY) {
+        return lim_fail(lim, LIM_ERROR_NATIVE, "invalid native name `%s`",
+                        name);
+    }
+
+    int index = lim_find_native(lim, cstr_as_sv(name));
+    if (index < 0) {
+        if (lim->natives_size >= LIM_NATIVES_CAPACITY) {
+            return lim_fail(lim, LIM_ERROR_CAPACITY,
+                            "too many natives registered");
+        }
+        index = lim->natives_size++;
+    }
+
+    Lim_Native *native = &lim->natives[index];
+    strcpy(native->name, name);
+    native->func = func;
+    native->args = args;
+    native->rets = rets;
+    return LIM_OK;
+}
+
+int lim_find_native(const Lim *lim, String_View name)
+{
+    for (uint64_t i = 0; i < lim->natives_size; i++) {
+        if (sv_equal(name, cstr_as_sv(lim->natives[i].name))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Index of `name` in the import table of the program, adding it if needed
+Lim_Error lim_import_native(Lim *lim, String_View name, uint64_t *index)
+{
+    for (uint64_t i = 0; i < lim->imports_size; i++) {
+        if (sv_equal(name, cstr_as_sv(lim->imports[i].name))) {
+            *index = i;
+            return LIM_OK;
+        }
+    }
+
+    if (name.count == 0 || name.count >= LIM_NATIVE_NAME_CAPACITY) {
+        return lim_fail(lim, LIM_ERROR_NATIVE, "invalid native name `%.*s`",
+                        (int) name.count, name.data);
+    }
+    if (lim->imports_size >= LIM_IMPORTS_CAPACITY) {
+        return lim_fail(lim, LIM_ERROR_CAPACITY,
+                        "too many natives imported");
+    }
+
+    Lim_Native *import = &lim->imports[lim->imports_size];
+    memcpy(import->name, name.data, name.count);
+    import->name[name.count] = '\0';
+    import->func = lim_native_unbound;
+    import->args = 0;
+    import->rets = 0;
+    *index = lim->imports_size++;
+    return LIM_OK;
+}
+
+// Resolve the import table of the loaded program against the registered
+// natives, once, before the program runs. Fails on the first import with no
+// native of that name, so a misspelled native is reported at load time.
+Lim_Error lim_bind_natives(Lim *lim)
+{
+    for (uint64_t i = 0; i < lim->imports_size; i++) {
+        Lim_Native *import = &lim->imports[i];
+        int index = lim_find_native(lim, cstr_as_sv(import->name));
+        if (index < 0) {
+            return lim_fail(lim, LIM_ERROR_NATIVE, "unknown native `%s`",
+                            import->name);
+        }
+        *import = lim->natives[index];
+    }
+    return LIM_OK;
 }
 
-void lim_push_native_func(Lim *lim, Lim_Native_Func func)
+Lim_Error lim_load_plugin(Lim *lim, const char *file_path)
 {
-    assert(lim->natives_size < LIM_NATIVES_CAPACITY);
-    lim->natives[lim->natives_size++] = func;
+    void *handle = dlopen(file_path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        return lim_fail(lim, LIM_ERROR_IO, "Could not load plugin `%s`: %s",
+                        file_path, dlerror());
+    }
+
+    const Lim_Plugin *plugin = dlsym(handle, LIM_PLUGIN_SYMBOL);
+    if (plugin == NULL) {
+        dlclose(handle);
+        return lim_fail(lim, LIM_ERROR_FORMAT, "`%s` does not export `%s`",
+                        file_path, LIM_PLUGIN_SYMBOL);
+    }
+    if (plugin->abi_version != LIM_PLUGIN_ABI_VERSION) {
+        Lim_Error error =
+            lim_fail(lim, LIM_ERROR_FORMAT,
+                     "plugin `%s` is built for ABI version %u, expected %u",
+                     file_path, plugin->abi_version, LIM_PLUGIN_ABI_VERSION);
+        dlclose(handle);
+        return error;
+    }
+    // the plugin stays loaded for the lifetime of the process, natives it
+    // registered before failing may still be in use
+    if (plugin->init(lim, lim_push_native_func) != 0) {
+        return lim_fail(lim, LIM_ERROR_NATIVE,
+                        "plugin `%s` failed to initialize", plugin->name);
+    }
+    return LIM_OK;
 }
 
 const char *shift_args(int *argc, char ***argv)
@@ -908,6 +6376,3 @@ const char *shift_args(int *argc, char ***argv)
     *argc -= 1;
     return result;
 }
-
-Lim lim = {0};
-Lasm lasm = {0};
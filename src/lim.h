@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -14,8 +15,22 @@
 #define LIM_STACK_CAPACITY 1024
 #define LIM_PROGRAM_CAPACITY 1024
 #define LIM_NATIVES_CAPACITY 1024
+#define LIM_IMPORTS_CAPACITY 256
+#define LIM_NATIVE_NAME_CAPACITY 64
+#define LIM_FRAMES_CAPACITY 1024
+#define LIM_HEAP_CAPACITY (256ULL * 1024 * 1024)
+#define LIM_HEAP_ADDRESS ((void *) 0x100000000000)
+#define LIM_THREADS_CAPACITY (256 * 1024)
+#define LIM_CHANNELS_CAPACITY (64 * 1024)
+#define LIM_RING_CAPACITY (1ULL << 32)
+#define LIM_MAP_WORKERS_CAPACITY 64
+#define LIM_ERROR_MESSAGE_CAPACITY 512
 #define LABEL_CAPACITY 1024
 #define UNRESOLVED_JMPS_CAPACITY 1024
+#define LIM_SYMBOL_NAME_CAPACITY 64
+#define LIM_DATA_CAPACITY (64 * 1024)
+#define LIM_INTERNED_CAPACITY 4096
+#define LIM_INTERNED_NAME_CAPACITY 64
 
 typedef enum {
     TRAP_OK = 0,
@@ -25,10 +40,30 @@ typedef enum {
     TRAP_ILLEGAL_INST,
     TRAP_ILLEGAL_INST_ACCESS,
     TRAP_ILLEGAL_OPERAND,
+    TRAP_CALL_STACK_OVERFLOW,
+    TRAP_CALL_STACK_UNDERFLOW,
+    TRAP_THREADS_OVERFLOW,
+    TRAP_DEADLOCK,
+    TRAP_OUT_OF_FUEL,  // not an error, the VM can be run again from here
+    TRAP_SNAPSHOT_FAILED,
 } Trap;
 
 const char *trap_as_cstr(Trap trap);
 
+// Errors of loading, assembling and binding, which happen before a program
+// runs. The function which fails leaves a message in `Lim.error`.
+typedef enum {
+    LIM_OK = 0,
+    LIM_ERROR_IO,
+    LIM_ERROR_FORMAT,    // not a program, snapshot or plugin of this version
+    LIM_ERROR_CAPACITY,  // more than the fixed capacities of the VM hold
+    LIM_ERROR_SYNTAX,
+    LIM_ERROR_NATIVE,
+    LIM_ERROR_MEMORY,
+} Lim_Error;
+
+const char *lim_error_as_cstr(Lim_Error error);
+
 typedef uint64_t Inst_Addr;
 
 typedef union Word {
@@ -68,6 +103,18 @@ typedef enum {
     INST_NATIVE,
     INST_HALT,
     INST_PRINT_DEBUG,
+    INST_LOAD_LOCAL,
+    INST_STORE_LOCAL,
+    INST_DROP,
+    INST_SNAPSHOT,
+    INST_SPAWN,
+    INST_YIELD,
+    INST_JOIN,
+    INST_CHAN,
+    INST_SEND,
+    INST_RECV,
+    INST_PUSH_DATA,
+    INST_PUSH_SYM,
     INST_NUM,
 } Inst_Type;
 
@@ -235,10 +282,10 @@ typedef struct {
         .type = INST_RET                 \
     }
 
-#define /*Inst*/ MAKE_INST_NATIVE(/*Word*/ number) \
+#define /*Inst*/ MAKE_INST_NATIVE(/*Word*/ import) \
     (Inst)                                         \
     {                                              \
-        .type = INST_NATIVE, .operand = number,    \
+        .type = INST_NATIVE, .operand = import,    \
     }
 
 #define /*Inst*/ MAKE_INST_HALT(/*void*/) \
@@ -253,6 +300,84 @@ typedef struct {
         .type = INST_PRINT_DEBUG                 \
     }
 
+#define /*Inst*/ MAKE_INST_LOAD_LOCAL(/*Word*/ offset) \
+    (Inst)                                             \
+    {                                                  \
+        .type = INST_LOAD_LOCAL, .operand = (offset),  \
+    }
+
+#define /*Inst*/ MAKE_INST_STORE_LOCAL(/*Word*/ offset) \
+    (Inst)                                              \
+    {                                                   \
+        .type = INST_STORE_LOCAL, .operand = (offset),  \
+    }
+
+#define /*Inst*/ MAKE_INST_DROP(/*Word*/ count) \
+    (Inst)                                      \
+    {                                           \
+        .type = INST_DROP, .operand = (count),  \
+    }
+
+#define /*Inst*/ MAKE_INST_SNAPSHOT(/*void*/) \
+    (Inst)                                    \
+    {                                         \
+        .type = INST_SNAPSHOT                 \
+    }
+
+#define /*Inst*/ MAKE_INST_SPAWN(/*Word*/ addr) \
+    (Inst)                                      \
+    {                                           \
+        .type = INST_SPAWN, .operand = (addr),  \
+    }
+
+#define /*Inst*/ MAKE_INST_SPAWN_WITHOUT_OPERAND(/*void*/) \
+    (Inst)                                                 \
+    {                                                      \
+        .type = INST_SPAWN                                 \
+    }
+
+#define /*Inst*/ MAKE_INST_YIELD(/*void*/) \
+    (Inst)                                 \
+    {                                      \
+        .type = INST_YIELD                 \
+    }
+
+#define /*Inst*/ MAKE_INST_JOIN(/*void*/) \
+    (Inst)                                \
+    {                                     \
+        .type = INST_JOIN                 \
+    }
+
+#define /*Inst*/ MAKE_INST_CHAN(/*void*/) \
+    (Inst)                                \
+    {                                     \
+        .type = INST_CHAN                 \
+    }
+
+#define /*Inst*/ MAKE_INST_SEND(/*void*/) \
+    (Inst)                                \
+    {                                     \
+        .type = INST_SEND                 \
+    }
+
+#define /*Inst*/ MAKE_INST_RECV(/*void*/) \
+    (Inst)                                \
+    {                                     \
+        .type = INST_RECV                 \
+    }
+
+#define /*Inst*/ MAKE_INST_PUSH_DATA(/*Word*/ offset) \
+    (Inst)                                            \
+    {                                                 \
+        .type = INST_PUSH_DATA, .operand = (offset),  \
+    }
+
+#define /*Inst*/ MAKE_INST_PUSH_SYM(/*Word*/ symbol) \
+    (Inst)                                           \
+    {                                                \
+        .type = INST_PUSH_SYM, .operand = (symbol),  \
+    }
+
 typedef struct {
     size_t count;
     const char *data;
@@ -285,54 +410,588 @@ typedef struct {
     /* Unresolved jump instructions */
     Unresolved_Jmp unresolved_jmps[UNRESOLVED_JMPS_CAPACITY];
     size_t unresolved_jmps_size;
+
+    /* Labels declared with `.export`, visible to other modules */
+    String_View exports[LABEL_CAPACITY];
+    size_t exports_size;
+
+    /* The `.data` section, its labels are offsets into it */
+    uint8_t data[LIM_DATA_CAPACITY];
+    uint64_t data_size;
+    Label data_labels[LABEL_CAPACITY];
+    size_t data_labels_size;
+    Unresolved_Jmp unresolved_data[UNRESOLVED_JMPS_CAPACITY];
+    size_t unresolved_data_size;
+
+    /* Leave unknown labels to the linker instead of failing */
+    bool relocatable;
+
+    /* First error of the translation */
+    Lim_Error error;
 } Lasm;
 
 int label_table_find(const Lasm *lasm, String_View label);
-void label_table_push(Lasm *lasm, String_View label, Inst_Addr addr);
-void label_table_push_unresolved_jmp(Lasm *lasm,
+bool label_table_push(Lasm *lasm, String_View label, Inst_Addr addr);
+bool label_table_push_unresolved_jmp(Lasm *lasm,
                                      Inst_Addr addr,
                                      String_View label);
-extern Lasm lasm;
 
 /* Lisp Virtual Machine */
 typedef struct Lim Lim;
 
 typedef Trap (*Lim_Native_Func)(Lim *);
 
+typedef struct {
+    char name[LIM_NATIVE_NAME_CAPACITY];
+    Lim_Native_Func func;
+    uint64_t args;  // amount of words the native pops from the stack
+    uint64_t rets;  // amount of words the native pushes back
+} Lim_Native;
+
+// A call frame lives on the return stack, apart from the operand stack.
+// `base` is the operand stack size at the moment of the call, so arguments
+// pushed by the caller are the locals right below it (offsets -1, -2, ...).
+typedef struct {
+    Inst_Addr ret;
+    uint64_t base;
+} Lim_Frame;
+
+// Memory handed out by the `alloc` native. The arena is reserved at a fixed
+// address on first use, so pointers into it stay valid across a snapshot.
+typedef struct {
+    uint8_t *base;
+    uint64_t size;  // bytes used from the start of the arena
+    void *free;     // list of freed blocks
+} Lim_Heap;
+
+// FIFO of green threads linked through `Lim_Thread.next`, ids are stored
+// plus one so a zeroed queue is empty
+typedef struct {
+    uint64_t head;
+    uint64_t tail;
+} Lim_Queue;
+
+typedef enum {
+    THREAD_READY = 0,
+    THREAD_BLOCKED,
+    THREAD_DONE,
+    THREAD_FREE,  // joined, the id goes to the next `spawn`
+} Lim_Thread_State;
+
+// A green thread which is not running keeps its operand and return stack in
+// buffers of its own, switching copies them in and out of `Lim`.
+typedef struct {
+    Lim_Thread_State state;
+    Inst_Addr ip;
+    Word *stack;
+    uint64_t stack_size;
+    Lim_Frame *frames;
+    uint64_t frames_size;
+    uint64_t capacity;  // of `stack` and of `frames`
+    uint64_t next;
+    Lim_Queue joiners;
+    Word result;
+} Lim_Thread;
+
+// A freed channel has no items and is linked through `head`
+typedef struct {
+    Word *items;
+    uint64_t capacity;  // 0 once freed
+    uint64_t head;
+    uint64_t size;
+    Lim_Queue senders;
+    Lim_Queue receivers;
+} Lim_Channel;
+
+// What the natives opened for the program: files, I/O queues, mappings and
+// scanners. `lim_reset` and `lim_destroy` release the ones the program did
+// not.
+typedef enum {
+    LIM_RESOURCE_FILE,  // `handle` is the fd
+    LIM_RESOURCE_IO,    // `handle` is the `Lim_Io`
+    LIM_RESOURCE_MAP,   // `handle` is the address of `size` bytes
+    LIM_RESOURCE_SCAN,  // `handle` is the scanner of `scan_new`
+} Lim_Resource_Type;
+
+typedef struct {
+    Lim_Resource_Type type;
+    Word handle;
+    uint64_t size;
+} Lim_Resource;
+
+// Counters the VM keeps while it runs, cheap enough to be always on.
+// Instructions are the stack instructions executed by any engine, the ones
+// the IR and traces fold away included; the workers of `par_map` are not
+// counted. `stack_peak` is exact in the interpreter; the IR raises it to the
+// deepest stack of the translated code it enters, an upper bound.
+typedef struct {
+    uint64_t instructions;
+    uint64_t stack_peak;
+    uint64_t calls;
+    uint64_t returns;
+    uint64_t allocated;  // bytes handed out by `lim_heap_alloc`
+    uint64_t freed;      // bytes given back to `lim_heap_free`
+    uint64_t native_calls[LIM_IMPORTS_CAPACITY];  // per import
+} Lim_Stats;
+
 struct Lim {
     /* Stack */
     Word stack[LIM_STACK_CAPACITY];
     uint64_t stack_size;
 
+    /* Return stack */
+    Lim_Frame frames[LIM_FRAMES_CAPACITY];
+    uint64_t frames_size;
+
     /* Code */
     Inst program[LIM_PROGRAM_CAPACITY];
     uint64_t program_size;
 
-    /* Natives */
-    Lim_Native_Func natives[LIM_NATIVES_CAPACITY];
+    /* Read-only data of the program, `push_data N` pushes `data + N`.
+     * `data_map` is the mapping of the VM that `data` points into, if any. */
+    const uint8_t *data;
+    uint64_t data_size;
+    void *data_map;
+    uint64_t data_map_size;
+
+    /* Natives registered by the host and plugins */
+    Lim_Native natives[LIM_NATIVES_CAPACITY];
     uint64_t natives_size;
 
+    /* Import table of the program, `native N` calls `imports[N]` */
+    Lim_Native imports[LIM_IMPORTS_CAPACITY];
+    uint64_t imports_size;
+
+    /* Interned symbols, `push_sym N` pushes symbol N. The symbols of the
+     * program come first, in the order of its table, then the ones
+     * interned while it runs, from `interned_program` on. `interned_index`
+     * holds symbol + 1 by hash of the name, 0 when the slot is free. */
+    char interned[LIM_INTERNED_CAPACITY][LIM_INTERNED_NAME_CAPACITY];
+    uint64_t interned_size;
+    uint64_t interned_program;
+    uint32_t interned_index[LIM_INTERNED_CAPACITY * 2];
+
+    /* Heap */
+    Lim_Heap heap;
+
+    /* Green threads and channels, allocated on first use. Thread 0 is the
+     * one the VM starts with. Ids of joined threads and freed channels are
+     * reused, `threads_free` and `channels_free` hold the first one + 1. */
+    Lim_Thread *threads;
+    uint64_t threads_size;
+    uint64_t threads_free;
+    uint64_t thread;
+    Lim_Queue ready;
+    Lim_Channel *channels;
+    uint64_t channels_size;
+    uint64_t channels_free;
+
+    /* Resources of the natives, grown on demand */
+    Lim_Resource *resources;
+    uint64_t resources_size;
+    uint64_t resources_capacity;
+
     /* State */
     Inst_Addr ip;
     bool halt;
+
+    /* Where the `snapshot` instruction saves the VM, ignored when NULL */
+    const char *snapshot_file_path;
+
+    /* Where the print natives and `print_debug` write, stdout when NULL */
+    FILE *output;
+
+    /* Worker VMs of the `par_map` native, one per core when 0 */
+    uint64_t map_workers;
+
+    /* Message of the last `Lim_Error` or `TRAP_SNAPSHOT_FAILED` */
+    char error[LIM_ERROR_MESSAGE_CAPACITY];
+
+    /* Counters since the VM was created or reset */
+    Lim_Stats stats;
 };
 
+// A zeroed VM on the heap, `Lim` is too big for the stack of most threads.
+// Returns NULL when out of memory.
+Lim *lim_create(void);
+void lim_destroy(Lim *lim);
+// Back to the state after loading: empty stacks, heap and threads, no open
+// resources, `ip` at the entry, only the symbols of the program. The
+// program, natives and imports are kept.
+void lim_reset(Lim *lim);
+Trap lim_push_word(Lim *lim, Word word);
+Trap lim_pop_word(Lim *lim, Word *word);
+
+uint64_t lim_frame_base(const Lim *lim);
 Trap lim_execute_inst(Lim *lim);
 Trap lim_execute_program(Lim *lim);
-void lim_load_program_from_memory(Lim *lim,
-                                  Inst *program,
-                                  uint64_t program_size);
-void lim_load_program_from_file(Lim *lim, const char *file_path);
-void lim_save_program_to_file(Lim *lim, const char *file_path);
-String_View slurp_file(const char *file_path);
-Word number_literal_as_word(String_View sv);
-void lim_translate_source(String_View source, Lim *lim, Lasm *lasm);
+// Run until about `fuel` instructions are used up, then `TRAP_OUT_OF_FUEL`
+Trap lim_execute_budget(Lim *lim, uint64_t fuel);
+Lim_Error lim_load_program_from_memory(Lim *lim,
+                                       const Inst *program,
+                                       uint64_t program_size);
+Lim_Error lim_load_program_from_file(Lim *lim, const char *file_path);
+// Load the image of a .lim file from memory, the data is copied into a
+// read-only mapping of the VM
+Lim_Error lim_load_program_from_bytes(Lim *lim, const void *data, size_t size);
+
+// A label and its address, kept in programs for debuggers and exported by
+// objects to the linker
+typedef struct {
+    char name[LIM_SYMBOL_NAME_CAPACITY];
+    uint64_t addr;
+} Lim_Symbol;
+
+// Layout of a .lim file: this header, `imports_size` native names of
+// LIM_NATIVE_NAME_CAPACITY bytes each, `interned_size` symbol names of
+// LIM_INTERNED_NAME_CAPACITY bytes each, `program_size` instructions,
+// `symbols_size` symbols and, at the page aligned `data_offset`, `data_size`
+// bytes of read-only data which is mapped from the file at load.
+#define LIM_FILE_MAGIC 0x4d494c  // "LIM"
+#define LIM_FILE_VERSION 4
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t program_size;
+    uint64_t imports_size;
+    uint64_t symbols_size;
+    uint64_t data_size;
+    uint64_t data_offset;
+    uint64_t interned_size;
+} Lim_File_Meta;
+
+Lim_Error lim_save_program_to_file(Lim *lim, const char *file_path);
+Lim_Error lim_save_program_with_symbols(Lim *lim,
+                                        const Lim_Symbol *symbols,
+                                        uint64_t symbols_size,
+                                        const char *file_path);
+// `symbols` has room for LABEL_CAPACITY symbols
+Lim_Error lim_load_symbols_from_file(Lim *lim,
+                                     const char *file_path,
+                                     Lim_Symbol *symbols,
+                                     uint64_t *symbols_size);
+
+// Layout of a .limo object: this header, `imports_size` native names,
+// `interned_size` symbol names, `program_size` instructions, `symbols_size`
+// symbols, `relocs_size` relocations and `data_size` bytes of data.
+// Addresses are relative to the start of the module, so are the `push_data`
+// offsets to its data, and `push_sym` operands index its symbol names.
+#define LIM_OBJECT_MAGIC 0x4f4d494c  // "LIMO"
+#define LIM_OBJECT_VERSION 3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t program_size;
+    uint64_t imports_size;
+    uint64_t symbols_size;
+    uint64_t relocs_size;
+    uint64_t source_hash;  // of the source the object is assembled from
+    uint64_t data_size;
+    uint64_t interned_size;
+} Lim_Object_Meta;
+
+// The operand of the instruction at `addr` becomes the address of `symbol`,
+// or is offset by the start of the module when `symbol` is empty.
+typedef struct {
+    uint64_t addr;
+    char symbol[LIM_SYMBOL_NAME_CAPACITY];
+} Lim_Reloc;
+
+Lim_Error lim_save_object_to_file(Lim *lim,
+                                  const Lasm *lasm,
+                                  uint64_t source_hash,
+                                  const char *file_path);
+// Link the objects into the program of `lim`, the first object starts at
+// address 0 and is the entry point. The exported symbols are stored into
+// `symbols`, which has room for LABEL_CAPACITY symbols, unless it is NULL.
+Lim_Error lim_link_objects(Lim *lim,
+                           const char *const *file_paths,
+                           size_t file_paths_size,
+                           Lim_Symbol *symbols,
+                           uint64_t *symbols_size);
+uint64_t lim_hash_bytes(const void *data, size_t size);
+
+#define LIM_SNAPSHOT_MAGIC 0x534d494c  // "LIMS"
+#define LIM_SNAPSHOT_VERSION 3
+
+// Snapshot file: meta, import names, symbol names, program, stack, frames
+// and, at the page aligned `heap_offset`, the used part of the heap which is
+// mapped back copy on write at `heap_address`, then at the page aligned
+// `data_offset` the data which is mapped back read-only at `data_address`.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t program_size;
+    uint64_t imports_size;
+    uint64_t stack_size;
+    uint64_t frames_size;
+    uint64_t ip;
+    uint64_t heap_address;
+    uint64_t heap_size;
+    uint64_t heap_free;
+    uint64_t heap_offset;
+    uint64_t data_address;
+    uint64_t data_size;
+    uint64_t data_offset;
+    uint64_t interned_size;
+} Lim_Snapshot_Meta;
+
+Lim_Error lim_save_snapshot(Lim *lim, const char *file_path);
+Lim_Error lim_load_snapshot(Lim *lim, const char *file_path);
+
+void *lim_heap_alloc(Lim *lim, uint64_t size);
+void lim_heap_free(Lim *lim, void *ptr);
+// The content is allocated with malloc and owned by the caller
+Lim_Error slurp_file(Lim *lim, const char *file_path, String_View *content);
+bool number_literal_as_word(String_View sv, Word *word);
+Lim_Error lim_translate_source(String_View source, Lim *lim, Lasm *lasm);
 void lim_dump_stack(FILE *stream, const Lim *lim);
 
 void lim_attach_natives(Lim *lim);
-void lim_push_native_func(Lim *lim, Lim_Native_Func func);
+Lim_Error lim_push_native_func(Lim *lim,
+                               const char *name,
+                               Lim_Native_Func func,
+                               uint64_t args,
+                               uint64_t rets);
+int lim_find_native(const Lim *lim, String_View name);
+Lim_Error lim_import_native(Lim *lim, String_View name, uint64_t *index);
+Lim_Error lim_bind_natives(Lim *lim);
+
+// The symbol of `name`, which is interned first when it is new. Symbols the
+// host interns count as the program's, `lim_reset` keeps them.
+Lim_Error lim_intern(Lim *lim, String_View name, uint64_t *symbol);
+// NULL when there is no such symbol
+const char *lim_interned_name(const Lim *lim, uint64_t symbol);
+
+/* Native plugins */
+// Bump whenever `Lim`, `Lim_Native_Func` or the plugin interface change, a
+// plugin built against another version is refused at load time.
+#define LIM_PLUGIN_ABI_VERSION 9
+#define LIM_PLUGIN_SYMBOL "lim_plugin"
+
+typedef Lim_Error (*Lim_Register_Native)(Lim *lim,
+                                         const char *name,
+                                         Lim_Native_Func func,
+                                         uint64_t args,
+                                         uint64_t rets);
+
+// Every plugin exports `const Lim_Plugin lim_plugin`. `init` registers the
+// natives of the plugin through `register_native` and returns 0 on success.
+typedef struct {
+    uint32_t abi_version;
+    const char *name;
+    int (*init)(Lim *lim, Lim_Register_Native register_native);
+} Lim_Plugin;
+
+Lim_Error lim_load_plugin(Lim *lim, const char *file_path);
+
+/* Register IR */
+#define LIM_IR_CAPACITY (8 * LIM_PROGRAM_CAPACITY)
+#define LIM_IR_CONSTS_CAPACITY (LIM_PROGRAM_CAPACITY + 1)
+#define LIM_IR_TEMPS_CAPACITY (4 * LIM_STACK_CAPACITY)
+
+// Every stack slot of the VM is a register of the IR. Operands point straight
+// at the slot in `lim->stack`, at a constant or at a scratch register, so
+// `dup`, `swap`, `pop`, `push` and the local instructions disappear and only
+// the data movement which is left at the end of a basic block is emitted as
+// `IR_MOV`.
+typedef enum {
+    IR_MOV = 0,
+    IR_PLUS,
+    IR_MINUS,
+    IR_MULT,
+    IR_DIV,
+    IR_FPLUS,
+    IR_FMINUS,
+    IR_FMULT,
+    IR_FDIV,
+    IR_GT,
+    IR_LT,
+    IR_GE,
+    IR_LE,
+    IR_EQ,
+    IR_JMP,
+    IR_JNZ,
+    IR_JZ,
+    IR_CALL,
+    IR_RET,
+    IR_STEP,  // run the stack instruction at the exit through the interpreter
+    IR_EXIT,  // leave the IR and continue in the stack interpreter
+    IR_HALT,
+    IR_TRAP,
+} Ir_Op;
+
+typedef struct {
+    Inst_Addr ip;
+    uint64_t stack_size;
+    uint64_t cost;  // stack instructions since the previous charged exit
+} Ir_Exit;
+
+typedef struct {
+    Ir_Op op;
+    uint32_t exit;  // index into `Ir.exits`, state to sync back to `Lim`
+    Word *dst;
+    Word *a;
+    union {
+        Word *b;
+        uint64_t target;  // IR index for jumps, trap for IR_TRAP
+    };
+} Ir_Inst;
+
+typedef struct {
+    Ir_Inst insts[LIM_IR_CAPACITY];
+    size_t insts_size;
+
+    Ir_Exit exits[LIM_IR_CAPACITY];
+    size_t exits_size;
+
+    Word consts[LIM_IR_CONSTS_CAPACITY];
+    size_t consts_size;
+
+    Word temps[LIM_IR_TEMPS_CAPACITY];
+
+    // Stack depth and frame base of every instruction as found by the
+    // analysis (-1 when unreachable) and the IR index of translated basic
+    // blocks (-1 when none)
+    int64_t depths[LIM_PROGRAM_CAPACITY];
+    int64_t bases[LIM_PROGRAM_CAPACITY];
+    int64_t entries[LIM_PROGRAM_CAPACITY];
+
+    // No two paths reach an instruction with different depths or bases, so
+    // `depths` and `bases` hold for every execution from the entry
+    bool exact;
+
+    // Deepest stack of the translated code
+    uint64_t stack_peak;
+} Ir;
+
+void lim_ir_analyze(Ir *ir, Lim *lim);
+bool lim_ir_translate(Ir *ir, Lim *lim);
+Trap lim_ir_execute(const Ir *ir, Lim *lim, uint64_t *fuel);
+Trap lim_ir_execute_budget(const Ir *ir, Lim *lim, uint64_t fuel);
+Trap lim_ir_execute_program(const Ir *ir, Lim *lim);
+
+/* Tracing JIT */
+// Runs the program in the interpreter and compiles its hot loops to x86-64:
+// once a loop head is hot one iteration is recorded as it executes, with the
+// stack shuffles gone and every value in a register, and later iterations run
+// as machine code until a branch goes the other way than it did while
+// recording. Loops which call, return or call natives stay interpreted, and
+// so does everything on other architectures. The traces belong to the
+// program loaded while they are recorded, use a new JIT for another one.
+typedef struct Lim_Jit Lim_Jit;
 
-extern Lim lim;
+typedef struct {
+    uint64_t traces;      // loops compiled
+    uint64_t aborts;      // recordings given up
+    uint64_t entries;     // times a trace was run
+    uint64_t iterations;  // of loops run as machine code
+    uint64_t exits;       // traces left before the loop head
+} Lim_Jit_Stats;
+
+// Returns NULL when out of memory
+Lim_Jit *lim_jit_create(void);
+void lim_jit_destroy(Lim_Jit *jit);
+Trap lim_jit_execute_budget(Lim_Jit *jit, Lim *lim, uint64_t fuel);
+Trap lim_jit_execute_program(Lim_Jit *jit, Lim *lim);
+Lim_Jit_Stats lim_jit_stats(const Lim_Jit *jit);
+
+/* Hash maps */
+// Open addressing map from words to words, keys compare bit by bit. The map
+// lives on the heap of the VM, like memory from `alloc`, so it is released
+// by `lim_reset` and saved by snapshots. Inserting may move the entries and
+// invalidates cursors.
+typedef struct Lim_Map Lim_Map;
+
+// Room for `capacity` keys before the map grows. Returns NULL when out of
+// memory or when that many keys could never fit into the heap.
+Lim_Map *lim_map_create(Lim *lim, uint64_t capacity);
+void lim_map_destroy(Lim *lim, Lim_Map *map);
+// Inserts or replaces, false when out of memory
+bool lim_map_insert(Lim *lim, Lim_Map *map, Word key, Word value);
+// False when the key is missing
+bool lim_map_get(const Lim_Map *map, Word key, Word *value);
+bool lim_map_delete(Lim_Map *map, Word key);
+uint64_t lim_map_size(const Lim_Map *map);
+// Cursor of the first entry after `cursor`, starting at 0; 0 after the last
+uint64_t lim_map_next(const Lim_Map *map, uint64_t cursor);
+
+/* Big integers */
+// Signed integers of any size. Like maps they live on the heap of the VM,
+// every operation returns a new integer and leaves its operands alone, and
+// the functions which allocate return NULL when out of memory.
+typedef struct Lim_Big Lim_Big;
+
+Lim_Big *lim_big_from_i64(Lim *lim, int64_t x);
+void lim_big_destroy(Lim *lim, Lim_Big *big);
+// The low 64 bits with the sign applied
+int64_t lim_big_to_i64(const Lim_Big *big);
+int lim_big_cmp(const Lim_Big *a, const Lim_Big *b);
+Lim_Big *lim_big_add(Lim *lim, const Lim_Big *a, const Lim_Big *b);
+Lim_Big *lim_big_sub(Lim *lim, const Lim_Big *a, const Lim_Big *b);
+Lim_Big *lim_big_mul(Lim *lim, const Lim_Big *a, const Lim_Big *b);
+// The quotient is rounded toward zero like `div` and the remainder takes the
+// sign of `a`. `b` must not be zero, false when out of memory.
+bool lim_big_divmod(Lim *lim, const Lim_Big *a, const Lim_Big *b,
+                    Lim_Big **quotient, Lim_Big **remainder);
+Lim_Big *lim_big_pow(Lim *lim, const Lim_Big *a, uint64_t exponent);
+// NUL-terminated decimal digits allocated with malloc and owned by the
+// caller, NULL when out of memory
+char *lim_big_to_decimal(const Lim_Big *big);
+
+/* Lock-free rings */
+// Bounded queue of words between VMs, or hosts, on different threads. A ring
+// made for one sender and one receiver (`mpmc` false) must not be shared by
+// more. Blocking calls spin for a moment, then park the thread in the kernel.
+typedef struct Lim_Ring Lim_Ring;
+
+// `capacity` is rounded up to a power of two. Returns NULL when it is above
+// LIM_RING_CAPACITY or out of memory.
+Lim_Ring *lim_ring_create(uint64_t capacity, bool mpmc);
+void lim_ring_destroy(Lim_Ring *ring);
+// False when the ring is full or closed
+bool lim_ring_try_send(Lim_Ring *ring, Word value);
+// False when the ring is empty
+bool lim_ring_try_recv(Lim_Ring *ring, Word *value);
+// Block while the ring is full, false once it is closed
+bool lim_ring_send(Lim_Ring *ring, Word value);
+// Block while the ring is empty, false once it is closed and drained
+bool lim_ring_recv(Lim_Ring *ring, Word *value);
+void lim_ring_close(Lim_Ring *ring);
+
+/* Asynchronous I/O */
+#define LIM_IO_ENTRIES_CAPACITY 4096
+
+// Queue of file reads and writes which run in the background and complete
+// in any order, through io_uring or a pool of threads. A queue belongs to
+// one thread.
+typedef struct Lim_Io Lim_Io;
+
+typedef enum {
+    LIM_IO_AUTO = 0,  // io_uring when the kernel allows it, threads otherwise
+    LIM_IO_URING,
+    LIM_IO_THREADS,
+} Lim_Io_Backend;
+
+// Room for `entries` requests in flight, at most `LIM_IO_ENTRIES_CAPACITY`.
+// Returns NULL when out of memory or the backend is not available.
+Lim_Io *lim_io_create(uint64_t entries, Lim_Io_Backend backend);
+// Waits for the requests in flight
+void lim_io_destroy(Lim_Io *io);
+Lim_Io_Backend lim_io_backend(const Lim_Io *io);
+// Queue a transfer at `offset`, or at the file position when it is
+// negative. The buffer must stay until the completion is polled. False when
+// `entries` requests are in flight.
+bool lim_io_read(Lim_Io *io, int fd, void *buffer, uint64_t size,
+                 int64_t offset, uint64_t tag);
+bool lim_io_write(Lim_Io *io, int fd, const void *buffer, uint64_t size,
+                  int64_t offset, uint64_t tag);
+// The tag and result of a completed request, the bytes transferred or
+// -errno. False when none completed yet or, when waiting, none is in
+// flight.
+bool lim_io_poll(Lim_Io *io, bool wait, uint64_t *tag, int64_t *result);
 
 const char *shift_args(int *argc, char ***argv);
 
@@ -0,0 +1,788 @@
+#define _DEFAULT_SOURCE
+#include "lim.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef LIM_SRC_DIR
+#define LIM_SRC_DIR "src"
+#endif
+
+#ifndef LIM_LIB_DIR
+#define LIM_LIB_DIR "build"
+#endif
+
+static Lim lim = {0};
+static Ir ir = {0};
+
+// Instructions which are the target of a jump, a call or a return
+static bool labels[LIM_PROGRAM_CAPACITY + 1];
+
+// Runtime of the generated program. `stack` and `frames` are locals of the
+// generated function and only synced back to `lim` around natives and when
+// the program stops, so the C compiler is free to keep them in registers.
+static const char *const prelude =
+    "#include \"lim.h\"\n"
+    "\n"
+    "static Trap lim_aot_exit(Lim *lim,\n"
+    "                         const Word *stack,\n"
+    "                         uint64_t stack_size,\n"
+    "                         const Lim_Frame *frames,\n"
+    "                         uint64_t frames_size,\n"
+    "                         Inst_Addr ip,\n"
+    "                         Trap trap)\n"
+    "{\n"
+    "    memcpy(lim->stack, stack, sizeof(stack[0]) * stack_size);\n"
+    "    lim->stack_size = stack_size;\n"
+    "    memcpy(lim->frames, frames, sizeof(frames[0]) * frames_size);\n"
+    "    lim->frames_size = frames_size;\n"
+    "    lim->ip = ip;\n"
+    "    return trap;\n"
+    "}\n"
+    "\n"
+    "#define EXIT(at, size, trap) \\\n"
+    "    return lim_aot_exit(lim, stack, (size), frames, fp, (at), (trap))\n"
+    "\n"
+    "#define NATIVE(at, size, index)                                  \\\n"
+    "    do {                                                         \\\n"
+    "        memcpy(lim->stack, stack, sizeof(stack[0]) * (size));    \\\n"
+    "        lim->stack_size = (size);                                \\\n"
+    "        lim->ip = (at);                                          \\\n"
+    "        Trap trap = lim->imports[(index)].func(lim);             \\\n"
+    "        if (trap != TRAP_OK) {                                   \\\n"
+    "            memcpy(lim->frames, frames, sizeof(frames[0]) * fp); \\\n"
+    "            lim->frames_size = fp;                               \\\n"
+    "            return trap;                                         \\\n"
+    "        }                                                        \\\n"
+    "        memcpy(stack, lim->stack,                                \\\n"
+    "               sizeof(stack[0]) * lim->stack_size);              \\\n"
+    "        sp = lim->stack_size;                                    \\\n"
+    "    } while (0)\n"
+    "\n"
+    "// The interpreter takes over at `at` with the stack a native left\n"
+    "#define INTERPRET(at)                                            \\\n"
+    "    do {                                                         \\\n"
+    "        memcpy(lim->frames, frames, sizeof(frames[0]) * fp);     \\\n"
+    "        lim->frames_size = fp;                                   \\\n"
+    "        lim->ip = (at);                                          \\\n"
+    "        return lim_execute_program(lim);                         \\\n"
+    "    } while (0)\n"
+    "\n";
+
+// C operator and `Word` field of the binary instructions
+static const struct {
+    const char *op;
+    const char *field;
+} binary_ops[INST_NUM] = {
+    [INST_PLUS] = {"+", "as_i64"},   [INST_MINUS] = {"-", "as_i64"},
+    [INST_MULT] = {"*", "as_i64"},   [INST_DIV] = {"/", "as_i64"},
+    [INST_FPLUS] = {"+", "as_f64"},  [INST_FMINUS] = {"-", "as_f64"},
+    [INST_FMULT] = {"*", "as_f64"},  [INST_FDIV] = {"/", "as_f64"},
+    [INST_GT] = {">", "as_i64"},     [INST_LT] = {"<", "as_i64"},
+    [INST_GE] = {">=", "as_i64"},    [INST_LE] = {"<=", "as_i64"},
+    [INST_EQ] = {"==", "as_i64"},
+};
+
+static void emit_goto(FILE *out,
+                      const Lim *lim,
+                      Inst_Addr target,
+                      const char *size)
+{
+    if (target < lim->program_size) {
+        fprintf(out, "goto inst_%lu;", target);
+    } else {
+        fprintf(out, "EXIT(%lu, %s, TRAP_ILLEGAL_INST_ACCESS);", target, size);
+    }
+}
+
+static void emit_ret(FILE *out, const Lim *lim, const char *size)
+{
+    fprintf(out, "    if (fp < 1) {\n");
+    fprintf(out, "        EXIT(ip, %s, TRAP_CALL_STACK_UNDERFLOW);\n", size);
+    fprintf(out, "    }\n");
+    fprintf(out, "    ret = frames[--fp].ret;\n");
+    fprintf(out, "    switch (ret) {\n");
+    for (Inst_Addr i = 0; i < lim->program_size; i++) {
+        if (lim->program[i].type == INST_CALL && i + 1 < lim->program_size &&
+            labels[i + 1]) {
+            fprintf(out, "    case %lu: goto inst_%lu;\n", i + 1, i + 1);
+        }
+    }
+    fprintf(out, "    default: EXIT(ret, %s, TRAP_ILLEGAL_INST_ACCESS);\n",
+            size);
+    fprintf(out, "    }\n");
+}
+
+// Stack depth `k` and frame base `b` are known at compile time, every slot is
+// a constant index into the local stack and stack checks are resolved here.
+// Returns the stack depth after the instruction or -1 if execution never
+// continues with the next one.
+static int64_t emit_static(FILE *out, const Lim *lim, Inst_Addr ip)
+{
+    const Inst inst = lim->program[ip];
+    const uint64_t k = ir.depths[ip];
+    const uint64_t b = ir.bases[ip];
+    const uint64_t operand = inst.operand.as_u64;
+    char size[32];
+    snprintf(size, sizeof(size), "%lu", k);
+
+#define STATIC_TRAP(trap)                                             \
+    do {                                                              \
+        fprintf(out, "    EXIT(%lu, %lu, %s);\n", ip, k, #trap);      \
+        return -1;                                                    \
+    } while (0)
+
+    switch (inst.type) {
+    case INST_NOP:
+    case INST_SNAPSHOT:
+        return k;
+
+    case INST_PUSH:
+    case INST_PUSH_SYM:
+        if (k >= LIM_STACK_CAPACITY) {
+            STATIC_TRAP(TRAP_STACK_OVERFLOW);
+        }
+        fprintf(out, "    stack[%lu].as_u64 = 0x%016lxULL;\n", k, operand);
+        return k + 1;
+
+    case INST_PUSH_DATA:
+        if (k >= LIM_STACK_CAPACITY) {
+            STATIC_TRAP(TRAP_STACK_OVERFLOW);
+        }
+        fprintf(out, "    stack[%lu].as_ptr = (void *) (lim->data + %lu);\n",
+                k, operand);
+        return k + 1;
+
+    case INST_POP:
+        if (k < 1) {
+            STATIC_TRAP(TRAP_STACK_UNDERFLOW);
+        }
+        return k - 1;
+
+    case INST_DUP:
+        if (k >= LIM_STACK_CAPACITY) {
+            STATIC_TRAP(TRAP_STACK_OVERFLOW);
+        }
+        if (k <= operand) {
+            STATIC_TRAP(TRAP_STACK_UNDERFLOW);
+        }
+        fprintf(out, "    stack[%lu] = stack[%lu];\n", k, k - 1 - operand);
+        return k + 1;
+
+    case INST_SWAP:
+        if (k <= operand) {
+            STATIC_TRAP(TRAP_STACK_UNDERFLOW);
+        }
+        if (operand > 0) {
+            fprintf(out,
+                    "    { Word t = stack[%lu]; stack[%lu] = stack[%lu]; "
+                    "stack[%lu] = t; }\n",
+                    k - 1, k - 1, k - 1 - operand, k - 1 - operand);
+        }
+        return k;
+
+    case INST_JMP:
+        fprintf(out, "    ");
+        emit_goto(out, lim, operand, size);
+        fprintf(out, "\n");
+        return -1;
+
+    case INST_JNZ:
+    case INST_JZ:
+        if (k < 1) {
+            STATIC_TRAP(TRAP_STACK_UNDERFLOW);
+        }
+        snprintf(size, sizeof(size), "%lu", k - 1);
+        fprintf(out, "    if (%sstack[%lu].as_u64) { ",
+                inst.type == INST_JZ ? "!" : "", k - 1);
+        emit_goto(out, lim, operand, size);
+        fprintf(out, " }\n");
+        return k - 1;
+
+    case INST_CALL:
+        fprintf(out, "    if (fp >= LIM_FRAMES_CAPACITY) {\n");
+        fprintf(out, "        EXIT(%lu, %lu, TRAP_CALL_STACK_OVERFLOW);\n", ip,
+                k);
+        fprintf(out, "    }\n");
+        fprintf(out,
+                "    frames[fp++] = (Lim_Frame){.ret = %lu, .base = %lu};\n",
+                ip + 1, k);
+        fprintf(out, "    ");
+        emit_goto(out, lim, operand, size);
+        fprintf(out, "\n");
+        return -1;
+
+    case INST_RET:
+        fprintf(out, "    ip = %lu;\n", ip);
+        emit_ret(out, lim, size);
+        return -1;
+
+    case INST_NATIVE:
+        // the code after a native is only valid for its declared stack
+        // effect, a native which does not keep to it hands the rest of the
+        // run to the interpreter like the register IR does
+        fprintf(out, "    NATIVE(%lu, %lu, %lu);\n", ip, k, operand);
+        if (ip + 1 < lim->program_size && ir.depths[ip + 1] >= 0) {
+            fprintf(out, "    if (sp != %ld) {\n", ir.depths[ip + 1]);
+            fprintf(out, "        INTERPRET(%lu);\n", ip + 1);
+            fprintf(out, "    }\n");
+        } else {
+            fprintf(out, "    INTERPRET(%lu);\n", ip + 1);
+        }
+        return -1;
+
+    case INST_HALT:
+        fprintf(out, "    lim->halt = true;\n");
+        fprintf(out, "    EXIT(%lu, %lu, TRAP_OK);\n", ip, k);
+        return -1;
+
+    case INST_PRINT_DEBUG:
+        if (k < 1) {
+            STATIC_TRAP(TRAP_STACK_UNDERFLOW);
+        }
+        fprintf(out,
+                "    printf(\"%%lu %%ld %%lf %%p\\n\", stack[%lu].as_u64, "
+                "stack[%lu].as_i64, stack[%lu].as_f64, stack[%lu].as_ptr);\n",
+                k - 1, k - 1, k - 1, k - 1);
+        return k - 1;
+
+    case INST_LOAD_LOCAL:
+        if (k >= LIM_STACK_CAPACITY) {
+            STATIC_TRAP(TRAP_STACK_OVERFLOW);
+        }
+        if (b + operand >= k) {
+            STATIC_TRAP(TRAP_ILLEGAL_OPERAND);
+        }
+        fprintf(out, "    stack[%lu] = stack[%lu];\n", k, b + operand);
+        return k + 1;
+
+    case INST_STORE_LOCAL:
+        if (k < 1) {
+            STATIC_TRAP(TRAP_STACK_UNDERFLOW);
+        }
+        if (b + operand >= k - 1) {
+            STATIC_TRAP(TRAP_ILLEGAL_OPERAND);
+        }
+        fprintf(out, "    stack[%lu] = stack[%lu];\n", b + operand, k - 1);
+        return k - 1;
+
+    case INST_DROP:
+        if (k <= operand) {
+            STATIC_TRAP(TRAP_STACK_UNDERFLOW);
+        }
+        if (operand > 0) {
+            fprintf(out, "    stack[%lu] = stack[%lu];\n", k - 1 - operand,
+                    k - 1);
+        }
+        return k - operand;
+
+    case INST_PLUS:
+    case INST_MINUS:
+    case INST_MULT:
+    case INST_DIV:
+    case INST_FPLUS:
+    case INST_FMINUS:
+    case INST_FMULT:
+    case INST_FDIV:
+    case INST_GT:
+    case INST_LT:
+    case INST_GE:
+    case INST_LE:
+    case INST_EQ:
+        if (k < 2) {
+            STATIC_TRAP(TRAP_STACK_UNDERFLOW);
+        }
+        if (inst.type == INST_DIV) {
+            fprintf(out, "    if (stack[%lu].as_i64 == 0) {\n", k - 1);
+            fprintf(out, "        EXIT(%lu, %lu, TRAP_DIV_BY_ZERO);\n", ip, k);
+            fprintf(out, "    }\n");
+        }
+        fprintf(out, "    stack[%lu].%s = stack[%lu].%s %s stack[%lu].%s;\n",
+                k - 2, binary_ops[inst.type].field, k - 2,
+                binary_ops[inst.type].field, binary_ops[inst.type].op, k - 1,
+                binary_ops[inst.type].field);
+        return k - 1;
+
+    case INST_SPAWN:
+    case INST_YIELD:
+    case INST_JOIN:
+    case INST_CHAN:
+    case INST_SEND:
+    case INST_RECV:
+    case INST_NUM:
+    default:
+        STATIC_TRAP(TRAP_ILLEGAL_INST);
+    }
+
+#undef STATIC_TRAP
+}
+
+// Stack depth only known at runtime, checks are the ones of
+// `lim_execute_inst`
+static void emit_dynamic(FILE *out, const Lim *lim, Inst_Addr ip)
+{
+    const Inst inst = lim->program[ip];
+    const uint64_t operand = inst.operand.as_u64;
+
+#define DYNAMIC_CHECK(cond, trap)                                    \
+    do {                                                             \
+        fprintf(out, "    if (%s) {\n", (cond));                     \
+        fprintf(out, "        EXIT(%lu, sp, %s);\n", ip, #trap);     \
+        fprintf(out, "    }\n");                                     \
+    } while (0)
+
+    char cond[128];
+    switch (inst.type) {
+    case INST_NOP:
+    case INST_SNAPSHOT:
+        break;
+
+    case INST_PUSH:
+    case INST_PUSH_SYM:
+        DYNAMIC_CHECK("sp >= LIM_STACK_CAPACITY", TRAP_STACK_OVERFLOW);
+        fprintf(out, "    stack[sp++].as_u64 = 0x%016lxULL;\n", operand);
+        break;
+
+    case INST_PUSH_DATA:
+        DYNAMIC_CHECK("sp >= LIM_STACK_CAPACITY", TRAP_STACK_OVERFLOW);
+        fprintf(out, "    stack[sp++].as_ptr = (void *) (lim->data + %lu);\n",
+                operand);
+        break;
+
+    case INST_POP:
+        DYNAMIC_CHECK("sp < 1", TRAP_STACK_UNDERFLOW);
+        fprintf(out, "    sp--;\n");
+        break;
+
+    case INST_DUP:
+        DYNAMIC_CHECK("sp >= LIM_STACK_CAPACITY", TRAP_STACK_OVERFLOW);
+        snprintf(cond, sizeof(cond), "sp <= %luULL", operand);
+        DYNAMIC_CHECK(cond, TRAP_STACK_UNDERFLOW);
+        fprintf(out, "    stack[sp] = stack[sp - 1 - %luULL];\n", operand);
+        fprintf(out, "    sp++;\n");
+        break;
+
+    case INST_SWAP:
+        snprintf(cond, sizeof(cond), "sp <= %luULL", operand);
+        DYNAMIC_CHECK(cond, TRAP_STACK_UNDERFLOW);
+        if (operand > 0) {
+            fprintf(out,
+                    "    { Word t = stack[sp - 1]; stack[sp - 1] = stack[sp - "
+                    "1 - %luULL]; stack[sp - 1 - %luULL] = t; }\n",
+                    operand, operand);
+        }
+        break;
+
+    case INST_JMP:
+        fprintf(out, "    ");
+        emit_goto(out, lim, operand, "sp");
+        fprintf(out, "\n");
+        break;
+
+    case INST_JNZ:
+    case INST_JZ:
+        DYNAMIC_CHECK("sp < 1", TRAP_STACK_UNDERFLOW);
+        fprintf(out, "    if (%sstack[--sp].as_u64) { ",
+                inst.type == INST_JZ ? "!" : "");
+        emit_goto(out, lim, operand, "sp");
+        fprintf(out, " }\n");
+        break;
+
+    case INST_CALL:
+        DYNAMIC_CHECK("fp >= LIM_FRAMES_CAPACITY", TRAP_CALL_STACK_OVERFLOW);
+        fprintf(out,
+                "    frames[fp++] = (Lim_Frame){.ret = %lu, .base = sp};\n",
+                ip + 1);
+        fprintf(out, "    ");
+        emit_goto(out, lim, operand, "sp");
+        fprintf(out, "\n");
+        break;
+
+    case INST_RET:
+        fprintf(out, "    ip = %lu;\n", ip);
+        emit_ret(out, lim, "sp");
+        break;
+
+    case INST_NATIVE:
+        fprintf(out, "    NATIVE(%lu, sp, %lu);\n", ip, operand);
+        break;
+
+    case INST_HALT:
+        fprintf(out, "    lim->halt = true;\n");
+        fprintf(out, "    EXIT(%lu, sp, TRAP_OK);\n", ip);
+        break;
+
+    case INST_PRINT_DEBUG:
+        DYNAMIC_CHECK("sp < 1", TRAP_STACK_UNDERFLOW);
+        fprintf(out, "    sp--;\n");
+        fprintf(out,
+                "    printf(\"%%lu %%ld %%lf %%p\\n\", stack[sp].as_u64, "
+                "stack[sp].as_i64, stack[sp].as_f64, stack[sp].as_ptr);\n");
+        break;
+
+    case INST_LOAD_LOCAL:
+        DYNAMIC_CHECK("sp >= LIM_STACK_CAPACITY", TRAP_STACK_OVERFLOW);
+        fprintf(out, "    slot = BASE + %luULL;\n", operand);
+        DYNAMIC_CHECK("slot >= sp", TRAP_ILLEGAL_OPERAND);
+        fprintf(out, "    stack[sp++] = stack[slot];\n");
+        break;
+
+    case INST_STORE_LOCAL:
+        DYNAMIC_CHECK("sp < 1", TRAP_STACK_UNDERFLOW);
+        fprintf(out, "    slot = BASE + %luULL;\n", operand);
+        DYNAMIC_CHECK("slot >= sp - 1", TRAP_ILLEGAL_OPERAND);
+        fprintf(out, "    stack[slot] = stack[--sp];\n");
+        break;
+
+    case INST_DROP:
+        snprintf(cond, sizeof(cond), "sp <= %luULL", operand);
+        DYNAMIC_CHECK(cond, TRAP_STACK_UNDERFLOW);
+        fprintf(out, "    stack[sp - 1 - %luULL] = stack[sp - 1];\n", operand);
+        fprintf(out, "    sp -= %luULL;\n", operand);
+        break;
+
+    case INST_PLUS:
+    case INST_MINUS:
+    case INST_MULT:
+    case INST_DIV:
+    case INST_FPLUS:
+    case INST_FMINUS:
+    case INST_FMULT:
+    case INST_FDIV:
+    case INST_GT:
+    case INST_LT:
+    case INST_GE:
+    case INST_LE:
+    case INST_EQ:
+        DYNAMIC_CHECK("sp < 2", TRAP_STACK_UNDERFLOW);
+        if (inst.type == INST_DIV) {
+            DYNAMIC_CHECK("stack[sp - 1].as_i64 == 0", TRAP_DIV_BY_ZERO);
+        }
+        fprintf(out,
+                "    stack[sp - 2].%s = stack[sp - 2].%s %s stack[sp - 1].%s;\n",
+                binary_ops[inst.type].field, binary_ops[inst.type].field,
+                binary_ops[inst.type].op, binary_ops[inst.type].field);
+        fprintf(out, "    sp--;\n");
+        break;
+
+    case INST_SPAWN:
+    case INST_YIELD:
+    case INST_JOIN:
+    case INST_CHAN:
+    case INST_SEND:
+    case INST_RECV:
+    case INST_NUM:
+    default:
+        fprintf(out, "    EXIT(%lu, sp, TRAP_ILLEGAL_INST);\n", ip);
+        break;
+    }
+
+#undef DYNAMIC_CHECK
+}
+
+static void mark_labels(const Lim *lim, bool exact)
+{
+    memset(labels, 0, sizeof(labels));
+    for (Inst_Addr ip = 0; ip < lim->program_size; ip++) {
+        if (exact && ir.depths[ip] < 0) {
+            continue;
+        }
+        const Inst inst = lim->program[ip];
+        if (inst.type == INST_CALL) {
+            labels[ip + 1] = true;
+        }
+        if ((inst.type == INST_CALL || inst.type == INST_JMP ||
+             inst.type == INST_JNZ || inst.type == INST_JZ) &&
+            inst.operand.as_u64 < lim->program_size) {
+            labels[inst.operand.as_u64] = true;
+        }
+    }
+}
+
+static void limc_compile(FILE *out, Lim *lim, const char *source)
+{
+    lim_ir_analyze(&ir, lim);
+    const bool exact = ir.exact;
+    mark_labels(lim, exact);
+
+    fprintf(out, "// Generated by limc from `%s`, do not edit\n", source);
+    fprintf(out, "%s", prelude);
+    fprintf(out, "#define BASE (fp > 0 ? frames[fp - 1].base : 0)\n\n");
+
+    fprintf(out, "static Trap lim_aot_execute(Lim *lim)\n");
+    fprintf(out, "{\n");
+    fprintf(out, "    Word stack[LIM_STACK_CAPACITY];\n");
+    fprintf(out, "    Lim_Frame frames[LIM_FRAMES_CAPACITY];\n");
+    fprintf(out, "    uint64_t sp = 0;\n");
+    fprintf(out, "    uint64_t fp = 0;\n");
+    fprintf(out, "    uint64_t slot = 0;\n");
+    fprintf(out, "    Inst_Addr ip = 0;\n");
+    fprintf(out, "    Inst_Addr ret = 0;\n");
+    fprintf(out, "    (void) sp;\n");
+    fprintf(out, "    (void) slot;\n");
+    fprintf(out, "    (void) ip;\n");
+    fprintf(out, "    (void) ret;\n");
+    if (exact) {
+        fprintf(out, "    // the stack depth is known at every instruction\n");
+    }
+    fprintf(out, "\n");
+
+    for (Inst_Addr ip = 0; ip < lim->program_size; ip++) {
+        if (exact && ir.depths[ip] < 0) {
+            continue;
+        }
+        const Inst inst = lim->program[ip];
+        if (labels[ip]) {
+            fprintf(out, "inst_%lu:\n", ip);
+        }
+        fprintf(out, "    // %s", inst_type_as_cstr(inst.type));
+        if (inst.type == INST_NATIVE) {
+            fprintf(out, " %s", lim->imports[inst.operand.as_u64].name);
+        } else if (inst_has_operand(inst.type)) {
+            fprintf(out, " %ld", inst.operand.as_i64);
+        }
+        fprintf(out, "\n");
+
+        if (exact) {
+            int64_t next = emit_static(out, lim, ip);
+            if (next >= 0 && ip + 1 >= lim->program_size) {
+                fprintf(out, "    EXIT(%lu, %ld, TRAP_ILLEGAL_INST_ACCESS);\n",
+                        ip + 1, next);
+            }
+        } else {
+            emit_dynamic(out, lim, ip);
+        }
+    }
+
+    if (!exact || lim->program_size == 0) {
+        fprintf(out, "    EXIT(%lu, sp, TRAP_ILLEGAL_INST_ACCESS);\n",
+                lim->program_size);
+    }
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "static const char *const imports[] = {\n");
+    for (uint64_t i = 0; i < lim->imports_size; i++) {
+        fprintf(out, "    \"%s\",\n", lim->imports[i].name);
+    }
+    fprintf(out, "    NULL,\n");
+    fprintf(out, "};\n\n");
+
+    // symbols are interned in order, so they keep their numbers
+    fprintf(out, "static const char *const interned[] = {\n");
+    for (uint64_t i = 0; i < lim->interned_size; i++) {
+        fprintf(out, "    \"");
+        for (const char *c = lim->interned[i]; *c != '\0'; c++) {
+            if (isalnum(*c) || *c == '_' || *c == '-') {
+                fputc(*c, out);
+            } else {
+                fprintf(out, "\\%03o", (unsigned char) *c);
+            }
+        }
+        fprintf(out, "\",\n");
+    }
+    fprintf(out, "    NULL,\n");
+    fprintf(out, "};\n\n");
+
+    // natives such as `par_map` run functions of the program in the VM
+    fprintf(out, "static const Inst program[] = {\n");
+    for (uint64_t i = 0; i < lim->program_size; i++) {
+        fprintf(out, "    {%d, {.as_u64 = 0x%lxULL}},\n", lim->program[i].type,
+                lim->program[i].operand.as_u64);
+    }
+    fprintf(out, "    {0},\n");
+    fprintf(out, "};\n\n");
+
+    // the data is compiled into the read-only data of the executable
+    fprintf(out, "static const uint8_t data[] = {");
+    for (uint64_t i = 0; i < lim->data_size; i++) {
+        fprintf(out, "%s0x%02x,", i % 12 == 0 ? "\n    " : " ", lim->data[i]);
+    }
+    fprintf(out, "\n    0,\n");
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static Lim lim = {0};\n\n");
+    fprintf(out, "int main(void)\n");
+    fprintf(out, "{\n");
+    fprintf(out, "    uint64_t index = 0;\n");
+    fprintf(out, "    lim_attach_natives(&lim);\n");
+    fprintf(out, "    for (size_t i = 0; imports[i] != NULL; i++) {\n");
+    fprintf(out, "        if (lim_import_native(&lim, cstr_as_sv(imports[i]), "
+                 "&index) != LIM_OK) {\n");
+    fprintf(out,
+            "            fprintf(stderr, \"ERROR: %%s\\n\", lim.error);\n");
+    fprintf(out, "            return 1;\n");
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    for (size_t i = 0; interned[i] != NULL; i++) {\n");
+    fprintf(out, "        if (lim_intern(&lim, cstr_as_sv(interned[i]), "
+                 "&index) != LIM_OK) {\n");
+    fprintf(out,
+            "            fprintf(stderr, \"ERROR: %%s\\n\", lim.error);\n");
+    fprintf(out, "            return 1;\n");
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    lim.data = data;\n");
+    fprintf(out, "    lim.data_size = %lu;\n", lim->data_size);
+    fprintf(out,
+            "    if (lim_load_program_from_memory(&lim, program, %lu) != "
+            "LIM_OK ||\n",
+            lim->program_size);
+    fprintf(out, "        lim_bind_natives(&lim) != LIM_OK) {\n");
+    fprintf(out, "        fprintf(stderr, \"ERROR: %%s\\n\", lim.error);\n");
+    fprintf(out, "        return 1;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "\n");
+    fprintf(out, "    Trap trap = lim_aot_execute(&lim);\n");
+    fprintf(out, "    if (trap != TRAP_OK) {\n");
+    fprintf(out,
+            "        fprintf(stderr, \"Error: %%s\\n\", trap_as_cstr(trap));\n");
+    fprintf(out, "        return 1;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+}
+
+// Compile the generated C file against the built liblim. The compiler runs
+// directly without a shell, so `$CC` names a single program.
+static bool limc_build_executable(const char *c_file_path,
+                                  const char *executable_path)
+{
+    const char *cc = getenv("CC");
+    char *const args[] = {
+        (char *) (cc != NULL && *cc != '\0' ? cc : "cc"),
+        "-O2",
+        "-I" LIM_SRC_DIR,
+        (char *) c_file_path,
+        LIM_LIB_DIR "/liblim.a",
+        "-o",
+        (char *) executable_path,
+        "-lm",
+        "-ldl",
+        "-lpthread",
+        NULL,
+    };
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        execvp(args[0], args);
+        fprintf(stderr, "ERROR: Could not run `%s`: %s\n", args[0],
+                strerror(errno));
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *program = shift_args(&argc, &argv);
+    const char *input_file_path = NULL;
+    const char *output_file_path = NULL;
+    const char *executable_path = NULL;
+
+    while (argc > 0) {
+        const char *flag = shift_args(&argc, &argv);
+
+        if (!strcmp(flag, "-i")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect input file\n");
+                return 1;
+            }
+            input_file_path = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-o")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect output path\n");
+                return 1;
+            }
+            output_file_path = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-e")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect executable path\n");
+                return 1;
+            }
+            executable_path = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-h")) {
+            fprintf(stdout,
+                    "Usage: %s -i <input.lim> [-o <output.c>] [-e "
+                    "<executable>] [-h]\n",
+                    program);
+            return 0;
+        } else {
+            fprintf(stderr, "Error: unknown flag `%s`\n", flag);
+            return 1;
+        }
+    }
+
+    if (input_file_path == NULL) {
+        fprintf(stderr, "Error: input file is not provided\n");
+        return 1;
+    }
+    if (output_file_path == NULL && executable_path == NULL) {
+        fprintf(stderr, "Error: output path is not provided\n");
+        return 1;
+    }
+
+    char c_file_path[4096];
+    if (output_file_path == NULL) {
+        snprintf(c_file_path, sizeof(c_file_path), "%s.c", executable_path);
+        output_file_path = c_file_path;
+    }
+
+    // the generated program links the built-in natives of lim.c, their stack
+    // effects are needed for the analysis
+    lim_attach_natives(&lim);
+    if (lim_load_program_from_file(&lim, input_file_path) != LIM_OK ||
+        lim_bind_natives(&lim) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim.error);
+        return 1;
+    }
+    for (Inst_Addr ip = 0; ip < lim.program_size; ip++) {
+        // the scheduler swaps stacks in and out of `Lim`, compiled code
+        // keeps its stack in C locals
+        const Inst_Type type = lim.program[ip].type;
+        if (type == INST_SPAWN || type == INST_YIELD || type == INST_JOIN ||
+            type == INST_CHAN || type == INST_SEND || type == INST_RECV) {
+            fprintf(stderr,
+                    "ERROR: `%s` at address %lu: green threads are not "
+                    "supported by limc\n",
+                    inst_type_as_cstr(type), ip);
+            return 1;
+        }
+    }
+
+    FILE *out = fopen(output_file_path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
+                output_file_path, strerror(errno));
+        return 1;
+    }
+    limc_compile(out, &lim, input_file_path);
+    if (ferror(out)) {
+        fprintf(stderr, "ERROR: Could not write file `%s`: %s\n",
+                output_file_path, strerror(errno));
+        return 1;
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "ERROR: Could not write file `%s`: %s\n",
+                output_file_path, strerror(errno));
+        return 1;
+    }
+
+    if (executable_path != NULL &&
+        !limc_build_executable(output_file_path, executable_path)) {
+        fprintf(stderr, "ERROR: Could not compile `%s`\n", output_file_path);
+        return 1;
+    }
+
+    return 0;
+}
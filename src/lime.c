@@ -1,10 +1,1201 @@
+#define _DEFAULT_SOURCE
 #include "lim.h"
 
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+static Lim lim = {0};
+static Ir ir = {0};
+static Lim_Jit *jit = NULL;
+
+#define SERVE_PROGRAMS_CAPACITY 256
+#define SERVE_VMS_CAPACITY 64
+#define SERVE_LINE_CAPACITY 4096
+
+// Server mode. A request is one line
+//
+//     run <program.lim> [<word>]...
+//
+// which runs the program with the words pushed as initial stack. The answer
+// is a line `<trap> <stack size> <output size>`, one line `<i64> <f64>` per
+// word of the final stack from the bottom and the output of the program, or
+// a line `ERROR <message>` when the program could not be loaded.
+//
+// Programs are read once and then found by path, as long as the file does
+// not change, and identified by the hash of their content. Every VM of the
+// pool keeps the last program it ran together with its IR, so a request for
+// a program a free VM already holds only resets the VM.
+typedef struct {
+    char *path;
+    struct stat st;
+    uint64_t hash;
+    uint8_t *bytes;
+    size_t size;
+} Serve_Program;
+
+typedef struct {
+    Lim *lim;
+    Ir *ir;
+    bool translated;
+    uint64_t hash;  // of the program loaded into `lim`, 0 when none
+    bool busy;
+} Serve_Vm;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t vm_released;
+
+    Serve_Program programs[SERVE_PROGRAMS_CAPACITY];
+    size_t programs_size;
+    size_t programs_evict;
+
+    Serve_Vm vms[SERVE_VMS_CAPACITY];
+    size_t vms_size;
+
+    uint64_t fuel;
+    bool stack_only;
+} Serve;
+
+static Serve serve = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .vm_released = PTHREAD_COND_INITIALIZER,
+};
+
+// Never 0 so that 0 can mean no program
+static uint64_t serve_hash(const uint8_t *bytes, size_t size)
+{
+    uint64_t hash = lim_hash_bytes(bytes, size);
+    return hash != 0 ? hash : 1;
+}
+
+static bool serve_program_fresh(const Serve_Program *program,
+                                const char *path,
+                                const struct stat *st)
+{
+    return !strcmp(program->path, path) && program->st.st_ino == st->st_ino &&
+           program->st.st_dev == st->st_dev &&
+           program->st.st_size == st->st_size &&
+           program->st.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+           program->st.st_mtim.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Called with the mutex held. Returns NULL with `errno` set when the
+// program can not be read.
+static Serve_Program *serve_find_program(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        return NULL;
+    }
+    for (size_t i = 0; i < serve.programs_size; i++) {
+        if (serve_program_fresh(&serve.programs[i], path, &st)) {
+            return &serve.programs[i];
+        }
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    uint8_t *bytes = malloc(st.st_size > 0 ? st.st_size : 1);
+    char *copy = strdup(path);
+    if (bytes == NULL || copy == NULL ||
+        fread(bytes, 1, st.st_size, f) != (size_t) st.st_size) {
+        errno = bytes == NULL || copy == NULL ? ENOMEM : EIO;
+        free(bytes);
+        free(copy);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    Serve_Program *program = NULL;
+    if (serve.programs_size < SERVE_PROGRAMS_CAPACITY) {
+        program = &serve.programs[serve.programs_size++];
+    } else {
+        program = &serve.programs[serve.programs_evict];
+        serve.programs_evict =
+            (serve.programs_evict + 1) % SERVE_PROGRAMS_CAPACITY;
+        free(program->path);
+        free(program->bytes);
+    }
+    *program = (Serve_Program){
+        .path = copy,
+        .st = st,
+        .hash = serve_hash(bytes, st.st_size),
+        .bytes = bytes,
+        .size = st.st_size,
+    };
+    return program;
+}
+
+// Called with the mutex held. Prefers a free VM which holds the program.
+static Serve_Vm *serve_acquire_vm(uint64_t hash)
+{
+    for (;;) {
+        Serve_Vm *free_vm = NULL;
+        for (size_t i = 0; i < serve.vms_size; i++) {
+            Serve_Vm *vm = &serve.vms[i];
+            if (vm->busy) {
+                continue;
+            }
+            if (vm->hash == hash) {
+                free_vm = vm;
+                break;
+            }
+            if (free_vm == NULL) {
+                free_vm = vm;
+            }
+        }
+        if (free_vm != NULL) {
+            free_vm->busy = true;
+            return free_vm;
+        }
+        pthread_cond_wait(&serve.vm_released, &serve.mutex);
+    }
+}
+
+static void serve_release_vm(Serve_Vm *vm)
+{
+    pthread_mutex_lock(&serve.mutex);
+    vm->busy = false;
+    pthread_cond_signal(&serve.vm_released);
+    pthread_mutex_unlock(&serve.mutex);
+}
+
+static void serve_run(FILE *out, String_View path, String_View args)
+{
+    char file_path[SERVE_LINE_CAPACITY];
+    snprintf(file_path, sizeof(file_path), "%.*s", (int) path.count,
+             path.data);
+
+    pthread_mutex_lock(&serve.mutex);
+    const Serve_Program *program = serve_find_program(file_path);
+    if (program == NULL) {
+        const int error = errno;
+        pthread_mutex_unlock(&serve.mutex);
+        fprintf(out, "ERROR Could not read file `%s`: %s\n", file_path,
+                strerror(error));
+        return;
+    }
+    Serve_Vm *vm = serve_acquire_vm(program->hash);
+    Lim *lim = vm->lim;
+    if (vm->hash != program->hash) {
+        vm->hash = 0;
+        if (lim_load_program_from_bytes(lim, program->bytes, program->size) !=
+                LIM_OK ||
+            lim_bind_natives(lim) != LIM_OK) {
+            pthread_mutex_unlock(&serve.mutex);
+            fprintf(out, "ERROR `%s`: %s\n", file_path, lim->error);
+            serve_release_vm(vm);
+            return;
+        }
+        vm->hash = program->hash;
+        vm->translated = false;
+    }
+    pthread_mutex_unlock(&serve.mutex);
+
+    if (!vm->translated && !serve.stack_only) {
+        vm->translated = lim_ir_translate(vm->ir, lim);
+    }
+
+    lim_reset(lim);
+    Trap trap = TRAP_OK;
+    while (args.count > 0 && trap == TRAP_OK) {
+        String_View arg = sv_trim(sv_chop_delim(&args, ' '));
+        Word word = {0};
+        if (arg.count == 0) {
+            continue;
+        }
+        if (!number_literal_as_word(arg, &word)) {
+            fprintf(out, "ERROR `%.*s` is not a valid number literal\n",
+                    (int) arg.count, arg.data);
+            serve_release_vm(vm);
+            return;
+        }
+        trap = lim_push_word(lim, word);
+    }
+
+    char *output = NULL;
+    size_t output_size = 0;
+    lim->output = open_memstream(&output, &output_size);
+    if (trap == TRAP_OK) {
+        trap = vm->translated ? lim_ir_execute_budget(vm->ir, lim, serve.fuel)
+                              : lim_execute_budget(lim, serve.fuel);
+    }
+    if (lim->output != NULL) {
+        fclose(lim->output);
+        lim->output = NULL;
+    }
+
+    fprintf(out, "%s %lu %zu\n", trap_as_cstr(trap), lim->stack_size,
+            output_size);
+    for (uint64_t i = 0; i < lim->stack_size; i++) {
+        fprintf(out, "%ld %.17g\n", lim->stack[i].as_i64,
+                lim->stack[i].as_f64);
+    }
+    fwrite(output, 1, output_size, out);
+    free(output);
+    serve_release_vm(vm);
+}
+
+static void serve_stream(FILE *in, FILE *out)
+{
+    char line[SERVE_LINE_CAPACITY];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        String_View request = sv_trim(cstr_as_sv(line));
+        String_View command = sv_chop_delim(&request, ' ');
+        if (line[strlen(line) - 1] != '\n' && !feof(in)) {
+            fprintf(out, "ERROR request is longer than %d bytes\n",
+                    SERVE_LINE_CAPACITY - 2);
+            break;
+        }
+
+        if (sv_equal(command, cstr_as_sv("run"))) {
+            request = sv_trim(request);
+            String_View path = sv_chop_delim(&request, ' ');
+            serve_run(out, path, request);
+        } else if (command.count > 0) {
+            fprintf(out, "ERROR unknown request `%.*s`\n", (int) command.count,
+                    command.data);
+        }
+        fflush(out);
+    }
+}
+
+static void *serve_connection(void *arg)
+{
+    int fd = (int) (intptr_t) arg;
+    FILE *in = fdopen(fd, "r");
+    int out_fd = dup(fd);
+    FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+    if (in != NULL && out != NULL) {
+        serve_stream(in, out);
+    }
+    if (out != NULL) {
+        fclose(out);
+    } else if (out_fd >= 0) {
+        close(out_fd);
+    }
+    if (in != NULL) {
+        fclose(in);
+    } else {
+        close(fd);
+    }
+    return NULL;
+}
+
+static int serve_socket(const char *socket_path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "ERROR: socket path `%s` is too long\n", socket_path);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    // a socket left behind by an earlier server is replaced
+    struct stat st;
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socket_path);
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 ||
+        bind(server, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+        listen(server, SOMAXCONN) < 0) {
+        fprintf(stderr, "ERROR: Could not listen on `%s`: %s\n", socket_path,
+                strerror(errno));
+        return 1;
+    }
+    // a client which goes away mid answer must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+
+    for (;;) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: Could not accept on `%s`: %s\n",
+                    socket_path, strerror(errno));
+            return 1;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection,
+                           (void *) (intptr_t) client) != 0) {
+            close(client);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+// Every VM is created with the natives bound before the first request
+static bool serve_warm_up(size_t vms_size,
+                          const char **plugins,
+                          size_t plugins_size)
+{
+    for (size_t i = 0; i < vms_size; i++) {
+        Serve_Vm *vm = &serve.vms[serve.vms_size];
+        vm->lim = lim_create();
+        vm->ir = malloc(sizeof(*vm->ir));
+        if (vm->lim == NULL || vm->ir == NULL) {
+            fprintf(stderr, "ERROR: Could not allocate VM\n");
+            return false;
+        }
+        lim_attach_natives(vm->lim);
+        for (size_t j = 0; j < plugins_size; j++) {
+            if (lim_load_plugin(vm->lim, plugins[j]) != LIM_OK) {
+                fprintf(stderr, "ERROR: %s\n", vm->lim->error);
+                return false;
+            }
+        }
+        serve.vms_size++;
+    }
+    return true;
+}
+
+#define DEBUGGER_BREAKPOINTS_CAPACITY 256
+#define DEBUGGER_WATCHPOINTS_CAPACITY 64
+#define DEBUGGER_LINE_CAPACITY 256
+
+// Debugger. The program runs on the stack interpreter until it reaches a
+// breakpoint, a watched stack slot changes or it traps, then the debugger
+// reads commands from stdin. With neither breakpoints nor watchpoints set
+// `continue` is the plain interpreter loop.
+typedef enum {
+    DEBUGGER_CMP_NONE = 0,
+    DEBUGGER_CMP_EQ,
+    DEBUGGER_CMP_NE,
+    DEBUGGER_CMP_LT,
+    DEBUGGER_CMP_LE,
+    DEBUGGER_CMP_GT,
+    DEBUGGER_CMP_GE,
+} Debugger_Cmp;
+
+typedef struct {
+    Inst_Addr addr;
+    // stop only when the word `depth` below the top of the stack compares
+    // to `value`, as f64 when `value` is written with a dot
+    Debugger_Cmp cmp;
+    uint64_t depth;
+    Word value;
+    bool is_f64;
+} Debugger_Breakpoint;
+
+typedef struct {
+    uint64_t slot;  // counted from the bottom of the stack
+    bool live;      // the slot is on the stack
+    Word value;
+} Debugger_Watchpoint;
+
+typedef enum {
+    DEBUGGER_STEP,
+    DEBUGGER_NEXT,
+    DEBUGGER_FINISH,
+    DEBUGGER_CONTINUE,
+} Debugger_Mode;
+
+typedef struct {
+    Lim_Symbol symbols[LABEL_CAPACITY];
+    uint64_t symbols_size;
+
+    Debugger_Breakpoint breakpoints[DEBUGGER_BREAKPOINTS_CAPACITY];
+    size_t breakpoints_size;
+    // amount of breakpoints per address, checked before every instruction
+    uint8_t breaks_at[LIM_PROGRAM_CAPACITY];
+    // the program stopped at a breakpoint, which the next run passes
+    bool at_break;
+
+    Debugger_Watchpoint watchpoints[DEBUGGER_WATCHPOINTS_CAPACITY];
+    size_t watchpoints_size;
+} Debugger;
+
+static Debugger debugger = {0};
+
+static bool debugger_parse_addr(String_View sv, Inst_Addr *addr)
+{
+    Word word = {0};
+    if (sv.count > 0 && isdigit(*sv.data) &&
+        number_literal_as_word(sv, &word)) {
+        *addr = word.as_u64;
+        return true;
+    }
+    for (uint64_t i = 0; i < debugger.symbols_size; i++) {
+        if (sv_equal(sv, cstr_as_sv(debugger.symbols[i].name))) {
+            *addr = debugger.symbols[i].addr;
+            return true;
+        }
+    }
+    return false;
+}
+
+// `<addr> <label+offset>` after the closest label at or before `addr`
+static void debugger_print_addr(Inst_Addr addr)
+{
+    const Lim_Symbol *closest = NULL;
+    for (uint64_t i = 0; i < debugger.symbols_size; i++) {
+        const Lim_Symbol *symbol = &debugger.symbols[i];
+        if (symbol->addr <= addr &&
+            (closest == NULL || symbol->addr > closest->addr)) {
+            closest = symbol;
+        }
+    }
+    printf("%lu", addr);
+    if (closest != NULL && closest->addr == addr) {
+        printf(" <%s>", closest->name);
+    } else if (closest != NULL) {
+        printf(" <%s+%lu>", closest->name, addr - closest->addr);
+    }
+}
+
+static void debugger_print_location(void)
+{
+    printf("  ");
+    debugger_print_addr(lim.ip);
+    if (lim.ip >= lim.program_size) {
+        printf(": out of the program\n");
+        return;
+    }
+    const Inst inst = lim.program[lim.ip];
+    printf(": %s", inst_type_as_cstr(inst.type));
+    if (inst.type == INST_NATIVE) {
+        printf(" %s", lim.imports[inst.operand.as_u64].name);
+    } else if (inst_has_operand(inst.type)) {
+        printf(" %ld", inst.operand.as_i64);
+    }
+    printf("\n");
+}
+
+static bool debugger_compare(const Debugger_Breakpoint *breakpoint)
+{
+    if (breakpoint->cmp == DEBUGGER_CMP_NONE) {
+        return true;
+    }
+    if (breakpoint->depth >= lim.stack_size) {
+        return false;
+    }
+
+    Word word = lim.stack[lim.stack_size - 1 - breakpoint->depth];
+    int order = 0;
+    if (breakpoint->is_f64) {
+        double a = word.as_f64, b = breakpoint->value.as_f64;
+        if (a != a || b != b) {
+            return breakpoint->cmp == DEBUGGER_CMP_NE;
+        }
+        order = (a > b) - (a < b);
+    } else {
+        int64_t a = word.as_i64, b = breakpoint->value.as_i64;
+        order = (a > b) - (a < b);
+    }
+
+    switch (breakpoint->cmp) {
+    case DEBUGGER_CMP_NONE:
+        return true;
+    case DEBUGGER_CMP_EQ:
+        return order == 0;
+    case DEBUGGER_CMP_NE:
+        return order != 0;
+    case DEBUGGER_CMP_LT:
+        return order < 0;
+    case DEBUGGER_CMP_LE:
+        return order <= 0;
+    case DEBUGGER_CMP_GT:
+        return order > 0;
+    case DEBUGGER_CMP_GE:
+        return order >= 0;
+    }
+    return false;
+}
+
+static bool debugger_breakpoint_hit(void)
+{
+    for (size_t i = 0; i < debugger.breakpoints_size; i++) {
+        const Debugger_Breakpoint *breakpoint = &debugger.breakpoints[i];
+        if (breakpoint->addr == lim.ip && debugger_compare(breakpoint)) {
+            printf("Breakpoint %zu\n", i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void debugger_watchpoint_read(Debugger_Watchpoint *watchpoint)
+{
+    watchpoint->live = watchpoint->slot < lim.stack_size;
+    watchpoint->value =
+        watchpoint->live ? lim.stack[watchpoint->slot] : (Word){0};
+}
+
+static bool debugger_watchpoint_hit(void)
+{
+    bool hit = false;
+    for (size_t i = 0; i < debugger.watchpoints_size; i++) {
+        Debugger_Watchpoint *watchpoint = &debugger.watchpoints[i];
+        Debugger_Watchpoint old = *watchpoint;
+        debugger_watchpoint_read(watchpoint);
+        if (old.live == watchpoint->live &&
+            old.value.as_u64 == watchpoint->value.as_u64) {
+            continue;
+        }
+
+        printf("Watchpoint %zu, slot %lu: ", i, watchpoint->slot);
+        if (old.live) {
+            printf("%ld (%lf)", old.value.as_i64, old.value.as_f64);
+        } else {
+            printf("(none)");
+        }
+        if (watchpoint->live) {
+            printf(" -> %ld (%lf)\n", watchpoint->value.as_i64,
+                   watchpoint->value.as_f64);
+        } else {
+            printf(" -> (none)\n");
+        }
+        hit = true;
+    }
+    return hit;
+}
+
+static bool debugger_break_here(void)
+{
+    if (lim.ip < LIM_PROGRAM_CAPACITY && debugger.breaks_at[lim.ip] > 0 &&
+        debugger_breakpoint_hit()) {
+        debugger.at_break = true;
+    }
+    return debugger.at_break;
+}
+
+static Trap debugger_run(Debugger_Mode mode)
+{
+    if (mode == DEBUGGER_CONTINUE && debugger.breakpoints_size == 0 &&
+        debugger.watchpoints_size == 0) {
+        return lim_execute_program(&lim);
+    }
+
+    uint64_t frames_size = lim.frames_size;
+    bool resumed = debugger.at_break;
+    debugger.at_break = false;
+    while (!lim.halt) {
+        if (!resumed && debugger_break_here()) {
+            break;
+        }
+        resumed = false;
+
+        Trap trap = lim_execute_inst(&lim);
+        lim.stats.instructions++;
+        if (trap != TRAP_OK) {
+            return trap;
+        }
+
+        bool stop = false;
+        if (debugger.watchpoints_size > 0) {
+            stop = debugger_watchpoint_hit();
+        }
+        if (stop || mode == DEBUGGER_STEP ||
+            (mode == DEBUGGER_NEXT && lim.frames_size <= frames_size) ||
+            (mode == DEBUGGER_FINISH && lim.frames_size < frames_size)) {
+            // a breakpoint where the run stops anyway is reported now
+            debugger_break_here();
+            break;
+        }
+    }
+    return TRAP_OK;
+}
+
+static void debugger_break(String_View args)
+{
+    Debugger_Breakpoint breakpoint = {0};
+    String_View where = sv_chop_delim(&args, ' ');
+    if (!debugger_parse_addr(where, &breakpoint.addr) ||
+        breakpoint.addr >= lim.program_size) {
+        printf("Unknown address `%.*s`\n", (int) where.count, where.data);
+        return;
+    }
+
+    // break <where> if <depth> <cmp> <value>
+    args = sv_trim(args);
+    if (args.count > 0) {
+        static const char *cmps[] = {
+            [DEBUGGER_CMP_EQ] = "==", [DEBUGGER_CMP_NE] = "!=",
+            [DEBUGGER_CMP_LT] = "<",  [DEBUGGER_CMP_LE] = "<=",
+            [DEBUGGER_CMP_GT] = ">",  [DEBUGGER_CMP_GE] = ">=",
+        };
+        String_View keyword = sv_trim(sv_chop_delim(&args, ' '));
+        String_View depth = sv_trim(sv_chop_delim(&args, ' '));
+        String_View cmp = sv_trim(sv_chop_delim(&args, ' '));
+        String_View value = sv_trim(args);
+
+        Word word = {0};
+        for (size_t i = DEBUGGER_CMP_EQ; i <= DEBUGGER_CMP_GE; i++) {
+            if (sv_equal(cmp, cstr_as_sv(cmps[i]))) {
+                breakpoint.cmp = i;
+            }
+        }
+        if (!sv_equal(keyword, cstr_as_sv("if")) ||
+            !number_literal_as_word(depth, &word) ||
+            breakpoint.cmp == DEBUGGER_CMP_NONE ||
+            !number_literal_as_word(value, &breakpoint.value)) {
+            printf("Expected `break <addr|label> if <depth> <cmp> <value>`\n");
+            return;
+        }
+        breakpoint.depth = word.as_u64;
+        breakpoint.is_f64 = memchr(value.data, '.', value.count) != NULL;
+    }
+
+    if (debugger.breakpoints_size >= DEBUGGER_BREAKPOINTS_CAPACITY ||
+        debugger.breaks_at[breakpoint.addr] == UINT8_MAX) {
+        printf("Too many breakpoints\n");
+        return;
+    }
+    debugger.breaks_at[breakpoint.addr]++;
+    printf("Breakpoint %zu at ", debugger.breakpoints_size);
+    debugger_print_addr(breakpoint.addr);
+    printf("\n");
+    debugger.breakpoints[debugger.breakpoints_size++] = breakpoint;
+}
+
+static void debugger_watch(String_View args)
+{
+    Word slot = {0};
+    if (!number_literal_as_word(args, &slot)) {
+        printf("Expected `watch <slot>`\n");
+        return;
+    }
+    if (debugger.watchpoints_size >= DEBUGGER_WATCHPOINTS_CAPACITY) {
+        printf("Too many watchpoints\n");
+        return;
+    }
+    Debugger_Watchpoint *watchpoint =
+        &debugger.watchpoints[debugger.watchpoints_size];
+    watchpoint->slot = slot.as_u64;
+    debugger_watchpoint_read(watchpoint);
+    printf("Watchpoint %zu, slot %lu\n", debugger.watchpoints_size++,
+           watchpoint->slot);
+}
+
+// `delete` removes everything, `delete <addr|label>` the breakpoints there
+static void debugger_delete(String_View args)
+{
+    Inst_Addr addr = 0;
+    if (args.count > 0 && !debugger_parse_addr(args, &addr)) {
+        printf("Unknown address `%.*s`\n", (int) args.count, args.data);
+        return;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < debugger.breakpoints_size; i++) {
+        Debugger_Breakpoint breakpoint = debugger.breakpoints[i];
+        if (args.count > 0 && breakpoint.addr != addr) {
+            debugger.breakpoints[kept++] = breakpoint;
+        } else {
+            debugger.breaks_at[breakpoint.addr]--;
+        }
+    }
+    debugger.breakpoints_size = kept;
+    if (args.count == 0) {
+        debugger.watchpoints_size = 0;
+    }
+}
+
+static void debugger_backtrace(void)
+{
+    printf("#0 ");
+    debugger_print_addr(lim.ip);
+    printf("\n");
+    // the call instruction is right before the return address
+    for (uint64_t i = lim.frames_size; i > 0; i--) {
+        printf("#%lu ", lim.frames_size - i + 1);
+        debugger_print_addr(lim.frames[i - 1].ret - 1);
+        printf("\n");
+    }
+}
+
+// `x` dumps the stack, `x <ptr> [<count>]` words of the heap
+static void debugger_examine(String_View args)
+{
+    if (args.count == 0) {
+        lim_dump_stack(stdout, &lim);
+        return;
+    }
+
+    Word ptr = {0};
+    Word count = {.as_u64 = 1};
+    String_View where = sv_chop_delim(&args, ' ');
+    args = sv_trim(args);
+    if (!number_literal_as_word(where, &ptr) ||
+        (args.count > 0 && !number_literal_as_word(args, &count))) {
+        printf("Expected `x [<ptr> [<count>]]`\n");
+        return;
+    }
+
+    const uint8_t *base = lim.heap.base;
+    for (uint64_t i = 0; i < count.as_u64; i++) {
+        const uint8_t *p = (const uint8_t *) ptr.as_ptr + i * sizeof(Word);
+        if (base == NULL || p < base ||
+            p + sizeof(Word) > base + lim.heap.size) {
+            printf("  %p: out of the heap\n", (void *) p);
+            return;
+        }
+        Word word = {0};
+        memcpy(&word, p, sizeof(word));
+        printf("  %p:\t%lu\t%ld\t%lf\n", (void *) p, word.as_u64, word.as_i64,
+               word.as_f64);
+    }
+}
+
+static Trap debugger_repl(void)
+{
+    static const char *help =
+        "  step, s              run one instruction\n"
+        "  next, n              run one instruction, stepping over calls\n"
+        "  finish               run until the current function returns\n"
+        "  continue, c          run until a breakpoint, watchpoint or trap\n"
+        "  break, b <addr|label> [if <depth> <cmp> <value>]\n"
+        "                       stop at the address, if the word <depth>\n"
+        "                       below the top compares (== != < <= > >=)\n"
+        "  watch, w <slot>      stop when the stack slot changes\n"
+        "  delete [<addr|label>]  remove breakpoints and watchpoints\n"
+        "  bt                   show the call frames\n"
+        "  x [<ptr> [<count>]]  show the stack or words of the heap\n"
+        "  quit, q              leave the debugger\n";
+    char line[DEBUGGER_LINE_CAPACITY];
+    char last[DEBUGGER_LINE_CAPACITY] = "";
+    Trap trap = TRAP_OK;
+
+    printf("Type `help` for the commands\n");
+    debugger_print_location();
+    while (printf("(lime) "), fflush(stdout),
+           fgets(line, sizeof(line), stdin) != NULL) {
+        // an empty line repeats the last command
+        if (sv_trim(cstr_as_sv(line)).count == 0) {
+            memcpy(line, last, sizeof(line));
+        } else {
+            memcpy(last, line, sizeof(last));
+        }
+        String_View args = sv_trim(cstr_as_sv(line));
+        String_View command = sv_chop_delim(&args, ' ');
+        args = sv_trim(args);
+
+        Debugger_Mode mode = DEBUGGER_CONTINUE;
+        if (sv_equal(command, cstr_as_sv("step")) ||
+            sv_equal(command, cstr_as_sv("s"))) {
+            mode = DEBUGGER_STEP;
+        } else if (sv_equal(command, cstr_as_sv("next")) ||
+                   sv_equal(command, cstr_as_sv("n"))) {
+            mode = DEBUGGER_NEXT;
+        } else if (sv_equal(command, cstr_as_sv("finish"))) {
+            mode = DEBUGGER_FINISH;
+        } else if (sv_equal(command, cstr_as_sv("continue")) ||
+                   sv_equal(command, cstr_as_sv("c"))) {
+            mode = DEBUGGER_CONTINUE;
+        } else {
+            if (sv_equal(command, cstr_as_sv("break")) ||
+                sv_equal(command, cstr_as_sv("b"))) {
+                debugger_break(args);
+            } else if (sv_equal(command, cstr_as_sv("watch")) ||
+                       sv_equal(command, cstr_as_sv("w"))) {
+                debugger_watch(args);
+            } else if (sv_equal(command, cstr_as_sv("delete"))) {
+                debugger_delete(args);
+            } else if (sv_equal(command, cstr_as_sv("bt"))) {
+                debugger_backtrace();
+            } else if (sv_equal(command, cstr_as_sv("x"))) {
+                debugger_examine(args);
+            } else if (sv_equal(command, cstr_as_sv("quit")) ||
+                       sv_equal(command, cstr_as_sv("q"))) {
+                break;
+            } else if (sv_equal(command, cstr_as_sv("help"))) {
+                printf("%s", help);
+            } else if (command.count > 0) {
+                printf("Unknown command `%.*s`, see `help`\n",
+                       (int) command.count, command.data);
+            }
+            continue;
+        }
+
+        if (lim.halt || trap != TRAP_OK) {
+            printf("The program is not running\n");
+            continue;
+        }
+        trap = debugger_run(mode);
+        if (trap != TRAP_OK) {
+            printf("Trap %s at\n", trap_as_cstr(trap));
+            debugger_print_location();
+        } else if (lim.halt) {
+            printf("The program halted\n");
+        } else {
+            debugger_print_location();
+        }
+    }
+    return trap;
+}
+
+// Profiler. The run and every native call of the main VM are measured with
+// hardware counters from perf_event_open, read as one group, or only with
+// the clock when the counters are not available. The program runs on the
+// stack interpreter, so every VM instruction is one dispatch.
+typedef struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} Profile_Event;
+
+#define PROFILE_CACHE_MISS(cache)                                              \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |                           \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+typedef enum {
+    PROFILE_CYCLES = 0,
+    PROFILE_INSTRUCTIONS,
+    PROFILE_BRANCH_MISSES,
+    PROFILE_L1I_MISSES,
+    PROFILE_L1D_MISSES,
+    PROFILE_EVENTS_SIZE,
+} Profile_Event_Kind;
+
+static const Profile_Event profile_events[PROFILE_EVENTS_SIZE] = {
+    [PROFILE_CYCLES] = {"cycles", PERF_TYPE_HARDWARE,
+                        PERF_COUNT_HW_CPU_CYCLES},
+    [PROFILE_INSTRUCTIONS] = {"instructions", PERF_TYPE_HARDWARE,
+                              PERF_COUNT_HW_INSTRUCTIONS},
+    [PROFILE_BRANCH_MISSES] = {"branch-misses", PERF_TYPE_HARDWARE,
+                               PERF_COUNT_HW_BRANCH_MISSES},
+    [PROFILE_L1I_MISSES] = {"L1i-misses", PERF_TYPE_HW_CACHE,
+                            PROFILE_CACHE_MISS(PERF_COUNT_HW_CACHE_L1I)},
+    [PROFILE_L1D_MISSES] = {"L1d-misses", PERF_TYPE_HW_CACHE,
+                            PROFILE_CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+};
+
+typedef struct {
+    uint64_t ns;
+    uint64_t events[PROFILE_EVENTS_SIZE];
+} Profile_Sample;
+
+typedef struct {
+    int leader;  // -1 when no counter could be opened
+    // position of each event in the group, -1 when it is not counted
+    int slots[PROFILE_EVENTS_SIZE];
+    int fds[PROFILE_EVENTS_SIZE];
+    size_t fds_size;
+
+    // the natives the profiler stands in for
+    Lim_Native natives[LIM_IMPORTS_CAPACITY];
+    uint64_t native_calls[LIM_IMPORTS_CAPACITY];
+    Profile_Sample native_totals[LIM_IMPORTS_CAPACITY];
+} Profile;
+
+static Profile profile = {.leader = -1};
+
+static void profile_open(void)
+{
+    for (size_t i = 0; i < PROFILE_EVENTS_SIZE; i++) {
+        struct perf_event_attr attr = {0};
+        attr.size = sizeof(attr);
+        attr.type = profile_events[i].type;
+        attr.config = profile_events[i].config;
+        attr.disabled = profile.leader < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        profile.slots[i] = -1;
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, profile.leader, 0);
+        if (fd < 0) {
+            continue;
+        }
+        if (profile.leader < 0) {
+            profile.leader = fd;
+        }
+        profile.slots[i] = profile.fds_size;
+        profile.fds[profile.fds_size++] = fd;
+    }
+    if (profile.leader >= 0) {
+        ioctl(profile.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(profile.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+static void profile_read(Profile_Sample *sample)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sample->ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    if (profile.leader < 0) {
+        return;
+    }
+
+    // { nr, values[nr] }
+    uint64_t group[1 + PROFILE_EVENTS_SIZE] = {0};
+    if (read(profile.leader, group, sizeof(group)) < 0) {
+        return;
+    }
+    for (size_t i = 0; i < PROFILE_EVENTS_SIZE; i++) {
+        sample->events[i] =
+            profile.slots[i] >= 0 ? group[1 + profile.slots[i]] : 0;
+    }
+}
+
+static void profile_add(Profile_Sample *total,
+                        const Profile_Sample *begin,
+                        const Profile_Sample *end)
+{
+    total->ns += end->ns - begin->ns;
+    for (size_t i = 0; i < PROFILE_EVENTS_SIZE; i++) {
+        total->events[i] += end->events[i] - begin->events[i];
+    }
+}
+
+// Stands in for every import of the main VM. Worker VMs of `par_map` copy
+// the import table and call the native directly.
+static Trap profile_native(Lim *vm)
+{
+    uint64_t index = vm->program[vm->ip].operand.as_u64;
+    if (vm != &lim) {
+        return profile.natives[index].func(vm);
+    }
+
+    Profile_Sample begin = {0}, end = {0};
+    profile_read(&begin);
+    Trap trap = profile.natives[index].func(vm);
+    profile_read(&end);
+    profile.native_calls[index]++;
+    profile_add(&profile.native_totals[index], &begin, &end);
+    return trap;
+}
+
+static void profile_report_ratio(const char *what,
+                                 uint64_t value,
+                                 uint64_t per,
+                                 double scale)
+{
+    if (per > 0) {
+        fprintf(stderr, "  %-32s %.3f\n", what, value * scale / per);
+    }
+}
+
+static void profile_report(const Profile_Sample *run, uint64_t executed)
+{
+    fprintf(stderr, "Profile:\n");
+    fprintf(stderr, "  %-32s %lu\n", "VM instructions", executed);
+    fprintf(stderr, "  %-32s %.3f ms\n", "wall time", run->ns / 1e6);
+    if (profile.leader < 0) {
+        fprintf(stderr, "  (perf events are not available)\n");
+        profile_report_ratio("ns per VM instruction", run->ns, executed, 1);
+    }
+    for (size_t i = 0; i < PROFILE_EVENTS_SIZE; i++) {
+        if (profile.slots[i] >= 0) {
+            fprintf(stderr, "  %-32s %lu\n", profile_events[i].name,
+                    run->events[i]);
+        }
+    }
+    if (profile.slots[PROFILE_CYCLES] >= 0) {
+        profile_report_ratio("cycles per VM instruction",
+                             run->events[PROFILE_CYCLES], executed, 1);
+    }
+    if (profile.slots[PROFILE_INSTRUCTIONS] >= 0) {
+        profile_report_ratio("instructions per VM instruction",
+                             run->events[PROFILE_INSTRUCTIONS], executed, 1);
+    }
+    if (profile.slots[PROFILE_BRANCH_MISSES] >= 0) {
+        profile_report_ratio("branch misses per dispatch",
+                             run->events[PROFILE_BRANCH_MISSES], executed, 1);
+    }
+    if (profile.slots[PROFILE_L1I_MISSES] >= 0) {
+        profile_report_ratio("L1i misses per 1K VM instructions",
+                             run->events[PROFILE_L1I_MISSES], executed, 1000);
+    }
+
+    bool header = false;
+    for (uint64_t i = 0; i < lim.imports_size; i++) {
+        if (profile.native_calls[i] == 0) {
+            continue;
+        }
+        if (!header) {
+            fprintf(stderr, "Natives:\n  %-20s %12s %14s", "name", "calls",
+                    "ns");
+            for (size_t j = 0; j < PROFILE_EVENTS_SIZE; j++) {
+                if (profile.slots[j] >= 0) {
+                    fprintf(stderr, " %14s", profile_events[j].name);
+                }
+            }
+            fprintf(stderr, "\n");
+            header = true;
+        }
+
+        const Profile_Sample *total = &profile.native_totals[i];
+        fprintf(stderr, "  %-20s %12lu %14lu", profile.natives[i].name,
+                profile.native_calls[i], total->ns);
+        for (size_t j = 0; j < PROFILE_EVENTS_SIZE; j++) {
+            if (profile.slots[j] >= 0) {
+                fprintf(stderr, " %14lu", total->events[j]);
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+static Trap profile_run(uint64_t fuel)
+{
+    for (uint64_t i = 0; i < lim.imports_size; i++) {
+        profile.natives[i] = lim.imports[i];
+        lim.imports[i].func = profile_native;
+    }
+    profile_open();
+
+    Profile_Sample begin = {0}, end = {0};
+    Trap trap = TRAP_OK;
+    uint64_t executed = 0;
+    profile_read(&begin);
+    while (!lim.halt) {
+        if (executed >= fuel) {
+            trap = TRAP_OUT_OF_FUEL;
+            break;
+        }
+        trap = lim_execute_inst(&lim);
+        executed++;
+        lim.stats.instructions++;
+        if (trap != TRAP_OK) {
+            break;
+        }
+    }
+    profile_read(&end);
+
+    Profile_Sample run = {0};
+    profile_add(&run, &begin, &end);
+    profile_report(&run, executed);
+    return trap;
+}
+
+// Metrics. With `-m` a JSON record of the VM counters is written as one line
+// when the program stops and, with `-t`, every few milliseconds while it
+// runs. For the periodic records the program runs in slices of fuel and the
+// clock is checked between them.
+#define METRICS_SLICE 1000000
+
+typedef struct {
+    FILE *out;
+    uint64_t interval_ns;  // 0 when only the final record is written
+    uint64_t load_ns;
+    uint64_t wall_begin;
+    uint64_t cpu_begin;
+} Metrics;
+
+static Metrics metrics = {0};
+
+static uint64_t metrics_clock(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// `target` is a file path or `fd:<n>` for an already open descriptor
+static bool metrics_open(const char *target)
+{
+    if (!strncmp(target, "fd:", 3)) {
+        metrics.out = fdopen(atoi(target + 3), "w");
+    } else {
+        metrics.out = fopen(target, "w");
+    }
+    if (metrics.out == NULL) {
+        fprintf(stderr, "ERROR: could not open metrics output `%s`: %s\n",
+                target, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void metrics_write_string(const char *cstr)
+{
+    fputc('"', metrics.out);
+    for (; *cstr != '\0'; cstr++) {
+        if (*cstr == '"' || *cstr == '\\') {
+            fprintf(metrics.out, "\\%c", *cstr);
+        } else if ((unsigned char) *cstr < ' ') {
+            fprintf(metrics.out, "\\u%04x", *cstr);
+        } else {
+            fputc(*cstr, metrics.out);
+        }
+    }
+    fputc('"', metrics.out);
+}
+
+static void metrics_write(bool final, Trap trap)
+{
+    const Lim_Stats *stats = &lim.stats;
+    uint64_t wall = metrics_clock(CLOCK_MONOTONIC) - metrics.wall_begin;
+    uint64_t cpu = metrics_clock(CLOCK_PROCESS_CPUTIME_ID) - metrics.cpu_begin;
+
+    fprintf(metrics.out, "{\"final\":%s,\"trap\":", final ? "true" : "false");
+    metrics_write_string(trap_as_cstr(trap));
+    fprintf(metrics.out,
+            ",\"instructions\":%lu,\"wall_ns\":%lu,\"cpu_ns\":%lu,"
+            "\"instructions_per_second\":%.0f,\"stack_peak\":%lu,"
+            "\"calls\":%lu,\"returns\":%lu,\"natives\":{",
+            stats->instructions, wall, cpu,
+            wall > 0 ? stats->instructions * 1e9 / wall : 0.0,
+            stats->stack_peak, stats->calls, stats->returns);
+    for (uint64_t i = 0; i < lim.imports_size; i++) {
+        if (i > 0) {
+            fputc(',', metrics.out);
+        }
+        metrics_write_string(lim.imports[i].name);
+        fprintf(metrics.out, ":%lu", stats->native_calls[i]);
+    }
+    fprintf(metrics.out,
+            "},\"allocated_bytes\":%lu,\"freed_bytes\":%lu,\"load_ns\":%lu}\n",
+            stats->allocated, stats->freed, metrics.load_ns);
+    fflush(metrics.out);
+}
+
+static Trap metrics_run(bool translated, uint64_t fuel)
+{
+    uint64_t last = metrics.wall_begin;
+    Trap trap = TRAP_OUT_OF_FUEL;
+    while (trap == TRAP_OUT_OF_FUEL && fuel > 0) {
+        uint64_t before = lim.stats.instructions;
+        uint64_t slice = fuel < METRICS_SLICE ? fuel : METRICS_SLICE;
+        trap = jit != NULL   ? lim_jit_execute_budget(jit, &lim, slice)
+               : translated ? lim_ir_execute_budget(&ir, &lim, slice)
+                            : lim_execute_budget(&lim, slice);
+        // the last basic block of a slice may overrun it
+        uint64_t used = lim.stats.instructions - before;
+        fuel -= used < fuel ? used : fuel;
+
+        uint64_t now = metrics_clock(CLOCK_MONOTONIC);
+        if (trap == TRAP_OUT_OF_FUEL && now - last >= metrics.interval_ns) {
+            metrics_write(false, TRAP_OK);
+            last = now;
+        }
+    }
+    return trap;
+}
+
 int main(int argc, char *argv[])
 {
     const char *program = shift_args(&argc, &argv);
     const char *input_file_path = NULL;
+    const char *restore_file_path = NULL;
+    const char *plugins[LIM_NATIVES_CAPACITY];
+    size_t plugins_size = 0;
     bool debug = false;
+    bool stack_only = false;
+    bool jit_enabled = false;
+    bool profiling = false;
+    const char *metrics_target = NULL;
+    uint64_t fuel = UINT64_MAX;
+    bool serve_pipe = false;
+    const char *socket_path = NULL;
+    long vms_size = sysconf(_SC_NPROCESSORS_ONLN);
 
     while (argc > 0) {
         const char *flag = shift_args(&argc, &argv);
@@ -15,57 +1206,168 @@ int main(int argc, char *argv[])
                 return 1;
             }
             input_file_path = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-S")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect snapshot file\n");
+                return 1;
+            }
+            lim.snapshot_file_path = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-r")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect snapshot file\n");
+                return 1;
+            }
+            restore_file_path = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-f")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect amount of fuel\n");
+                return 1;
+            }
+            fuel = strtoull(shift_args(&argc, &argv), NULL, 10);
+        } else if (!strcmp(flag, "-m")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect metrics output\n");
+                return 1;
+            }
+            metrics_target = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-t")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect metrics interval\n");
+                return 1;
+            }
+            metrics.interval_ns =
+                strtoull(shift_args(&argc, &argv), NULL, 10) * 1000000;
+        } else if (!strcmp(flag, "-l")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect plugin file\n");
+                return 1;
+            }
+            if (plugins_size >= LIM_NATIVES_CAPACITY) {
+                fprintf(stderr, "Error: too many plugins\n");
+                return 1;
+            }
+            plugins[plugins_size++] = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-p")) {
+            serve_pipe = true;
+        } else if (!strcmp(flag, "-u")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect socket path\n");
+                return 1;
+            }
+            socket_path = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-j")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect amount of VMs\n");
+                return 1;
+            }
+            vms_size = strtol(shift_args(&argc, &argv), NULL, 10);
         } else if (!strcmp(flag, "-h")) {
-            fprintf(stdout, "Usage: %s -i <input.lim> [-h]\n", program);
+            fprintf(stdout,
+                    "Usage: %s (-i <input.lim> | -r <snapshot> | -p | -u "
+                    "<socket>) [-S <snapshot>] [-l <plugin.so>]... [-f "
+                    "<fuel>] [-j <vms>] [-m <file|fd:N> [-t <ms>]] [-d] [-s] "
+                    "[-J] [-P] [-h]\n",
+                    program);
             return 0;
         } else if (!strcmp(flag, "-d")) {
             debug = true;
+        } else if (!strcmp(flag, "-s")) {
+            stack_only = true;
+        } else if (!strcmp(flag, "-J")) {
+            jit_enabled = true;
+        } else if (!strcmp(flag, "-P")) {
+            profiling = true;
         } else {
             fprintf(stderr, "Error: unknown flag `%s`\n", flag);
             return 1;
         }
     }
 
-    if (input_file_path == NULL) {
+    if (serve_pipe || socket_path != NULL) {
+        if (vms_size < 1 || vms_size > SERVE_VMS_CAPACITY) {
+            vms_size = vms_size < 1 ? 1 : SERVE_VMS_CAPACITY;
+        }
+        serve.fuel = fuel;
+        serve.stack_only = stack_only;
+        if (!serve_warm_up(vms_size, plugins, plugins_size)) {
+            return 1;
+        }
+        if (socket_path != NULL) {
+            return serve_socket(socket_path);
+        }
+        serve_stream(stdin, stdout);
+        return 0;
+    }
+
+    if (input_file_path == NULL && restore_file_path == NULL) {
         fprintf(stderr, "Error: input file is not provided\n");
         return 1;
     }
 
-    lim_load_program_from_file(&lim, input_file_path);
+    if (metrics_target != NULL && !metrics_open(metrics_target)) {
+        return 1;
+    }
+
+    uint64_t load_begin = metrics_clock(CLOCK_MONOTONIC);
+    Lim_Error error = restore_file_path != NULL
+                          ? lim_load_snapshot(&lim, restore_file_path)
+                          : lim_load_program_from_file(&lim, input_file_path);
     lim_attach_natives(&lim);
+    for (size_t i = 0; i < plugins_size && error == LIM_OK; i++) {
+        error = lim_load_plugin(&lim, plugins[i]);
+    }
+    if (error == LIM_OK) {
+        error = lim_bind_natives(&lim);
+    }
+    if (error != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim.error);
+        return 1;
+    }
+    metrics.load_ns = metrics_clock(CLOCK_MONOTONIC) - load_begin;
+    metrics.wall_begin = metrics_clock(CLOCK_MONOTONIC);
+    metrics.cpu_begin = metrics_clock(CLOCK_PROCESS_CPUTIME_ID);
 
     Trap trap = TRAP_OK;
     if (debug) {
-        // In debug mode, stack as state and instruction as event to construct a
-        // FSM
-        lim_dump_stack(stdout, &lim);
-        while (!lim.halt) {
-            const Inst *const inst = &lim.program[lim.ip];
-            printf("> %s", inst_type_as_cstr(inst->type));
-            if (inst_has_operand(inst->type)) {
-                printf(" %lu", inst->operand.as_u64);
-            }
-            printf("\n");
-
-            trap = lim_execute_inst(&lim);
-            lim_dump_stack(stdout, &lim);
-            if (trap != TRAP_OK) {
-                break;
-            }
-
-            char c = getchar();
-            if (c == 'q' || c == 'Q') {
-                exit(1);
-            }
+        // labels are only known for programs, not for snapshots
+        if (input_file_path != NULL) {
+            lim_load_symbols_from_file(&lim, input_file_path,
+                                       debugger.symbols,
+                                       &debugger.symbols_size);
         }
+        trap = debugger_repl();
+    } else if (profiling) {
+        trap = profile_run(fuel);
     } else {
-        trap = lim_execute_program(&lim);
+        if (jit_enabled) {
+            jit = lim_jit_create();
+            if (jit == NULL) {
+                fprintf(stderr, "ERROR: could not create the JIT\n");
+                return 1;
+            }
+        }
+        bool translated =
+            jit == NULL && !stack_only && lim_ir_translate(&ir, &lim);
+        if (metrics.out != NULL && metrics.interval_ns > 0) {
+            trap = metrics_run(translated, fuel);
+        } else if (jit != NULL) {
+            trap = lim_jit_execute_budget(jit, &lim, fuel);
+        } else if (translated) {
+            trap = lim_ir_execute_budget(&ir, &lim, fuel);
+        } else {
+            trap = lim_execute_budget(&lim, fuel);
+        }
+    }
+    if (metrics.out != NULL) {
+        metrics_write(true, trap);
     }
 
     if (trap != TRAP_OK) {
         fprintf(stderr, "Error: %s\n", trap_as_cstr(trap));
+        if (trap == TRAP_SNAPSHOT_FAILED) {
+            fprintf(stderr, "ERROR: %s\n", lim.error);
+        }
         return 1;
-        ;
     }
 
     return 0;
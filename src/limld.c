@@ -0,0 +1,61 @@
+#include "lim.h"
+
+static Lim lim = {0};
+
+static const char *input_file_paths[LIM_PROGRAM_CAPACITY];
+static size_t input_file_paths_size = 0;
+static Lim_Symbol symbols[LABEL_CAPACITY];
+static uint64_t symbols_size = 0;
+
+int main(int argc, char *argv[])
+{
+    const char *program = shift_args(&argc, &argv);
+    const char *output_file_path = NULL;
+
+    while (argc > 0) {
+        const char *flag = shift_args(&argc, &argv);
+
+        if (!strcmp(flag, "-o")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect output path\n");
+                return 1;
+            }
+            output_file_path = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-h")) {
+            fprintf(stdout,
+                    "Usage: %s -o <output.lim> <input.limo>... [-h]\n"
+                    "  the first object is the entry point of the program\n",
+                    program);
+            return 0;
+        } else if (*flag == '-') {
+            fprintf(stderr, "Error: unknown flag `%s`\n", flag);
+            return 1;
+        } else {
+            if (input_file_paths_size >= LIM_PROGRAM_CAPACITY) {
+                fprintf(stderr, "Error: too many input files\n");
+                return 1;
+            }
+            input_file_paths[input_file_paths_size++] = flag;
+        }
+    }
+
+    if (input_file_paths_size == 0) {
+        fprintf(stderr, "Error: input files are not provided\n");
+        return 1;
+    }
+    if (output_file_path == NULL) {
+        fprintf(stderr, "Error: output path is not provided\n");
+        return 1;
+    }
+
+    // the exported symbols are kept for debuggers
+    if (lim_link_objects(&lim, input_file_paths, input_file_paths_size,
+                         symbols, &symbols_size) != LIM_OK ||
+        lim_save_program_with_symbols(&lim, symbols, symbols_size,
+                                      output_file_path) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim.error);
+        return 1;
+    }
+
+    return 0;
+}
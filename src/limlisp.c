@@ -0,0 +1,1042 @@
+#include <stdarg.h>
+
+#include "lim.h"
+
+// A Lisp front end. Top level forms are
+//
+//     (define (name param...) body...)
+//     (define name (lambda (param...) body...))
+//     (define name <constant expression>)
+//     <expression>
+//
+// where the expressions outside of `define` make up the main program. The
+// expressions are numbers, names, `(if c a b)`, `(let ((name e)...) body...)`,
+// `(begin e...)`, `((lambda (param...) body...) arg...)`, calls of functions
+// and natives, the integer operators `+ - * / < > <= >= = not` and the float
+// operators `+. -. *. /.`. Every word is untyped, just like on the VM.
+//
+// Code generation keeps the whole state on the operand stack: the arguments
+// of a function are the locals below the frame base and let-bound values are
+// the locals above it, so a variable is a single `load_local`.
+
+#define LISP_NODES_CAPACITY (64 * 1024)
+#define LISP_FUNCS_CAPACITY LABEL_CAPACITY
+#define LISP_VARS_CAPACITY 1024
+
+typedef enum {
+    NODE_ATOM,
+    NODE_LIST,
+} Node_Kind;
+
+// Node 0 stands for nothing, so `head` and `next` of 0 end a list
+typedef struct {
+    Node_Kind kind;
+    String_View atom;
+    size_t head;
+    size_t next;
+    size_t line;
+    size_t col;
+} Node;
+
+typedef struct {
+    String_View name;
+    size_t params;  // first parameter name
+    size_t arity;
+    size_t body;    // first form of the body
+    size_t node;    // the definition, for errors
+    Inst_Addr addr;
+} Lisp_Func;
+
+typedef struct {
+    String_View name;
+    bool is_const;
+    Word value;    // of a constant
+    int64_t slot;  // otherwise, offset about the frame base
+} Lisp_Var;
+
+// The value of an expression is pushed (VALUE), thrown away (EFFECT) or
+// returned from the current function (TAIL)
+typedef enum {
+    LISP_VALUE,
+    LISP_EFFECT,
+    LISP_TAIL,
+} Lisp_Mode;
+
+static const struct {
+    const char *name;
+    Inst_Type inst;
+} lisp_ops[] = {
+    {"+", INST_PLUS},    {"-", INST_MINUS},   {"*", INST_MULT},
+    {"/", INST_DIV},     {"+.", INST_FPLUS},  {"-.", INST_FMINUS},
+    {"*.", INST_FMULT},  {"/.", INST_FDIV},   {">", INST_GT},
+    {"<", INST_LT},      {">=", INST_GE},     {"<=", INST_LE},
+    {"=", INST_EQ},
+};
+
+static Lim lim = {0};
+static const char *input_file_path = NULL;
+
+static Node nodes[LISP_NODES_CAPACITY];
+static size_t nodes_size = 1;
+
+static Lisp_Func funcs[LISP_FUNCS_CAPACITY];
+static size_t funcs_size = 0;
+
+// The variables in scope, innermost last
+static Lisp_Var vars[LISP_VARS_CAPACITY];
+static size_t vars_size = 0;
+
+// Words on the stack above the frame base
+static int64_t depth = 0;
+// NULL while the main program is compiled
+static const Lisp_Func *current = NULL;
+
+// `call` and `jmp` instructions whose operand is an index into `funcs`
+static Inst_Addr calls[LIM_PROGRAM_CAPACITY];
+static size_t calls_size = 0;
+
+static Lim_Symbol symbols[LABEL_CAPACITY];
+static uint64_t symbols_size = 0;
+
+// The top level forms of the main program
+static size_t forms[LISP_NODES_CAPACITY];
+static size_t forms_size = 0;
+
+static void lisp_error(size_t node, const char *fmt, ...)
+{
+    fprintf(stderr, "%s:%zu:%zu: ERROR: ", input_file_path, nodes[node].line,
+            nodes[node].col);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/* Parser */
+
+static String_View source = {0};
+static const char *line_start = NULL;
+static size_t line = 1;
+
+static void skip_whitespace(void)
+{
+    while (source.count > 0) {
+        if (*source.data == ';') {
+            while (source.count > 0 && *source.data != '\n') {
+                source.data++;
+                source.count--;
+            }
+        } else if (isspace(*source.data)) {
+            if (*source.data == '\n') {
+                line++;
+                line_start = source.data + 1;
+            }
+            source.data++;
+            source.count--;
+        } else {
+            break;
+        }
+    }
+}
+
+static size_t node_new(Node_Kind kind)
+{
+    if (nodes_size >= LISP_NODES_CAPACITY) {
+        fprintf(stderr, "%s: ERROR: program is too big\n", input_file_path);
+        exit(1);
+    }
+    size_t node = nodes_size++;
+    nodes[node].kind = kind;
+    nodes[node].line = line;
+    nodes[node].col = source.data - line_start + 1;
+    return node;
+}
+
+static size_t parse_expr(void)
+{
+    size_t node = node_new(NODE_ATOM);
+
+    if (*source.data == ')') {
+        lisp_error(node, "unexpected `)`");
+    }
+
+    // 'x is (quote x)
+    if (*source.data == '\'') {
+        nodes[node].kind = NODE_LIST;
+        source.data++;
+        source.count--;
+        size_t quote = node_new(NODE_ATOM);
+        nodes[quote].atom = cstr_as_sv("quote");
+        nodes[node].head = quote;
+        skip_whitespace();
+        if (source.count == 0) {
+            lisp_error(node, "expected an expression after `'`");
+        }
+        nodes[quote].next = parse_expr();
+        return node;
+    }
+
+    if (*source.data == '(') {
+        nodes[node].kind = NODE_LIST;
+        source.data++;
+        source.count--;
+
+        size_t *last = &nodes[node].head;
+        for (;;) {
+            skip_whitespace();
+            if (source.count == 0) {
+                lisp_error(node, "unclosed `(`");
+            }
+            if (*source.data == ')') {
+                source.data++;
+                source.count--;
+                return node;
+            }
+            *last = parse_expr();
+            last = &nodes[*last].next;
+        }
+    }
+
+    size_t count = 0;
+    while (count < source.count && !isspace(source.data[count]) &&
+           source.data[count] != '(' && source.data[count] != ')' &&
+           source.data[count] != ';') {
+        count++;
+    }
+    nodes[node].atom = (String_View){.count = count, .data = source.data};
+    source.data += count;
+    source.count -= count;
+    return node;
+}
+
+/* Helpers */
+
+static bool is_atom(size_t node, const char *name)
+{
+    return node != 0 && nodes[node].kind == NODE_ATOM &&
+           sv_equal(nodes[node].atom, cstr_as_sv(name));
+}
+
+static size_t list_length(size_t node)
+{
+    size_t length = 0;
+    for (size_t it = nodes[node].head; it != 0; it = nodes[it].next) {
+        length++;
+    }
+    return length;
+}
+
+// The `index`th element of a list, 0 past its end
+static size_t list_nth(size_t node, size_t index)
+{
+    size_t it = nodes[node].head;
+    while (it != 0 && index-- > 0) {
+        it = nodes[it].next;
+    }
+    return it;
+}
+
+static bool number_atom(size_t node, Word *value)
+{
+    return nodes[node].kind == NODE_ATOM &&
+           number_literal_as_word(nodes[node].atom, value);
+}
+
+static void expect_name(size_t node)
+{
+    Word ignored;
+    if (nodes[node].kind != NODE_ATOM || number_atom(node, &ignored)) {
+        lisp_error(node, "expected a name");
+    }
+}
+
+static const Lisp_Var *var_find(String_View name)
+{
+    for (size_t i = vars_size; i-- > 0;) {
+        if (sv_equal(vars[i].name, name)) {
+            return &vars[i];
+        }
+    }
+    return NULL;
+}
+
+static void var_push(size_t node, Lisp_Var var)
+{
+    if (vars_size >= LISP_VARS_CAPACITY) {
+        lisp_error(node, "too many variables in scope");
+    }
+    vars[vars_size++] = var;
+}
+
+static int func_find(String_View name)
+{
+    for (size_t i = 0; i < funcs_size; i++) {
+        if (sv_equal(funcs[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int op_find(String_View name)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(lisp_ops); i++) {
+        if (sv_equal(name, cstr_as_sv(lisp_ops[i].name))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Constant folding */
+
+// Same as the VM does, false when the VM would trap
+static bool fold_op(Inst_Type inst, Word a, Word b, Word *result)
+{
+    switch (inst) {
+    case INST_PLUS:
+        result->as_u64 = a.as_u64 + b.as_u64;
+        return true;
+    case INST_MINUS:
+        result->as_u64 = a.as_u64 - b.as_u64;
+        return true;
+    case INST_MULT:
+        result->as_u64 = a.as_u64 * b.as_u64;
+        return true;
+    case INST_DIV:
+        if (b.as_i64 == 0 || (a.as_i64 == INT64_MIN && b.as_i64 == -1)) {
+            return false;
+        }
+        result->as_i64 = a.as_i64 / b.as_i64;
+        return true;
+    case INST_FPLUS:
+        result->as_f64 = a.as_f64 + b.as_f64;
+        return true;
+    case INST_FMINUS:
+        result->as_f64 = a.as_f64 - b.as_f64;
+        return true;
+    case INST_FMULT:
+        result->as_f64 = a.as_f64 * b.as_f64;
+        return true;
+    case INST_FDIV:
+        result->as_f64 = a.as_f64 / b.as_f64;
+        return true;
+    case INST_GT:
+        result->as_i64 = a.as_i64 > b.as_i64;
+        return true;
+    case INST_LT:
+        result->as_i64 = a.as_i64 < b.as_i64;
+        return true;
+    case INST_GE:
+        result->as_i64 = a.as_i64 >= b.as_i64;
+        return true;
+    case INST_LE:
+        result->as_i64 = a.as_i64 <= b.as_i64;
+        return true;
+    case INST_EQ:
+        result->as_i64 = a.as_i64 == b.as_i64;
+        return true;
+
+    case INST_NOP:
+    case INST_PUSH:
+    case INST_POP:
+    case INST_DUP:
+    case INST_JMP:
+    case INST_JNZ:
+    case INST_JZ:
+    case INST_SWAP:
+    case INST_CALL:
+    case INST_RET:
+    case INST_NATIVE:
+    case INST_HALT:
+    case INST_PRINT_DEBUG:
+    case INST_LOAD_LOCAL:
+    case INST_STORE_LOCAL:
+    case INST_DROP:
+    case INST_SNAPSHOT:
+    case INST_SPAWN:
+    case INST_YIELD:
+    case INST_JOIN:
+    case INST_CHAN:
+    case INST_SEND:
+    case INST_RECV:
+    case INST_PUSH_DATA:
+    case INST_PUSH_SYM:
+    case INST_NUM:
+    default:
+        assert(false && "fold_op: unreachable");
+        return false;
+    }
+}
+
+static bool is_comparison(Inst_Type inst)
+{
+    return inst == INST_GT || inst == INST_LT || inst == INST_GE ||
+           inst == INST_LE || inst == INST_EQ;
+}
+
+// The value of `expr` when it is known at compile time
+static bool fold(size_t expr, Word *value)
+{
+    if (nodes[expr].kind == NODE_ATOM) {
+        if (number_atom(expr, value)) {
+            return true;
+        }
+        const Lisp_Var *var = var_find(nodes[expr].atom);
+        if (var != NULL && var->is_const) {
+            *value = var->value;
+            return true;
+        }
+        return false;
+    }
+
+    size_t head = nodes[expr].head;
+    if (head == 0 || nodes[head].kind != NODE_ATOM ||
+        var_find(nodes[head].atom) != NULL) {
+        return false;
+    }
+
+    if (is_atom(head, "if") && list_length(expr) == 4) {
+        Word cond;
+        return fold(list_nth(expr, 1), &cond) &&
+               fold(list_nth(expr, cond.as_u64 ? 2 : 3), value);
+    }
+
+    if (is_atom(head, "not") && list_length(expr) == 2) {
+        if (!fold(list_nth(expr, 1), value)) {
+            return false;
+        }
+        value->as_i64 = value->as_i64 == 0;
+        return true;
+    }
+
+    int op = op_find(nodes[head].atom);
+    size_t arity = list_length(expr) - 1;
+    if (op < 0 || arity == 0 ||
+        (is_comparison(lisp_ops[op].inst) && arity != 2)) {
+        return false;
+    }
+
+    size_t arg = nodes[head].next;
+    if (!fold(arg, value)) {
+        return false;
+    }
+    if (arity == 1) {
+        // (- x) is 0 - x
+        Word x = *value;
+        value->as_u64 = 0;
+        return (lisp_ops[op].inst == INST_MINUS ||
+                lisp_ops[op].inst == INST_FMINUS) &&
+               fold_op(lisp_ops[op].inst, *value, x, value);
+    }
+    for (arg = nodes[arg].next; arg != 0; arg = nodes[arg].next) {
+        Word x;
+        if (!fold(arg, &x) || !fold_op(lisp_ops[op].inst, *value, x, value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Code generation */
+
+static Inst_Addr emit(size_t node, Inst_Type type, Word operand)
+{
+    if (lim.program_size >= LIM_PROGRAM_CAPACITY) {
+        lisp_error(node, "program is too big");
+    }
+    lim.program[lim.program_size] = (Inst){.type = type, .operand = operand};
+    return lim.program_size++;
+}
+
+static void emit_call(size_t node, Inst_Type type, size_t func)
+{
+    calls[calls_size++] = emit(node, type, (Word){.as_u64 = func});
+}
+
+// The value of the expression is on top of the stack
+static void finish(size_t node, Lisp_Mode mode)
+{
+    switch (mode) {
+    case LISP_VALUE:
+        break;
+    case LISP_EFFECT:
+        emit(node, INST_POP, (Word){0});
+        depth--;
+        break;
+    case LISP_TAIL: {
+        // the arguments and the locals go, the value stays
+        uint64_t below = current->arity + depth - 1;
+        if (below > 0) {
+            emit(node, INST_DROP, (Word){.as_u64 = below});
+        }
+        emit(node, INST_RET, (Word){0});
+        depth--;
+    } break;
+    }
+}
+
+static void compile_expr(size_t expr, Lisp_Mode mode);
+
+static void compile_body(size_t node, size_t form, Lisp_Mode mode)
+{
+    if (form == 0) {
+        // an empty body is 0
+        if (mode != LISP_EFFECT) {
+            emit(node, INST_PUSH, (Word){0});
+            depth++;
+            finish(node, mode);
+        }
+        return;
+    }
+    for (; nodes[form].next != 0; form = nodes[form].next) {
+        compile_expr(form, LISP_EFFECT);
+    }
+    compile_expr(form, mode);
+}
+
+static void compile_if(size_t expr, Lisp_Mode mode)
+{
+    size_t length = list_length(expr);
+    if (length != 3 && length != 4) {
+        lisp_error(expr, "`if` expects a condition and one or two branches");
+    }
+    size_t cond = list_nth(expr, 1);
+    size_t then = list_nth(expr, 2);
+    size_t otherwise = list_nth(expr, 3);
+
+    Word value;
+    if (fold(cond, &value)) {
+        // the other branch is never compiled
+        if (value.as_u64) {
+            compile_expr(then, mode);
+        } else {
+            compile_body(expr, otherwise, mode);
+        }
+        return;
+    }
+
+    // (if (not c) a b) jumps on c
+    Inst_Type jump = INST_JZ;
+    if (nodes[cond].kind == NODE_LIST && is_atom(nodes[cond].head, "not") &&
+        var_find(cstr_as_sv("not")) == NULL && list_length(cond) == 2) {
+        cond = list_nth(cond, 1);
+        jump = INST_JNZ;
+    }
+    compile_expr(cond, LISP_VALUE);
+    Inst_Addr to_else = emit(expr, jump, (Word){0});
+    depth--;
+
+    int64_t entry = depth;
+    compile_expr(then, mode);
+    Inst_Addr to_end = 0;
+    if (mode != LISP_TAIL) {
+        // a returning branch falls through to nothing
+        to_end = emit(expr, INST_JMP, (Word){0});
+    }
+
+    depth = entry;
+    lim.program[to_else].operand = (Word){.as_u64 = lim.program_size};
+    compile_body(expr, otherwise, mode);
+    if (mode != LISP_TAIL && lim.program_size == to_end + 1) {
+        // nothing to jump over
+        lim.program_size--;
+        lim.program[to_else].operand = (Word){.as_u64 = lim.program_size};
+    } else if (mode != LISP_TAIL) {
+        lim.program[to_end].operand = (Word){.as_u64 = lim.program_size};
+    }
+}
+
+// A constant or another variable is bound without taking a slot
+static Lisp_Var bind(size_t name, size_t init)
+{
+    expect_name(name);
+    Lisp_Var var = {.name = nodes[name].atom};
+    if (fold(init, &var.value)) {
+        var.is_const = true;
+        return var;
+    }
+    if (nodes[init].kind == NODE_ATOM) {
+        const Lisp_Var *alias = var_find(nodes[init].atom);
+        if (alias != NULL) {
+            var.slot = alias->slot;
+            return var;
+        }
+    }
+    compile_expr(init, LISP_VALUE);
+    var.slot = depth - 1;
+    return var;
+}
+
+static void compile_scope(size_t expr, int64_t entry, size_t scope,
+                          size_t body, Lisp_Mode mode)
+{
+    uint64_t pushed = depth - entry;
+    compile_body(expr, body, mode);
+    if (pushed > 0 && mode == LISP_VALUE) {
+        emit(expr, INST_DROP, (Word){.as_u64 = pushed});
+    } else if (mode == LISP_EFFECT) {
+        for (uint64_t i = 0; i < pushed; i++) {
+            emit(expr, INST_POP, (Word){0});
+        }
+    }
+    // a return drops the locals anyway
+    depth = entry + (mode == LISP_VALUE);
+    vars_size = scope;
+}
+
+// (let ((name value)...) body...), every binding sees the ones before it
+static void compile_let(size_t expr, Lisp_Mode mode)
+{
+    size_t bindings = list_nth(expr, 1);
+    if (bindings == 0 || nodes[bindings].kind != NODE_LIST) {
+        lisp_error(expr, "`let` expects a list of bindings");
+    }
+
+    int64_t entry = depth;
+    size_t scope = vars_size;
+    for (size_t it = nodes[bindings].head; it != 0; it = nodes[it].next) {
+        if (nodes[it].kind != NODE_LIST || list_length(it) != 2) {
+            lisp_error(it, "expected a `(name value)` binding");
+        }
+        Lisp_Var var = bind(nodes[it].head, list_nth(it, 1));
+        var_push(it, var);
+    }
+    compile_scope(expr, entry, scope, nodes[bindings].next, mode);
+}
+
+// ((lambda (param...) body...) arg...), the arguments see none of the params
+static void compile_lambda(size_t expr, Lisp_Mode mode)
+{
+    size_t lambda = nodes[expr].head;
+    size_t params = list_nth(lambda, 1);
+    if (!is_atom(nodes[lambda].head, "lambda") || params == 0 ||
+        nodes[params].kind != NODE_LIST) {
+        lisp_error(lambda, "only functions can be applied");
+    }
+    if (list_length(params) != list_length(expr) - 1) {
+        lisp_error(expr, "lambda expects %zu arguments, got %zu",
+                   list_length(params), list_length(expr) - 1);
+    }
+
+    int64_t entry = depth;
+    size_t scope = vars_size;
+    Lisp_Var bound[LISP_VARS_CAPACITY];
+    size_t bound_size = 0;
+    size_t arg = nodes[lambda].next;
+    for (size_t param = nodes[params].head; param != 0;
+         param = nodes[param].next, arg = nodes[arg].next) {
+        bound[bound_size++] = bind(param, arg);
+    }
+    for (size_t i = 0; i < bound_size; i++) {
+        var_push(expr, bound[i]);
+    }
+    compile_scope(expr, entry, scope, nodes[params].next, mode);
+}
+
+// The arguments of a tail call to a function of the same arity as the
+// current one replace its arguments in place and the call becomes a jump
+static void compile_tail_call(size_t expr, size_t func)
+{
+    int64_t slots[LISP_VARS_CAPACITY];
+    size_t slots_size = 0;
+    int64_t arity = current->arity;
+    int64_t index = 0;
+
+    for (size_t arg = nodes[nodes[expr].head].next; arg != 0;
+         arg = nodes[arg].next, index++) {
+        int64_t slot = index - arity;
+        if (nodes[arg].kind == NODE_ATOM) {
+            // an argument passed on in its own place stays where it is
+            const Lisp_Var *var = var_find(nodes[arg].atom);
+            if (var != NULL && !var->is_const && var->slot == slot) {
+                continue;
+            }
+        }
+        compile_expr(arg, LISP_VALUE);
+        slots[slots_size++] = slot;
+    }
+
+    while (slots_size > 0) {
+        emit(expr, INST_STORE_LOCAL, (Word){.as_i64 = slots[--slots_size]});
+        depth--;
+    }
+    for (int64_t i = 0; i < depth; i++) {
+        emit(expr, INST_POP, (Word){0});
+    }
+    emit_call(expr, INST_JMP, func);
+}
+
+static void compile_call(size_t expr, size_t func, Lisp_Mode mode)
+{
+    size_t arity = list_length(expr) - 1;
+    if (arity != funcs[func].arity) {
+        lisp_error(expr, "`%.*s` expects %zu arguments, got %zu",
+                   (int) funcs[func].name.count, funcs[func].name.data,
+                   funcs[func].arity, arity);
+    }
+
+    if (mode == LISP_TAIL && funcs[func].arity == current->arity) {
+        compile_tail_call(expr, func);
+        return;
+    }
+
+    for (size_t arg = nodes[nodes[expr].head].next; arg != 0;
+         arg = nodes[arg].next) {
+        compile_expr(arg, LISP_VALUE);
+    }
+    emit_call(expr, INST_CALL, func);
+    depth -= arity - 1;
+    finish(expr, mode);
+}
+
+static void compile_native(size_t expr, int native, Lisp_Mode mode)
+{
+    const Lim_Native *n = &lim.natives[native];
+    size_t arity = list_length(expr) - 1;
+    if (arity != n->args) {
+        lisp_error(expr, "native `%s` expects %lu arguments, got %zu", n->name,
+                   n->args, arity);
+    }
+    if (n->rets > 1) {
+        lisp_error(expr, "native `%s` returns %lu values, only one is supported",
+                   n->name, n->rets);
+    }
+
+    for (size_t arg = nodes[nodes[expr].head].next; arg != 0;
+         arg = nodes[arg].next) {
+        compile_expr(arg, LISP_VALUE);
+    }
+    uint64_t index = 0;
+    if (lim_import_native(&lim, cstr_as_sv(n->name), &index) != LIM_OK) {
+        lisp_error(expr, "%s", lim.error);
+    }
+    emit(expr, INST_NATIVE, (Word){.as_u64 = index});
+    depth -= arity;
+
+    if (n->rets == 0) {
+        if (mode == LISP_EFFECT) {
+            return;
+        }
+        emit(expr, INST_PUSH, (Word){0});
+    }
+    depth++;
+    finish(expr, mode);
+}
+
+static void compile_op(size_t expr, int op, Lisp_Mode mode)
+{
+    Inst_Type inst = lisp_ops[op].inst;
+    size_t arity = list_length(expr) - 1;
+    size_t arg = nodes[nodes[expr].head].next;
+
+    if (is_comparison(inst) ? arity != 2 : arity == 0) {
+        lisp_error(expr, "wrong amount of arguments for `%s`",
+                   lisp_ops[op].name);
+    }
+
+    if (arity == 1) {
+        if (inst != INST_MINUS && inst != INST_FMINUS) {
+            lisp_error(expr, "`%s` expects at least two arguments",
+                       lisp_ops[op].name);
+        }
+        emit(expr, INST_PUSH, (Word){0});
+        depth++;
+        compile_expr(arg, LISP_VALUE);
+        emit(expr, inst, (Word){0});
+        depth--;
+        finish(expr, mode);
+        return;
+    }
+
+    // the constant arguments of integer `+` and `*` are folded into one
+    bool merge = inst == INST_PLUS || inst == INST_MULT;
+    Word identity = (Word){.as_u64 = inst == INST_MULT};
+    Word merged = identity;
+    bool first = true;
+    for (; arg != 0; arg = nodes[arg].next) {
+        Word value;
+        if (merge && fold(arg, &value)) {
+            fold_op(inst, merged, value, &merged);
+            continue;
+        }
+        compile_expr(arg, LISP_VALUE);
+        if (!first) {
+            emit(expr, inst, (Word){0});
+            depth--;
+        }
+        first = false;
+    }
+    if (first || merged.as_u64 != identity.as_u64) {
+        emit(expr, INST_PUSH, merged);
+        depth++;
+        if (!first) {
+            emit(expr, inst, (Word){0});
+            depth--;
+        }
+    }
+    finish(expr, mode);
+}
+
+static void compile_list(size_t expr, Lisp_Mode mode)
+{
+    size_t head = nodes[expr].head;
+    if (head == 0) {
+        lisp_error(expr, "empty application");
+    }
+
+    if (nodes[head].kind == NODE_LIST) {
+        compile_lambda(expr, mode);
+        return;
+    }
+
+    String_View name = nodes[head].atom;
+    if (var_find(name) != NULL) {
+        lisp_error(head, "`%.*s` is not a function", (int) name.count,
+                   name.data);
+    }
+
+    if (is_atom(head, "if")) {
+        compile_if(expr, mode);
+    } else if (is_atom(head, "let")) {
+        compile_let(expr, mode);
+    } else if (is_atom(head, "begin")) {
+        compile_body(expr, nodes[head].next, mode);
+    } else if (is_atom(head, "not")) {
+        if (list_length(expr) != 2) {
+            lisp_error(expr, "`not` expects one argument");
+        }
+        compile_expr(nodes[head].next, LISP_VALUE);
+        emit(expr, INST_PUSH, (Word){0});
+        emit(expr, INST_EQ, (Word){0});
+        finish(expr, mode);
+    } else if (is_atom(head, "quote")) {
+        // symbols are interned at compile time and compare with `=`
+        size_t name = nodes[head].next;
+        if (list_length(expr) != 2 || nodes[name].kind != NODE_ATOM) {
+            lisp_error(expr, "`quote` expects a symbol");
+        }
+        Word symbol = {0};
+        if (lim_intern(&lim, nodes[name].atom, &symbol.as_u64) != LIM_OK) {
+            lisp_error(name, "%s", lim.error);
+        }
+        if (mode != LISP_EFFECT) {
+            emit(expr, INST_PUSH_SYM, symbol);
+            depth++;
+            finish(expr, mode);
+        }
+    } else if (is_atom(head, "lambda")) {
+        lisp_error(expr, "a lambda can only be defined or applied, the VM has "
+                         "no closures");
+    } else if (is_atom(head, "define")) {
+        lisp_error(expr, "`define` is only allowed at the top level");
+    } else if (op_find(name) >= 0) {
+        compile_op(expr, op_find(name), mode);
+    } else if (func_find(name) >= 0) {
+        compile_call(expr, func_find(name), mode);
+    } else if (lim_find_native(&lim, name) >= 0) {
+        compile_native(expr, lim_find_native(&lim, name), mode);
+    } else {
+        lisp_error(head, "unknown function `%.*s`", (int) name.count,
+                   name.data);
+    }
+}
+
+static void compile_expr(size_t expr, Lisp_Mode mode)
+{
+    Word value;
+    if (fold(expr, &value)) {
+        if (mode != LISP_EFFECT) {
+            emit(expr, INST_PUSH, value);
+            depth++;
+            finish(expr, mode);
+        }
+        return;
+    }
+
+    if (nodes[expr].kind == NODE_LIST) {
+        compile_list(expr, mode);
+        return;
+    }
+
+    String_View name = nodes[expr].atom;
+    const Lisp_Var *var = var_find(name);
+    if (var == NULL) {
+        lisp_error(expr, "unknown variable `%.*s`", (int) name.count,
+                   name.data);
+    }
+    if (mode != LISP_EFFECT) {
+        emit(expr, INST_LOAD_LOCAL, (Word){.as_i64 = var->slot});
+        depth++;
+        finish(expr, mode);
+    }
+}
+
+/* Top level */
+
+static void define_func(size_t form, size_t name, size_t params, size_t body)
+{
+    expect_name(name);
+    if (func_find(nodes[name].atom) >= 0) {
+        lisp_error(name, "function `%.*s` is already defined",
+                   (int) nodes[name].atom.count, nodes[name].atom.data);
+    }
+    if (funcs_size >= LISP_FUNCS_CAPACITY) {
+        lisp_error(form, "too many functions");
+    }
+    size_t arity = 0;
+    for (size_t param = params; param != 0; param = nodes[param].next) {
+        expect_name(param);
+        arity++;
+    }
+    funcs[funcs_size++] = (Lisp_Func){
+        .name = nodes[name].atom,
+        .params = params,
+        .arity = arity,
+        .body = body,
+        .node = form,
+    };
+}
+
+// Registers the functions and evaluates the constants, the rest is the main
+// program
+static bool define(size_t form)
+{
+    if (nodes[form].kind != NODE_LIST || !is_atom(nodes[form].head, "define")) {
+        return false;
+    }
+    size_t target = list_nth(form, 1);
+    size_t value = list_nth(form, 2);
+    if (target == 0) {
+        lisp_error(form, "`define` expects a name");
+    }
+
+    if (nodes[target].kind == NODE_LIST) {
+        // (define (name param...) body...)
+        if (nodes[target].head == 0) {
+            lisp_error(target, "expected a name");
+        }
+        size_t name = nodes[target].head;
+        define_func(form, name, nodes[name].next, value);
+        return true;
+    }
+
+    expect_name(target);
+    if (value == 0 || nodes[value].next != 0) {
+        lisp_error(form, "`define` expects one value");
+    }
+    if (nodes[value].kind == NODE_LIST && is_atom(nodes[value].head, "lambda")) {
+        size_t params = list_nth(value, 1);
+        if (params == 0 || nodes[params].kind != NODE_LIST) {
+            lisp_error(value, "`lambda` expects a list of parameters");
+        }
+        define_func(form, target, nodes[params].head, nodes[params].next);
+        return true;
+    }
+
+    Lisp_Var var = {.name = nodes[target].atom, .is_const = true};
+    if (!fold(value, &var.value)) {
+        lisp_error(value, "the value of a global must be a constant");
+    }
+    var_push(target, var);
+    return true;
+}
+
+static void compile_func(Lisp_Func *func)
+{
+    func->addr = lim.program_size;
+    if (func->name.count < LIM_SYMBOL_NAME_CAPACITY) {
+        Lim_Symbol *symbol = &symbols[symbols_size++];
+        memcpy(symbol->name, func->name.data, func->name.count);
+        symbol->addr = func->addr;
+    }
+
+    size_t scope = vars_size;
+    int64_t slot = -(int64_t) func->arity;
+    for (size_t param = func->params; param != 0; param = nodes[param].next) {
+        var_push(param, (Lisp_Var){.name = nodes[param].atom, .slot = slot++});
+    }
+
+    current = func;
+    depth = 0;
+    compile_body(func->node, func->body, LISP_TAIL);
+    vars_size = scope;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *program = shift_args(&argc, &argv);
+    const char *output_file_path = NULL;
+
+    while (argc > 0) {
+        const char *flag = shift_args(&argc, &argv);
+
+        if (!strcmp(flag, "-i")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect input file\n");
+                return 1;
+            }
+            input_file_path = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-o")) {
+            if (argc == 0) {
+                fprintf(stderr, "Error: expect output path\n");
+                return 1;
+            }
+            output_file_path = shift_args(&argc, &argv);
+        } else if (!strcmp(flag, "-h")) {
+            fprintf(stdout, "Usage: %s -i <input.lisp> -o <output.lim> [-h]\n",
+                    program);
+            return 0;
+        } else {
+            fprintf(stderr, "Error: unknown flag `%s`\n", flag);
+            return 1;
+        }
+    }
+
+    if (input_file_path == NULL) {
+        fprintf(stderr, "Error: input file is not provided\n");
+        return 1;
+    }
+    if (output_file_path == NULL) {
+        fprintf(stderr, "Error: output path is not provided\n");
+        return 1;
+    }
+
+    // the built-in natives can be called by name
+    lim_attach_natives(&lim);
+    if (slurp_file(&lim, input_file_path, &source) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim.error);
+        return 1;
+    }
+    line_start = source.data;
+
+    for (skip_whitespace(); source.count > 0; skip_whitespace()) {
+        size_t form = parse_expr();
+        if (!define(form)) {
+            forms[forms_size++] = form;
+        }
+    }
+
+    // the main program comes first and halts, then the functions
+    for (size_t i = 0; i < forms_size; i++) {
+        compile_expr(forms[i], LISP_EFFECT);
+    }
+    emit(0, INST_HALT, (Word){0});
+    for (size_t i = 0; i < funcs_size; i++) {
+        compile_func(&funcs[i]);
+    }
+    for (size_t i = 0; i < calls_size; i++) {
+        Inst *inst = &lim.program[calls[i]];
+        inst->operand = (Word){.as_u64 = funcs[inst->operand.as_u64].addr};
+    }
+
+    if (lim_save_program_with_symbols(&lim, symbols, symbols_size,
+                                      output_file_path) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim.error);
+        return 1;
+    }
+
+    return 0;
+}
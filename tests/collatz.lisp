@@ -0,0 +1,25 @@
+; The number below `limit` with the longest Collatz chain:
+; https://en.wikipedia.org/wiki/Collatz_conjecture
+(define limit (* 10 1000))
+
+(define (even? n) (= n (* (/ n 2) 2)))
+
+; tail calls of functions with as many parameters are jumps
+(define (steps n count)
+  (if (= n 1)
+      count
+      (steps (if (even? n) (/ n 2) (+ (* 3 n) 1)) (+ count 1))))
+
+(define (longest n best best-n)
+  (if (>= n limit)
+      best-n
+      (let ((s (steps n 0)))
+        (if (> s best)
+            (longest (+ n 1) s n)
+            (longest (+ n 1) best best-n)))))
+
+(define lerp
+  (lambda (x y t) (+. x (*. (-. y x) t))))
+
+(print_i64 (longest 1 0 1))
+(print_f64 (lerp 69.0 420.0 (/. 1.0 4.0)))
@@ -0,0 +1,74 @@
+// Example of a host program embedding the VM through liblim, run with
+// `build/embed`
+#include "lim.h"
+
+// The host pushes n, the program leaves the sum of the squares of 1..n
+static const char *const source =
+    "  push 0\n"
+    "loop:\n"
+    "  dup 1\n"
+    "  native square_u64    # provided by the host\n"
+    "  plus\n"
+    "  swap 1\n"
+    "  push 1\n"
+    "  minus\n"
+    "  swap 1\n"
+    "  dup 1\n"
+    "  jnz loop\n"
+    "  swap 1\n"
+    "  pop\n"
+    "  halt\n";
+
+static Trap host_square_u64(Lim *lim)
+{
+    Word x = {0};
+    Trap trap = lim_pop_word(lim, &x);
+    if (trap != TRAP_OK) {
+        return trap;
+    }
+    return lim_push_word(lim, (Word){.as_u64 = x.as_u64 * x.as_u64});
+}
+
+int main(void)
+{
+    Lim *lim = lim_create();
+    Lasm *lasm = calloc(1, sizeof(*lasm));
+    if (lim == NULL || lasm == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return 1;
+    }
+
+    if (lim_push_native_func(lim, "square_u64", host_square_u64, 1, 1) !=
+            LIM_OK ||
+        lim_translate_source(cstr_as_sv(source), lim, lasm) != LIM_OK ||
+        lim_bind_natives(lim) != LIM_OK) {
+        fprintf(stderr, "ERROR: %s\n", lim->error);
+        return 1;
+    }
+    free(lasm);
+
+    // the same VM serves every request: reset it, push the argument, run in
+    // slices of a small budget and pop the result
+    for (uint64_t n = 1; n <= 1000; n *= 10) {
+        lim_reset(lim);
+        lim_push_word(lim, (Word){.as_u64 = n});
+
+        Trap trap = TRAP_OK;
+        do {
+            trap = lim_execute_budget(lim, 64);
+        } while (trap == TRAP_OUT_OF_FUEL);
+
+        Word result = {0};
+        if (trap == TRAP_OK) {
+            trap = lim_pop_word(lim, &result);
+        }
+        if (trap != TRAP_OK) {
+            fprintf(stderr, "Error: %s\n", trap_as_cstr(trap));
+            return 1;
+        }
+        printf("%lu: %lu\n", n, result.as_u64);
+    }
+
+    lim_destroy(lim);
+    return 0;
+}
@@ -0,0 +1,14 @@
+; Quoted symbols are interned when the program is compiled
+(define (next-light light)
+  (if (= light 'red)
+      'green
+      (if (= light 'green) 'yellow 'red)))
+
+(define (count-until light stop n)
+  (if (= light stop)
+      n
+      (count-until (next-light light) stop (+ n 1))))
+
+(print_i64 (count-until 'green 'red 0))
+(print_u64 (str_len (sym_name (next-light 'yellow))))
+(print_i64 (= 'red 'red))
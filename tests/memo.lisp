@@ -0,0 +1,15 @@
+; Memoized Fibonacci numbers in a table of the `map_*` natives
+(define (fib memo n)
+  (if (< n 2)
+      n
+      (let ((known (map_get memo n -1)))
+        (if (>= known 0)
+            known
+            (let ((f (+ (fib memo (- n 1)) (fib memo (- n 2)))))
+              (begin (map_insert memo n f) f))))))
+
+(let ((memo (map_new 128)))
+  (begin
+    (print_i64 (fib memo 90))
+    (print_u64 (map_size memo))
+    (map_free memo)))
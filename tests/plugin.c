@@ -0,0 +1,37 @@
+// Example of a native plugin, loaded with `lime -l build/plugin.so`
+#include "lim.h"
+
+static Trap plugin_square_f64(Lim *lim)
+{
+    if (lim->stack_size < 1) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    lim->stack[lim->stack_size - 1].as_f64 *=
+        lim->stack[lim->stack_size - 1].as_f64;
+    return TRAP_OK;
+}
+
+static Trap plugin_hypot_f64(Lim *lim)
+{
+    if (lim->stack_size < 2) {
+        return TRAP_STACK_UNDERFLOW;
+    }
+    double x = lim->stack[lim->stack_size - 2].as_f64;
+    double y = lim->stack[lim->stack_size - 1].as_f64;
+    lim->stack[lim->stack_size - 2].as_f64 = sqrt(x * x + y * y);
+    lim->stack_size--;
+    return TRAP_OK;
+}
+
+static int plugin_init(Lim *lim, Lim_Register_Native register_native)
+{
+    register_native(lim, "square_f64", plugin_square_f64, 1, 1);
+    register_native(lim, "hypot_f64", plugin_hypot_f64, 2, 1);
+    return 0;
+}
+
+const Lim_Plugin lim_plugin = {
+    .abi_version = LIM_PLUGIN_ABI_VERSION,
+    .name = "plugin",
+    .init = plugin_init,
+};